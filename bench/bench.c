@@ -0,0 +1,833 @@
+/**
+@file  bench.c
+@brief SNet loopback benchmarks
+
+Runs standard scenarios between hosts on 127.0.0.1 in a single thread, servicing every host
+in turn without waiting, so the figures measure the library rather than the scheduler.
+Each scenario prints one JSON object per line, for comparing runs across changes.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "snet/snet.h"
+
+typedef struct _BenchScenario BenchScenario;
+
+typedef int (*BenchRun) (const BenchScenario * scenario, size_t peerCount, size_t messageSize);
+
+struct _BenchScenario
+{
+	const char * name;
+	BenchRun     run;
+	snet_uint32  flags;
+	size_t       messageSize;
+	size_t       peerCount;
+};
+
+typedef struct _Bench
+{
+	double             seconds;
+	size_t             window;
+	size_t             streams;
+	size_t             maximumStreams;
+	const char *       coder;
+	const char *       checksum;
+	const char *       transport;
+	int                preciseTime;
+	SNetImpairment     impairment;
+	int                impaired;
+	snet_uint32        seed;
+	snet_uint8 *       message;
+	unsigned long long connects;
+	unsigned long long clientConnects;
+	unsigned long long receivedMessages;
+	unsigned long long receivedData;
+	unsigned long long pingTime;
+	unsigned long long * streamSentTimes;
+	unsigned long long outOfOrder;
+	int                pongs;
+	SNetHistogram      latency;
+} Bench;
+
+static Bench bench;
+
+typedef void (*BenchHandler) (SNetHost * host, SNetEvent * event);
+
+static void
+bench_count(SNetHost * host, SNetEvent * event)
+{
+	switch (event->type)
+	{
+	case SNET_EVENT_TYPE_CONNECT:
+		++bench.connects;
+		break;
+
+	case SNET_EVENT_TYPE_RECEIVE:
+		++bench.receivedMessages;
+		bench.receivedData += event->packet->dataLength;
+		snet_packet_destroy(event->packet);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* counts a message, timing its delivery from the send time stamped at its start, and
+   checks that a message on a stream was sent after the one delivered before it there */
+static void
+bench_deliver(SNetHost * host, SNetEvent * event)
+{
+	if (event->type == SNET_EVENT_TYPE_RECEIVE && event->packet->dataLength >= sizeof(unsigned long long))
+	{
+		unsigned long long sentTime, elapsed;
+
+		memcpy(&sentTime, event->packet->data, sizeof(sentTime));
+		elapsed = snet_time_get_nanoseconds() - sentTime;
+
+		snet_histogram_record(&bench.latency, elapsed > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (snet_uint32)elapsed);
+
+		if (bench.streamSentTimes != NULL && (event->packet->flags & SNET_PACKET_FLAG_STREAM))
+		{
+			unsigned long long * lastSentTime = &bench.streamSentTimes[(event->peer - host->peers) * bench.streams + event->data % bench.streams];
+
+			if (sentTime < *lastSentTime)
+				++bench.outOfOrder;
+			else
+				*lastSentTime = sentTime;
+		}
+	}
+
+	bench_count(host, event);
+}
+
+/* services a host until it has nothing more to do right now */
+static void
+bench_service(SNetHost * host, BenchHandler handler)
+{
+	SNetEvent event;
+
+	while (snet_host_service(host, &event, 0) > 0)
+		handler(host, &event);
+}
+
+static double
+bench_now(void)
+{
+	return snet_time_get_nanoseconds() / 1e9;
+}
+
+static double
+bench_cpu(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static SNetHost *
+bench_host(const SNetAddress * address, size_t peerCount)
+{
+	SNetHost * host = snet_host_create(address, peerCount, 1, 0, 0);
+
+	if (host == NULL)
+	{
+		fprintf(stderr, "could not create a host with %u peers\n", (unsigned int)peerCount);
+		exit(1);
+	}
+
+	if (bench.coder != NULL)
+	{
+		if (strcmp(bench.coder, "range") == 0)
+			snet_host_compress_with_range_coder(host);
+		else
+			snet_host_compress_with_rans_coder(host);
+	}
+
+	if (bench.checksum != NULL)
+		snet_host_checksum(host, strcmp(bench.checksum, "crc32") == 0 ? SNET_CHECKSUM_TYPE_CRC32 : SNET_CHECKSUM_TYPE_CRC32C);
+
+	snet_host_precise_time(host, bench.preciseTime);
+
+	if (bench.transport != NULL && snet_host_shared_memory(host, 1) < 0)
+	{
+		fprintf(stderr, "could not enable shared memory\n");
+		exit(1);
+	}
+
+	/* impairing what every host sends impairs both directions of every connection once */
+	if (bench.impaired)
+		snet_host_impair(host, &bench.impairment, NULL, bench.seed++);
+
+	return host;
+}
+
+static SNetHost *
+bench_server(size_t peerCount, SNetAddress * address)
+{
+	SNetHost * host;
+
+	snet_address_set_host(address, "127.0.0.1");
+	address->port = 0;
+
+	host = bench_host(address, peerCount);
+
+	snet_socket_get_address(host->socket, address);
+
+	return host;
+}
+
+/* connects peerCount peers of the client to the server, servicing both until all are connected */
+static void
+bench_connect(SNetHost * server, SNetHost * client, const SNetAddress * address, size_t peerCount, BenchHandler serverHandler)
+{
+	double deadline = bench_now() + 10.0;
+	size_t i;
+
+	for (i = 0; i < peerCount; ++i)
+		if (snet_host_connect(client, address, 1, 0) == NULL)
+		{
+			fprintf(stderr, "could not connect peer %u\n", (unsigned int)i);
+			exit(1);
+		}
+
+	bench.connects = 0;
+
+	while (bench.connects < 2 * peerCount)
+	{
+		if (bench_now() > deadline)
+		{
+			fprintf(stderr, "only %u of %u connections completed\n", (unsigned int)(bench.connects / 2), (unsigned int)peerCount);
+			exit(1);
+		}
+
+		bench_service(client, bench_count);
+		bench_service(server, serverHandler);
+	}
+}
+
+static void
+bench_begin(const BenchScenario * scenario, size_t peerCount, size_t messageSize)
+{
+	printf("{\"scenario\":\"%s\",\"version\":\"%d.%d.%d\",\"compression\":\"%s\",\"checksum\":\"%s\",\"transport\":\"%s\",\"sent_time\":\"%s\",\"peers\":%u,\"message_size\":%u",
+		scenario->name, SNET_VERSION_MAJOR, SNET_VERSION_MINOR, SNET_VERSION_PATCH,
+		bench.coder != NULL ? bench.coder : "none", bench.checksum != NULL ? bench.checksum : "none",
+		bench.transport != NULL ? bench.transport : "udp", bench.preciseTime ? "us" : "ms",
+		(unsigned int)peerCount, (unsigned int)messageSize);
+	printf(",\"loss_percent\":%g,\"duplicate_percent\":%g,\"reorder_percent\":%g,\"delay_ms\":%u,\"jitter_ms\":%u,\"bandwidth\":%u",
+		bench.impairment.loss / 1e4, bench.impairment.duplicate / 1e4, bench.impairment.reorder / 1e4,
+		bench.impairment.delay, bench.impairment.jitter, bench.impairment.bandwidth);
+}
+
+static void
+bench_field(const char * name, double value)
+{
+	if (value == (unsigned long long)value)
+		printf(",\"%s\":%llu", name, (unsigned long long)value);
+	else
+		printf(",\"%s\":%.3f", name, value);
+}
+
+static void
+bench_end(void)
+{
+	printf("}\n");
+	fflush(stdout);
+}
+
+/* one client host with peerCount peers streams messages to a server, sharing the window between them;
+   stream scenarios spread each peer's messages over bench.streams streams in turn and count those
+   delivered out of order within their stream */
+static int
+bench_throughput(const BenchScenario * scenario, size_t peerCount, size_t messageSize)
+{
+	SNetAddress address;
+	SNetHost * server = bench_server(peerCount, &address),
+		* client = bench_host(NULL, peerCount);
+	unsigned long long sentMessages = 0;
+	double start, end, cpu;
+	size_t window = bench.window / peerCount, i;
+
+	bench_connect(server, client, &address, peerCount, bench_count);
+
+	bench.receivedMessages = 0;
+	bench.receivedData = 0;
+	bench.outOfOrder = 0;
+	snet_histogram_reset(&bench.latency);
+
+	if (scenario->flags & SNET_PACKET_FLAG_STREAM)
+	{
+		if (bench.maximumStreams > 0)
+			server->maximumStreams = bench.maximumStreams;
+
+		bench.streamSentTimes = (unsigned long long *)calloc(peerCount * bench.streams, sizeof(unsigned long long));
+		if (bench.streamSentTimes == NULL)
+		{
+			fprintf(stderr, "could not track %u streams\n", (unsigned int)(peerCount * bench.streams));
+			exit(1);
+		}
+	}
+
+	start = bench_now();
+	cpu = bench_cpu();
+	end = start + bench.seconds;
+
+	while (bench_now() < end)
+	{
+		for (i = 0; i < peerCount; ++i)
+		{
+			SNetChannel * channel = &client->peers[i].channels[0];
+
+			while (channel->outgoingQueuedData + channel->outgoingInFlightData < window)
+			{
+				if (messageSize >= sizeof(unsigned long long))
+				{
+					unsigned long long sentTime = snet_time_get_nanoseconds();
+
+					memcpy(bench.message, &sentTime, sizeof(sentTime));
+				}
+
+				if (scenario->flags & SNET_PACKET_FLAG_STREAM)
+				{
+					if (snet_peer_send_stream(&client->peers[i], 0, (snet_uint32)(sentMessages % bench.streams), snet_packet_create(bench.message, messageSize, scenario->flags)) < 0)
+						break;
+				}
+				else
+					if (snet_peer_send(&client->peers[i], 0, snet_packet_create(bench.message, messageSize, scenario->flags)) < 0)
+						break;
+
+				++sentMessages;
+			}
+		}
+
+		bench_service(client, bench_count);
+		bench_service(server, bench_deliver);
+	}
+
+	end = bench_now() - start;
+	cpu = bench_cpu() - cpu;
+
+	bench_begin(scenario, peerCount, messageSize);
+	bench_field("seconds", end);
+	bench_field("cpu_seconds", cpu);
+	bench_field("sent_messages", (double)sentMessages);
+	bench_field("received_messages", (double)bench.receivedMessages);
+	bench_field("messages_per_second", bench.receivedMessages / end);
+	bench_field("megabytes_per_second", bench.receivedData / end / 1e6);
+	bench_field("megabytes_per_second_per_peer", bench.receivedData / end / 1e6 / peerCount);
+	if (scenario->flags & SNET_PACKET_FLAG_STREAM)
+	{
+		bench_field("streams", (double)bench.streams);
+		bench_field("maximum_streams", (double)server->maximumStreams);
+		if (messageSize >= sizeof(unsigned long long))
+			bench_field("out_of_order", (double)bench.outOfOrder);
+	}
+	if (messageSize >= sizeof(unsigned long long))
+	{
+		bench_field("delivery_p50_us", snet_histogram_percentile(&bench.latency, 50.0) / 1e3);
+		bench_field("delivery_p99_us", snet_histogram_percentile(&bench.latency, 99.0) / 1e3);
+		bench_field("delivery_max_us", bench.latency.maximum / 1e3);
+	}
+	bench_end();
+
+	free(bench.streamSentTimes);
+	bench.streamSentTimes = NULL;
+
+	snet_host_destroy(client);
+	snet_host_destroy(server);
+
+	return 0;
+}
+
+static void
+bench_echo(SNetHost * host, SNetEvent * event)
+{
+	if (event->type == SNET_EVENT_TYPE_RECEIVE)
+	{
+		snet_peer_send(event->peer, event->channelID, event->packet);
+		return;
+	}
+
+	bench_count(host, event);
+}
+
+static void
+bench_pong(SNetHost * host, SNetEvent * event)
+{
+	if (event->type == SNET_EVENT_TYPE_RECEIVE)
+	{
+		unsigned long long elapsed = snet_time_get_nanoseconds() - bench.pingTime;
+
+		snet_histogram_record(&bench.latency, elapsed > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (snet_uint32)elapsed);
+		++bench.pongs;
+
+		snet_packet_destroy(event->packet);
+		return;
+	}
+
+	bench_count(host, event);
+}
+
+/* one message at a time goes to the server and back, timing each round trip */
+static int
+bench_pingpong(const BenchScenario * scenario, size_t peerCount, size_t messageSize)
+{
+	SNetAddress address;
+	SNetHost * server = bench_server(1, &address),
+		* client = bench_host(NULL, 1);
+	unsigned long long roundTrips = 0;
+	double start, end, cpu;
+	SNetPeerStats stats;
+
+	bench_connect(server, client, &address, 1, bench_echo);
+
+	snet_histogram_reset(&bench.latency);
+
+	start = bench_now();
+	cpu = bench_cpu();
+	end = start + bench.seconds;
+
+	while (bench_now() < end)
+	{
+		bench.pongs = 0;
+		bench.pingTime = snet_time_get_nanoseconds();
+
+		snet_peer_send(&client->peers[0], 0, snet_packet_create(bench.message, messageSize, scenario->flags));
+
+		while (bench.pongs == 0)
+		{
+			bench_service(client, bench_pong);
+			bench_service(server, bench_echo);
+		}
+
+		++roundTrips;
+	}
+
+	end = bench_now() - start;
+	cpu = bench_cpu() - cpu;
+
+	stats.version = SNET_PEER_STATS_VERSION;
+	snet_peer_get_stats(&client->peers[0], &stats);
+
+	bench_begin(scenario, 1, messageSize);
+	bench_field("seconds", end);
+	bench_field("cpu_seconds", cpu);
+	bench_field("round_trips", (double)roundTrips);
+	bench_field("round_trips_per_second", roundTrips / end);
+	bench_field("p50_us", snet_histogram_percentile(&bench.latency, 50.0) / 1e3);
+	bench_field("p90_us", snet_histogram_percentile(&bench.latency, 90.0) / 1e3);
+	bench_field("p99_us", snet_histogram_percentile(&bench.latency, 99.0) / 1e3);
+	bench_field("p999_us", snet_histogram_percentile(&bench.latency, 99.9) / 1e3);
+	bench_field("max_us", bench.latency.maximum / 1e3);
+	bench_field("smoothed_rtt_us", stats.roundTripTimeMicroseconds);
+	bench_field("smoothed_rtt_variance_us", stats.roundTripTimeVarianceMicroseconds);
+	bench_end();
+
+	snet_host_destroy(client);
+	snet_host_destroy(server);
+
+	return 0;
+}
+
+/* the server broadcasts to peerCount clients, each on its own host, keeping a few broadcasts in flight */
+static int
+bench_fanout(const BenchScenario * scenario, size_t peerCount, size_t messageSize)
+{
+	SNetAddress address;
+	SNetHost * server = bench_server(peerCount, &address),
+		** clients = (SNetHost **)malloc(peerCount * sizeof(SNetHost *));
+	unsigned long long broadcasts = 0;
+	double start, end, cpu;
+	size_t i;
+
+	for (i = 0; i < peerCount; ++i)
+	{
+		clients[i] = bench_host(NULL, 1);
+
+		bench_connect(server, clients[i], &address, 1, bench_count);
+	}
+
+	bench.receivedMessages = 0;
+	bench.receivedData = 0;
+
+	start = bench_now();
+	cpu = bench_cpu();
+	end = start + bench.seconds;
+
+	while (bench_now() < end)
+	{
+		/* every client is at most eight broadcasts behind */
+		while (broadcasts * peerCount < bench.receivedMessages + 8 * peerCount &&
+			server->peers[0].channels[0].outgoingQueuedData < bench.window)
+		{
+			snet_host_broadcast(server, 0, snet_packet_create(bench.message, messageSize, scenario->flags));
+			++broadcasts;
+		}
+
+		bench_service(server, bench_count);
+
+		for (i = 0; i < peerCount; ++i)
+			bench_service(clients[i], bench_count);
+	}
+
+	end = bench_now() - start;
+	cpu = bench_cpu() - cpu;
+
+	bench_begin(scenario, peerCount, messageSize);
+	bench_field("seconds", end);
+	bench_field("cpu_seconds", cpu);
+	bench_field("broadcasts", (double)broadcasts);
+	bench_field("deliveries", (double)bench.receivedMessages);
+	bench_field("broadcasts_per_second", bench.receivedMessages / end / peerCount);
+	bench_field("deliveries_per_second", bench.receivedMessages / end);
+	bench_field("megabytes_per_second", bench.receivedData / end / 1e6);
+	bench_end();
+
+	for (i = 0; i < peerCount; ++i)
+		snet_host_destroy(clients[i]);
+	free(clients);
+
+	snet_host_destroy(server);
+
+	return 0;
+}
+
+/* times snet_host_service() on a server with every peer slot allocated and peerCount of them connected but quiet */
+static int
+bench_idle(const BenchScenario * scenario, size_t peerCount, size_t messageSize)
+{
+	SNetAddress address;
+	SNetHost * server = bench_server(SNET_PROTOCOL_MAXIMUM_PEER_ID, &address),
+		* client = peerCount > 0 ? bench_host(NULL, peerCount) : NULL;
+	unsigned long long calls = 0;
+	double start, end, cpu;
+
+	if (client != NULL)
+		bench_connect(server, client, &address, peerCount, bench_count);
+
+	snet_histogram_reset(&bench.latency);
+
+	start = bench_now();
+	cpu = bench_cpu();
+	end = start + bench.seconds;
+
+	while (bench_now() < end)
+	{
+		unsigned long long callStart = snet_time_get_nanoseconds(), elapsed;
+
+		bench_service(server, bench_count);
+
+		elapsed = snet_time_get_nanoseconds() - callStart;
+		snet_histogram_record(&bench.latency, elapsed > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (snet_uint32)elapsed);
+		++calls;
+
+		if (client != NULL)
+			bench_service(client, bench_count);
+	}
+
+	end = bench_now() - start;
+	cpu = bench_cpu() - cpu;
+
+	bench_begin(scenario, peerCount, 0);
+	bench_field("peer_slots", SNET_PROTOCOL_MAXIMUM_PEER_ID);
+	bench_field("seconds", end);
+	bench_field("cpu_seconds", cpu);
+	bench_field("services", (double)calls);
+	bench_field("mean_ns", (double)(bench.latency.sum / (calls ? calls : 1)));
+	bench_field("p50_ns", snet_histogram_percentile(&bench.latency, 50.0));
+	bench_field("p99_ns", snet_histogram_percentile(&bench.latency, 99.0));
+	bench_field("max_ns", bench.latency.maximum);
+	bench_end();
+
+	if (client != NULL)
+		snet_host_destroy(client);
+	snet_host_destroy(server);
+
+	return 0;
+}
+
+static void
+bench_client_connect(SNetHost * host, SNetEvent * event)
+{
+	if (event->type == SNET_EVENT_TYPE_CONNECT)
+	{
+		unsigned long long elapsed = snet_time_get_nanoseconds() - bench.pingTime;
+
+		snet_histogram_record(&bench.latency, elapsed > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (snet_uint32)elapsed);
+		++bench.clientConnects;
+		return;
+	}
+
+	bench_count(host, event);
+}
+
+/* a flooder sends connects with fresh connect IDs to a server with BENCH_FLOOD_SLOTS peers and
+   never services its socket, so like a spoofer it never sees the replies; a quarter of the way
+   in, peerCount legitimate clients connect.  Runs once without and once with connect cookies. */
+#define BENCH_FLOOD_SLOTS 256
+#define BENCH_FLOOD_PEERS 4095
+#define BENCH_FLOOD_BURST 64
+
+static int
+bench_flood(const BenchScenario * scenario, size_t peerCount, size_t messageSize)
+{
+	int cookies;
+
+	for (cookies = 0; cookies <= 1; ++cookies)
+	{
+		SNetAddress address;
+		SNetHost * server = bench_server(BENCH_FLOOD_SLOTS, &address),
+			* flooder = bench_host(NULL, BENCH_FLOOD_PEERS),
+			* client = bench_host(NULL, peerCount);
+		unsigned long long floodConnects = 0;
+		double start, end, cpu, clientStart;
+		size_t i, slotsUsed = 0;
+
+		snet_host_connect_cookies(server, cookies, NULL);
+
+		bench.clientConnects = 0;
+		snet_histogram_reset(&bench.latency);
+
+		start = bench_now();
+		cpu = bench_cpu();
+		end = start + bench.seconds;
+		clientStart = start + bench.seconds / 4;
+
+		while (bench_now() < end)
+		{
+			if (clientStart > 0 && bench_now() >= clientStart)
+			{
+				bench.pingTime = snet_time_get_nanoseconds();
+
+				for (i = 0; i < peerCount; ++i)
+					snet_host_connect(client, &address, 1, 0);
+
+				clientStart = 0;
+			}
+
+			for (i = 0; i < BENCH_FLOOD_BURST; ++i)
+			{
+				if (snet_host_connect(flooder, &address, 1, 0) == NULL)
+				{
+					size_t j;
+
+					for (j = 0; j < flooder->peerCount; ++j)
+						snet_peer_reset(&flooder->peers[j]);
+
+					snet_host_connect(flooder, &address, 1, 0);
+				}
+
+				++floodConnects;
+			}
+
+			snet_host_flush(flooder);
+
+			bench_service(server, bench_count);
+			bench_service(client, bench_client_connect);
+		}
+
+		end = bench_now() - start;
+		cpu = bench_cpu() - cpu;
+
+		for (i = 0; i < server->peerCount; ++i)
+			if (server->peers[i].state != SNET_PEER_STATE_DISCONNECTED)
+				++slotsUsed;
+
+		bench_begin(scenario, peerCount, 0);
+		bench_field("cookies", cookies);
+		bench_field("peer_slots", BENCH_FLOOD_SLOTS);
+		bench_field("seconds", end);
+		bench_field("cpu_seconds", cpu);
+		bench_field("flood_connects", (double)floodConnects);
+		bench_field("flood_connects_per_second", floodConnects / end);
+		bench_field("slots_used", (double)slotsUsed);
+		bench_field("client_connects", (double)bench.clientConnects);
+		bench_field("client_success_rate", peerCount > 0 ? (double)bench.clientConnects / peerCount : 0);
+		if (bench.clientConnects > 0)
+		{
+			bench_field("connect_p50_us", snet_histogram_percentile(&bench.latency, 50.0) / 1e3);
+			bench_field("connect_max_us", bench.latency.maximum / 1e3);
+		}
+		bench_end();
+
+		snet_host_destroy(client);
+		snet_host_destroy(flooder);
+		snet_host_destroy(server);
+	}
+
+	return 0;
+}
+
+static const BenchScenario scenarios[] =
+{
+	{ "reliable",   bench_throughput, SNET_PACKET_FLAG_RELIABLE,                                1024,    1 },
+	{ "unreliable", bench_throughput, 0,                                                        1024,    1 },
+	{ "unordered",  bench_throughput, SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNSEQUENCED, 1024,    1 },
+	{ "streams",    bench_throughput, SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_STREAM,      1024,    1 },
+	{ "small",      bench_throughput, SNET_PACKET_FLAG_RELIABLE,                                16,      1 },
+	{ "large",      bench_throughput, SNET_PACKET_FLAG_RELIABLE,                                1048576, 1 },
+	{ "pingpong",   bench_pingpong,   SNET_PACKET_FLAG_RELIABLE,                                32,      1 },
+	{ "fanout",     bench_fanout,     SNET_PACKET_FLAG_RELIABLE,                                256,     64 },
+	{ "idle",       bench_idle,       0,                                                        0,       0 },
+	{ "flood",      bench_flood,      0,                                                        0,       16 }
+};
+
+static void
+bench_usage(void)
+{
+	size_t i;
+
+	fprintf(stderr,
+		"usage: bench [options] [scenario...]\n"
+		"  -t seconds   time to run each scenario (default 2)\n"
+		"  -p peers     peers, overriding the scenario's default\n"
+		"  -m size      message size in bytes, overriding the scenario's default\n"
+		"  -w window    bytes a sender keeps queued or in flight, across all its peers (default 262144)\n"
+		"  -s streams   streams each peer sends on in the streams scenario (default 1024)\n"
+		"  -M streams   streams the server lets each peer use at once in the streams scenario\n"
+		"  -z coder     compression: range or rans (default none)\n"
+		"  -k checksum  checksum: crc32 or crc32c (default none)\n"
+		"  -T transport transport: udp or shm (default udp)\n"
+		"  -c clock     sent times for round trips: ms or us (default ms)\n"
+		"network impairment of every datagram sent, in each direction:\n"
+		"  -l percent   loss\n"
+		"  -u percent   duplication\n"
+		"  -r percent   reordering, by skipping the delay\n"
+		"  -d ms        delay\n"
+		"  -j ms        jitter around the delay\n"
+		"  -b bytes     link rate per second\n"
+		"  -q bytes     queue for the link rate, beyond which datagrams drop\n"
+		"  -S seed      seed for the impairments (default 1)\n"
+		"scenarios:");
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+		fprintf(stderr, " %s", scenarios[i].name);
+	fprintf(stderr, " (default all)\n");
+	exit(2);
+}
+
+int
+main(int argc, char ** argv)
+{
+	const char * selected[sizeof(scenarios) / sizeof(scenarios[0])];
+	size_t selectedCount = 0, peerCount = 0, messageSize = 0, largest = 0, i, j;
+	int argument;
+
+	bench.seconds = 2.0;
+	bench.window = 262144;
+	bench.streams = 1024;
+	bench.seed = 1;
+
+	for (argument = 1; argument < argc; ++argument)
+	{
+		const char * arg = argv[argument], * value;
+
+		if (arg[0] != '-')
+		{
+			if (selectedCount >= sizeof(selected) / sizeof(selected[0]))
+				bench_usage();
+			selected[selectedCount++] = arg;
+			continue;
+		}
+
+		if (arg[1] == '\0' || arg[2] != '\0' || argument + 1 >= argc)
+			bench_usage();
+		value = argv[++argument];
+
+		switch (arg[1])
+		{
+		case 't': bench.seconds = atof(value); break;
+		case 'p': peerCount = (size_t)atoi(value); break;
+		case 'm': messageSize = (size_t)atoi(value); break;
+		case 'w': bench.window = (size_t)atoi(value); break;
+		case 's':
+			bench.streams = (size_t)atoi(value);
+			if (bench.streams == 0)
+				bench_usage();
+			break;
+		case 'M': bench.maximumStreams = (size_t)atoi(value); break;
+		case 'z':
+			if (strcmp(value, "range") != 0 && strcmp(value, "rans") != 0)
+				bench_usage();
+			bench.coder = value;
+			break;
+		case 'k':
+			if (strcmp(value, "crc32") != 0 && strcmp(value, "crc32c") != 0)
+				bench_usage();
+			bench.checksum = value;
+			break;
+		case 'T':
+			if (strcmp(value, "udp") != 0 && strcmp(value, "shm") != 0)
+				bench_usage();
+			bench.transport = strcmp(value, "shm") == 0 ? value : NULL;
+			break;
+		case 'c':
+			if (strcmp(value, "ms") != 0 && strcmp(value, "us") != 0)
+				bench_usage();
+			bench.preciseTime = strcmp(value, "us") == 0;
+			break;
+		case 'l': bench.impairment.loss = (snet_uint32)(atof(value) * 1e4); bench.impaired = 1; break;
+		case 'u': bench.impairment.duplicate = (snet_uint32)(atof(value) * 1e4); bench.impaired = 1; break;
+		case 'r': bench.impairment.reorder = (snet_uint32)(atof(value) * 1e4); bench.impaired = 1; break;
+		case 'd': bench.impairment.delay = (snet_uint32)atoi(value); bench.impaired = 1; break;
+		case 'j': bench.impairment.jitter = (snet_uint32)atoi(value); bench.impaired = 1; break;
+		case 'b': bench.impairment.bandwidth = (snet_uint32)atoi(value); bench.impaired = 1; break;
+		case 'q': bench.impairment.queueLimit = (snet_uint32)atoi(value); bench.impaired = 1; break;
+		case 'S': bench.seed = (snet_uint32)atoi(value); break;
+		default: bench_usage();
+		}
+	}
+
+	if (peerCount > SNET_PROTOCOL_MAXIMUM_PEER_ID)
+		peerCount = SNET_PROTOCOL_MAXIMUM_PEER_ID;
+
+	for (i = 0; i < selectedCount; ++i)
+	{
+		for (j = 0; j < sizeof(scenarios) / sizeof(scenarios[0]); ++j)
+			if (strcmp(selected[i], scenarios[j].name) == 0)
+				break;
+
+		if (j >= sizeof(scenarios) / sizeof(scenarios[0]))
+			bench_usage();
+	}
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+		if (scenarios[i].messageSize > largest)
+			largest = scenarios[i].messageSize;
+	if (messageSize > largest)
+		largest = messageSize;
+
+	/* compressible but not trivially so */
+	bench.message = (snet_uint8 *)malloc(largest);
+	for (i = 0; i < largest; ++i)
+		bench.message[i] = (snet_uint8)((i * 7) % 61);
+
+	if (snet_initialize() != 0)
+	{
+		fprintf(stderr, "could not initialize SNet\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+	{
+		const BenchScenario * scenario = &scenarios[i];
+
+		if (selectedCount > 0)
+		{
+			for (j = 0; j < selectedCount; ++j)
+				if (strcmp(selected[j], scenario->name) == 0)
+					break;
+
+			if (j >= selectedCount)
+				continue;
+		}
+
+		scenario->run(scenario,
+			peerCount > 0 || scenario->run == bench_idle ? peerCount : scenario->peerCount,
+			messageSize > 0 ? messageSize : scenario->messageSize);
+	}
+
+	snet_deinitialize();
+
+	free(bench.message);
+
+	return 0;
+}
@@ -0,0 +1,586 @@
+/**
+@file  micro.c
+@brief SNet microbenchmarks
+
+Times the primitives the protocol leans on in isolation: the range and rANS coders over
+several payload corpora, the CRC32 checksums, the list operations behind every queue, packet
+creation, and queueing incoming reliable commands as they arrive in order and out of it.
+Each benchmark prints one JSON object per line with the time and, on x86, the TSC cycles
+per operation or per byte.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snet/snet.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define MICRO_CYCLES() __rdtsc()
+#define MICRO_HAS_CYCLES 1
+#else
+#define MICRO_CYCLES() 0ULL
+#define MICRO_HAS_CYCLES 0
+#endif
+
+enum
+{
+	MICRO_PAYLOAD_SIZE = 1200,
+	MICRO_PAYLOAD_COUNT = 64,
+	MICRO_LIST_NODES = 64,
+	MICRO_COMMAND_BLOCK = 32
+};
+
+/* one batch of work, returning how many operations or bytes it covered */
+typedef size_t (*MicroBody) (void * context);
+
+static double microSeconds = 0.2;
+static snet_uint32 microRandom = 1;
+
+static snet_uint32
+micro_random(void)
+{
+	microRandom ^= microRandom << 13;
+	microRandom ^= microRandom >> 17;
+	microRandom ^= microRandom << 5;
+
+	return microRandom;
+}
+
+/* repeats a batch for at least microSeconds after a warm up, then reports per unit of work */
+static void
+micro_measure(const char * benchmark, const char * corpus, const char * unit, MicroBody body, void * context, const char * extra)
+{
+	unsigned long long units = 0, startTime, elapsedTime, startCycles, elapsedCycles;
+
+	body(context);
+
+	startTime = snet_time_get_nanoseconds();
+	startCycles = MICRO_CYCLES();
+
+	do
+		units += body(context);
+	while (snet_time_get_nanoseconds() - startTime < (unsigned long long)(microSeconds * 1e9));
+
+	elapsedCycles = MICRO_CYCLES() - startCycles;
+	elapsedTime = snet_time_get_nanoseconds() - startTime;
+
+	printf("{\"benchmark\":\"%s\"", benchmark);
+	if (corpus != NULL)
+		printf(",\"corpus\":\"%s\"", corpus);
+	printf(",\"%ss\":%llu,\"ns_per_%s\":%.3f", unit, units, unit, (double)elapsedTime / units);
+	if (MICRO_HAS_CYCLES)
+		printf(",\"cycles_per_%s\":%.3f", unit, (double)elapsedCycles / units);
+	if (strcmp(unit, "byte") == 0)
+		printf(",\"megabytes_per_second\":%.3f", units * 1e3 / elapsedTime);
+	if (extra != NULL)
+		printf(",%s", extra);
+	printf("}\n");
+	fflush(stdout);
+}
+
+/* corpora */
+
+static const char * const microWords[] =
+{
+	"the", "player", "moved", "to", "position", "and", "fired", "at", "a", "target", "which",
+	"was", "hit", "for", "damage", "while", "team", "score", "changed", "in", "round", "over"
+};
+
+static void
+micro_corpus(const char * corpus, snet_uint8 * data, size_t dataLength)
+{
+	size_t i = 0;
+
+	if (strcmp(corpus, "zeros") == 0)
+		memset(data, 0, dataLength);
+	else
+	if (strcmp(corpus, "random") == 0)
+	{
+		for (i = 0; i < dataLength; ++i)
+			data[i] = (snet_uint8)micro_random();
+	}
+	else
+	if (strcmp(corpus, "text") == 0)
+	{
+		while (i < dataLength)
+		{
+			const char * word = microWords[micro_random() % (sizeof(microWords) / sizeof(microWords[0]))];
+
+			while (*word && i < dataLength)
+				data[i++] = (snet_uint8)*word++;
+			if (i < dataLength)
+				data[i++] = ' ';
+		}
+	}
+	else
+	if (strcmp(corpus, "state") == 0)
+	{
+		/* entity records: a 16-bit id and three 16-bit coordinates that drift slowly */
+		snet_uint16 coordinates[3] = { 1000, 2000, 3000 }, id = 0;
+
+		while (i + 8 <= dataLength)
+		{
+			int axis;
+
+			data[i++] = (snet_uint8)(id >> 8);
+			data[i++] = (snet_uint8)id++;
+
+			for (axis = 0; axis < 3; ++axis)
+			{
+				coordinates[axis] += (snet_uint16)(micro_random() % 7) - 3;
+				data[i++] = (snet_uint8)(coordinates[axis] >> 8);
+				data[i++] = (snet_uint8)coordinates[axis];
+			}
+		}
+
+		memset(&data[i], 0, dataLength - i);
+	}
+	else
+	{
+		/* protocol: reliable sends with rising sequence numbers and short, similar payloads */
+		snet_uint16 sequenceNumber = (snet_uint16)micro_random();
+
+		while (i + 14 <= dataLength)
+		{
+			++sequenceNumber;
+
+			data[i++] = SNET_PROTOCOL_COMMAND_SEND_RELIABLE | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
+			data[i++] = 0;
+			data[i++] = (snet_uint8)(sequenceNumber >> 8);
+			data[i++] = (snet_uint8)sequenceNumber;
+			data[i++] = 0;
+			data[i++] = 8;
+			data[i++] = 'u';
+			data[i++] = 'p';
+			data[i++] = 'd';
+			data[i++] = (snet_uint8)(micro_random() % 4);
+			data[i++] = (snet_uint8)(sequenceNumber & 0x0F);
+			data[i++] = 0;
+			data[i++] = 0;
+			data[i++] = 1;
+		}
+
+		memset(&data[i], 0, dataLength - i);
+	}
+}
+
+/* compressors */
+
+typedef struct _MicroCoder
+{
+	const char * name;
+	void *    (*create) (void);
+	void      (*destroy) (void *);
+	size_t    (*compress) (void *, const SNetBuffer *, size_t, size_t, snet_uint8 *, size_t);
+	size_t    (*decompress) (void *, const snet_uint8 *, size_t, snet_uint8 *, size_t);
+} MicroCoder;
+
+typedef struct _MicroCompression
+{
+	const MicroCoder * coder;
+	void *       context;
+	snet_uint8   payloads[MICRO_PAYLOAD_COUNT][MICRO_PAYLOAD_SIZE];
+	snet_uint8   compressed[MICRO_PAYLOAD_COUNT][MICRO_PAYLOAD_SIZE];
+	size_t       compressedLengths[MICRO_PAYLOAD_COUNT];
+	snet_uint8   output[MICRO_PAYLOAD_SIZE];
+} MicroCompression;
+
+static size_t
+micro_compress(void * context)
+{
+	MicroCompression * compression = (MicroCompression *)context;
+	SNetBuffer buffer;
+	size_t i;
+
+	for (i = 0; i < MICRO_PAYLOAD_COUNT; ++i)
+	{
+		buffer.data = compression->payloads[i];
+		buffer.dataLength = MICRO_PAYLOAD_SIZE;
+
+		compression->coder->compress(compression->context, &buffer, 1, MICRO_PAYLOAD_SIZE, compression->output, sizeof(compression->output));
+	}
+
+	return MICRO_PAYLOAD_COUNT * MICRO_PAYLOAD_SIZE;
+}
+
+static size_t
+micro_decompress(void * context)
+{
+	MicroCompression * compression = (MicroCompression *)context;
+	size_t outputData = 0, i;
+
+	for (i = 0; i < MICRO_PAYLOAD_COUNT; ++i)
+		if (compression->compressedLengths[i] > 0)
+			outputData += compression->coder->decompress(compression->context, compression->compressed[i], compression->compressedLengths[i], compression->output, sizeof(compression->output));
+
+	return outputData;
+}
+
+static const MicroCoder microCoders[] =
+{
+	{ "range", snet_range_coder_create, snet_range_coder_destroy, snet_range_coder_compress, snet_range_coder_decompress },
+	{ "rans",  snet_rans_coder_create,  snet_rans_coder_destroy,  snet_rans_coder_compress,  snet_rans_coder_decompress }
+};
+
+static const char * const microCorpora[] = { "zeros", "text", "state", "protocol", "random" };
+
+static void
+micro_compressors(void)
+{
+	static MicroCompression compression;
+	size_t coder, corpus, i;
+
+	for (coder = 0; coder < sizeof(microCoders) / sizeof(microCoders[0]); ++coder)
+		for (corpus = 0; corpus < sizeof(microCorpora) / sizeof(microCorpora[0]); ++corpus)
+		{
+			size_t compressedData = 0, failures = 0;
+			char name[32], extra[96];
+
+			compression.coder = &microCoders[coder];
+			compression.context = compression.coder->create();
+
+			for (i = 0; i < MICRO_PAYLOAD_COUNT; ++i)
+			{
+				SNetBuffer buffer;
+
+				micro_corpus(microCorpora[corpus], compression.payloads[i], MICRO_PAYLOAD_SIZE);
+
+				buffer.data = compression.payloads[i];
+				buffer.dataLength = MICRO_PAYLOAD_SIZE;
+
+				/* as in the protocol, a payload that does not shrink is sent as it is */
+				compression.compressedLengths[i] = compression.coder->compress(compression.context, &buffer, 1, MICRO_PAYLOAD_SIZE,
+					compression.compressed[i], sizeof(compression.compressed[i]));
+
+				if (compression.compressedLengths[i] == 0 || compression.compressedLengths[i] >= MICRO_PAYLOAD_SIZE)
+				{
+					compression.compressedLengths[i] = 0;
+					compressedData += MICRO_PAYLOAD_SIZE;
+					continue;
+				}
+
+				compressedData += compression.compressedLengths[i];
+
+				if (compression.coder->decompress(compression.context, compression.compressed[i], compression.compressedLengths[i],
+					compression.output, sizeof(compression.output)) != MICRO_PAYLOAD_SIZE ||
+					memcmp(compression.output, compression.payloads[i], MICRO_PAYLOAD_SIZE) != 0)
+					++failures;
+			}
+
+			sprintf(extra, "\"ratio\":%.3f,\"round_trip_failures\":%u", (double)compressedData / (MICRO_PAYLOAD_COUNT * MICRO_PAYLOAD_SIZE), (unsigned int)failures);
+
+			sprintf(name, "%s_compress", compression.coder->name);
+			micro_measure(name, microCorpora[corpus], "byte", micro_compress, &compression, extra);
+
+			/* payloads that did not shrink are never decompressed */
+			sprintf(name, "%s_decompress", compression.coder->name);
+			if (compressedData < MICRO_PAYLOAD_COUNT * MICRO_PAYLOAD_SIZE)
+				micro_measure(name, microCorpora[corpus], "byte", micro_decompress, &compression, extra);
+
+			compression.coder->destroy(compression.context);
+		}
+}
+
+/* checksums */
+
+typedef struct _MicroChecksum
+{
+	snet_uint32 (*checksum) (const SNetBuffer *, size_t);
+	SNetBuffer  buffer;
+	snet_uint32 result;
+} MicroChecksum;
+
+static size_t
+micro_checksum(void * context)
+{
+	MicroChecksum * checksum = (MicroChecksum *)context;
+	int i;
+
+	for (i = 0; i < 64; ++i)
+		checksum->result += checksum->checksum(&checksum->buffer, 1);
+
+	return 64 * checksum->buffer.dataLength;
+}
+
+static void
+micro_checksums(void)
+{
+	static snet_uint8 data[MICRO_PAYLOAD_SIZE];
+	static const size_t sizes[] = { 64, MICRO_PAYLOAD_SIZE };
+	MicroChecksum checksum;
+	size_t i;
+
+	micro_corpus("random", data, sizeof(data));
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		char corpus[32];
+
+		sprintf(corpus, "%u_bytes", (unsigned int)sizes[i]);
+
+		checksum.buffer.data = data;
+		checksum.buffer.dataLength = sizes[i];
+		checksum.result = 0;
+
+		checksum.checksum = snet_crc32;
+		micro_measure("crc32", corpus, "byte", micro_checksum, &checksum, NULL);
+
+		checksum.checksum = snet_crc32c;
+		micro_measure("crc32c", corpus, "byte", micro_checksum, &checksum, NULL);
+	}
+}
+
+/* lists */
+
+typedef struct _MicroLists
+{
+	SNetList     queue;
+	SNetList     other;
+	SNetListNode nodes[MICRO_LIST_NODES];
+	size_t       size;
+} MicroLists;
+
+/* the outgoing and acknowledgement queue pattern: append at the back, take from the front */
+static size_t
+micro_list_queue(void * context)
+{
+	MicroLists * lists = (MicroLists *)context;
+	size_t i;
+
+	for (i = 0; i < MICRO_LIST_NODES; ++i)
+		snet_list_insert(snet_list_end(&lists->queue), &lists->nodes[i]);
+
+	while (!snet_list_empty(&lists->queue))
+		snet_list_remove(snet_list_begin(&lists->queue));
+
+	return MICRO_LIST_NODES;
+}
+
+/* the dispatch pattern: move a run of nodes from one list to another and back */
+static size_t
+micro_list_move(void * context)
+{
+	MicroLists * lists = (MicroLists *)context;
+	size_t i;
+
+	for (i = 0; i < MICRO_LIST_NODES / 4; ++i)
+	{
+		snet_list_move(snet_list_end(&lists->other), &lists->nodes[4 * i], &lists->nodes[4 * i + 3]);
+		snet_list_move(snet_list_end(&lists->queue), &lists->nodes[4 * i], &lists->nodes[4 * i + 3]);
+	}
+
+	return MICRO_LIST_NODES / 2;
+}
+
+static size_t
+micro_list_size(void * context)
+{
+	MicroLists * lists = (MicroLists *)context;
+
+	lists->size += snet_list_size(&lists->queue);
+
+	return 1;
+}
+
+static void
+micro_lists(void)
+{
+	static MicroLists lists;
+	char extra[32];
+	size_t i;
+
+	snet_list_clear(&lists.queue);
+	snet_list_clear(&lists.other);
+
+	micro_measure("list_insert_remove", NULL, "op", micro_list_queue, &lists, NULL);
+
+	for (i = 0; i < MICRO_LIST_NODES; ++i)
+		snet_list_insert(snet_list_end(&lists.queue), &lists.nodes[i]);
+
+	micro_measure("list_move", NULL, "op", micro_list_move, &lists, NULL);
+
+	sprintf(extra, "\"list_length\":%u", MICRO_LIST_NODES);
+	micro_measure("list_size", NULL, "op", micro_list_size, &lists, extra);
+}
+
+/* packets */
+
+typedef struct _MicroPackets
+{
+	size_t      dataLength;
+	snet_uint32 flags;
+	snet_uint8  data[MICRO_PAYLOAD_SIZE];
+} MicroPackets;
+
+static size_t
+micro_packet(void * context)
+{
+	MicroPackets * packets = (MicroPackets *)context;
+	int i;
+
+	for (i = 0; i < 64; ++i)
+		snet_packet_destroy(snet_packet_create(packets->data, packets->dataLength, packets->flags));
+
+	return 64;
+}
+
+static void
+micro_packets(void)
+{
+	static MicroPackets packets;
+
+	packets.dataLength = 16;
+	packets.flags = SNET_PACKET_FLAG_RELIABLE;
+	micro_measure("packet_create_destroy", "16_bytes", "op", micro_packet, &packets, NULL);
+
+	packets.dataLength = 1024;
+	micro_measure("packet_create_destroy", "1024_bytes", "op", micro_packet, &packets, NULL);
+
+	packets.flags = SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_NO_ALLOCATE;
+	micro_measure("packet_create_destroy", "1024_bytes_no_allocate", "op", micro_packet, &packets, NULL);
+}
+
+/* incoming commands */
+
+typedef struct _MicroCommands
+{
+	SNetPeer *  peer;
+	snet_uint16 sequenceNumber;
+	size_t      order[MICRO_COMMAND_BLOCK];
+	snet_uint8  data[64];
+} MicroCommands;
+
+/* queues a block of reliable commands in the given order, then takes the packets they complete */
+static size_t
+micro_commands(void * context)
+{
+	MicroCommands * commands = (MicroCommands *)context;
+	SNetProtocol command;
+	SNetPacket * packet;
+	snet_uint8 channelID;
+	size_t i;
+
+	memset(&command, 0, sizeof(command));
+	command.header.command = SNET_PROTOCOL_COMMAND_SEND_RELIABLE | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
+	command.header.channelID = 0;
+
+	for (i = 0; i < MICRO_COMMAND_BLOCK; ++i)
+	{
+		command.header.reliableSequenceNumber = (snet_uint16)(commands->sequenceNumber + 1 + commands->order[i]);
+
+		snet_peer_queue_incoming_command(commands->peer, &command, commands->data, sizeof(commands->data), SNET_PACKET_FLAG_RELIABLE, 0);
+	}
+
+	commands->sequenceNumber += MICRO_COMMAND_BLOCK;
+
+	while ((packet = snet_peer_receive(commands->peer, &channelID)) != NULL)
+		snet_packet_destroy(packet);
+
+	return MICRO_COMMAND_BLOCK;
+}
+
+static void
+micro_incoming_commands(void)
+{
+	static MicroCommands commands;
+	static const char * const orders[] = { "in_order", "reversed", "shuffled" };
+	SNetAddress address;
+	SNetHost * host;
+	size_t order, i;
+
+	address.host = SNET_HOST_BROADCAST;
+	address.port = 1;
+
+	for (order = 0; order < sizeof(orders) / sizeof(orders[0]); ++order)
+	{
+		host = snet_host_create(NULL, 1, 1, 0, 0);
+		if (host == NULL)
+			return;
+
+		/* connected without a handshake, as snet_protocol_change_state() would leave it */
+		commands.peer = snet_host_connect(host, &address, 1, 0);
+		snet_peer_on_connect(commands.peer);
+		commands.peer->state = SNET_PEER_STATE_CONNECTED;
+		commands.sequenceNumber = 0;
+
+		for (i = 0; i < MICRO_COMMAND_BLOCK; ++i)
+			commands.order[i] = order == 1 ? MICRO_COMMAND_BLOCK - 1 - i : i;
+
+		if (order == 2)
+			for (i = MICRO_COMMAND_BLOCK - 1; i > 0; --i)
+			{
+				size_t other = micro_random() % (i + 1), swap = commands.order[i];
+
+				commands.order[i] = commands.order[other];
+				commands.order[other] = swap;
+			}
+
+		micro_measure("queue_incoming_command", orders[order], "op", micro_commands, &commands, "\"block\":32");
+
+		snet_host_destroy(host);
+	}
+}
+
+static const struct
+{
+	const char * name;
+	void      (*run) (void);
+} microGroups[] =
+{
+	{ "compress", micro_compressors },
+	{ "checksum", micro_checksums },
+	{ "list",     micro_lists },
+	{ "packet",   micro_packets },
+	{ "incoming", micro_incoming_commands }
+};
+
+int
+main(int argc, char ** argv)
+{
+	size_t group;
+	int argument;
+
+	for (argument = 1; argument < argc; ++argument)
+		if (strcmp(argv[argument], "-t") == 0 && argument + 1 < argc)
+			microSeconds = atof(argv[++argument]);
+		else
+			if (argv[argument][0] == '-')
+			{
+				fprintf(stderr, "usage: micro [-t seconds] [compress|checksum|list|packet|incoming...]\n");
+				return 2;
+			}
+
+	if (snet_initialize() != 0)
+	{
+		fprintf(stderr, "could not initialize SNet\n");
+		return 1;
+	}
+
+	for (group = 0; group < sizeof(microGroups) / sizeof(microGroups[0]); ++group)
+	{
+		int selected = 1;
+
+		for (argument = 1; argument < argc; ++argument)
+		{
+			if (strcmp(argv[argument], "-t") == 0)
+			{
+				++argument;
+				continue;
+			}
+
+			selected = 0;
+			if (strcmp(argv[argument], microGroups[group].name) == 0)
+			{
+				selected = 1;
+				break;
+			}
+		}
+
+		if (selected)
+			microGroups[group].run();
+	}
+
+	snet_deinitialize();
+
+	return 0;
+}
@@ -0,0 +1,476 @@
+/**
+@file  sim.c
+@brief SNet virtual-time simulations
+
+Runs many client hosts against a few servers on an in-memory fabric, so scaling experiments
+that would need a fleet of machines and minutes of wall time finish in seconds in one process.
+Each scenario prints one JSON object per line; everything but the real time is the same from
+one run to the next.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snet/snet.h"
+#include "snet/time.h"
+
+typedef struct _SimClient
+{
+	SNetHost *  host;
+	SNetPeer *  peer;
+	int         connected;
+	snet_uint32 connectStart;
+} SimClient;
+
+typedef struct _SimScenario
+{
+	const char * name;
+	double       seconds;
+	double       stormSeconds;         /* when every client drops its connection and reconnects, or 0 */
+} SimScenario;
+
+typedef struct _Sim
+{
+	size_t             clientCount;
+	size_t             serverCount;
+	double             seconds;
+	snet_uint32        interval;
+	size_t             messageSize;
+	snet_uint32        latency;
+	const char *       coder;
+	const char *       checksum;
+	SNetImpairment     impairment;
+	int                impaired;
+	snet_uint32        seed;
+	snet_uint8 *       message;
+	SNetFabric *       fabric;
+	SNetHost **        servers;
+	SimClient *        clients;
+	size_t             connectedClients;
+	snet_uint32        lastConnectTime;
+	unsigned long long clientConnects;
+	unsigned long long clientDisconnects;
+	unsigned long long serverConnects;
+	unsigned long long serverDisconnects;
+	unsigned long long sentMessages;
+	unsigned long long receivedMessages;
+	SNetHistogram      connectTime;
+} Sim;
+
+static Sim sim;
+
+static double
+sim_now(void)
+{
+	return snet_time_get_nanoseconds() / 1e9;
+}
+
+static SNetHost *
+sim_host(const SNetAddress * address, size_t peerCount)
+{
+	SNetHost * host = snet_fabric_host_create(sim.fabric, address, peerCount, 1, 0, 0);
+
+	if (host == NULL)
+	{
+		fprintf(stderr, "could not create a host with %u peers\n", (unsigned int)peerCount);
+		exit(1);
+	}
+
+	if (sim.coder != NULL)
+	{
+		if (strcmp(sim.coder, "range") == 0)
+			snet_host_compress_with_range_coder(host);
+		else
+			snet_host_compress_with_rans_coder(host);
+	}
+
+	if (sim.checksum != NULL)
+		snet_host_checksum(host, strcmp(sim.checksum, "crc32") == 0 ? SNET_CHECKSUM_TYPE_CRC32 : SNET_CHECKSUM_TYPE_CRC32C);
+
+	if (sim.impaired)
+		snet_host_impair(host, &sim.impairment, NULL, sim.seed++);
+
+	return host;
+}
+
+static void
+sim_server_address(size_t server, SNetAddress * address)
+{
+	address->host = SNET_HOST_TO_NET_32(0xC0A80001 + (snet_uint32)server);   /* 192.168.0.1 onwards */
+	address->port = 7000;
+}
+
+static void
+sim_connect(SimClient * client)
+{
+	SNetAddress address;
+
+	sim_server_address((size_t)(client - sim.clients) % sim.serverCount, &address);
+
+	client->peer = snet_host_connect(client->host, &address, 1, 0);
+	if (client->peer == NULL)
+	{
+		fprintf(stderr, "could not connect client %u\n", (unsigned int)(client - sim.clients));
+		exit(1);
+	}
+
+	client->peer->data = client;
+	client->connectStart = snet_fabric_time(sim.fabric);
+
+	snet_host_flush(client->host);
+}
+
+static void
+sim_event(SNetEvent * event)
+{
+	SimClient * client = (SimClient *)event->peer->data;
+
+	switch (event->type)
+	{
+	case SNET_EVENT_TYPE_CONNECT:
+		if (client == NULL)
+		{
+			++sim.serverConnects;
+			break;
+		}
+
+		++sim.clientConnects;
+		++sim.connectedClients;
+		client->connected = 1;
+		sim.lastConnectTime = snet_fabric_time(sim.fabric);
+		snet_histogram_record(&sim.connectTime, sim.lastConnectTime - client->connectStart);
+		break;
+
+	case SNET_EVENT_TYPE_DISCONNECT:
+		if (client == NULL)
+		{
+			++sim.serverDisconnects;
+			break;
+		}
+
+		++sim.clientDisconnects;
+		if (client->connected)
+			--sim.connectedClients;
+		client->connected = 0;
+		client->peer = NULL;
+		break;
+
+	case SNET_EVENT_TYPE_RECEIVE:
+		++sim.receivedMessages;
+		snet_packet_destroy(event->packet);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* runs the fabric up to the given virtual time, handling events as they come */
+static void
+sim_run_until(snet_uint32 time)
+{
+	SNetEvent event;
+
+	while (SNET_TIME_LESS(snet_fabric_time(sim.fabric), time))
+	{
+		int result = snet_fabric_service(sim.fabric, &event, SNET_TIME_DIFFERENCE(time, snet_fabric_time(sim.fabric)));
+
+		if (result < 0)
+		{
+			fprintf(stderr, "fabric service failed\n");
+			exit(1);
+		}
+
+		if (result > 0)
+			sim_event(&event);
+	}
+}
+
+static void
+sim_send(void)
+{
+	size_t i;
+
+	for (i = 0; i < sim.clientCount; ++i)
+	{
+		SimClient * client = &sim.clients[i];
+		SNetPacket * packet;
+
+		if (!client->connected)
+			continue;
+
+		packet = snet_packet_create(sim.message, sim.messageSize, SNET_PACKET_FLAG_RELIABLE);
+		if (packet == NULL || snet_peer_send(client->peer, 0, packet) < 0)
+		{
+			if (packet != NULL)
+				snet_packet_destroy(packet);
+			continue;
+		}
+
+		++sim.sentMessages;
+
+		snet_host_flush(client->host);
+	}
+}
+
+static void
+sim_field(const char * name, double value)
+{
+	if (value == (unsigned long long)value)
+		printf(",\"%s\":%llu", name, (unsigned long long)value);
+	else
+		printf(",\"%s\":%.3f", name, value);
+}
+
+static void
+sim_run(const SimScenario * scenario)
+{
+	double seconds = sim.seconds > 0 ? sim.seconds : scenario->seconds,
+		realStart, realSeconds;
+	size_t clientsPerServer = (sim.clientCount + sim.serverCount - 1) / sim.serverCount,
+		serverPeers = clientsPerServer,
+		i;
+	snet_uint32 startTime, endTime, stormTime = 0, storm = 0, tick;
+	unsigned long long stormConnects = 0;
+
+	/* reconnecting clients need a second slot until the server times their old peer out */
+	if (scenario->stormSeconds > 0)
+		serverPeers *= 2;
+	if (serverPeers > SNET_PROTOCOL_MAXIMUM_PEER_ID)
+		serverPeers = SNET_PROTOCOL_MAXIMUM_PEER_ID;
+	if (clientsPerServer > serverPeers)
+	{
+		fprintf(stderr, "%u clients per server exceed the %u peers a host can have; add servers with -s\n",
+			(unsigned int)clientsPerServer, (unsigned int)serverPeers);
+		exit(1);
+	}
+
+	snet_histogram_reset(&sim.connectTime);
+	sim.connectedClients = 0;
+	sim.lastConnectTime = 0;
+	sim.clientConnects = sim.clientDisconnects = sim.serverConnects = sim.serverDisconnects = 0;
+	sim.sentMessages = sim.receivedMessages = 0;
+
+	realStart = sim_now();
+
+	sim.fabric = snet_fabric_create(sim.latency);
+	if (sim.fabric == NULL)
+	{
+		fprintf(stderr, "could not create the fabric\n");
+		exit(1);
+	}
+
+	sim.servers = (SNetHost **)malloc(sim.serverCount * sizeof(SNetHost *));
+	sim.clients = (SimClient *)calloc(sim.clientCount, sizeof(SimClient));
+
+	for (i = 0; i < sim.serverCount; ++i)
+	{
+		SNetAddress address;
+
+		sim_server_address(i, &address);
+		sim.servers[i] = sim_host(&address, serverPeers);
+	}
+
+	for (i = 0; i < sim.clientCount; ++i)
+	{
+		sim.clients[i].host = sim_host(NULL, 1);
+		sim_connect(&sim.clients[i]);
+	}
+
+	startTime = snet_fabric_time(sim.fabric);
+	endTime = startTime + (snet_uint32)(seconds * 1000.0);
+	if (scenario->stormSeconds > 0)
+		stormTime = startTime + (snet_uint32)(scenario->stormSeconds * 1000.0);
+
+	for (tick = startTime + sim.interval; SNET_TIME_LESS_EQUAL(tick, endTime); tick += sim.interval)
+	{
+		sim_run_until(tick);
+
+		if (stormTime != 0 && !storm && SNET_TIME_GREATER_EQUAL(tick, stormTime))
+		{
+			/* every client drops its connection without a word and dials again at once */
+			for (i = 0; i < sim.clientCount; ++i)
+			{
+				SimClient * client = &sim.clients[i];
+
+				if (client->peer != NULL)
+				{
+					client->peer->data = NULL;
+					snet_peer_reset(client->peer);
+				}
+
+				if (client->connected)
+					--sim.connectedClients;
+				client->connected = 0;
+
+				sim_connect(client);
+			}
+
+			storm = 1;
+			stormConnects = sim.clientConnects;
+			snet_histogram_reset(&sim.connectTime);
+			continue;
+		}
+
+		sim_send();
+	}
+
+	sim_run_until(endTime);
+
+	realSeconds = sim_now() - realStart;
+
+	printf("{\"scenario\":\"%s\",\"version\":\"%d.%d.%d\",\"compression\":\"%s\",\"checksum\":\"%s\",\"clients\":%u,\"servers\":%u",
+		scenario->name, SNET_VERSION_MAJOR, SNET_VERSION_MINOR, SNET_VERSION_PATCH,
+		sim.coder != NULL ? sim.coder : "none", sim.checksum != NULL ? sim.checksum : "none",
+		(unsigned int)sim.clientCount, (unsigned int)sim.serverCount);
+	printf(",\"message_size\":%u,\"interval_ms\":%u,\"latency_ms\":%u,\"loss_percent\":%g,\"jitter_ms\":%u",
+		(unsigned int)sim.messageSize, sim.interval, sim.latency, sim.impairment.loss / 1e4, sim.impairment.jitter);
+	sim_field("virtual_seconds", seconds);
+	sim_field("real_seconds", realSeconds);
+	sim_field("speedup", realSeconds > 0 ? seconds / realSeconds : 0);
+	sim_field("connected", (double)sim.connectedClients);
+	sim_field("client_connects", (double)sim.clientConnects);
+	sim_field("client_disconnects", (double)sim.clientDisconnects);
+	sim_field("server_connects", (double)sim.serverConnects);
+	sim_field("server_disconnects", (double)sim.serverDisconnects);
+	if (storm)
+		sim_field("storm_reconnects", (double)(sim.clientConnects - stormConnects));
+	sim_field("connect_p50_ms", (double)snet_histogram_percentile(&sim.connectTime, 50.0));
+	sim_field("connect_p99_ms", (double)snet_histogram_percentile(&sim.connectTime, 99.0));
+	sim_field("connect_max_ms", (double)sim.connectTime.maximum);
+	sim_field("sent_messages", (double)sim.sentMessages);
+	sim_field("received_messages", (double)sim.receivedMessages);
+	printf("}\n");
+	fflush(stdout);
+
+	snet_fabric_destroy(sim.fabric);
+	free(sim.servers);
+	free(sim.clients);
+}
+
+static const SimScenario scenarios[] =
+{
+	{ "scale", 60.0,   0.0 },
+	{ "storm", 120.0,  30.0 },
+	{ "soak",  3600.0, 0.0 }
+};
+
+static void
+sim_usage(void)
+{
+	size_t i;
+
+	fprintf(stderr,
+		"usage: sim [options] [scenario...]\n"
+		"  -c clients   client hosts (default 1000)\n"
+		"  -s servers   server hosts the clients are spread over (default 1)\n"
+		"  -t seconds   virtual time to run each scenario, overriding its default\n"
+		"  -i ms        interval at which every client sends a reliable message (default 100)\n"
+		"  -m size      message size in bytes (default 64)\n"
+		"  -d ms        one-way latency of the fabric (default 20)\n"
+		"  -l percent   loss of every datagram sent\n"
+		"  -j ms        jitter of every datagram sent\n"
+		"  -S seed      seed for the loss and jitter (default 1)\n"
+		"  -z coder     compression: range or rans (default none)\n"
+		"  -k checksum  checksum: crc32 or crc32c (default none)\n"
+		"scenarios:");
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+		fprintf(stderr, " %s", scenarios[i].name);
+	fprintf(stderr, " (default scale)\n");
+	exit(2);
+}
+
+int
+main(int argc, char ** argv)
+{
+	const char * selected[sizeof(scenarios) / sizeof(scenarios[0])];
+	size_t selectedCount = 0, i, j;
+	int argument;
+
+	sim.clientCount = 1000;
+	sim.serverCount = 1;
+	sim.interval = 100;
+	sim.messageSize = 64;
+	sim.latency = 20;
+	sim.seed = 1;
+
+	for (argument = 1; argument < argc; ++argument)
+	{
+		const char * arg = argv[argument], * value;
+
+		if (arg[0] != '-')
+		{
+			if (selectedCount >= sizeof(selected) / sizeof(selected[0]))
+				sim_usage();
+			selected[selectedCount++] = arg;
+			continue;
+		}
+
+		if (arg[1] == '\0' || arg[2] != '\0' || argument + 1 >= argc)
+			sim_usage();
+		value = argv[++argument];
+
+		switch (arg[1])
+		{
+		case 'c': sim.clientCount = (size_t)atoi(value); break;
+		case 's': sim.serverCount = (size_t)atoi(value); break;
+		case 't': sim.seconds = atof(value); break;
+		case 'i': sim.interval = (snet_uint32)atoi(value); break;
+		case 'm': sim.messageSize = (size_t)atoi(value); break;
+		case 'd': sim.latency = (snet_uint32)atoi(value); break;
+		case 'l': sim.impairment.loss = (snet_uint32)(atof(value) * 1e4); sim.impaired = 1; break;
+		case 'j': sim.impairment.jitter = (snet_uint32)atoi(value); sim.impaired = 1; break;
+		case 'S': sim.seed = (snet_uint32)atoi(value); break;
+		case 'z':
+			if (strcmp(value, "range") != 0 && strcmp(value, "rans") != 0)
+				sim_usage();
+			sim.coder = value;
+			break;
+		case 'k':
+			if (strcmp(value, "crc32") != 0 && strcmp(value, "crc32c") != 0)
+				sim_usage();
+			sim.checksum = value;
+			break;
+		default: sim_usage();
+		}
+	}
+
+	if (sim.clientCount == 0 || sim.serverCount == 0 || sim.interval == 0)
+		sim_usage();
+
+	for (i = 0; i < selectedCount; ++i)
+	{
+		for (j = 0; j < sizeof(scenarios) / sizeof(scenarios[0]); ++j)
+			if (strcmp(selected[i], scenarios[j].name) == 0)
+				break;
+
+		if (j >= sizeof(scenarios) / sizeof(scenarios[0]))
+			sim_usage();
+	}
+
+	sim.message = (snet_uint8 *)malloc(sim.messageSize > 0 ? sim.messageSize : 1);
+	for (i = 0; i < sim.messageSize; ++i)
+		sim.message[i] = (snet_uint8)((i * 7) % 61);
+
+	if (snet_initialize() != 0)
+	{
+		fprintf(stderr, "could not initialize SNet\n");
+		return 1;
+	}
+
+	if (selectedCount == 0)
+		sim_run(&scenarios[0]);
+	else
+		for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+			for (j = 0; j < selectedCount; ++j)
+				if (strcmp(selected[j], scenarios[i].name) == 0)
+				{
+					sim_run(&scenarios[i]);
+					break;
+				}
+
+	snet_deinitialize();
+
+	free(sim.message);
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/**
+@file  bandwidth.c
+@brief SNet hierarchical bandwidth classes
+*/
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/utility.h"
+#include "snet/snet.h"
+
+/** @defgroup bandwidth SNet bandwidth class functions
+@{
+*/
+
+/** Creates a bandwidth class.
+
+Bandwidth classes form a tree of egress limits, in the style of a hierarchical token
+bucket.  Every class is guaranteed its rate.  Once that is spent it may borrow from its
+parent, which is shared with its siblings, up to its ceiling.  A datagram sent to a peer
+is charged against the peer's class and every ancestor of it.
+
+@param host host the class belongs to
+@param parent parent class to borrow from, or NULL for a root class
+@param rate guaranteed rate in bytes/second; must be non-zero
+@param ceiling maximum rate in bytes/second when borrowing; if 0 or less than rate, the class never borrows
+@param burst bytes that may be sent back to back; defaults to the host's MTU if 0
+@returns the class on success, NULL on failure
+@remarks Classes are destroyed along with the host.
+*/
+SNetBandwidthClass *
+snet_bandwidth_class_create(SNetHost * host, SNetBandwidthClass * parent, snet_uint32 rate, snet_uint32 ceiling, snet_uint32 burst)
+{
+	SNetBandwidthClass * bandwidthClass;
+	snet_uint32 currentTime = snet_host_time(host);
+
+	if (rate == 0 || (parent != NULL && parent->host != host))
+		return NULL;
+
+	bandwidthClass = (SNetBandwidthClass *)snet_malloc(sizeof(SNetBandwidthClass));
+	if (bandwidthClass == NULL)
+		return NULL;
+	memset(bandwidthClass, 0, sizeof(SNetBandwidthClass));
+
+	if (burst == 0)
+		burst = host->mtu;
+	if (ceiling < rate)
+		ceiling = rate;
+
+	bandwidthClass->host = host;
+	bandwidthClass->parent = parent;
+	snet_token_bucket_configure(&bandwidthClass->rateBucket, rate, burst, currentTime);
+	snet_token_bucket_configure(&bandwidthClass->ceilingBucket, ceiling, burst, currentTime);
+
+	if (parent != NULL)
+		++parent->childCount;
+
+	snet_list_insert(snet_list_end(&host->bandwidthClasses), bandwidthClass);
+
+	return bandwidthClass;
+}
+
+/** Destroys a bandwidth class, detaching any peers assigned to it.
+@param bandwidthClass class to destroy
+@retval 0 on success
+@retval < 0 if the class still has child classes
+*/
+int
+snet_bandwidth_class_destroy(SNetBandwidthClass * bandwidthClass)
+{
+	SNetHost * host;
+	SNetPeer * currentPeer;
+
+	if (bandwidthClass == NULL)
+		return 0;
+
+	if (bandwidthClass->childCount > 0)
+		return -1;
+
+	host = bandwidthClass->host;
+
+	if (bandwidthClass->peerCount > 0)
+	{
+		for (currentPeer = host->peers;
+			currentPeer < &host->peers[host->peerCount];
+			++currentPeer)
+		{
+			if (currentPeer->bandwidthClass == bandwidthClass)
+				currentPeer->bandwidthClass = NULL;
+		}
+	}
+
+	if (bandwidthClass->parent != NULL)
+		--bandwidthClass->parent->childCount;
+
+	snet_list_remove(&bandwidthClass->classList);
+
+	snet_free(bandwidthClass);
+
+	return 0;
+}
+
+/** Assigns a peer to a bandwidth class.
+@param peer peer to assign
+@param bandwidthClass class to assign the peer to, or NULL to remove the peer from its class
+@remarks The assignment lasts until the peer is reset.
+*/
+void
+snet_peer_bandwidth_class(SNetPeer * peer, SNetBandwidthClass * bandwidthClass)
+{
+	if (peer->bandwidthClass != NULL)
+		--peer->bandwidthClass->peerCount;
+
+	peer->bandwidthClass = bandwidthClass;
+
+	if (bandwidthClass != NULL)
+		++bandwidthClass->peerCount;
+}
+
+/** Refills the class and its ancestors and determines how long until it may send.
+@returns 0 if the class may send now, either within its rate or by borrowing, otherwise
+the number of milliseconds until it may
+*/
+snet_uint32
+snet_bandwidth_class_delay(SNetBandwidthClass * bandwidthClass, snet_uint32 currentTime)
+{
+	snet_uint32 rateDelay, borrowDelay;
+
+	snet_token_bucket_refill(&bandwidthClass->rateBucket, currentTime);
+	snet_token_bucket_refill(&bandwidthClass->ceilingBucket, currentTime);
+
+	rateDelay = snet_token_bucket_delay(&bandwidthClass->rateBucket);
+	if (rateDelay == 0 || bandwidthClass->parent == NULL)
+		return rateDelay;
+
+	borrowDelay = SNET_MAX(snet_token_bucket_delay(&bandwidthClass->ceilingBucket),
+		snet_bandwidth_class_delay(bandwidthClass->parent, currentTime));
+
+	return SNET_MIN(rateDelay, borrowDelay);
+}
+
+/** Charges a sent datagram against the class and all of its ancestors. */
+void
+snet_bandwidth_class_charge(SNetBandwidthClass * bandwidthClass, snet_uint32 dataLength)
+{
+	for (; bandwidthClass != NULL; bandwidthClass = bandwidthClass->parent)
+	{
+		/* a class with tokens left is within its rate even if this datagram overdraws it */
+		if (bandwidthClass->parent != NULL && bandwidthClass->rateBucket.tokens <= 0)
+			bandwidthClass->totalBorrowedData += dataLength;
+
+		bandwidthClass->totalSentData += dataLength;
+		bandwidthClass->totalSentPackets++;
+
+		/* a class that keeps borrowing only owes at most one burst, so it recovers its guarantee quickly */
+		bandwidthClass->rateBucket.tokens = SNET_MAX(bandwidthClass->rateBucket.tokens - (int)dataLength, -(int)bandwidthClass->rateBucket.burst);
+		bandwidthClass->ceilingBucket.tokens = SNET_MAX(bandwidthClass->ceilingBucket.tokens - (int)dataLength, -(int)bandwidthClass->ceilingBucket.burst);
+	}
+}
+
+/** @} */
@@ -0,0 +1,358 @@
+/**
+@file  capture.c
+@brief SNet pcapng capture of raw datagrams
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+
+/** @defgroup capture SNet datagram capture functions
+@{
+*/
+
+/* the ring has one producer, the service loop, and one consumer, the writer thread */
+#ifdef _MSC_VER
+#include <intrin.h>
+#if defined(_M_ARM64) || defined(_M_ARM64EC)
+#define SNET_CAPTURE_LOAD(position) ((size_t)__ldar64((unsigned __int64 volatile *)&(position)))
+#define SNET_CAPTURE_STORE(position, value) __stlr64((unsigned __int64 volatile *)&(position), (unsigned __int64)(value))
+#else
+/* x86 and x64 keep loads and stores in order, so only the compiler needs holding back: nothing
+   after a load moves before it, and nothing before a store moves after it */
+static __forceinline size_t
+snet_capture_load(volatile size_t * position)
+{
+	size_t value = *position;
+
+	_ReadWriteBarrier();
+
+	return value;
+}
+
+#define SNET_CAPTURE_LOAD(position) snet_capture_load(&(position))
+#define SNET_CAPTURE_STORE(position, value) do { _ReadWriteBarrier(); *(volatile size_t *)&(position) = (value); } while (0)
+#endif
+#else
+#define SNET_CAPTURE_LOAD(position) __atomic_load_n(&(position), __ATOMIC_ACQUIRE)
+#define SNET_CAPTURE_STORE(position, value) __atomic_store_n(&(position), (value), __ATOMIC_RELEASE)
+#endif
+
+#define SNET_CAPTURE_PAD(length) (((length) + 3) & ~3)
+
+enum
+{
+	SNET_CAPTURE_LINKTYPE_IPV4        = 228,
+	SNET_CAPTURE_IDLE_INTERVAL        = 10,
+	SNET_CAPTURE_IP_HEADER_SIZE       = 20,
+	SNET_CAPTURE_UDP_HEADER_SIZE      = 8,
+	SNET_CAPTURE_COMMENT_SIZE         = 48,
+
+	SNET_CAPTURE_BLOCK_SECTION_HEADER = 0x0A0D0D0A,
+	SNET_CAPTURE_BLOCK_INTERFACE      = 1,
+	SNET_CAPTURE_BLOCK_PACKET         = 6,
+	SNET_CAPTURE_OPTION_END           = 0,
+	SNET_CAPTURE_OPTION_COMMENT       = 1,
+	SNET_CAPTURE_OPTION_FLAGS         = 2,
+	SNET_CAPTURE_FLAG_INBOUND         = 1,
+	SNET_CAPTURE_FLAG_OUTBOUND        = 2
+};
+
+static void
+snet_capture_writer(void * data)
+{
+	SNetCapture * capture = (SNetCapture *)data;
+	FILE * file = (FILE *)capture->file;
+
+	for (;;)
+	{
+		size_t head = SNET_CAPTURE_LOAD(capture->head),
+			tail = capture->tail,
+			offset = tail & (capture->bufferSize - 1),
+			available = head - tail;
+
+		if (available == 0)
+		{
+			if (SNET_CAPTURE_LOAD(capture->stopping))
+				break;
+
+			fflush(file);
+
+			snet_thread_sleep(SNET_CAPTURE_IDLE_INTERVAL);
+
+			continue;
+		}
+
+		if (offset + available > capture->bufferSize)
+		{
+			size_t split = capture->bufferSize - offset;
+
+			if (fwrite(capture->buffer + offset, 1, split, file) != split ||
+				fwrite(capture->buffer, 1, available - split, file) != available - split)
+				++capture->writeErrors;
+		}
+		else
+		if (fwrite(capture->buffer + offset, 1, available, file) != available)
+			++capture->writeErrors;
+
+		SNET_CAPTURE_STORE(capture->tail, head);
+	}
+
+	if (fflush(file) != 0)
+		++capture->writeErrors;
+}
+
+static int
+snet_capture_stop(SNetHost * host)
+{
+	SNetCapture * capture = host->capture;
+	int result;
+
+	if (capture == NULL)
+		return 0;
+
+	host->capture = NULL;
+
+	SNET_CAPTURE_STORE(capture->stopping, (size_t)1);
+
+	snet_thread_join(capture->thread);
+
+	if (fclose((FILE *)capture->file) != 0)
+		++capture->writeErrors;
+
+	result = capture->writeErrors > 0 ? -1 : 0;
+
+	snet_free(capture->buffer);
+	snet_free(capture);
+
+	return result;
+}
+
+/** Starts or stops capturing a host's datagrams to a pcapng file.
+
+Every datagram the host sends or receives is recorded as it appears on the wire, behind a
+synthesized IPv4 and UDP header, so tools such as Wireshark show the addresses and ports.
+Each packet is marked inbound or outbound and commented with the peer's incoming ID and,
+for compressed datagrams sent, the length before compression.
+
+Records are copied into a ring buffer which a background thread drains to the file, so the
+service loop never waits on disk.  Datagrams arriving while the ring is full are counted in
+the capture's droppedDatagrams rather than recorded, and writes to the file that fail are
+counted in its writeErrors.
+
+@param host host to capture
+@param fileName file to create, or NULL to stop capturing
+@param bufferSize size of the ring buffer in bytes, rounded up to a power of 2; defaults to 1 MB if 0
+@retval 0 on success
+@retval < 0 if the file, buffer or thread could not be created, or if stopping a capture whose file could not be fully written
+@remarks Starting a capture stops any capture already running on the host, discarding whether its file was fully written.
+*/
+int
+snet_host_capture(SNetHost * host, const char * fileName, size_t bufferSize)
+{
+	SNetCapture * capture;
+	snet_uint32 header[7];
+	snet_uint16 fields[2];
+	int result = snet_capture_stop(host);
+
+	if (fileName == NULL)
+		return result;
+
+	if (bufferSize == 0)
+		bufferSize = SNET_HOST_CAPTURE_DEFAULT_BUFFER_SIZE;
+
+	capture = (SNetCapture *)snet_malloc(sizeof(SNetCapture));
+	if (capture == NULL)
+		return -1;
+	memset(capture, 0, sizeof(SNetCapture));
+
+	capture->bufferSize = 1;
+	while (capture->bufferSize < bufferSize)
+		capture->bufferSize <<= 1;
+
+	capture->buffer = (snet_uint8 *)snet_malloc(capture->bufferSize);
+	capture->file = fopen(fileName, "wb");
+	if (capture->buffer == NULL || capture->file == NULL)
+	{
+		if (capture->file != NULL)
+			fclose((FILE *)capture->file);
+
+		snet_free(capture->buffer);
+		snet_free(capture);
+
+		return -1;
+	}
+
+	/* a section header with no options, in the writer's byte order, and one interface without a snapshot length limit;
+	   the version and link type are pairs of 16-bit fields, so they are laid out as such rather than as one word */
+	header[0] = SNET_CAPTURE_BLOCK_SECTION_HEADER;
+	header[1] = 28;
+	header[2] = 0x1A2B3C4D;
+	fields[0] = 1;
+	fields[1] = 0;
+	memcpy(&header[3], fields, sizeof(fields));
+	header[4] = 0xFFFFFFFF;
+	header[5] = 0xFFFFFFFF;
+	header[6] = 28;
+	result = fwrite(header, sizeof(snet_uint32), 7, (FILE *)capture->file) == 7 ? 0 : -1;
+
+	header[0] = SNET_CAPTURE_BLOCK_INTERFACE;
+	header[1] = 20;
+	fields[0] = SNET_CAPTURE_LINKTYPE_IPV4;
+	fields[1] = 0;
+	memcpy(&header[2], fields, sizeof(fields));
+	header[3] = 0;
+	header[4] = 20;
+	if (fwrite(header, sizeof(snet_uint32), 5, (FILE *)capture->file) != 5)
+		result = -1;
+
+	/* timestamps are the wall clock at the start plus the monotonic time since */
+	capture->startTime = (unsigned long long)time(NULL) * 1000000;
+	capture->startNanoseconds = snet_time_get_nanoseconds();
+
+	if (result == 0)
+		capture->thread = snet_thread_create(snet_capture_writer, capture);
+	if (result < 0 || capture->thread == NULL)
+	{
+		fclose((FILE *)capture->file);
+
+		snet_free(capture->buffer);
+		snet_free(capture);
+
+		return -1;
+	}
+
+	host->capture = capture;
+
+	return 0;
+}
+
+static size_t
+snet_capture_copy(SNetCapture * capture, size_t position, const void * data, size_t dataLength)
+{
+	size_t offset = position & (capture->bufferSize - 1);
+
+	if (offset + dataLength > capture->bufferSize)
+	{
+		size_t split = capture->bufferSize - offset;
+
+		memcpy(capture->buffer + offset, data, split);
+		memcpy(capture->buffer, (const snet_uint8 *)data + split, dataLength - split);
+	}
+	else
+		memcpy(capture->buffer + offset, data, dataLength);
+
+	return position + dataLength;
+}
+
+static size_t
+snet_capture_copy_option(SNetCapture * capture, size_t position, snet_uint16 code, const void * data, snet_uint16 dataLength)
+{
+	static const snet_uint8 padding[4] = { 0 };
+
+	position = snet_capture_copy(capture, position, &code, sizeof(snet_uint16));
+	position = snet_capture_copy(capture, position, &dataLength, sizeof(snet_uint16));
+	if (dataLength > 0)
+		position = snet_capture_copy(capture, position, data, dataLength);
+
+	return snet_capture_copy(capture, position, padding, SNET_CAPTURE_PAD(dataLength) - dataLength);
+}
+
+/** Records a datagram in the host's capture.
+@param host host capturing
+@param outgoing non-zero if the host sent the datagram, 0 if it received it
+@param peerID incoming ID of the peer the datagram belongs to, or SNET_PROTOCOL_MAXIMUM_PEER_ID if none
+@param address foreign address the datagram was sent to or received from
+@param buffers the datagram as sent or received
+@param bufferCount number of buffers
+@param uncompressedLength length of the datagram before compression, or 0 if it was not compressed
+*/
+void
+snet_host_capture_datagram(SNetHost * host, int outgoing, snet_uint16 peerID, const SNetAddress * address,
+	const SNetBuffer * buffers, size_t bufferCount, size_t uncompressedLength)
+{
+	SNetCapture * capture = host->capture;
+	snet_uint8 headers[SNET_CAPTURE_IP_HEADER_SIZE + SNET_CAPTURE_UDP_HEADER_SIZE];
+	snet_uint32 block[7], flags = outgoing ? SNET_CAPTURE_FLAG_OUTBOUND : SNET_CAPTURE_FLAG_INBOUND, checksum = 0;
+	char comment[SNET_CAPTURE_COMMENT_SIZE];
+	const SNetAddress * source = outgoing ? &host->address : address,
+		* destination = outgoing ? address : &host->address;
+	size_t dataLength = 0, packetLength, commentLength, blockLength, head, i;
+	unsigned long long currentTime;
+	snet_uint16 value;
+
+	for (i = 0; i < bufferCount; ++i)
+		dataLength += buffers[i].dataLength;
+
+	packetLength = sizeof(headers) + dataLength;
+
+	if (uncompressedLength > 0)
+		commentLength = sprintf(comment, "peer %u uncompressed %u", (unsigned int)peerID, (unsigned int)uncompressedLength);
+	else
+		commentLength = sprintf(comment, "peer %u", (unsigned int)peerID);
+
+	/* the packet, the flags and comment options, the end of options and the trailing length */
+	blockLength = sizeof(block) + SNET_CAPTURE_PAD(packetLength) + 4 + sizeof(flags) + 4 + SNET_CAPTURE_PAD(commentLength) + 4 + sizeof(snet_uint32);
+
+	head = capture->head;
+	if (blockLength > capture->bufferSize - (head - SNET_CAPTURE_LOAD(capture->tail)))
+	{
+		++capture->droppedDatagrams;
+
+		return;
+	}
+
+	currentTime = capture->startTime + (snet_time_get_nanoseconds() - capture->startNanoseconds) / 1000;
+
+	block[0] = SNET_CAPTURE_BLOCK_PACKET;
+	block[1] = (snet_uint32)blockLength;
+	block[2] = 0;
+	block[3] = (snet_uint32)(currentTime >> 32);
+	block[4] = (snet_uint32)currentTime;
+	block[5] = (snet_uint32)packetLength;
+	block[6] = (snet_uint32)packetLength;
+	head = snet_capture_copy(capture, head, block, sizeof(block));
+
+	memset(headers, 0, sizeof(headers));
+	headers[0] = 0x45;
+	value = SNET_HOST_TO_NET_16((snet_uint16)packetLength);
+	memcpy(&headers[2], &value, 2);
+	headers[8] = 64;
+	headers[9] = 17;
+	memcpy(&headers[12], &source->host, 4);
+	memcpy(&headers[16], &destination->host, 4);
+
+	for (i = 0; i < SNET_CAPTURE_IP_HEADER_SIZE; i += 2)
+		checksum += (headers[i] << 8) | headers[i + 1];
+	while (checksum > 0xFFFF)
+		checksum = (checksum & 0xFFFF) + (checksum >> 16);
+	headers[10] = (snet_uint8)(~checksum >> 8);
+	headers[11] = (snet_uint8)~checksum;
+
+	/* the UDP checksum is left 0, which IPv4 allows */
+	value = SNET_HOST_TO_NET_16(source->port);
+	memcpy(&headers[20], &value, 2);
+	value = SNET_HOST_TO_NET_16(destination->port);
+	memcpy(&headers[22], &value, 2);
+	value = SNET_HOST_TO_NET_16((snet_uint16)(SNET_CAPTURE_UDP_HEADER_SIZE + dataLength));
+	memcpy(&headers[24], &value, 2);
+	head = snet_capture_copy(capture, head, headers, sizeof(headers));
+
+	for (i = 0; i < bufferCount; ++i)
+		head = snet_capture_copy(capture, head, buffers[i].data, buffers[i].dataLength);
+
+	memset(block, 0, sizeof(block));
+	head = snet_capture_copy(capture, head, block, SNET_CAPTURE_PAD(packetLength) - packetLength);
+
+	head = snet_capture_copy_option(capture, head, SNET_CAPTURE_OPTION_FLAGS, &flags, sizeof(flags));
+	head = snet_capture_copy_option(capture, head, SNET_CAPTURE_OPTION_COMMENT, comment, (snet_uint16)commentLength);
+	head = snet_capture_copy_option(capture, head, SNET_CAPTURE_OPTION_END, NULL, 0);
+
+	block[1] = (snet_uint32)blockLength;
+	head = snet_capture_copy(capture, head, &block[1], sizeof(snet_uint32));
+
+	SNET_CAPTURE_STORE(capture->head, head);
+}
+
+/** @} */
@@ -0,0 +1,371 @@
+/**
+@file  checksum.c
+@brief SNet packet checksum functions
+*/
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SNET_CHECKSUM_X86 1
+#define SNET_CHECKSUM_TARGET(features)
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define SNET_CHECKSUM_X86 1
+#define SNET_CHECKSUM_TARGET(features) __attribute__ ((target (features)))
+#endif
+
+/** @defgroup checksum SNet checksum functions
+@{
+*/
+
+enum
+{
+	SNET_CHECKSUM_CRC32_POLYNOMIAL = 0xEDB88320,
+	SNET_CHECKSUM_CRC32C_POLYNOMIAL = 0x82F63B78,
+
+	SNET_CHECKSUM_CLMUL_MINIMUM = 64
+};
+
+static snet_uint32 crc32Table[8][256];
+static snet_uint32 crc32cTable[8][256];
+
+static void
+snet_crc_initialize_table(snet_uint32 table[8][256], snet_uint32 polynomial)
+{
+	int byte, slice;
+
+	for (byte = 0; byte < 256; ++byte)
+	{
+		snet_uint32 crc = byte;
+		int bit;
+
+		for (bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ (polynomial & (0 - (crc & 1)));
+
+		table[0][byte] = crc;
+	}
+
+	for (byte = 0; byte < 256; ++byte)
+	{
+		for (slice = 1; slice < 8; ++slice)
+			table[slice][byte] = (table[slice - 1][byte] >> 8) ^ table[0][table[slice - 1][byte] & 0xFF];
+	}
+}
+
+/* Slice-by-8: eight table lookups retire eight input bytes per iteration instead of one.
+   Bytes are assembled explicitly so the result does not depend on host byte order. */
+static snet_uint32
+snet_crc_update_tables(snet_uint32 table[8][256], snet_uint32 crc, const snet_uint8 * data, size_t dataLength)
+{
+	while (dataLength >= 8)
+	{
+		snet_uint32 low = crc ^ ((snet_uint32)data[0] | ((snet_uint32)data[1] << 8) | ((snet_uint32)data[2] << 16) | ((snet_uint32)data[3] << 24)),
+			high = (snet_uint32)data[4] | ((snet_uint32)data[5] << 8) | ((snet_uint32)data[6] << 16) | ((snet_uint32)data[7] << 24);
+
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+			table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+
+		data += 8;
+		dataLength -= 8;
+	}
+
+	while (dataLength-- > 0)
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+
+	return crc;
+}
+
+static snet_uint32
+snet_crc32_update_software(snet_uint32 crc, const snet_uint8 * data, size_t dataLength)
+{
+	return snet_crc_update_tables(crc32Table, crc, data, dataLength);
+}
+
+static snet_uint32
+snet_crc32c_update_software(snet_uint32 crc, const snet_uint8 * data, size_t dataLength)
+{
+	return snet_crc_update_tables(crc32cTable, crc, data, dataLength);
+}
+
+#ifdef SNET_CHECKSUM_X86
+
+/* SSE4.2 has a dedicated instruction for CRC32C (but not for the CRC32 polynomial). */
+SNET_CHECKSUM_TARGET("sse4.2")
+static snet_uint32
+snet_crc32c_update_sse42(snet_uint32 crc, const snet_uint8 * data, size_t dataLength)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	unsigned long long crc64 = crc;
+
+	while (dataLength >= 8)
+	{
+		unsigned long long word;
+
+		memcpy(&word, data, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+
+		data += 8;
+		dataLength -= 8;
+	}
+
+	crc = (snet_uint32)crc64;
+#else
+	while (dataLength >= 4)
+	{
+		snet_uint32 word;
+
+		memcpy(&word, data, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+
+		data += 4;
+		dataLength -= 4;
+	}
+#endif
+
+	while (dataLength-- > 0)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+
+/* Folds the CRC32 polynomial with carry-less multiplication, 64 bytes per iteration,
+   then reduces the remaining 128 bits with a Barrett reduction.  The constants are
+   x^(k) mod P(x) for the bit-reflected CRC32 polynomial. */
+SNET_CHECKSUM_TARGET("pclmul,sse4.1")
+static snet_uint32
+snet_crc32_update_clmul(snet_uint32 crc, const snet_uint8 * data, size_t dataLength)
+{
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+	size_t foldLength;
+
+	if (dataLength < SNET_CHECKSUM_CLMUL_MINIMUM)
+		return snet_crc32_update_software(crc, data, dataLength);
+
+	foldLength = dataLength & ~(size_t)15;
+
+	x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+	x0 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+
+	data += 64;
+	foldLength -= 64;
+
+	while (foldLength >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		data += 64;
+		foldLength -= 64;
+	}
+
+	x0 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (foldLength >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i *)data);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		data += 16;
+		foldLength -= 16;
+	}
+
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	crc = (snet_uint32)_mm_extract_epi32(x1, 1);
+
+	return snet_crc32_update_software(crc, data, dataLength & 15);
+}
+
+static void
+snet_checksum_cpuid(int leaf, snet_uint32 registers[4])
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, leaf);
+	registers[0] = info[0];
+	registers[1] = info[1];
+	registers[2] = info[2];
+	registers[3] = info[3];
+#else
+	if (!__get_cpuid(leaf, &registers[0], &registers[1], &registers[2], &registers[3]))
+		memset(registers, 0, 4 * sizeof(snet_uint32));
+#endif
+}
+
+#endif
+
+static SNetChecksumUpdateCallback crc32Update = snet_crc32_update_software;
+static SNetChecksumUpdateCallback crc32cUpdate = snet_crc32c_update_software;
+
+/** Builds the software tables and selects the fastest CRC implementations the CPU supports.
+Called once from snet_initialize(), so no checksum ever races a lazily built table.
+*/
+void
+snet_checksum_initialize(void)
+{
+	snet_crc_initialize_table(crc32Table, SNET_CHECKSUM_CRC32_POLYNOMIAL);
+	snet_crc_initialize_table(crc32cTable, SNET_CHECKSUM_CRC32C_POLYNOMIAL);
+
+	crc32Update = snet_crc32_update_software;
+	crc32cUpdate = snet_crc32c_update_software;
+
+#ifdef SNET_CHECKSUM_X86
+	{
+		snet_uint32 registers[4];
+
+		snet_checksum_cpuid(0, registers);
+		if (registers[0] >= 1)
+		{
+			snet_checksum_cpuid(1, registers);
+
+			/* ECX bit 20 is SSE4.2, bit 19 is SSE4.1 and bit 1 is PCLMULQDQ */
+			if (registers[2] & (1 << 20))
+				crc32cUpdate = snet_crc32c_update_sse42;
+			if ((registers[2] & (1 << 19)) && (registers[2] & (1 << 1)))
+				crc32Update = snet_crc32_update_clmul;
+		}
+	}
+#endif
+}
+
+/** Computes the CRC32 (IEEE 802.3 polynomial) of the data held in buffers[0:bufferCount-1].
+@returns the checksum in network byte order, suitable for use as an SNetChecksumCallback
+*/
+snet_uint32
+snet_crc32(const SNetBuffer * buffers, size_t bufferCount)
+{
+	snet_uint32 crc = 0xFFFFFFFF;
+
+	while (bufferCount-- > 0)
+	{
+		crc = crc32Update(crc, (const snet_uint8 *)buffers->data, buffers->dataLength);
+
+		++buffers;
+	}
+
+	return SNET_HOST_TO_NET_32(~crc);
+}
+
+/** Computes the CRC32C (Castagnoli polynomial) of the data held in buffers[0:bufferCount-1].
+Uses the SSE4.2 crc32 instruction where available.
+@returns the checksum in network byte order, suitable for use as an SNetChecksumCallback
+*/
+snet_uint32
+snet_crc32c(const SNetBuffer * buffers, size_t bufferCount)
+{
+	snet_uint32 crc = 0xFFFFFFFF;
+
+	while (bufferCount-- > 0)
+	{
+		crc = crc32cUpdate(crc, (const snet_uint8 *)buffers->data, buffers->dataLength);
+
+		++buffers;
+	}
+
+	return SNET_HOST_TO_NET_32(~crc);
+}
+
+/** Returns the built-in checksum callback for a checksum type.
+@param type checksum type
+@returns the callback, or NULL for SNET_CHECKSUM_TYPE_NONE and unknown types
+*/
+SNetChecksumCallback
+snet_checksum_callback(SNetChecksumType type)
+{
+	switch (type)
+	{
+	case SNET_CHECKSUM_TYPE_CRC32:
+		return snet_crc32;
+
+	case SNET_CHECKSUM_TYPE_CRC32C:
+		return snet_crc32c;
+
+	default:
+		return NULL;
+	}
+}
+
+/** Returns the incremental form of a built-in checksum, for compressors that fold the
+checksum into their own pass over the data.
+@param type checksum type
+@returns the update callback, or NULL for SNET_CHECKSUM_TYPE_NONE and unknown types
+@remarks The running state starts at 0xFFFFFFFF; SNET_HOST_TO_NET_32(~state) then equals
+the value returned by the corresponding SNetChecksumCallback.
+*/
+SNetChecksumUpdateCallback
+snet_checksum_update_callback(SNetChecksumType type)
+{
+	switch (type)
+	{
+	case SNET_CHECKSUM_TYPE_CRC32:
+		return crc32Update;
+
+	case SNET_CHECKSUM_TYPE_CRC32C:
+		return crc32cUpdate;
+
+	default:
+		return NULL;
+	}
+}
+
+/** @} */
@@ -26,6 +26,8 @@ enum
 {
 	SNET_RANGE_CODER_TOP = 1 << 24,
 	SNET_RANGE_CODER_BOTTOM = 1 << 16,
+	/* bytes coded between checksum updates, so each block is folded in while it is still in L1 */
+	SNET_RANGE_CODER_CHECKSUM_BLOCK = 64,
 
 	SNET_CONTEXT_SYMBOL_DELTA = 3,
 	SNET_CONTEXT_SYMBOL_MINIMUM = 1,
@@ -244,11 +246,11 @@ SNET_CONTEXT_WALK(context, { \
 #endif
 
 size_t
-snet_range_coder_compress(void * context, const SNetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, snet_uint8 * outData, size_t outLimit)
+snet_range_coder_compress_checksum(void * context, const SNetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, snet_uint8 * outData, size_t outLimit, SNetChecksumUpdateCallback update, snet_uint32 * checksum)
 {
 	SNetRangeCoder * rangeCoder = (SNetRangeCoder *)context;
 	snet_uint8 * outStart = outData, *outEnd = &outData[outLimit];
-	const snet_uint8 * inData, *inEnd;
+	const snet_uint8 * inData, *inEnd, *checksumData;
 	snet_uint32 encodeLow = 0, encodeRange = ~0;
 	SNetSymbol * root;
 	snet_uint16 predicted = 0;
@@ -259,6 +261,7 @@ snet_range_coder_compress(void * context, const SNetBuffer * inBuffers, size_t i
 
 	inData = (const snet_uint8 *)inBuffers->data;
 	inEnd = &inData[inBuffers->dataLength];
+	checksumData = inData;
 	inBuffers++;
 	inBufferCount--;
 
@@ -274,13 +277,26 @@ snet_range_coder_compress(void * context, const SNetBuffer * inBuffers, size_t i
 		snet_uint16 count, under, *parent = &predicted, total;
 		if (inData >= inEnd)
 		{
-			if (inBufferCount <= 0)
-				break;
-			inData = (const snet_uint8 *)inBuffers->data;
-			inEnd = &inData[inBuffers->dataLength];
-			inBuffers++;
-			inBufferCount--;
+			if (update != NULL)
+				*checksum = update(*checksum, checksumData, (size_t)(inData - checksumData));
+			/* skip empty buffers, such as those of empty packets, rather than reading past them */
+			do
+			{
+				if (inBufferCount <= 0)
+					goto flush;
+				inData = (const snet_uint8 *)inBuffers->data;
+				inEnd = &inData[inBuffers->dataLength];
+				inBuffers++;
+				inBufferCount--;
+			} while (inData >= inEnd);
+			checksumData = inData;
 		}
+		else
+			if (update != NULL && inData - checksumData >= SNET_RANGE_CODER_CHECKSUM_BLOCK)
+			{
+				*checksum = update(*checksum, checksumData, (size_t)(inData - checksumData));
+				checksumData = inData;
+			}
 		value = *inData++;
 
 		for (subcontext = &rangeCoder->symbols[predicted];
@@ -336,6 +352,7 @@ snet_range_coder_compress(void * context, const SNetBuffer * inBuffers, size_t i
 		SNET_RANGE_CODER_FREE_SYMBOLS;
 	}
 
+flush:
 	SNET_RANGE_CODER_FLUSH;
 
 	return (size_t)(outData - outStart);
@@ -496,10 +513,10 @@ typedef struct _SNetExclude
 #define SNET_CONTEXT_NOT_EXCLUDED(value_, after, before)
 
 size_t
-snet_range_coder_decompress(void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit)
+snet_range_coder_decompress_checksum(void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit, SNetChecksumUpdateCallback update, snet_uint32 * checksum)
 {
 	SNetRangeCoder * rangeCoder = (SNetRangeCoder *)context;
-	snet_uint8 * outStart = outData, *outEnd = &outData[outLimit];
+	snet_uint8 * outStart = outData, *outEnd = &outData[outLimit], *checksumData = outData;
 	const snet_uint8 * inEnd = &inData[inLimit];
 	snet_uint32 decodeLow = 0, decodeCode = 0, decodeRange = ~0;
 	SNetSymbol * root;
@@ -616,6 +633,12 @@ snet_range_coder_decompress(void * context, const snet_uint8 * inData, size_t in
 
 		SNET_RANGE_CODER_OUTPUT(value);
 
+		if (update != NULL && outData - checksumData >= SNET_RANGE_CODER_CHECKSUM_BLOCK)
+		{
+			*checksum = update(*checksum, checksumData, (size_t)(outData - checksumData));
+			checksumData = outData;
+		}
+
 		if (order >= SNET_SUBCONTEXT_ORDER)
 			predicted = rangeCoder->symbols[predicted].parent;
 		else
@@ -623,9 +646,24 @@ snet_range_coder_decompress(void * context, const snet_uint8 * inData, size_t in
 		SNET_RANGE_CODER_FREE_SYMBOLS;
 	}
 
+	if (update != NULL)
+		*checksum = update(*checksum, checksumData, (size_t)(outData - checksumData));
+
 	return (size_t)(outData - outStart);
 }
 
+size_t
+snet_range_coder_compress(void * context, const SNetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, snet_uint8 * outData, size_t outLimit)
+{
+	return snet_range_coder_compress_checksum(context, inBuffers, inBufferCount, inLimit, outData, outLimit, NULL, NULL);
+}
+
+size_t
+snet_range_coder_decompress(void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit)
+{
+	return snet_range_coder_decompress_checksum(context, inData, inLimit, outData, outLimit, NULL, NULL);
+}
+
 /** @defgroup host SNet host functions
 @{
 */
@@ -645,6 +683,8 @@ snet_host_compress_with_range_coder(SNetHost * host)
 	compressor.compress = snet_range_coder_compress;
 	compressor.decompress = snet_range_coder_decompress;
 	compressor.destroy = snet_range_coder_destroy;
+	compressor.compressChecksum = snet_range_coder_compress_checksum;
+	compressor.decompressChecksum = snet_range_coder_decompress_checksum;
 	snet_host_compress(host, &compressor);
 	return 0;
 }
@@ -0,0 +1,258 @@
+/**
+@file  cookie.c
+@brief SNet stateless connect cookies and session tickets
+*/
+#include <stddef.h>
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/time.h"
+#include "snet/snet.h"
+
+/** @defgroup cookie SNet connect cookie and session ticket functions
+@{
+*/
+
+#define SNET_SIPHASH_ROTATE(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SNET_SIPHASH_ROUND(v0, v1, v2, v3) \
+	do { \
+		v0 += v1; v1 = SNET_SIPHASH_ROTATE(v1, 13); v1 ^= v0; v0 = SNET_SIPHASH_ROTATE(v0, 32); \
+		v2 += v3; v3 = SNET_SIPHASH_ROTATE(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = SNET_SIPHASH_ROTATE(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = SNET_SIPHASH_ROTATE(v1, 17); v1 ^= v2; v2 = SNET_SIPHASH_ROTATE(v2, 32); \
+	} while (0)
+
+static unsigned long long
+snet_siphash_load(const snet_uint8 * data, size_t length)
+{
+	unsigned long long value = 0;
+
+	while (length > 0)
+	{
+		--length;
+		value = (value << 8) | data[length];
+	}
+
+	return value;
+}
+
+/* SipHash-2-4, a keyed hash built for authenticating short messages */
+static unsigned long long
+snet_siphash(const snet_uint8 * key, const snet_uint8 * data, size_t dataLength)
+{
+	unsigned long long k0 = snet_siphash_load(key, 8),
+		k1 = snet_siphash_load(key + 8, 8),
+		v0 = k0 ^ 0x736F6D6570736575ULL,
+		v1 = k1 ^ 0x646F72616E646F6DULL,
+		v2 = k0 ^ 0x6C7967656E657261ULL,
+		v3 = k1 ^ 0x7465646279746573ULL,
+		m;
+	size_t length = dataLength;
+
+	for (; length >= 8; data += 8, length -= 8)
+	{
+		m = snet_siphash_load(data, 8);
+		v3 ^= m;
+		SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+		SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	m = snet_siphash_load(data, length) | ((unsigned long long)(dataLength & 0xFF) << 56);
+	v3 ^= m;
+	SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+	SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xFF;
+	SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+	SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+	SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+	SNET_SIPHASH_ROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void
+snet_host_secret(SNetHost * host, snet_uint8 * secret, const snet_uint8 * userSecret)
+{
+	size_t i;
+
+	if (userSecret != NULL)
+	{
+		memcpy(secret, userSecret, SNET_HOST_CONNECT_COOKIE_SECRET_SIZE);
+
+		return;
+	}
+
+	for (i = 0; i < SNET_HOST_CONNECT_COOKIE_SECRET_SIZE; i += sizeof(snet_uint32))
+	{
+		snet_uint32 random = snet_host_random_seed() ^ ++host->randomSeed;
+
+		host->randomSeed = (host->randomSeed << 7) ^ (host->randomSeed >> 25) ^ random;
+		memcpy(secret + i, &random, sizeof(snet_uint32));
+	}
+}
+
+/** Makes a host answer connects with a cookie before allocating any peer state.
+
+Without cookies every connect reserves a peer and queues a reply, so spoofed connects can
+fill all peers.  With cookies enabled, a connect without a valid cookie is answered with a
+single stateless datagram carrying a MAC of the sender's address, its connect ID and the
+current time.  The connecting host echoes it in a resent connect, which proves it receives
+at that address, and only then is a peer set up.  The handshake takes one extra round trip.
+
+@param host host to configure
+@param enable non-zero to require cookies on incoming connects, 0 to accept connects directly
+@param secret SNET_HOST_CONNECT_COOKIE_SECRET_SIZE bytes of key to sign cookies with, or NULL to derive
+one from the host's random seed.  The derived key is guessable by someone who knows roughly when
+the host was created, so hosts on public networks should supply a secret from a proper random source.
+@remarks Connecting hosts always handle cookies, so only the accepting side needs this.
+*/
+void
+snet_host_connect_cookies(SNetHost * host, int enable, const snet_uint8 * secret)
+{
+	host->connectCookies = enable != 0;
+
+	snet_host_secret(host, host->connectCookieSecret, secret);
+}
+
+static void
+snet_host_connect_cookie_at(SNetHost * host, const SNetAddress * address, snet_uint32 connectID, snet_uint32 interval, snet_uint8 * cookie)
+{
+	snet_uint8 message[sizeof(snet_uint32) + sizeof(snet_uint16) + sizeof(snet_uint32) + sizeof(snet_uint32)];
+	unsigned long long mac;
+	size_t i;
+
+	memcpy(message, &address->host, sizeof(snet_uint32));
+	memcpy(message + 4, &address->port, sizeof(snet_uint16));
+	memcpy(message + 6, &connectID, sizeof(snet_uint32));
+	memcpy(message + 10, &interval, sizeof(snet_uint32));
+
+	mac = snet_siphash(host->connectCookieSecret, message, sizeof(message));
+
+	for (i = 0; i < SNET_PROTOCOL_CONNECT_COOKIE_SIZE; ++i, mac >>= 8)
+		cookie[i] = (snet_uint8)mac;
+}
+
+/** Computes the cookie for a connect from the given address and connect ID at the host's current service time. */
+void
+snet_host_connect_cookie(SNetHost * host, const SNetAddress * address, snet_uint32 connectID, snet_uint8 * cookie)
+{
+	snet_host_connect_cookie_at(host, address, connectID, host->serviceTime / SNET_HOST_CONNECT_COOKIE_INTERVAL, cookie);
+}
+
+/** Checks a cookie echoed in a connect.
+@returns non-zero if the cookie was issued to this address and connect ID in the current or previous interval
+*/
+int
+snet_host_verify_connect_cookie(SNetHost * host, const SNetAddress * address, snet_uint32 connectID, const snet_uint8 * cookie)
+{
+	snet_uint32 interval = host->serviceTime / SNET_HOST_CONNECT_COOKIE_INTERVAL;
+	snet_uint8 expected[SNET_PROTOCOL_CONNECT_COOKIE_SIZE];
+	int attempt;
+
+	for (attempt = 0; attempt < 2; ++attempt)
+	{
+		snet_uint8 difference = 0;
+		size_t i;
+
+		snet_host_connect_cookie_at(host, address, connectID, interval - attempt, expected);
+
+		for (i = 0; i < SNET_PROTOCOL_CONNECT_COOKIE_SIZE; ++i)
+			difference |= expected[i] ^ cookie[i];
+
+		if (difference == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/** Makes a host issue session tickets to its connected peers.
+
+Every SNET_HOST_SESSION_TICKET_INTERVAL milliseconds each connected peer is sent a ticket
+holding the round trip time and packet throttle the host currently has for it, signed with
+the host's secret along with the foreign host's IP address.  The foreign host keeps the latest
+one, and may present it with snet_host_resume() to connect again from the same IP address
+without measuring the connection from scratch.  Tickets are accepted for
+SNET_HOST_SESSION_TICKET_LIFETIME seconds by the host's clock.
+
+@param host host to configure
+@param enable non-zero to issue and accept tickets, 0 to do neither
+@param secret SNET_HOST_CONNECT_COOKIE_SECRET_SIZE bytes of key to sign tickets with, or NULL to derive
+one from the host's random seed.  Hosts that should accept each other's tickets, such as servers
+handing clients over, must share a secret and their clocks must roughly agree, as snet_time_get()
+does between machines unless snet_time_set() was called.
+@remarks A client that moves to another IP address connects afresh.  Tickets are not single
+use: within its lifetime a ticket can be presented again from the same address, which only
+yields the connection parameters it holds.
+*/
+void
+snet_host_session_tickets(SNetHost * host, int enable, const snet_uint8 * secret)
+{
+	host->sessionTickets = enable != 0;
+
+	snet_host_secret(host, host->sessionTicketSecret, secret);
+}
+
+static void
+snet_host_sign_session_ticket(SNetHost * host, const SNetSessionTicket * ticket, const SNetAddress * address, snet_uint8 * mac)
+{
+	snet_uint8 message[offsetof(SNetSessionTicket, mac) + sizeof(snet_uint32)];
+	unsigned long long hash;
+	size_t i;
+
+	memcpy(message, ticket, offsetof(SNetSessionTicket, mac));
+	memcpy(message + offsetof(SNetSessionTicket, mac), &address->host, sizeof(snet_uint32));
+
+	hash = snet_siphash(host->sessionTicketSecret, message, sizeof(message));
+
+	for (i = 0; i < sizeof(ticket->mac); ++i, hash >>= 8)
+		mac[i] = (snet_uint8)hash;
+}
+
+/** Checks the signature and age of a ticket presented in a connect.
+@param host host the connect came to
+@param ticket ticket presented
+@param address address the connect came from
+@returns non-zero if the ticket was signed with this host's secret for the address's IP and has not expired
+*/
+int
+snet_host_verify_session_ticket(SNetHost * host, const SNetSessionTicket * ticket, const SNetAddress * address)
+{
+	snet_uint8 mac[sizeof(ticket->mac)], difference = 0;
+	size_t i;
+
+	if (!host->sessionTickets ||
+		SNET_TIME_DIFFERENCE(host->serviceTime, SNET_NET_TO_HOST_32(ticket->issueTime)) > SNET_HOST_SESSION_TICKET_LIFETIME * 1000)
+		return 0;
+
+	snet_host_sign_session_ticket(host, ticket, address, mac);
+
+	for (i = 0; i < sizeof(mac); ++i)
+		difference |= mac[i] ^ ticket->mac[i];
+
+	return difference == 0;
+}
+
+/** Queues a fresh session ticket for a connected peer. */
+void
+snet_peer_issue_session_ticket(SNetPeer * peer)
+{
+	SNetProtocol command;
+
+	command.header.command = SNET_PROTOCOL_COMMAND_SESSION_TICKET | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
+	command.header.channelID = 0xFF;
+	command.sessionTicket.ticket.issueTime = SNET_HOST_TO_NET_32(peer->host->serviceTime);
+	command.sessionTicket.ticket.roundTripTime = SNET_HOST_TO_NET_32(peer->roundTripTime);
+	command.sessionTicket.ticket.roundTripTimeVariance = SNET_HOST_TO_NET_32(peer->roundTripTimeVariance);
+	command.sessionTicket.ticket.packetThrottle = SNET_HOST_TO_NET_32(peer->packetThrottle);
+	snet_host_sign_session_ticket(peer->host, &command.sessionTicket.ticket, &peer->address, command.sessionTicket.ticket.mac);
+
+	snet_peer_queue_outgoing_command(peer, &command, NULL, 0, 0);
+
+	peer->sessionTicketTime = peer->host->serviceTime;
+}
+
+/** @} */
@@ -0,0 +1,581 @@
+/**
+@file  fabric.c
+@brief SNet in-memory network for simulations in virtual time
+*/
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+#include "snet/time.h"
+
+/** @defgroup fabric SNet fabric functions
+@{
+*/
+
+enum
+{
+	SNET_FABRIC_START_TIME = 1,
+	SNET_FABRIC_MAXIMUM_SLEEP = 1000,
+	SNET_FABRIC_AUTOMATIC_NETWORK = 0x0A000000,   /* 10.0.0.0/8 */
+	SNET_FABRIC_AUTOMATIC_PORT = 1024
+};
+
+typedef struct _SNetFabricDatagram
+{
+	SNetListNode node;
+	snet_uint32  deliveryTime;
+	SNetAddress  source;
+	SNetAddress  destination;
+	size_t       dataLength;
+} SNetFabricDatagram;
+
+typedef struct _SNetFabricEndpoint
+{
+	SNetFabric *                 fabric;
+	SNetHost *                   host;
+	SNetAddress                  address;
+	struct _SNetFabricEndpoint * next;          /* chain in the fabric's address table */
+	SNetList                     received;      /* datagrams delivered and not yet read by the host */
+	size_t                       receivedBytes;
+	snet_uint32                  wakeTime;
+	size_t                       heapIndex;
+} SNetFabricEndpoint;
+
+struct _SNetFabric
+{
+	snet_uint32           time;
+	snet_uint32           latency;
+	SNetList              datagrams;            /* in flight, in order of delivery time since latency is constant */
+	SNetFabricEndpoint ** addressTable;
+	size_t                addressTableMask;
+	SNetFabricEndpoint ** heap;                 /* endpoints ordered by wake time */
+	size_t                endpointCount;
+	size_t                heapCapacity;
+	snet_uint32           nextAddress;
+	snet_uint32           nextSeed;
+};
+
+static size_t
+snet_fabric_address_index(const SNetFabric * fabric, const SNetAddress * address)
+{
+	snet_uint32 hash = address->host * 0x9E3779B1U;
+
+	hash ^= (hash >> 15) + address->port;
+	hash *= 0x85EBCA6BU;
+
+	return (hash ^ (hash >> 13)) & fabric->addressTableMask;
+}
+
+static SNetFabricEndpoint *
+snet_fabric_lookup(const SNetFabric * fabric, const SNetAddress * address)
+{
+	SNetFabricEndpoint * endpoint;
+
+	for (endpoint = fabric->addressTable[snet_fabric_address_index(fabric, address)];
+		endpoint != NULL;
+		endpoint = endpoint->next)
+	{
+		if (endpoint->address.host == address->host && endpoint->address.port == address->port)
+			return endpoint;
+	}
+
+	return NULL;
+}
+
+static int
+snet_fabric_grow(SNetFabric * fabric)
+{
+	size_t capacity = fabric->heapCapacity ? fabric->heapCapacity * 2 : 64, i;
+	SNetFabricEndpoint ** heap, ** addressTable;
+
+	heap = (SNetFabricEndpoint **)snet_malloc(capacity * sizeof(SNetFabricEndpoint *));
+	addressTable = (SNetFabricEndpoint **)snet_malloc(capacity * sizeof(SNetFabricEndpoint *));
+	if (heap == NULL || addressTable == NULL)
+	{
+		if (heap != NULL)
+			snet_free(heap);
+		if (addressTable != NULL)
+			snet_free(addressTable);
+
+		return -1;
+	}
+
+	if (fabric->heap != NULL)
+	{
+		memcpy(heap, fabric->heap, fabric->endpointCount * sizeof(SNetFabricEndpoint *));
+
+		snet_free(fabric->heap);
+		snet_free(fabric->addressTable);
+	}
+
+	fabric->heap = heap;
+	fabric->heapCapacity = capacity;
+	fabric->addressTable = addressTable;
+	fabric->addressTableMask = capacity - 1;
+
+	memset(addressTable, 0, capacity * sizeof(SNetFabricEndpoint *));
+
+	for (i = 0; i < fabric->endpointCount; ++i)
+	{
+		SNetFabricEndpoint * endpoint = heap[i];
+		size_t index = snet_fabric_address_index(fabric, &endpoint->address);
+
+		endpoint->next = addressTable[index];
+		addressTable[index] = endpoint;
+	}
+
+	return 0;
+}
+
+static void
+snet_fabric_heap_place(SNetFabric * fabric, SNetFabricEndpoint * endpoint, size_t index)
+{
+	fabric->heap[index] = endpoint;
+	endpoint->heapIndex = index;
+}
+
+static void
+snet_fabric_heap_up(SNetFabric * fabric, size_t index)
+{
+	SNetFabricEndpoint * endpoint = fabric->heap[index];
+
+	while (index > 0)
+	{
+		size_t parent = (index - 1) / 2;
+
+		if (!SNET_TIME_LESS(endpoint->wakeTime, fabric->heap[parent]->wakeTime))
+			break;
+
+		snet_fabric_heap_place(fabric, fabric->heap[parent], index);
+		index = parent;
+	}
+
+	snet_fabric_heap_place(fabric, endpoint, index);
+}
+
+static void
+snet_fabric_heap_down(SNetFabric * fabric, size_t index)
+{
+	SNetFabricEndpoint * endpoint = fabric->heap[index];
+
+	for (;;)
+	{
+		size_t child = 2 * index + 1;
+
+		if (child >= fabric->endpointCount)
+			break;
+
+		if (child + 1 < fabric->endpointCount &&
+			SNET_TIME_LESS(fabric->heap[child + 1]->wakeTime, fabric->heap[child]->wakeTime))
+			++child;
+
+		if (!SNET_TIME_LESS(fabric->heap[child]->wakeTime, endpoint->wakeTime))
+			break;
+
+		snet_fabric_heap_place(fabric, fabric->heap[child], index);
+		index = child;
+	}
+
+	snet_fabric_heap_place(fabric, endpoint, index);
+}
+
+static void
+snet_fabric_schedule(SNetFabric * fabric, SNetFabricEndpoint * endpoint, snet_uint32 wakeTime)
+{
+	snet_uint32 oldTime = endpoint->wakeTime;
+
+	endpoint->wakeTime = wakeTime;
+
+	if (SNET_TIME_LESS(wakeTime, oldTime))
+		snet_fabric_heap_up(fabric, endpoint->heapIndex);
+	else
+		snet_fabric_heap_down(fabric, endpoint->heapIndex);
+}
+
+static snet_uint32
+snet_fabric_earlier(snet_uint32 nextTime, snet_uint32 candidate, snet_uint32 currentTime)
+{
+	/* anything overdue is retried on the next tick rather than spun on */
+	if (!SNET_TIME_GREATER(candidate, currentTime))
+		candidate = currentTime + 1;
+
+	return SNET_TIME_LESS(candidate, nextTime) ? candidate : nextTime;
+}
+
+/* works out from the host's state when servicing it next could do anything other than wait */
+static snet_uint32
+snet_fabric_wake_time(SNetFabric * fabric, SNetFabricEndpoint * endpoint)
+{
+	SNetHost * host = endpoint->host;
+	snet_uint32 currentTime = fabric->time,
+		nextTime = currentTime + SNET_FABRIC_MAXIMUM_SLEEP,
+		deliveryTime;
+	SNetPeer ** currentPeer;
+
+	if (!snet_list_empty(&endpoint->received))
+		return currentTime;
+
+	if (snet_host_impairment_due(host, &deliveryTime))
+		nextTime = snet_fabric_earlier(nextTime, deliveryTime, currentTime);
+
+	if (host->tokenBucketDelay != 0)
+		nextTime = snet_fabric_earlier(nextTime, currentTime + host->tokenBucketDelay, currentTime);
+
+	nextTime = snet_fabric_earlier(nextTime, host->bandwidthThrottleEpoch + SNET_HOST_BANDWIDTH_THROTTLE_INTERVAL, currentTime);
+
+	for (currentPeer = &host->freePeerList[host->freePeers];
+		currentPeer < &host->freePeerList[host->peerCount];
+		++currentPeer)
+	{
+		SNetPeer * peer = *currentPeer;
+
+		if (peer->state == SNET_PEER_STATE_DISCONNECTED)
+			continue;
+
+		if (!snet_list_empty(&peer->acknowledgements) ||
+			!snet_list_empty(&peer->outgoingReliableCommands) ||
+			!snet_list_empty(&peer->outgoingUnreliableCommands))
+			return currentTime + 1;
+
+		if (!snet_list_empty(&peer->sentReliableCommands))
+			nextTime = snet_fabric_earlier(nextTime, peer->nextTimeout, currentTime);
+		else
+			if (peer->state == SNET_PEER_STATE_CONNECTED ||
+				peer->state == SNET_PEER_STATE_DISCONNECT_LATER)
+				nextTime = snet_fabric_earlier(nextTime, peer->lastReceiveTime + peer->pingInterval, currentTime);
+
+		if (host->sessionTickets && peer->state == SNET_PEER_STATE_CONNECTED)
+			nextTime = snet_fabric_earlier(nextTime, peer->sessionTicketTime + SNET_HOST_SESSION_TICKET_INTERVAL, currentTime);
+	}
+
+	return nextTime;
+}
+
+static snet_uint32 SNET_CALLBACK
+snet_fabric_clock(SNetHost * host)
+{
+	return ((SNetFabric *)host->clockContext)->time;
+}
+
+static int SNET_CALLBACK
+snet_fabric_send(void * context, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetFabricEndpoint * endpoint = (SNetFabricEndpoint *)context;
+	SNetFabric * fabric = endpoint->fabric;
+	SNetFabricDatagram * datagram;
+	snet_uint8 * data;
+	size_t dataLength = 0, i;
+
+	for (i = 0; i < bufferCount; ++i)
+		dataLength += buffers[i].dataLength;
+
+	datagram = (SNetFabricDatagram *)snet_malloc(sizeof(SNetFabricDatagram) + dataLength);
+	if (datagram == NULL)
+		return -1;
+
+	datagram->deliveryTime = fabric->time + fabric->latency;
+	datagram->source = endpoint->address;
+	datagram->destination = *address;
+	datagram->dataLength = dataLength;
+
+	for (data = (snet_uint8 *)(datagram + 1), i = 0; i < bufferCount; ++i)
+	{
+		memcpy(data, buffers[i].data, buffers[i].dataLength);
+		data += buffers[i].dataLength;
+	}
+
+	snet_list_insert(snet_list_end(&fabric->datagrams), datagram);
+
+	return (int)dataLength;
+}
+
+static int SNET_CALLBACK
+snet_fabric_receive(void * context, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetFabricEndpoint * endpoint = (SNetFabricEndpoint *)context;
+	SNetFabricDatagram * datagram;
+	int receivedLength = 0;
+
+	(void)bufferCount;
+
+	if (snet_list_empty(&endpoint->received))
+		return 0;
+
+	datagram = (SNetFabricDatagram *)snet_list_remove(snet_list_begin(&endpoint->received));
+	endpoint->receivedBytes -= datagram->dataLength;
+
+	/* a datagram too large for the buffer is dropped, as a socket would truncate and discard it */
+	if (datagram->dataLength <= buffers[0].dataLength)
+	{
+		memcpy(buffers[0].data, datagram + 1, datagram->dataLength);
+		*address = datagram->source;
+		receivedLength = (int)datagram->dataLength;
+	}
+
+	snet_free(datagram);
+
+	return receivedLength;
+}
+
+static void SNET_CALLBACK
+snet_fabric_endpoint_destroy(void * context)
+{
+	SNetFabricEndpoint * endpoint = (SNetFabricEndpoint *)context;
+	SNetFabric * fabric = endpoint->fabric;
+	SNetFabricEndpoint ** link = &fabric->addressTable[snet_fabric_address_index(fabric, &endpoint->address)];
+	size_t index = endpoint->heapIndex;
+
+	while (*link != endpoint)
+		link = &(*link)->next;
+	*link = endpoint->next;
+
+	if (index < --fabric->endpointCount)
+	{
+		SNetFabricEndpoint * last = fabric->heap[fabric->endpointCount];
+
+		snet_fabric_heap_place(fabric, last, index);
+		snet_fabric_heap_up(fabric, index);
+		snet_fabric_heap_down(fabric, last->heapIndex);
+	}
+
+	while (!snet_list_empty(&endpoint->received))
+		snet_free(snet_list_remove(snet_list_begin(&endpoint->received)));
+
+	snet_free(endpoint);
+}
+
+/* moves every datagram due by now to its destination's receive queue, dropping those nobody is bound to */
+static void
+snet_fabric_deliver(SNetFabric * fabric)
+{
+	while (!snet_list_empty(&fabric->datagrams))
+	{
+		SNetFabricDatagram * datagram = (SNetFabricDatagram *)snet_list_front(&fabric->datagrams);
+		SNetFabricEndpoint * endpoint;
+
+		if (SNET_TIME_GREATER(datagram->deliveryTime, fabric->time))
+			break;
+
+		snet_list_remove(&datagram->node);
+
+		endpoint = snet_fabric_lookup(fabric, &datagram->destination);
+		if (endpoint == NULL ||
+			endpoint->receivedBytes + datagram->dataLength > SNET_HOST_RECEIVE_BUFFER_SIZE)
+		{
+			snet_free(datagram);
+
+			continue;
+		}
+
+		snet_list_insert(snet_list_end(&endpoint->received), datagram);
+		endpoint->receivedBytes += datagram->dataLength;
+
+		if (SNET_TIME_GREATER(endpoint->wakeTime, fabric->time))
+			snet_fabric_schedule(fabric, endpoint, fabric->time);
+	}
+}
+
+/** Creates an in-memory network for running many hosts in one thread on a shared virtual clock.
+
+Hosts created on the fabric with snet_fabric_host_create() have no sockets: their datagrams are
+copied between them in memory, and time only advances as snet_fabric_service() skips from one
+moment at which some host has work to the next.  Thousands of hosts can so be simulated for
+minutes of virtual time in seconds, and a run repeats exactly, apart from the connect IDs
+hosts choose.
+
+@param latency one-way delay of every datagram, in milliseconds
+@returns the fabric on success and NULL on failure
+@remarks Loss, jitter and the like can be added per host with snet_host_impair(), which
+runs on the fabric's clock.
+*/
+SNetFabric *
+snet_fabric_create(snet_uint32 latency)
+{
+	SNetFabric * fabric = (SNetFabric *)snet_malloc(sizeof(SNetFabric));
+
+	if (fabric == NULL)
+		return NULL;
+
+	memset(fabric, 0, sizeof(SNetFabric));
+
+	fabric->time = SNET_FABRIC_START_TIME;
+	fabric->latency = latency;
+	snet_list_clear(&fabric->datagrams);
+
+	if (snet_fabric_grow(fabric) < 0)
+	{
+		snet_free(fabric);
+
+		return NULL;
+	}
+
+	return fabric;
+}
+
+/** Destroys the fabric, along with every host still on it and every datagram in flight.
+@param fabric fabric to destroy
+*/
+void
+snet_fabric_destroy(SNetFabric * fabric)
+{
+	if (fabric == NULL)
+		return;
+
+	while (fabric->endpointCount > 0)
+		snet_host_destroy(fabric->heap[fabric->endpointCount - 1]->host);
+
+	while (!snet_list_empty(&fabric->datagrams))
+		snet_free(snet_list_remove(snet_list_begin(&fabric->datagrams)));
+
+	snet_free(fabric->heap);
+	snet_free(fabric->addressTable);
+	snet_free(fabric);
+}
+
+/** Creates a host on the fabric, taking the same arguments as snet_host_create().
+
+@param fabric fabric to attach the host to
+@param address address other hosts on the fabric reach this one at; if NULL, a free one in 10.0.0.0/8 is chosen
+@returns the host on success, or NULL on failure or if the address is taken
+@remarks The host runs on the fabric's clock and should only be serviced through
+snet_fabric_service().  Commands queued between calls to it, such as by snet_peer_send() for a
+host other than the one an event came from, go out at the host's next service, or at once with
+snet_host_flush().  snet_host_destroy() takes the host off the fabric.
+*/
+SNetHost *
+snet_fabric_host_create(SNetFabric * fabric, const SNetAddress * address, size_t peerCount, size_t channelLimit, snet_uint32 incomingBandwidth, snet_uint32 outgoingBandwidth)
+{
+	SNetFabricEndpoint * endpoint;
+	SNetTransport transport;
+	SNetAddress endpointAddress;
+	SNetHost * host;
+	size_t index;
+
+	if (address != NULL)
+	{
+		endpointAddress = *address;
+
+		if (snet_fabric_lookup(fabric, &endpointAddress) != NULL)
+			return NULL;
+	}
+	else
+	{
+		endpointAddress.port = SNET_FABRIC_AUTOMATIC_PORT;
+
+		do
+			endpointAddress.host = SNET_HOST_TO_NET_32(SNET_FABRIC_AUTOMATIC_NETWORK | (++fabric->nextAddress & 0xFFFFFF));
+		while (snet_fabric_lookup(fabric, &endpointAddress) != NULL);
+	}
+
+	if (fabric->endpointCount >= fabric->heapCapacity && snet_fabric_grow(fabric) < 0)
+		return NULL;
+
+	endpoint = (SNetFabricEndpoint *)snet_malloc(sizeof(SNetFabricEndpoint));
+	if (endpoint == NULL)
+		return NULL;
+
+	memset(endpoint, 0, sizeof(SNetFabricEndpoint));
+
+	endpoint->fabric = fabric;
+	endpoint->address = endpointAddress;
+	snet_list_clear(&endpoint->received);
+
+	memset(&transport, 0, sizeof(SNetTransport));
+	transport.context = endpoint;
+	transport.send = snet_fabric_send;
+	transport.receive = snet_fabric_receive;
+	transport.destroy = snet_fabric_endpoint_destroy;
+
+	host = snet_host_create_with_transport(&endpointAddress, peerCount, channelLimit, incomingBandwidth, outgoingBandwidth, &transport);
+	if (host == NULL)
+	{
+		snet_free(endpoint);
+
+		return NULL;
+	}
+
+	/* seeded from the fabric rather than the wall clock and heap layout, so runs repeat */
+	host->randomSeed = ++fabric->nextSeed * 0x9E3779B9U;
+	host->addressHashSeed = host->randomSeed ^ 0x5BD1E995U;
+	host->clock = snet_fabric_clock;
+	host->clockContext = fabric;
+
+	endpoint->host = host;
+	endpoint->wakeTime = fabric->time;
+
+	index = snet_fabric_address_index(fabric, &endpointAddress);
+	endpoint->next = fabric->addressTable[index];
+	fabric->addressTable[index] = endpoint;
+
+	snet_fabric_heap_place(fabric, endpoint, fabric->endpointCount++);
+	snet_fabric_heap_up(fabric, endpoint->heapIndex);
+
+	return host;
+}
+
+/** Returns the fabric's virtual time in milliseconds. */
+snet_uint32
+snet_fabric_time(const SNetFabric * fabric)
+{
+	return fabric->time;
+}
+
+/** Runs the hosts on the fabric until one of them has an event or the timeout passes.
+
+Delivers datagrams and services each host with a timeout of 0 whenever it has something to do,
+advancing the virtual clock straight to the next such moment in between.
+
+@param fabric fabric to service
+@param event an event structure where the event, if any, will be placed; event->peer->host tells
+which host it came from
+@param timeout number of milliseconds of virtual time to run for
+@retval > 0 if an event occurred within the specified time limit
+@retval 0 if no event occurred, in which case the fabric's time has advanced by timeout
+@retval < 0 on failure
+*/
+int
+snet_fabric_service(SNetFabric * fabric, SNetEvent * event, snet_uint32 timeout)
+{
+	snet_uint32 deadline = fabric->time + timeout;
+
+	for (;;)
+	{
+		snet_uint32 nextTime = deadline;
+		SNetFabricEndpoint * endpoint;
+		int result;
+
+		if (!snet_list_empty(&fabric->datagrams) &&
+			SNET_TIME_LESS(((SNetFabricDatagram *)snet_list_front(&fabric->datagrams))->deliveryTime, nextTime))
+			nextTime = ((SNetFabricDatagram *)snet_list_front(&fabric->datagrams))->deliveryTime;
+
+		if (fabric->endpointCount > 0 && SNET_TIME_LESS(fabric->heap[0]->wakeTime, nextTime))
+			nextTime = fabric->heap[0]->wakeTime;
+
+		if (SNET_TIME_GREATER(nextTime, fabric->time))
+			fabric->time = nextTime;
+
+		snet_fabric_deliver(fabric);
+
+		if (fabric->endpointCount == 0 || SNET_TIME_GREATER(fabric->heap[0]->wakeTime, fabric->time))
+		{
+			if (!SNET_TIME_LESS(fabric->time, deadline))
+				return 0;
+
+			continue;
+		}
+
+		endpoint = fabric->heap[0];
+
+		result = snet_host_service(endpoint->host, event, 0);
+		if (result != 0)
+		{
+			/* there may be more to dispatch, and the application may queue replies */
+			snet_fabric_schedule(fabric, endpoint, fabric->time);
+
+			return result;
+		}
+
+		snet_fabric_schedule(fabric, endpoint, snet_fabric_wake_time(fabric, endpoint));
+	}
+}
+
+/** @} */
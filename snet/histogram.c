@@ -0,0 +1,254 @@
+/**
+@file  histogram.c
+@brief SNet latency histograms
+*/
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+
+/** @defgroup histogram SNet histogram functions
+@{
+*/
+
+#define SNET_HISTOGRAM_HALF_BUCKET_COUNT (1 << (SNET_HISTOGRAM_SUB_BUCKET_BITS - 1))
+
+static size_t
+snet_histogram_bucket(snet_uint32 value)
+{
+	snet_uint32 shift = 0, top = value >> SNET_HISTOGRAM_SUB_BUCKET_BITS;
+
+	while (top >= 0x100)
+	{
+		top >>= 8;
+		shift += 8;
+	}
+
+	while (top != 0)
+	{
+		top >>= 1;
+		++shift;
+	}
+
+	return shift * SNET_HISTOGRAM_HALF_BUCKET_COUNT + (value >> shift);
+}
+
+/* the largest value counted in a bucket, which is what percentiles report */
+static snet_uint32
+snet_histogram_bucket_value(size_t bucket)
+{
+	size_t shift = bucket < 2 * SNET_HISTOGRAM_HALF_BUCKET_COUNT ? 0 : bucket / SNET_HISTOGRAM_HALF_BUCKET_COUNT - 1;
+	unsigned long long subBucket = bucket - shift * SNET_HISTOGRAM_HALF_BUCKET_COUNT;
+
+	return (snet_uint32)(((subBucket + 1) << shift) - 1);
+}
+
+/** Empties a histogram. */
+void
+snet_histogram_reset(SNetHistogram * histogram)
+{
+	memset(histogram, 0, sizeof(SNetHistogram));
+
+	histogram->minimum = ~0U;
+}
+
+/** Counts one value in a histogram. */
+void
+snet_histogram_record(SNetHistogram * histogram, snet_uint32 value)
+{
+	++histogram->counts[snet_histogram_bucket(value)];
+	++histogram->totalCount;
+	histogram->sum += value;
+
+	if (value < histogram->minimum)
+		histogram->minimum = value;
+	if (value > histogram->maximum)
+		histogram->maximum = value;
+}
+
+/** Adds the counts of one histogram to another, such as to combine the histograms of several peers.
+@param histogram histogram to add to
+@param other histogram to add
+*/
+void
+snet_histogram_merge(SNetHistogram * histogram, const SNetHistogram * other)
+{
+	size_t bucket;
+
+	if (other->totalCount == 0)
+		return;
+
+	for (bucket = 0; bucket < SNET_HISTOGRAM_BUCKET_COUNT; ++bucket)
+		histogram->counts[bucket] += other->counts[bucket];
+
+	histogram->totalCount += other->totalCount;
+	histogram->sum += other->sum;
+
+	if (other->minimum < histogram->minimum)
+		histogram->minimum = other->minimum;
+	if (other->maximum > histogram->maximum)
+		histogram->maximum = other->maximum;
+}
+
+/** Finds the value below which a given percentage of the recorded values fall.
+@param histogram histogram to query
+@param percentile percentage from 0 to 100, such as 99.9
+@returns the value, rounded up to the largest value sharing its bucket but never above the
+largest value recorded, or 0 if the histogram is empty
+*/
+snet_uint32
+snet_histogram_percentile(const SNetHistogram * histogram, double percentile)
+{
+	unsigned long long wanted, seen = 0;
+	size_t bucket;
+
+	if (histogram->totalCount == 0)
+		return 0;
+
+	if (percentile >= 100.0)
+		return histogram->maximum;
+
+	if (percentile < 0.0)
+		percentile = 0.0;
+
+	/* the nearest rank, rounded up so the value found covers at least the given share */
+	wanted = (unsigned long long)(percentile * histogram->totalCount / 100.0);
+	if (wanted < percentile * histogram->totalCount / 100.0 || wanted == 0)
+		++wanted;
+
+	for (bucket = 0; bucket < SNET_HISTOGRAM_BUCKET_COUNT; ++bucket)
+	{
+		seen += histogram->counts[bucket];
+
+		if (seen >= wanted)
+		{
+			snet_uint32 value = snet_histogram_bucket_value(bucket);
+
+			return value < histogram->maximum ? value : histogram->maximum;
+		}
+	}
+
+	return histogram->maximum;
+}
+
+/** Enables or disables a host's latency histograms.
+
+While enabled, the host times the phases of snet_host_service() listed in SNetHostPhase, and
+records each round trip time sample and acknowledgement delay of every peer.  Each timed phase
+costs two reads of snet_time_get_nanoseconds(); while disabled, it costs a single test.
+
+@param host host to configure
+@param enable non-zero to allocate and start the histograms, 0 to free them
+@retval 0 on success
+@retval < 0 if the histograms could not be allocated
+@remarks Enabling histograms that are already enabled leaves them as they are.
+@sa snet_host_phase_histogram()
+@sa snet_peer_histogram()
+*/
+int
+snet_host_histograms(SNetHost * host, int enable)
+{
+	SNetPeer * currentPeer;
+
+	if (!enable)
+	{
+		for (currentPeer = host->peers;
+			currentPeer < &host->peers[host->peerCount];
+			++currentPeer)
+			currentPeer->histograms = NULL;
+
+		snet_free(host->phaseHistograms);
+		snet_free(host->peerHistograms);
+
+		host->phaseHistograms = NULL;
+		host->peerHistograms = NULL;
+
+		return 0;
+	}
+
+	if (host->phaseHistograms != NULL)
+		return 0;
+
+	host->phaseHistograms = (SNetHistogram *)snet_malloc(SNET_HOST_PHASE_COUNT * sizeof(SNetHistogram));
+	host->peerHistograms = (SNetHistogram *)snet_malloc(host->peerCount * SNET_PEER_HISTOGRAM_COUNT * sizeof(SNetHistogram));
+	if (host->phaseHistograms == NULL || host->peerHistograms == NULL)
+	{
+		snet_host_histograms(host, 0);
+
+		return -1;
+	}
+
+	for (currentPeer = host->peers;
+		currentPeer < &host->peers[host->peerCount];
+		++currentPeer)
+		currentPeer->histograms = &host->peerHistograms[(currentPeer - host->peers) * SNET_PEER_HISTOGRAM_COUNT];
+
+	snet_host_reset_histograms(host);
+
+	return 0;
+}
+
+/** Empties all of a host's histograms and those of its peers, such as after exporting them. */
+void
+snet_host_reset_histograms(SNetHost * host)
+{
+	size_t i;
+
+	if (host->phaseHistograms == NULL)
+		return;
+
+	for (i = 0; i < SNET_HOST_PHASE_COUNT; ++i)
+		snet_histogram_reset(&host->phaseHistograms[i]);
+
+	for (i = 0; i < host->peerCount * SNET_PEER_HISTOGRAM_COUNT; ++i)
+		snet_histogram_reset(&host->peerHistograms[i]);
+}
+
+/** Retrieves the histogram of one phase of a host's service loop.
+@returns the histogram, in nanoseconds, or NULL if the host's histograms are disabled
+*/
+const SNetHistogram *
+snet_host_phase_histogram(const SNetHost * host, SNetHostPhase phase)
+{
+	if (host->phaseHistograms == NULL || (unsigned int)phase >= SNET_HOST_PHASE_COUNT)
+		return NULL;
+
+	return &host->phaseHistograms[phase];
+}
+
+/** Retrieves one of a peer's histograms.
+@returns the histogram, in the unit SNetPeerHistogram gives for it, or NULL if the host's histograms are disabled
+@remarks A peer's histograms are emptied when it is reset.
+*/
+const SNetHistogram *
+snet_peer_histogram(const SNetPeer * peer, SNetPeerHistogram which)
+{
+	if (peer->histograms == NULL || (unsigned int)which >= SNET_PEER_HISTOGRAM_COUNT)
+		return NULL;
+
+	return &peer->histograms[which];
+}
+
+/** Starts timing a phase.
+@returns the current time in nanoseconds, or 0 without reading the clock if histograms are disabled
+*/
+unsigned long long
+snet_host_phase_start(const SNetHost * host)
+{
+	return host->phaseHistograms != NULL ? snet_time_get_nanoseconds() : 0;
+}
+
+/** Records a phase started with snet_host_phase_start(). */
+void
+snet_host_phase_end(SNetHost * host, SNetHostPhase phase, unsigned long long startTime)
+{
+	unsigned long long elapsed;
+
+	if (host->phaseHistograms == NULL || startTime == 0)
+		return;
+
+	elapsed = snet_time_get_nanoseconds() - startTime;
+
+	snet_histogram_record(&host->phaseHistograms[phase], elapsed > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (snet_uint32)elapsed);
+}
+
+/** @} */
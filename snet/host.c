@@ -3,13 +3,31 @@
 @brief SNet host management functions
 */
 #define SNET_BUILDING_LIB 1
+#include <stddef.h>
 #include <string.h>
+#include "snet/time.h"
+#include "snet/utility.h"
 #include "snet/snet.h"
 
 /** @defgroup host SNet host functions
 @{
 */
 
+static void
+snet_host_free_peer_tables(SNetHost * host)
+{
+	if (host->connectedPeerList != NULL)
+		snet_free(host->connectedPeerList);
+	if (host->freePeerList != NULL)
+		snet_free(host->freePeerList);
+	if (host->addressHash != NULL)
+		snet_free(host->addressHash);
+	if (host->addressCounts != NULL)
+		snet_free(host->addressCounts);
+	if (host->connectLimits != NULL)
+		snet_free(host->connectLimits);
+}
+
 /** Creates a host for communicating to peers.
 
 @param address   the address at which other peers may connect to this host.  If NULL, then no peers may connect to the host.
@@ -27,9 +45,30 @@ at any given time.
 */
 SNetHost *
 snet_host_create(const SNetAddress * address, size_t peerCount, size_t channelLimit, snet_uint32 incomingBandwidth, snet_uint32 outgoingBandwidth)
+{
+	return snet_host_create_with_transport(address, peerCount, channelLimit, incomingBandwidth, outgoingBandwidth, NULL);
+}
+
+/** Creates a host that sends and receives through a transport, without opening a socket.
+
+@param address   the address the host is known by on the transport, or NULL
+@param peerCount the maximum number of peers that should be allocated for the host.
+@param channelLimit the maximum number of channels allowed; if 0, then this is equivalent to SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT
+@param incomingBandwidth downstream bandwidth of the host in bytes/second; if 0, SNet will assume unlimited bandwidth.
+@param outgoingBandwidth upstream bandwidth of the host in bytes/second; if 0, SNet will assume unlimited bandwidth.
+@param transport callbacks the host uses in place of a socket; if NULL, this is the same as snet_host_create()
+
+@returns the host on success and NULL on failure
+@remarks The host owns the transport once created and destroys it along with itself, but a
+transport is left alone if creation fails.  Since there is no socket to go back to,
+snet_host_transport() should only ever replace the transport, such as by snet_host_impair().
+*/
+SNetHost *
+snet_host_create_with_transport(const SNetAddress * address, size_t peerCount, size_t channelLimit, snet_uint32 incomingBandwidth, snet_uint32 outgoingBandwidth, const SNetTransport * transport)
 {
 	SNetHost * host;
 	SNetPeer * currentPeer;
+	size_t addressHashSize;
 
 	if (peerCount > SNET_PROTOCOL_MAXIMUM_PEER_ID)
 		return NULL;
@@ -48,25 +87,58 @@ snet_host_create(const SNetAddress * address, size_t peerCount, size_t channelLi
 	}
 	memset(host->peers, 0, peerCount * sizeof(SNetPeer));
 
-	host->socket = snet_socket_create(SNET_SOCKET_TYPE_DATAGRAM);
-	if (host->socket == SNET_SOCKET_NULL || (address != NULL && snet_socket_bind(host->socket, address) < 0))
+	addressHashSize = 1;
+	while (addressHashSize < peerCount)
+		addressHashSize <<= 1;
+
+	host->connectedPeerList = (SNetPeer **)snet_malloc(peerCount * sizeof(SNetPeer *));
+	host->freePeerList = (SNetPeer **)snet_malloc(peerCount * sizeof(SNetPeer *));
+	host->addressHash = (SNetList *)snet_malloc(addressHashSize * sizeof(SNetList));
+	host->addressCounts = (SNetAddressCount *)snet_malloc(2 * addressHashSize * sizeof(SNetAddressCount));
+	if (host->connectedPeerList == NULL ||
+		host->freePeerList == NULL ||
+		host->addressHash == NULL ||
+		host->addressCounts == NULL)
 	{
-		if (host->socket != SNET_SOCKET_NULL)
-			snet_socket_destroy(host->socket);
-
+		snet_host_free_peer_tables(host);
 		snet_free(host->peers);
 		snet_free(host);
 
 		return NULL;
 	}
 
-	snet_socket_set_option(host->socket, SNET_SOCKOPT_NONBLOCK, 1);
-	snet_socket_set_option(host->socket, SNET_SOCKOPT_BROADCAST, 1);
-	snet_socket_set_option(host->socket, SNET_SOCKOPT_RCVBUF, SNET_HOST_RECEIVE_BUFFER_SIZE);
-	snet_socket_set_option(host->socket, SNET_SOCKOPT_SNDBUF, SNET_HOST_SEND_BUFFER_SIZE);
+	if (transport != NULL)
+	{
+		host->socket = SNET_SOCKET_NULL;
+
+		if (address != NULL)
+			host->address = *address;
+	}
+	else
+	{
+		host->socket = snet_socket_create(SNET_SOCKET_TYPE_DATAGRAM);
+		if (host->socket == SNET_SOCKET_NULL || (address != NULL && snet_socket_bind(host->socket, address) < 0))
+		{
+			if (host->socket != SNET_SOCKET_NULL)
+				snet_socket_destroy(host->socket);
+
+			snet_host_free_peer_tables(host);
+			snet_free(host->peers);
+			snet_free(host);
+
+			return NULL;
+		}
+
+		snet_socket_set_option(host->socket, SNET_SOCKOPT_NONBLOCK, 1);
+		snet_socket_set_option(host->socket, SNET_SOCKOPT_BROADCAST, 1);
+		snet_socket_set_option(host->socket, SNET_SOCKOPT_RCVBUF, SNET_HOST_RECEIVE_BUFFER_SIZE);
+		snet_socket_set_option(host->socket, SNET_SOCKOPT_SNDBUF, SNET_HOST_SEND_BUFFER_SIZE);
 
-	if (address != NULL && snet_socket_get_address(host->socket, &host->address) < 0)
-		host->address = *address;
+		if (address != NULL && snet_socket_get_address(host->socket, &host->address) < 0)
+			host->address = *address;
+
+		snet_socket_transport(&host->socket, &host->transport);
+	}
 
 	if (!channelLimit || channelLimit > SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT)
 		channelLimit = SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT;
@@ -87,6 +159,8 @@ snet_host_create(const SNetAddress * address, size_t peerCount, size_t channelLi
 	host->commandCount = 0;
 	host->bufferCount = 0;
 	host->checksum = NULL;
+	host->checksumType = SNET_CHECKSUM_TYPE_NONE;
+	host->protocolFlags = SNET_PROTOCOL_CONNECT_FLAG_STREAMS;
 	host->receivedAddress.host = SNET_HOST_ANY;
 	host->receivedAddress.port = 0;
 	host->receivedData = NULL;
@@ -100,8 +174,19 @@ snet_host_create(const SNetAddress * address, size_t peerCount, size_t channelLi
 	host->connectedPeers = 0;
 	host->bandwidthLimitedPeers = 0;
 	host->duplicatePeers = SNET_PROTOCOL_MAXIMUM_PEER_ID;
+	host->connectCookies = 0;
+	host->sessionTickets = 0;
+	host->connectLimits = NULL;
+	host->droppedConnects = 0;
+	host->phaseHistograms = NULL;
+	host->peerHistograms = NULL;
+	host->freePeers = 0;
+	host->addressHashMask = addressHashSize - 1;
+	host->addressHashSeed = snet_host_random_seed() ^ host->randomSeed;
+	memset(host->addressCounts, 0, 2 * addressHashSize * sizeof(SNetAddressCount));
 	host->maximumPacketSize = SNET_HOST_DEFAULT_MAXIMUM_PACKET_SIZE;
 	host->maximumWaitingData = SNET_HOST_DEFAULT_MAXIMUM_WAITING_DATA;
+	host->maximumStreams = SNET_HOST_DEFAULT_MAXIMUM_STREAMS;
 
 	host->compressor.context = NULL;
 	host->compressor.compress = NULL;
@@ -109,8 +194,30 @@ snet_host_create(const SNetAddress * address, size_t peerCount, size_t channelLi
 	host->compressor.destroy = NULL;
 
 	host->intercept = NULL;
+	host->trace = NULL;
+	host->capture = NULL;
+	host->receiveBatch = NULL;
+	host->sendBatch = NULL;
+	host->clock = NULL;
+	host->clockContext = NULL;
 
 	snet_list_clear(&host->dispatchQueue);
+	snet_list_clear(&host->bandwidthClasses);
+
+	while (addressHashSize > 0)
+		snet_list_clear(&host->addressHash[--addressHashSize]);
+
+	if (transport != NULL)
+		host->transport = *transport;
+
+	/* pushed in reverse, so connects take the lowest free slot first */
+	for (currentPeer = &host->peers[host->peerCount];
+		currentPeer > host->peers;
+		--currentPeer)
+	{
+		currentPeer[-1].freePeerIndex = host->freePeers;
+		host->freePeerList[host->freePeers++] = currentPeer - 1;
+	}
 
 	for (currentPeer = host->peers;
 		currentPeer < &host->peers[host->peerCount];
@@ -145,7 +252,12 @@ snet_host_destroy(SNetHost * host)
 	if (host == NULL)
 		return;
 
-	snet_socket_destroy(host->socket);
+	snet_host_capture(host, NULL, 0);
+	snet_host_transport(host, NULL);
+	snet_host_free_batches(host);
+
+	if (host->socket != SNET_SOCKET_NULL)
+		snet_socket_destroy(host->socket);
 
 	for (currentPeer = host->peers;
 		currentPeer < &host->peers[host->peerCount];
@@ -157,6 +269,12 @@ snet_host_destroy(SNetHost * host)
 	if (host->compressor.context != NULL && host->compressor.destroy)
 		(*host->compressor.destroy) (host->compressor.context);
 
+	while (!snet_list_empty(&host->bandwidthClasses))
+		snet_free(snet_list_remove(snet_list_begin(&host->bandwidthClasses)));
+
+	snet_host_histograms(host, 0);
+
+	snet_host_free_peer_tables(host);
 	snet_free(host->peers);
 	snet_free(host);
 }
@@ -172,6 +290,28 @@ notifies of an SNET_EVENT_TYPE_CONNECT event for the peer.
 */
 SNetPeer *
 snet_host_connect(SNetHost * host, const SNetAddress * address, size_t channelCount, snet_uint32 data)
+{
+	return snet_host_resume(host, address, channelCount, data, NULL);
+}
+
+/** Initiates a connection to a foreign host, resuming an earlier session with it.
+
+The ticket carries the round trip time and packet throttle the earlier connection had settled
+on.  Both ends start from those instead of the defaults, so throughput recovers at once
+rather than after several seconds of measurement.  A ticket the foreign host does not accept,
+because it has expired, was issued to another IP address or was signed with another secret,
+leaves that end with the defaults; the connection itself succeeds either way.
+
+@param host host seeking the connection
+@param address destination for the connection, which need not be the address of the earlier session
+@param channelCount number of channels to allocate
+@param data user data supplied to the receiving host
+@param ticket ticket retrieved with snet_peer_session_ticket(), or NULL to connect afresh
+@returns a peer representing the foreign host on success, NULL on failure
+@sa snet_host_connect()
+*/
+SNetPeer *
+snet_host_resume(SNetHost * host, const SNetAddress * address, size_t channelCount, snet_uint32 data, const SNetSessionTicket * ticket)
 {
 	SNetPeer * currentPeer;
 	SNetChannel * channel;
@@ -183,24 +323,23 @@ snet_host_connect(SNetHost * host, const SNetAddress * address, size_t channelCo
 		if (channelCount > SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT)
 			channelCount = SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT;
 
-	for (currentPeer = host->peers;
-		currentPeer < &host->peers[host->peerCount];
-		++currentPeer)
-	{
-		if (currentPeer->state == SNET_PEER_STATE_DISCONNECTED)
-			break;
-	}
-
-	if (currentPeer >= &host->peers[host->peerCount])
+	if (host->freePeers == 0)
 		return NULL;
 
+	currentPeer = host->freePeerList[host->freePeers - 1];
+
 	currentPeer->channels = (SNetChannel *)snet_malloc(channelCount * sizeof(SNetChannel));
 	if (currentPeer->channels == NULL)
 		return NULL;
+	--host->freePeers;
 	currentPeer->channelCount = channelCount;
 	currentPeer->state = SNET_PEER_STATE_CONNECTING;
 	currentPeer->address = *address;
 	currentPeer->connectID = ++host->randomSeed;
+	currentPeer->checksumType = host->checksumType;
+	currentPeer->advertisedIncomingBandwidth = host->incomingBandwidth;
+	currentPeer->advertisedOutgoingBandwidth = host->outgoingBandwidth;
+	currentPeer->hasSessionTicket = 0;
 
 	if (host->outgoingBandwidth == 0)
 		currentPeer->windowSize = SNET_PROTOCOL_MAXIMUM_WINDOW_SIZE;
@@ -229,6 +368,9 @@ snet_host_connect(SNetHost * host, const SNetAddress * address, size_t channelCo
 
 		channel->usedReliableWindows = 0;
 		memset(channel->reliableWindows, 0, sizeof(channel->reliableWindows));
+
+		channel->outgoingQueuedData = 0;
+		channel->outgoingInFlightData = 0;
 	}
 
 	command.header.command = SNET_PROTOCOL_COMMAND_CONNECT | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
@@ -246,6 +388,17 @@ snet_host_connect(SNetHost * host, const SNetAddress * address, size_t channelCo
 	command.connect.packetThrottleDeceleration = SNET_HOST_TO_NET_32(currentPeer->packetThrottleDeceleration);
 	command.connect.connectID = currentPeer->connectID;
 	command.connect.data = SNET_HOST_TO_NET_32(data);
+	command.connect.checksumType = currentPeer->checksumType;
+	command.connect.flags = host->protocolFlags;
+	memset(command.connect.cookie, 0, sizeof(command.connect.cookie));
+	if (ticket != NULL)
+	{
+		command.connect.ticket = *ticket;
+
+		snet_peer_resume_session(currentPeer, ticket);
+	}
+	else
+		memset(&command.connect.ticket, 0, sizeof(command.connect.ticket));
 
 	snet_peer_queue_outgoing_command(currentPeer, &command, NULL, 0, 0);
 
@@ -260,16 +413,16 @@ snet_host_connect(SNetHost * host, const SNetAddress * address, size_t channelCo
 void
 snet_host_broadcast(SNetHost * host, snet_uint8 channelID, SNetPacket * packet)
 {
-	SNetPeer * currentPeer;
+	SNetPeer ** currentPeer;
 
-	for (currentPeer = host->peers;
-		currentPeer < &host->peers[host->peerCount];
+	for (currentPeer = host->connectedPeerList;
+		currentPeer < &host->connectedPeerList[host->connectedPeers];
 		++currentPeer)
 	{
-		if (currentPeer->state != SNET_PEER_STATE_CONNECTED)
+		if ((*currentPeer)->state != SNET_PEER_STATE_CONNECTED)
 			continue;
 
-		snet_peer_send(currentPeer, channelID, packet);
+		snet_peer_send(*currentPeer, channelID, packet);
 	}
 
 	if (packet->referenceCount == 0)
@@ -292,6 +445,50 @@ snet_host_compress(SNetHost * host, const SNetCompressor * compressor)
 		host->compressor.context = NULL;
 }
 
+/** Sets the built-in checksum the host should use to verify packets.
+@param host host to enable or disable checksums for
+@param type checksum algorithm; SNET_CHECKSUM_TYPE_NONE disables checksums
+@retval 0 on success
+@retval < 0 if the type is unknown
+@remarks Checksums change the packet header, so both sides must enable them before connecting.
+The connecting host offers its checksum type and the receiving host adopts it for that peer.
+*/
+int
+snet_host_checksum(SNetHost * host, SNetChecksumType type)
+{
+	SNetChecksumCallback checksum = snet_checksum_callback(type);
+
+	if (checksum == NULL && type != SNET_CHECKSUM_TYPE_NONE)
+		return -1;
+
+	host->checksum = checksum;
+	host->checksumType = type;
+
+	return 0;
+}
+
+/** Sets whether the host should time round trips to its peers in microseconds.
+
+Otherwise the sent time a packet carries for its acknowledgement to echo is the low 16 bits of
+the service time, so round trip times only come in whole milliseconds.  That is too coarse for
+the retransmission timeout and packet throttle on a LAN, where a round trip takes a fraction
+of one.  A peer whose host enabled this as well gets the whole sent time in microseconds, for
+four bytes more in each packet carrying it and two in each acknowledgement of one.
+
+@param host host to configure
+@param enable nonzero to offer and accept microsecond sent times, 0 to stop
+@remarks Only connections made afterwards are affected.  The connecting host offers microsecond
+sent times and the receiving host accepts them if it has enabled them too.
+*/
+void
+snet_host_precise_time(SNetHost * host, int enable)
+{
+	if (enable)
+		host->protocolFlags |= SNET_PROTOCOL_CONNECT_FLAG_PRECISE_TIME;
+	else
+		host->protocolFlags &= ~SNET_PROTOCOL_CONNECT_FLAG_PRECISE_TIME;
+}
+
 /** Limits the maximum allowed channels of future incoming connections.
 @param host host to limit
 @param channelLimit the maximum number of channels allowed; if 0, then this is equivalent to SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT
@@ -324,10 +521,101 @@ snet_host_bandwidth_limit(SNetHost * host, snet_uint32 incomingBandwidth, snet_u
 	host->recalculateBandwidthLimits = 1;
 }
 
+/** Limits the aggregate rate at which the host sends datagrams to all of its peers.
+@param host host to limit
+@param rate sustained rate in bytes/second; 0 removes the limit
+@param burst bytes that may be sent back to back after the host has been idle; defaults to the host's MTU if 0
+@remarks Unlike the outgoing bandwidth given to snet_host_create(), which adjusts the packet
+throttle once per SNET_HOST_BANDWIDTH_THROTTLE_INTERVAL, this limit is enforced per datagram
+so bursts are spread out within milliseconds.  Acknowledgements are never held back.
+*/
+void
+snet_host_rate_limit(SNetHost * host, snet_uint32 rate, snet_uint32 burst)
+{
+	snet_token_bucket_configure(&host->tokenBucket, rate, burst ? burst : host->mtu, snet_host_time(host));
+}
+
+void
+snet_token_bucket_configure(SNetTokenBucket * bucket, snet_uint32 rate, snet_uint32 burst, snet_uint32 currentTime)
+{
+	bucket->rate = rate;
+	bucket->burst = burst;
+	bucket->tokens = (int)burst;
+	bucket->lastRefillTime = currentTime;
+}
+
+void
+snet_token_bucket_refill(SNetTokenBucket * bucket, snet_uint32 currentTime)
+{
+	unsigned long long refill;
+
+	if (bucket->rate == 0 || bucket->tokens >= (int)bucket->burst)
+	{
+		bucket->lastRefillTime = currentTime;
+		return;
+	}
+
+	refill = ((unsigned long long)bucket->rate * SNET_TIME_DIFFERENCE(currentTime, bucket->lastRefillTime)) / 1000;
+
+	/* leave the clock alone until a whole byte has accrued, so slow rates still make progress */
+	if (refill == 0)
+		return;
+
+	bucket->lastRefillTime = currentTime;
+
+	if (refill >= (unsigned long long)((long long)bucket->burst - bucket->tokens))
+		bucket->tokens = (int)bucket->burst;
+	else
+		bucket->tokens += (int)refill;
+}
+
+/** Returns the number of milliseconds until the bucket holds tokens again, or 0 if it does now. */
+snet_uint32
+snet_token_bucket_delay(const SNetTokenBucket * bucket)
+{
+	if (bucket->rate == 0 || bucket->tokens > 0)
+		return 0;
+
+	return (snet_uint32)(((unsigned long long)(1 - (long long)bucket->tokens) * 1000 + bucket->rate - 1) / bucket->rate);
+}
+
+/* Connected peers with an incoming bandwidth limit and pending data come first, ordered by the
+   fraction of their pending data their limit lets through, so the peers the throttle would
+   clamp always form a prefix. */
+static int
+snet_host_compare_outgoing_demand(const void * left, const void * right)
+{
+	const SNetPeer * leftPeer = *(SNetPeer * const *)left,
+		*rightPeer = *(SNetPeer * const *)right;
+	int leftLimited = leftPeer->incomingBandwidth != 0 && leftPeer->outgoingDataTotal != 0,
+		rightLimited = rightPeer->incomingBandwidth != 0 && rightPeer->outgoingDataTotal != 0;
+	unsigned long long leftShare, rightShare;
+
+	if (leftLimited != rightLimited)
+		return leftLimited ? -1 : 1;
+	if (!leftLimited)
+		return 0;
+
+	leftShare = (unsigned long long)leftPeer->incomingBandwidth * rightPeer->outgoingDataTotal;
+	rightShare = (unsigned long long)rightPeer->incomingBandwidth * leftPeer->outgoingDataTotal;
+
+	return leftShare < rightShare ? -1 : (leftShare > rightShare ? 1 : 0);
+}
+
+/* Peers that advertise no outgoing bandwidth sort first, as they never receive a fair share. */
+static int
+snet_host_compare_incoming_demand(const void * left, const void * right)
+{
+	snet_uint32 leftBandwidth = (*(SNetPeer * const *)left)->outgoingBandwidth,
+		rightBandwidth = (*(SNetPeer * const *)right)->outgoingBandwidth;
+
+	return leftBandwidth < rightBandwidth ? -1 : (leftBandwidth > rightBandwidth ? 1 : 0);
+}
+
 void
 snet_host_bandwidth_throttle(SNetHost * host)
 {
-	snet_uint32 timeCurrent = snet_time_get(),
+	snet_uint32 timeCurrent = snet_host_time(host),
 		elapsedTime = timeCurrent - host->bandwidthThrottleEpoch,
 		peersRemaining = (snet_uint32)host->connectedPeers,
 		dataTotal = ~0,
@@ -335,6 +623,9 @@ snet_host_bandwidth_throttle(SNetHost * host)
 		throttle = 0,
 		bandwidthLimit = 0;
 	int needsAdjustment = host->bandwidthLimitedPeers > 0 ? 1 : 0;
+	SNetPeer ** peers = host->connectedPeerList,
+		** peersEnd = &host->connectedPeerList[host->connectedPeers],
+		** currentPeer;
 	SNetPeer * peer;
 	SNetProtocol command;
 
@@ -351,17 +642,15 @@ snet_host_bandwidth_throttle(SNetHost * host)
 		dataTotal = 0;
 		bandwidth = (host->outgoingBandwidth * elapsedTime) / 1000;
 
-		for (peer = host->peers;
-			peer < &host->peers[host->peerCount];
-			++peer)
-		{
-			if (peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER)
-				continue;
-
-			dataTotal += peer->outgoingDataTotal;
-		}
+		for (currentPeer = peers; currentPeer < peersEnd; ++currentPeer)
+			dataTotal += (*currentPeer)->outgoingDataTotal;
 	}
 
+	if (needsAdjustment != 0)
+		qsort(peers, host->connectedPeers, sizeof(SNetPeer *), snet_host_compare_outgoing_demand);
+
+	currentPeer = peers;
+
 	while (peersRemaining > 0 && needsAdjustment != 0)
 	{
 		needsAdjustment = 0;
@@ -371,20 +660,17 @@ snet_host_bandwidth_throttle(SNetHost * host)
 		else
 			throttle = (bandwidth * SNET_PEER_PACKET_THROTTLE_SCALE) / dataTotal;
 
-		for (peer = host->peers;
-			peer < &host->peers[host->peerCount];
-			++peer)
+		for (; currentPeer < peersEnd; ++currentPeer)
 		{
 			snet_uint32 peerBandwidth;
 
-			if ((peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER) ||
-				peer->incomingBandwidth == 0 ||
-				peer->outgoingBandwidthThrottleEpoch == timeCurrent)
-				continue;
+			peer = *currentPeer;
+			if (peer->incomingBandwidth == 0 || peer->outgoingDataTotal == 0)
+				break;
 
 			peerBandwidth = (peer->incomingBandwidth * elapsedTime) / 1000;
 			if ((throttle * peer->outgoingDataTotal) / SNET_PEER_PACKET_THROTTLE_SCALE <= peerBandwidth)
-				continue;
+				break;
 
 			peer->packetThrottleLimit = (peerBandwidth *
 				SNET_PEER_PACKET_THROTTLE_SCALE) / peer->outgoingDataTotal;
@@ -414,13 +700,9 @@ snet_host_bandwidth_throttle(SNetHost * host)
 		else
 			throttle = (bandwidth * SNET_PEER_PACKET_THROTTLE_SCALE) / dataTotal;
 
-		for (peer = host->peers;
-			peer < &host->peers[host->peerCount];
-			++peer)
+		for (; currentPeer < peersEnd; ++currentPeer)
 		{
-			if ((peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER) ||
-				peer->outgoingBandwidthThrottleEpoch == timeCurrent)
-				continue;
+			peer = *currentPeer;
 
 			peer->packetThrottleLimit = throttle;
 
@@ -443,22 +725,23 @@ snet_host_bandwidth_throttle(SNetHost * host)
 		if (bandwidth == 0)
 			bandwidthLimit = 0;
 		else
+		{
+			qsort(peers, host->connectedPeers, sizeof(SNetPeer *), snet_host_compare_incoming_demand);
+
+			currentPeer = peers;
+
 			while (peersRemaining > 0 && needsAdjustment != 0)
 			{
 				needsAdjustment = 0;
 				bandwidthLimit = bandwidth / peersRemaining;
 
-				for (peer = host->peers;
-					peer < &host->peers[host->peerCount];
-					++peer)
+				for (; currentPeer < peersEnd; ++currentPeer)
 				{
-					if ((peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER) ||
-						peer->incomingBandwidthThrottleEpoch == timeCurrent)
-						continue;
+					peer = *currentPeer;
 
 					if (peer->outgoingBandwidth > 0 &&
 						peer->outgoingBandwidth >= bandwidthLimit)
-						continue;
+						break;
 
 					peer->incomingBandwidthThrottleEpoch = timeCurrent;
 
@@ -467,26 +750,259 @@ snet_host_bandwidth_throttle(SNetHost * host)
 					bandwidth -= peer->outgoingBandwidth;
 				}
 			}
+		}
 
-		for (peer = host->peers;
-			peer < &host->peers[host->peerCount];
-			++peer)
+		for (currentPeer = peers; currentPeer < peersEnd; ++currentPeer)
 		{
-			if (peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER)
+			snet_uint32 incomingBandwidth;
+
+			peer = *currentPeer;
+
+			if (peer->incomingBandwidthThrottleEpoch == timeCurrent)
+				incomingBandwidth = peer->outgoingBandwidth;
+			else
+				incomingBandwidth = bandwidthLimit;
+
+			if (incomingBandwidth == peer->advertisedIncomingBandwidth &&
+				host->outgoingBandwidth == peer->advertisedOutgoingBandwidth)
 				continue;
 
 			command.header.command = SNET_PROTOCOL_COMMAND_BANDWIDTH_LIMIT | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
 			command.header.channelID = 0xFF;
 			command.bandwidthLimit.outgoingBandwidth = SNET_HOST_TO_NET_32(host->outgoingBandwidth);
-
-			if (peer->incomingBandwidthThrottleEpoch == timeCurrent)
-				command.bandwidthLimit.incomingBandwidth = SNET_HOST_TO_NET_32(peer->outgoingBandwidth);
-			else
-				command.bandwidthLimit.incomingBandwidth = SNET_HOST_TO_NET_32(bandwidthLimit);
+			command.bandwidthLimit.incomingBandwidth = SNET_HOST_TO_NET_32(incomingBandwidth);
 
 			snet_peer_queue_outgoing_command(peer, &command, NULL, 0, 0);
+
+			peer->advertisedIncomingBandwidth = incomingBandwidth;
+			peer->advertisedOutgoingBandwidth = host->outgoingBandwidth;
+		}
+	}
+
+	for (currentPeer = peers; currentPeer < peersEnd; ++currentPeer)
+		(*currentPeer)->connectedPeerIndex = currentPeer - peers;
+}
+
+/** Mixes a value into a hash, seeded per host so that remote peers cannot pick colliding keys. */
+snet_uint32
+snet_host_hash(snet_uint32 hash, snet_uint32 value)
+{
+	hash ^= value * 0xCC9E2D51;
+	hash = (hash << 13) | (hash >> 19);
+	hash = hash * 5 + 0xE6546B64;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+
+	return hash;
+}
+
+static SNetList *
+snet_host_address_bucket(SNetHost * host, const SNetAddress * address, snet_uint32 connectID)
+{
+	snet_uint32 hash = snet_host_hash(host->addressHashSeed, address->host);
+
+	hash = snet_host_hash(hash, address->port);
+	hash = snet_host_hash(hash, connectID);
+
+	return &host->addressHash[hash & host->addressHashMask];
+}
+
+static SNetAddressCount *
+snet_host_address_count_entry(SNetHost * host, snet_uint32 address)
+{
+	size_t mask = 2 * host->addressHashMask + 1,
+		index = snet_host_hash(host->addressHashSeed, address) & mask;
+
+	/* at most peerCount addresses are in use, so the table is never more than half full */
+	while (host->addressCounts[index].count != 0 && host->addressCounts[index].host != address)
+		index = (index + 1) & mask;
+
+	return &host->addressCounts[index];
+}
+
+/** Registers a peer under its address and connect ID, and counts it against its IP address.
+@remarks Called once the peer's address and connect ID are final, when a connect is accepted or verified.
+*/
+void
+snet_host_address_insert(SNetHost * host, SNetPeer * peer)
+{
+	SNetAddressCount * entry;
+
+	if (peer->addressList.next != NULL)
+		return;
+
+	snet_list_insert(snet_list_end(snet_host_address_bucket(host, &peer->address, peer->connectID)), &peer->addressList);
+
+	entry = snet_host_address_count_entry(host, peer->address.host);
+	entry->host = peer->address.host;
+	++entry->count;
+}
+
+/** Unregisters a peer inserted by snet_host_address_insert(); does nothing if it is not registered. */
+void
+snet_host_address_remove(SNetHost * host, SNetPeer * peer)
+{
+	SNetAddressCount * entry;
+	size_t mask, index, next, home;
+
+	if (peer->addressList.next == NULL)
+		return;
+
+	snet_list_remove(&peer->addressList);
+	peer->addressList.next = NULL;
+
+	entry = snet_host_address_count_entry(host, peer->address.host);
+	if (--entry->count > 0)
+		return;
+
+	/* backward shift deletion, so probe sequences never run into a hole */
+	mask = 2 * host->addressHashMask + 1;
+	index = entry - host->addressCounts;
+	for (next = (index + 1) & mask;
+		host->addressCounts[next].count != 0;
+		next = (next + 1) & mask)
+	{
+		home = snet_host_hash(host->addressHashSeed, host->addressCounts[next].host) & mask;
+		if (((next - home) & mask) >= ((next - index) & mask))
+		{
+			host->addressCounts[index] = host->addressCounts[next];
+			host->addressCounts[next].count = 0;
+			index = next;
 		}
 	}
 }
 
+/** Looks up the registered peer with the given address and connect ID.
+@returns the peer, or NULL if there is none
+*/
+SNetPeer *
+snet_host_address_lookup(SNetHost * host, const SNetAddress * address, snet_uint32 connectID)
+{
+	SNetList * bucket = snet_host_address_bucket(host, address, connectID);
+	SNetListIterator currentNode;
+
+	for (currentNode = snet_list_begin(bucket);
+		currentNode != snet_list_end(bucket);
+		currentNode = snet_list_next(currentNode))
+	{
+		SNetPeer * peer = (SNetPeer *)((snet_uint8 *)currentNode - offsetof(SNetPeer, addressList));
+
+		if (peer->address.host == address->host &&
+			peer->address.port == address->port &&
+			peer->connectID == connectID)
+			return peer;
+	}
+
+	return NULL;
+}
+
+/** Returns the number of registered peers using the given IP address. */
+size_t
+snet_host_address_count(SNetHost * host, snet_uint32 address)
+{
+	SNetAddressCount * entry = snet_host_address_count_entry(host, address);
+
+	return entry->count;
+}
+
+/** Limits the rate of connect attempts accepted from each IP address.
+
+Attempts are counted in a fixed table of token buckets, 2 rows of SNET_HOST_CONNECT_LIMIT_WIDTH,
+indexed by independent hashes of the source address.  An attempt is allowed only if both of
+its buckets have a token left, as in a count-min sketch, so addresses that collide with a
+flooding one in a single row are still let through.  Dropped attempts cost one table lookup
+and are counted in droppedConnects.  The check happens before connect cookies are answered
+and before any peer is allocated.
+
+@param host host to limit
+@param rate sustained connect attempts per second and address; 0 removes the limit
+@param burst attempts an address may make back to back; defaults to rate if 0
+@retval 0 on success
+@retval < 0 if the table could not be allocated
+@remarks Retransmitted connects count as attempts, and a cookie handshake takes two.
+*/
+int
+snet_host_connect_rate_limit(SNetHost * host, snet_uint32 rate, snet_uint32 burst)
+{
+	size_t i;
+
+	if (rate == 0)
+	{
+		if (host->connectLimits != NULL)
+		{
+			snet_free(host->connectLimits);
+			host->connectLimits = NULL;
+		}
+
+		return 0;
+	}
+
+	if (host->connectLimits == NULL)
+	{
+		host->connectLimits = (SNetConnectLimit *)snet_malloc(2 * SNET_HOST_CONNECT_LIMIT_WIDTH * sizeof(SNetConnectLimit));
+		if (host->connectLimits == NULL)
+			return -1;
+	}
+
+	if (burst == 0)
+		burst = rate;
+
+	host->connectLimitRate = rate;
+	host->connectLimitBurst = burst;
+
+	for (i = 0; i < 2 * SNET_HOST_CONNECT_LIMIT_WIDTH; ++i)
+	{
+		host->connectLimits[i].tokens = burst * 1000;
+		host->connectLimits[i].lastRefillTime = host->serviceTime;
+	}
+
+	return 0;
+}
+
+static SNetConnectLimit *
+snet_host_connect_limit_refill(SNetHost * host, SNetConnectLimit * limit)
+{
+	snet_uint32 capacity = host->connectLimitBurst * 1000,
+		elapsed = SNET_TIME_DIFFERENCE(host->serviceTime, limit->lastRefillTime);
+
+	limit->lastRefillTime = host->serviceTime;
+
+	if (elapsed > capacity / host->connectLimitRate)
+		limit->tokens = capacity;
+	else
+		limit->tokens = SNET_MIN(limit->tokens + elapsed * host->connectLimitRate, capacity);
+
+	return limit;
+}
+
+/** Charges a connect attempt from the given IP address against the connect rate limiter.
+@returns non-zero if the attempt may proceed, 0 if it was dropped
+*/
+int
+snet_host_connect_allowed(SNetHost * host, snet_uint32 address)
+{
+	SNetConnectLimit * first, * second;
+
+	if (host->connectLimits == NULL)
+		return 1;
+
+	first = snet_host_connect_limit_refill(host,
+		&host->connectLimits[snet_host_hash(host->addressHashSeed, address) % SNET_HOST_CONNECT_LIMIT_WIDTH]);
+	second = snet_host_connect_limit_refill(host,
+		&host->connectLimits[SNET_HOST_CONNECT_LIMIT_WIDTH + snet_host_hash(~host->addressHashSeed, address) % SNET_HOST_CONNECT_LIMIT_WIDTH]);
+
+	if (first->tokens < 1000 || second->tokens < 1000)
+	{
+		++host->droppedConnects;
+
+		return 0;
+	}
+
+	first->tokens -= 1000;
+	second->tokens -= 1000;
+
+	return 1;
+}
+
 /** @} */
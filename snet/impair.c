@@ -0,0 +1,490 @@
+/**
+@file  impair.c
+@brief SNet network impairment emulator
+*/
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+#include "snet/time.h"
+
+/** @defgroup impair SNet impairment functions
+@{
+*/
+
+enum
+{
+	SNET_IMPAIR_OUTGOING = 0,
+	SNET_IMPAIR_INCOMING = 1,
+	SNET_IMPAIR_CHANCE_SCALE = 1000000
+};
+
+typedef struct _SNetImpairedDatagram
+{
+	SNetListNode node;
+	snet_uint32  deliveryTime;
+	SNetAddress  address;
+	size_t       dataLength;
+} SNetImpairedDatagram;
+
+typedef struct _SNetImpairedLink
+{
+	SNetImpairment impairment;
+	int            enabled;
+	SNetList       datagrams;          /* in order of delivery time */
+	size_t         backlog;            /* bytes still being serialized onto the link */
+	snet_uint32    backlogTime;
+} SNetImpairedLink;
+
+typedef struct _SNetImpairer
+{
+	SNetHost *       host;
+	SNetTransport    transport;         /* the transport being impaired */
+	SNetImpairedLink links[2];
+	snet_uint32      randomState;
+	snet_uint8       receiveData[SNET_PROTOCOL_MAXIMUM_MTU];
+} SNetImpairer;
+
+static snet_uint32
+snet_impairer_random(SNetImpairer * impairer)
+{
+	snet_uint32 state = impairer->randomState;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	impairer->randomState = state;
+
+	return state;
+}
+
+static int
+snet_impairer_chance(SNetImpairer * impairer, snet_uint32 chance)
+{
+	return chance != 0 && snet_impairer_random(impairer) % SNET_IMPAIR_CHANCE_SCALE < chance;
+}
+
+static int
+snet_impairer_forward(SNetImpairer * impairer, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	return impairer->transport.send(impairer->transport.context, address, buffers, bufferCount);
+}
+
+static int
+snet_impairer_fetch(SNetImpairer * impairer, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount)
+{
+	return impairer->transport.receive(impairer->transport.context, address, buffers, bufferCount);
+}
+
+/* applies a link's impairments to a datagram, queueing whatever copies of it survive */
+static void
+snet_impairer_enqueue(SNetImpairer * impairer, SNetImpairedLink * link, snet_uint32 currentTime, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount, size_t dataLength)
+{
+	const SNetImpairment * impairment = &link->impairment;
+	int copies = 1;
+
+	if (snet_impairer_chance(impairer, impairment->loss))
+		return;
+
+	if (impairment->bandwidth != 0)
+	{
+		unsigned long long drained = (unsigned long long)SNET_TIME_DIFFERENCE(currentTime, link->backlogTime) * impairment->bandwidth / 1000;
+
+		/* the time is only taken up once whole bytes have drained, so slow links still drain between frequent sends */
+		if (drained > 0 || link->backlog == 0)
+		{
+			link->backlog = drained >= link->backlog ? 0 : link->backlog - (size_t)drained;
+			link->backlogTime = currentTime;
+		}
+
+		if (impairment->queueLimit != 0 && link->backlog + dataLength > impairment->queueLimit)
+			return;
+
+		link->backlog += dataLength;
+	}
+
+	if (snet_impairer_chance(impairer, impairment->duplicate))
+		copies = 2;
+
+	while (copies-- > 0)
+	{
+		SNetImpairedDatagram * datagram = (SNetImpairedDatagram *)snet_malloc(sizeof(SNetImpairedDatagram) + dataLength);
+		snet_uint8 * data = (snet_uint8 *)(datagram + 1);
+		snet_uint32 delay = 0;
+		SNetListIterator position;
+		size_t i;
+
+		if (datagram == NULL)
+			return;
+
+		if (impairment->bandwidth != 0)
+			delay = (snet_uint32)(((unsigned long long)link->backlog * 1000 + impairment->bandwidth - 1) / impairment->bandwidth);
+
+		if (!snet_impairer_chance(impairer, impairment->reorder))
+		{
+			delay += impairment->delay;
+
+			if (impairment->jitter != 0)
+			{
+				snet_uint32 offset = snet_impairer_random(impairer) % (2 * impairment->jitter + 1);
+
+				delay = delay + offset >= impairment->jitter ? delay + offset - impairment->jitter : 0;
+			}
+		}
+
+		datagram->deliveryTime = currentTime + delay;
+		datagram->address = *address;
+		datagram->dataLength = dataLength;
+
+		for (i = 0; i < bufferCount; ++i)
+		{
+			memcpy(data, buffers[i].data, buffers[i].dataLength);
+			data += buffers[i].dataLength;
+		}
+
+		for (position = snet_list_end(&link->datagrams);
+			position != snet_list_begin(&link->datagrams);
+			position = snet_list_previous(position))
+		{
+			if (!SNET_TIME_GREATER(((SNetImpairedDatagram *)snet_list_previous(position))->deliveryTime, datagram->deliveryTime))
+				break;
+		}
+
+		snet_list_insert(position, datagram);
+	}
+}
+
+/* returns the first datagram of a link if it is due */
+static SNetImpairedDatagram *
+snet_impairer_due(SNetImpairedLink * link, snet_uint32 currentTime)
+{
+	SNetImpairedDatagram * datagram;
+
+	if (snet_list_empty(&link->datagrams))
+		return NULL;
+
+	datagram = (SNetImpairedDatagram *)snet_list_front(&link->datagrams);
+
+	return SNET_TIME_LESS_EQUAL(datagram->deliveryTime, currentTime) ? datagram : NULL;
+}
+
+static int
+snet_impairer_flush(SNetImpairer * impairer, snet_uint32 currentTime)
+{
+	SNetImpairedDatagram * datagram;
+
+	while ((datagram = snet_impairer_due(&impairer->links[SNET_IMPAIR_OUTGOING], currentTime)) != NULL)
+	{
+		SNetBuffer buffer;
+		int sentLength;
+
+		buffer.data = datagram + 1;
+		buffer.dataLength = datagram->dataLength;
+
+		sentLength = snet_impairer_forward(impairer, &datagram->address, &buffer, 1);
+		if (sentLength == 0)
+			break;
+
+		snet_list_remove(&datagram->node);
+		snet_free(datagram);
+
+		if (sentLength < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* moves every datagram waiting on the impaired transport into the incoming link */
+static int
+snet_impairer_poll(SNetImpairer * impairer, snet_uint32 currentTime)
+{
+	for (;;)
+	{
+		SNetAddress address;
+		SNetBuffer buffer;
+		int receivedLength;
+
+		buffer.data = impairer->receiveData;
+		buffer.dataLength = sizeof(impairer->receiveData);
+
+		receivedLength = snet_impairer_fetch(impairer, &address, &buffer, 1);
+		if (receivedLength <= 0)
+			return receivedLength;
+
+		buffer.dataLength = receivedLength;
+
+		snet_impairer_enqueue(impairer, &impairer->links[SNET_IMPAIR_INCOMING], currentTime, &address, &buffer, 1, receivedLength);
+	}
+}
+
+static int SNET_CALLBACK
+snet_impairer_send(void * context, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetImpairer * impairer = (SNetImpairer *)context;
+	snet_uint32 currentTime = snet_host_time(impairer->host);
+	size_t dataLength = 0, i;
+
+	if (!impairer->links[SNET_IMPAIR_OUTGOING].enabled)
+		return snet_impairer_forward(impairer, address, buffers, bufferCount);
+
+	for (i = 0; i < bufferCount; ++i)
+		dataLength += buffers[i].dataLength;
+
+	snet_impairer_enqueue(impairer, &impairer->links[SNET_IMPAIR_OUTGOING], currentTime, address, buffers, bufferCount, dataLength);
+
+	if (snet_impairer_flush(impairer, currentTime) < 0)
+		return -1;
+
+	return (int)dataLength;
+}
+
+static int SNET_CALLBACK
+snet_impairer_receive(void * context, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetImpairer * impairer = (SNetImpairer *)context;
+	SNetImpairedLink * link = &impairer->links[SNET_IMPAIR_INCOMING];
+	snet_uint32 currentTime = snet_host_time(impairer->host);
+	SNetImpairedDatagram * datagram;
+	int receivedLength;
+
+	if (snet_impairer_flush(impairer, currentTime) < 0)
+		return -1;
+
+	if (!link->enabled && snet_list_empty(&link->datagrams))
+		return snet_impairer_fetch(impairer, address, buffers, bufferCount);
+
+	if (link->enabled && snet_impairer_poll(impairer, currentTime) < 0)
+		return -1;
+
+	datagram = snet_impairer_due(link, currentTime);
+	if (datagram == NULL)
+		return 0;
+
+	snet_list_remove(&datagram->node);
+
+	if (datagram->dataLength <= buffers[0].dataLength)
+	{
+		memcpy(buffers[0].data, datagram + 1, datagram->dataLength);
+		*address = datagram->address;
+		receivedLength = (int)datagram->dataLength;
+	}
+	else
+		receivedLength = 0;
+
+	snet_free(datagram);
+
+	return receivedLength;
+}
+
+/* waits on the impaired transport, but wakes to send delayed datagrams and to deliver delayed ones as they fall due */
+static int SNET_CALLBACK
+snet_impairer_wait(void * context, snet_uint32 * condition, snet_uint32 timeout)
+{
+	SNetImpairer * impairer = (SNetImpairer *)context;
+	SNetImpairedLink * incoming = &impairer->links[SNET_IMPAIR_INCOMING];
+	snet_uint32 currentTime = snet_host_time(impairer->host),
+		deadline = currentTime + timeout,
+		wanted = *condition;
+
+	for (;;)
+	{
+		snet_uint32 waitCondition = wanted, waitTime = SNET_TIME_DIFFERENCE(deadline, currentTime);
+		size_t i;
+
+		if (snet_impairer_flush(impairer, currentTime) < 0)
+			return -1;
+
+		if ((wanted & SNET_SOCKET_WAIT_RECEIVE) && snet_impairer_due(incoming, currentTime) != NULL)
+		{
+			*condition = SNET_SOCKET_WAIT_RECEIVE;
+
+			return 0;
+		}
+
+		for (i = 0; i < 2; ++i)
+		{
+			SNetImpairedLink * link = &impairer->links[i];
+
+			if (!snet_list_empty(&link->datagrams))
+			{
+				snet_uint32 deliveryTime = ((SNetImpairedDatagram *)snet_list_front(&link->datagrams))->deliveryTime;
+
+				if (SNET_TIME_DIFFERENCE(deliveryTime, currentTime) < waitTime)
+					waitTime = SNET_TIME_DIFFERENCE(deliveryTime, currentTime);
+			}
+		}
+
+		if (impairer->transport.wait == NULL)
+			waitCondition = SNET_SOCKET_WAIT_NONE;
+		else
+			if (impairer->transport.wait(impairer->transport.context, &waitCondition, waitTime) != 0)
+				return -1;
+
+		if (waitCondition & SNET_SOCKET_WAIT_INTERRUPT)
+		{
+			*condition = SNET_SOCKET_WAIT_INTERRUPT;
+
+			return 0;
+		}
+
+		if ((waitCondition & SNET_SOCKET_WAIT_SEND) ||
+			((waitCondition & SNET_SOCKET_WAIT_RECEIVE) && !incoming->enabled))
+		{
+			*condition = waitCondition;
+
+			return 0;
+		}
+
+		currentTime = snet_host_time(impairer->host);
+
+		if ((waitCondition & SNET_SOCKET_WAIT_RECEIVE) && snet_impairer_poll(impairer, currentTime) < 0)
+			return -1;
+
+		/* a transport that cannot wait leaves the clock to its owner */
+		if (!SNET_TIME_LESS(currentTime, deadline) || impairer->transport.wait == NULL)
+		{
+			*condition = (wanted & SNET_SOCKET_WAIT_RECEIVE) && snet_impairer_due(incoming, currentTime) != NULL ?
+				SNET_SOCKET_WAIT_RECEIVE : SNET_SOCKET_WAIT_NONE;
+
+			return 0;
+		}
+	}
+}
+
+static void
+snet_impairer_clear(SNetImpairedLink * link)
+{
+	while (!snet_list_empty(&link->datagrams))
+		snet_free(snet_list_remove(snet_list_begin(&link->datagrams)));
+
+	link->backlog = 0;
+}
+
+static void SNET_CALLBACK
+snet_impairer_destroy(void * context)
+{
+	SNetImpairer * impairer = (SNetImpairer *)context;
+
+	snet_impairer_clear(&impairer->links[SNET_IMPAIR_OUTGOING]);
+	snet_impairer_clear(&impairer->links[SNET_IMPAIR_INCOMING]);
+
+	if (impairer->transport.destroy != NULL)
+		(*impairer->transport.destroy) (impairer->transport.context);
+
+	snet_free(impairer);
+}
+
+/** Emulates an impaired network between a host and its socket or transport.
+
+Datagrams the host sends and receives pass through queues that drop, duplicate, delay and
+reorder them and limit them to a link rate, as netem does, but within the process and on the
+host's clock, so a virtual clock also drives the emulator.  Each direction has its own
+settings, and all randomness comes from seed, so a run on a virtual clock can be repeated
+exactly.
+
+@param host host to impair
+@param outgoing conditions for the datagrams the host sends, or NULL to send them untouched
+@param incoming conditions for the datagrams the host receives, or NULL to receive them untouched
+@param seed seed for the emulator's random choices
+@retval 0 on success
+@retval < 0 if the emulator could not be allocated
+@remarks Wraps whatever transport the host has when first called, so set any transport of your
+own first.  Calling it again changes the settings and reseeds the emulator, keeping the datagrams
+it holds.  With both directions NULL, the emulator is removed, dropping any datagrams it holds,
+and the host goes back to the transport it wrapped.
+*/
+int
+snet_host_impair(SNetHost * host, const SNetImpairment * outgoing, const SNetImpairment * incoming, snet_uint32 seed)
+{
+	SNetImpairer * impairer = host->transport.send == snet_impairer_send ? (SNetImpairer *)host->transport.context : NULL;
+	SNetTransport transport;
+
+	if (outgoing == NULL && incoming == NULL)
+	{
+		if (impairer != NULL)
+		{
+			transport = impairer->transport;
+			impairer->transport.destroy = NULL;
+
+			snet_host_transport(host, &transport);
+		}
+
+		return 0;
+	}
+
+	if (impairer == NULL)
+	{
+		impairer = (SNetImpairer *)snet_malloc(sizeof(SNetImpairer));
+		if (impairer == NULL)
+			return -1;
+
+		memset(impairer, 0, sizeof(SNetImpairer));
+
+		impairer->host = host;
+		impairer->transport = host->transport;
+		snet_list_clear(&impairer->links[SNET_IMPAIR_OUTGOING].datagrams);
+		snet_list_clear(&impairer->links[SNET_IMPAIR_INCOMING].datagrams);
+
+		/* the impairer now owns the transport it wraps */
+		host->transport.destroy = NULL;
+
+		memset(&transport, 0, sizeof(SNetTransport));
+		transport.context = impairer;
+		transport.send = snet_impairer_send;
+		transport.receive = snet_impairer_receive;
+		transport.wait = snet_impairer_wait;
+		transport.destroy = snet_impairer_destroy;
+
+		snet_host_transport(host, &transport);
+	}
+
+	impairer->links[SNET_IMPAIR_OUTGOING].enabled = outgoing != NULL;
+	if (outgoing != NULL)
+		impairer->links[SNET_IMPAIR_OUTGOING].impairment = *outgoing;
+
+	impairer->links[SNET_IMPAIR_INCOMING].enabled = incoming != NULL;
+	if (incoming != NULL)
+		impairer->links[SNET_IMPAIR_INCOMING].impairment = *incoming;
+
+	impairer->randomState = seed != 0 ? seed : 0x9E3779B9;
+
+	return 0;
+}
+
+/** Finds when the host's impairment emulator next has a datagram to send or deliver.
+@param host host to check
+@param deliveryTime set to the earliest delivery time among the datagrams the emulator holds
+@returns 1 if the emulator holds a datagram, 0 if it holds none or the host is not impaired
+*/
+int
+snet_host_impairment_due(SNetHost * host, snet_uint32 * deliveryTime)
+{
+	SNetImpairer * impairer;
+	int found = 0;
+	size_t i;
+
+	if (host->transport.send != snet_impairer_send)
+		return 0;
+
+	impairer = (SNetImpairer *)host->transport.context;
+
+	for (i = 0; i < 2; ++i)
+	{
+		SNetImpairedLink * link = &impairer->links[i];
+		snet_uint32 frontTime;
+
+		if (snet_list_empty(&link->datagrams))
+			continue;
+
+		frontTime = ((SNetImpairedDatagram *)snet_list_front(&link->datagrams))->deliveryTime;
+		if (!found || SNET_TIME_LESS(frontTime, *deliveryTime))
+			*deliveryTime = frontTime;
+
+		found = 1;
+	}
+
+	return found;
+}
+
+/** @} */
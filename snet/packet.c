@@ -98,68 +98,4 @@ snet_packet_resize(SNetPacket * packet, size_t dataLength)
 	return 0;
 }
 
-static int initializedCRC32 = 0;
-static snet_uint32 crcTable[256];
-
-static snet_uint32
-reflect_crc(int val, int bits)
-{
-	int result = 0, bit;
-
-	for (bit = 0; bit < bits; bit++)
-	{
-		if (val & 1) result |= 1 << (bits - 1 - bit);
-		val >>= 1;
-	}
-
-	return result;
-}
-
-static void
-initialize_crc32(void)
-{
-	int byte;
-
-	for (byte = 0; byte < 256; ++byte)
-	{
-		snet_uint32 crc = reflect_crc(byte, 8) << 24;
-		int offset;
-
-		for (offset = 0; offset < 8; ++offset)
-		{
-			if (crc & 0x80000000)
-				crc = (crc << 1) ^ 0x04c11db7;
-			else
-				crc <<= 1;
-		}
-
-		crcTable[byte] = reflect_crc(crc, 32);
-	}
-
-	initializedCRC32 = 1;
-}
-
-snet_uint32
-snet_crc32(const SNetBuffer * buffers, size_t bufferCount)
-{
-	snet_uint32 crc = 0xFFFFFFFF;
-
-	if (!initializedCRC32) initialize_crc32();
-
-	while (bufferCount-- > 0)
-	{
-		const snet_uint8 * data = (const snet_uint8 *)buffers->data,
-			*dataEnd = &data[buffers->dataLength];
-
-		while (data < dataEnd)
-		{
-			crc = (crc >> 8) ^ crcTable[(crc & 0xFF) ^ *data++];
-		}
-
-		++buffers;
-	}
-
-	return SNET_HOST_TO_NET_32(~crc);
-}
-
 /** @} */
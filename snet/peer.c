@@ -4,7 +4,9 @@
 */
 #include <string.h>
 #define SNET_BUILDING_LIB 1
+#include "snet/utility.h"
 #include "snet/snet.h"
+#include "snet/trace.h"
 
 /** @defgroup peer SNet peer functions
 @{
@@ -89,29 +91,33 @@ snet_peer_throttle(SNetPeer * peer, snet_uint32 rtt)
 	return 0;
 }
 
-/** Queues a packet to be sent.
-@param peer destination for the packet
-@param channelID channel on which to send
-@param packet packet to send
-@retval 0 on success
-@retval < 0 on failure
-*/
-int
-snet_peer_send(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet)
+static int
+snet_peer_queue_packet(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet, SNetStream * stream)
 {
 	SNetChannel * channel = &peer->channels[channelID];
 	SNetProtocol command;
 	size_t fragmentLength;
-
-	if (peer->state != SNET_PEER_STATE_CONNECTED ||
-		channelID >= peer->channelCount ||
-		packet->dataLength > peer->host->maximumPacketSize)
-		return -1;
+	snet_uint16 streamDistance = 0;
 
 	fragmentLength = peer->mtu - sizeof(SNetProtocolHeader) - sizeof(SNetProtocolSendFragment);
+	if (peer->protocolFlags & SNET_PROTOCOL_CONNECT_FLAG_PRECISE_TIME)
+		fragmentLength -= 2 * sizeof(snet_uint16);
+	else
+		if (peer->outgoingPeerID >= SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME)
+			fragmentLength -= sizeof(snet_uint16);
 	if (peer->host->checksum != NULL)
 		fragmentLength -= sizeof(snet_uint32);
 
+	/* the packet names the one sent before it on the stream only while that may not have arrived */
+	if (stream != NULL)
+	{
+		if (stream->outgoingCommandCount > 0)
+			streamDistance = (snet_uint16)(channel->outgoingReliableSequenceNumber + 1 - stream->outgoingReliableSequenceNumber);
+
+		command.header.command = SNET_PROTOCOL_COMMAND_SEND_RELIABLE | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE | SNET_PROTOCOL_COMMAND_FLAG_STREAM;
+		fragmentLength -= snet_protocol_write_stream_header(&command, stream->streamID, streamDistance);
+	}
+
 	if (packet->dataLength > fragmentLength)
 	{
 		snet_uint32 fragmentCount = (packet->dataLength + fragmentLength - 1) / fragmentLength,
@@ -125,7 +131,8 @@ snet_peer_send(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet)
 		if (fragmentCount > SNET_PROTOCOL_MAXIMUM_FRAGMENT_COUNT)
 			return -1;
 
-		if ((packet->flags & (SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNRELIABLE_FRAGMENT)) == SNET_PACKET_FLAG_UNRELIABLE_FRAGMENT &&
+		if (stream == NULL &&
+			(packet->flags & (SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNRELIABLE_FRAGMENT)) == SNET_PACKET_FLAG_UNRELIABLE_FRAGMENT &&
 			channel->outgoingUnreliableSequenceNumber < 0xFFFF)
 		{
 			commandNumber = SNET_PROTOCOL_COMMAND_SEND_UNRELIABLE_FRAGMENT;
@@ -134,6 +141,11 @@ snet_peer_send(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet)
 		else
 		{
 			commandNumber = SNET_PROTOCOL_COMMAND_SEND_FRAGMENT | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
+			if (stream != NULL)
+				commandNumber |= SNET_PROTOCOL_COMMAND_FLAG_STREAM;
+			else
+				if ((packet->flags & (SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNSEQUENCED)) == (SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNSEQUENCED))
+					commandNumber |= SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED;
 			startSequenceNumber = SNET_HOST_TO_NET_16(channel->outgoingReliableSequenceNumber + 1);
 		}
 
@@ -172,6 +184,8 @@ snet_peer_send(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet)
 			fragment->command.sendFragment.fragmentNumber = SNET_HOST_TO_NET_32(fragmentNumber);
 			fragment->command.sendFragment.totalLength = SNET_HOST_TO_NET_32(packet->dataLength);
 			fragment->command.sendFragment.fragmentOffset = SNET_NET_TO_HOST_32(fragmentOffset);
+			if (stream != NULL)
+				snet_protocol_write_stream_header(&fragment->command, stream->streamID, streamDistance);
 
 			snet_list_insert(snet_list_end(&fragments), fragment);
 		}
@@ -185,31 +199,112 @@ snet_peer_send(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet)
 			snet_peer_setup_outgoing_command(peer, fragment);
 		}
 
+		if (stream != NULL)
+		{
+			stream->outgoingReliableSequenceNumber = SNET_NET_TO_HOST_16(startSequenceNumber);
+			stream->outgoingCommandCount += fragmentNumber;
+		}
+
 		return 0;
 	}
 
 	command.header.channelID = channelID;
 
-	if ((packet->flags & (SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNSEQUENCED)) == SNET_PACKET_FLAG_UNSEQUENCED)
-	{
-		command.header.command = SNET_PROTOCOL_COMMAND_SEND_UNSEQUENCED | SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED;
-		command.sendUnsequenced.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
-	}
+	if (stream != NULL)
+		command.sendReliable.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
 	else
-		if (packet->flags & SNET_PACKET_FLAG_RELIABLE || channel->outgoingUnreliableSequenceNumber >= 0xFFFF)
+		if ((packet->flags & (SNET_PACKET_FLAG_RELIABLE | SNET_PACKET_FLAG_UNSEQUENCED)) == SNET_PACKET_FLAG_UNSEQUENCED)
 		{
-			command.header.command = SNET_PROTOCOL_COMMAND_SEND_RELIABLE | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
-			command.sendReliable.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
+			command.header.command = SNET_PROTOCOL_COMMAND_SEND_UNSEQUENCED | SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED;
+			command.sendUnsequenced.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
 		}
 		else
-		{
-			command.header.command = SNET_PROTOCOL_COMMAND_SEND_UNRELIABLE;
-			command.sendUnreliable.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
-		}
+			if (packet->flags & SNET_PACKET_FLAG_RELIABLE || channel->outgoingUnreliableSequenceNumber >= 0xFFFF)
+			{
+				command.header.command = SNET_PROTOCOL_COMMAND_SEND_RELIABLE | SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
+				if (packet->flags & SNET_PACKET_FLAG_UNSEQUENCED)
+					command.header.command |= SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED;
+				command.sendReliable.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
+			}
+			else
+			{
+				command.header.command = SNET_PROTOCOL_COMMAND_SEND_UNRELIABLE;
+				command.sendUnreliable.dataLength = SNET_HOST_TO_NET_16(packet->dataLength);
+			}
 
 	if (snet_peer_queue_outgoing_command(peer, &command, packet, 0, packet->dataLength) == NULL)
 		return -1;
 
+	if (stream != NULL)
+	{
+		stream->outgoingReliableSequenceNumber = channel->outgoingReliableSequenceNumber;
+		++stream->outgoingCommandCount;
+	}
+
+	return 0;
+}
+
+/** Queues a packet to be sent.
+@param peer destination for the packet
+@param channelID channel on which to send
+@param packet packet to send
+@retval 0 on success
+@retval < 0 on failure
+@remarks A packet with both SNET_PACKET_FLAG_RELIABLE and SNET_PACKET_FLAG_UNSEQUENCED is resent
+until acknowledged like any reliable packet, but the peer delivers it as soon as all of it has
+arrived, so a lost packet before it on the channel does not hold it back.  Peers with versions
+that predate this deliver it in order instead.
+*/
+int
+snet_peer_send(SNetPeer * peer, snet_uint8 channelID, SNetPacket * packet)
+{
+	if (peer->state != SNET_PEER_STATE_CONNECTED ||
+		channelID >= peer->channelCount ||
+		packet->dataLength > peer->host->maximumPacketSize)
+		return -1;
+
+	return snet_peer_queue_packet(peer, channelID, packet, NULL);
+}
+
+/** Queues a packet to be sent reliably on a stream within a channel.
+
+Packets on the same stream are delivered in the order they were sent, but a packet lost on one
+stream does not hold back those on other streams of the channel, so an application can give each
+object or conversation its own stream rather than spreading them over channels.  Streams need
+not be opened or closed: either end keeps one only while packets sent on it are unacknowledged
+or packets received on it wait for an earlier one.  The receive event for the packet has
+SNET_PACKET_FLAG_STREAM set on the packet and the stream ID in its data.
+
+@param peer destination for the packet
+@param channelID channel on which to send
+@param streamID stream within the channel; IDs below 128 take the fewest bytes on the wire
+@param packet packet to send, which is sent reliably whatever its flags
+@retval 0 on success
+@retval < 0 on failure, or if the peer's version does not support streams or it has as many as
+the host's maximumStreams in use already
+*/
+int
+snet_peer_send_stream(SNetPeer * peer, snet_uint8 channelID, snet_uint32 streamID, SNetPacket * packet)
+{
+	SNetStream * stream;
+
+	if (peer->state != SNET_PEER_STATE_CONNECTED ||
+		channelID >= peer->channelCount ||
+		packet->dataLength > peer->host->maximumPacketSize ||
+		!(peer->protocolFlags & SNET_PROTOCOL_CONNECT_FLAG_STREAMS))
+		return -1;
+
+	stream = snet_peer_stream(peer, channelID, streamID);
+	if (stream == NULL)
+		return -1;
+
+	if (snet_peer_queue_packet(peer, channelID, packet, stream) < 0)
+	{
+		snet_peer_trim_stream(peer, stream);
+
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -268,7 +363,7 @@ snet_peer_reset_outgoing_commands(SNetList * queue)
 }
 
 static void
-snet_peer_remove_incoming_commands(SNetList * queue, SNetListIterator startCommand, SNetListIterator endCommand)
+snet_peer_remove_incoming_commands(SNetPeer * peer, SNetList * queue, SNetListIterator startCommand, SNetListIterator endCommand)
 {
 	SNetListIterator currentCommand;
 
@@ -289,16 +384,21 @@ snet_peer_remove_incoming_commands(SNetList * queue, SNetListIterator startComma
 		}
 
 		if (incomingCommand->fragments != NULL)
+		{
+			if (incomingCommand->fragmentsRemaining > 0)
+				--peer->incomingFragmentedPackets;
+
 			snet_free(incomingCommand->fragments);
+		}
 
 		snet_free(incomingCommand);
 	}
 }
 
 static void
-snet_peer_reset_incoming_commands(SNetList * queue)
+snet_peer_reset_incoming_commands(SNetPeer * peer, SNetList * queue)
 {
-	snet_peer_remove_incoming_commands(queue, snet_list_begin(queue), snet_list_end(queue));
+	snet_peer_remove_incoming_commands(peer, queue, snet_list_begin(queue), snet_list_end(queue));
 }
 
 void
@@ -320,7 +420,8 @@ snet_peer_reset_queues(SNetPeer * peer)
 	snet_peer_reset_outgoing_commands(&peer->sentUnreliableCommands);
 	snet_peer_reset_outgoing_commands(&peer->outgoingReliableCommands);
 	snet_peer_reset_outgoing_commands(&peer->outgoingUnreliableCommands);
-	snet_peer_reset_incoming_commands(&peer->dispatchedCommands);
+	snet_peer_reset_incoming_commands(peer, &peer->dispatchedCommands);
+	snet_peer_reset_streams(peer);
 
 	if (peer->channels != NULL && peer->channelCount > 0)
 	{
@@ -328,8 +429,8 @@ snet_peer_reset_queues(SNetPeer * peer)
 			channel < &peer->channels[peer->channelCount];
 			++channel)
 		{
-			snet_peer_reset_incoming_commands(&channel->incomingReliableCommands);
-			snet_peer_reset_incoming_commands(&channel->incomingUnreliableCommands);
+			snet_peer_reset_incoming_commands(peer, &channel->incomingReliableCommands);
+			snet_peer_reset_incoming_commands(peer, &channel->incomingUnreliableCommands);
 		}
 
 		snet_free(peer->channels);
@@ -339,6 +440,109 @@ snet_peer_reset_queues(SNetPeer * peer)
 	peer->channelCount = 0;
 }
 
+/** Retrieves the latest session ticket the foreign host issued for this connection.
+@param peer peer to query; the ticket stays available after the peer disconnects, until the peer is reused
+@param ticket receives the ticket
+@retval 0 on success
+@retval < 0 if the foreign host has not issued a ticket
+@sa snet_host_resume()
+*/
+int
+snet_peer_session_ticket(const SNetPeer * peer, SNetSessionTicket * ticket)
+{
+	if (!peer->hasSessionTicket)
+		return -1;
+
+	*ticket = peer->sessionTicket;
+
+	return 0;
+}
+
+/** Takes a snapshot of a peer's statistics.
+
+All figures come from counters kept up to date as commands are queued, sent, acknowledged
+and received, so this is cheap enough to call every frame.
+
+@param peer peer to query
+@param stats receives the statistics; its version field must be set to SNET_PEER_STATS_VERSION,
+or an earlier version to fill in only the fields that version has
+@retval 0 on success
+@retval < 0 if the version is not one this library knows
+*/
+int
+snet_peer_get_stats(const SNetPeer * peer, SNetPeerStats * stats)
+{
+	size_t channelID;
+
+	if (stats->version == 0 || stats->version > SNET_PEER_STATS_VERSION)
+		return -1;
+
+	stats->state = peer->state;
+	stats->roundTripTime = peer->roundTripTime;
+	stats->roundTripTimeMinimum = (peer->minimumRoundTripTime + 999) / 1000;
+	stats->roundTripTimeVariance = peer->roundTripTimeVariance;
+	stats->roundTripTimeSamples = peer->roundTripTimeSamples;
+	stats->packetThrottle = peer->packetThrottle;
+	stats->packetLoss = peer->packetLoss;
+	stats->retransmits = peer->retransmits;
+	stats->queuedData = 0;
+	stats->inFlightData = 0;
+	memcpy(stats->drops, peer->drops, sizeof(stats->drops));
+	stats->incomingFragmentedPackets = peer->incomingFragmentedPackets;
+	stats->sentData = peer->totalSentData;
+	stats->sentUncompressedData = peer->totalSentUncompressedData;
+	stats->receivedData = peer->totalReceivedData;
+	stats->receivedUncompressedData = peer->totalReceivedUncompressedData;
+	stats->channelCount = peer->channels != NULL ? peer->channelCount : 0;
+
+	for (channelID = 0; channelID < stats->channelCount; ++channelID)
+	{
+		const SNetChannel * channel = &peer->channels[channelID];
+
+		stats->channels[channelID].queuedData = channel->outgoingQueuedData;
+		stats->channels[channelID].inFlightData = channel->outgoingInFlightData;
+
+		stats->queuedData += channel->outgoingQueuedData;
+		stats->inFlightData += channel->outgoingInFlightData;
+	}
+
+	if (stats->version >= 2)
+	{
+		stats->roundTripTimeMicroseconds = peer->roundTripTimeMicroseconds;
+		stats->roundTripTimeMinimumMicroseconds = peer->minimumRoundTripTime;
+		stats->roundTripTimeVarianceMicroseconds = peer->roundTripTimeVarianceMicroseconds;
+	}
+
+	if (stats->version >= 3)
+		stats->lateDrops = peer->drops[SNET_PEER_DROP_LATE];
+
+	return 0;
+}
+
+/** Seeds the peer's round trip time and packet throttle from a session ticket.
+
+These are what the connection measures over its first seconds.  The reliable window is not
+carried: both ends work it out from their bandwidth limits while connecting, as they would
+for the earlier session.
+*/
+void
+snet_peer_resume_session(SNetPeer * peer, const SNetSessionTicket * ticket)
+{
+	snet_uint32 roundTripTime = SNET_NET_TO_HOST_32(ticket->roundTripTime),
+		roundTripTimeVariance = SNET_NET_TO_HOST_32(ticket->roundTripTimeVariance),
+		packetThrottle = SNET_NET_TO_HOST_32(ticket->packetThrottle);
+
+	if (roundTripTime == 0 || roundTripTime > SNET_PEER_TIMEOUT_MINIMUM)
+		return;
+
+	peer->roundTripTime = roundTripTime;
+	peer->roundTripTimeVariance = SNET_MIN(roundTripTimeVariance, roundTripTime);
+	peer->roundTripTimeMicroseconds = peer->lastRoundTripTime = peer->lowestRoundTripTime = peer->roundTripTime * 1000;
+	peer->roundTripTimeVarianceMicroseconds = peer->lastRoundTripTimeVariance = peer->highestRoundTripTimeVariance =
+		peer->roundTripTimeVariance * 1000;
+	peer->packetThrottle = SNET_MIN(packetThrottle, peer->packetThrottleLimit);
+}
+
 void
 snet_peer_on_connect(SNetPeer * peer)
 {
@@ -347,6 +551,9 @@ snet_peer_on_connect(SNetPeer * peer)
 		if (peer->incomingBandwidth != 0)
 			++peer->host->bandwidthLimitedPeers;
 
+		peer->connectedPeerIndex = peer->host->connectedPeers;
+		peer->host->connectedPeerList[peer->connectedPeerIndex] = peer;
+
 		++peer->host->connectedPeers;
 	}
 }
@@ -356,10 +563,16 @@ snet_peer_on_disconnect(SNetPeer * peer)
 {
 	if (peer->state == SNET_PEER_STATE_CONNECTED || peer->state == SNET_PEER_STATE_DISCONNECT_LATER)
 	{
+		SNetPeer * lastPeer;
+
 		if (peer->incomingBandwidth != 0)
 			--peer->host->bandwidthLimitedPeers;
 
 		--peer->host->connectedPeers;
+
+		lastPeer = peer->host->connectedPeerList[peer->host->connectedPeers];
+		lastPeer->connectedPeerIndex = peer->connectedPeerIndex;
+		peer->host->connectedPeerList[peer->connectedPeerIndex] = lastPeer;
 	}
 }
 
@@ -372,9 +585,28 @@ void
 snet_peer_reset(SNetPeer * peer)
 {
 	snet_peer_on_disconnect(peer);
+	snet_host_address_remove(peer->host, peer);
+
+	if (peer->state != SNET_PEER_STATE_DISCONNECTED)
+	{
+		SNetHost * host = peer->host;
+		SNetPeer * firstPeer = host->freePeerList[host->freePeers];
+
+		/* the peers in use follow the free ones, so the peer trades places with the first of them */
+		firstPeer->freePeerIndex = peer->freePeerIndex;
+		host->freePeerList[peer->freePeerIndex] = firstPeer;
+		peer->freePeerIndex = host->freePeers;
+		host->freePeerList[host->freePeers++] = peer;
+	}
 
 	peer->outgoingPeerID = SNET_PROTOCOL_MAXIMUM_PEER_ID;
 	peer->connectID = 0;
+	peer->advertisedIncomingBandwidth = 0;
+	peer->advertisedOutgoingBandwidth = 0;
+	memset(&peer->tokenBucket, 0, sizeof(peer->tokenBucket));
+	snet_peer_bandwidth_class(peer, NULL);
+	peer->checksumType = SNET_CHECKSUM_TYPE_NONE;
+	peer->protocolFlags = 0;
 
 	peer->state = SNET_PEER_STATE_DISCONNECTED;
 
@@ -404,12 +636,22 @@ snet_peer_reset(SNetPeer * peer)
 	peer->timeoutLimit = SNET_PEER_TIMEOUT_LIMIT;
 	peer->timeoutMinimum = SNET_PEER_TIMEOUT_MINIMUM;
 	peer->timeoutMaximum = SNET_PEER_TIMEOUT_MAXIMUM;
-	peer->lastRoundTripTime = SNET_PEER_DEFAULT_ROUND_TRIP_TIME;
-	peer->lowestRoundTripTime = SNET_PEER_DEFAULT_ROUND_TRIP_TIME;
+	peer->lastRoundTripTime = SNET_PEER_DEFAULT_ROUND_TRIP_TIME * 1000;
+	peer->lowestRoundTripTime = SNET_PEER_DEFAULT_ROUND_TRIP_TIME * 1000;
 	peer->lastRoundTripTimeVariance = 0;
 	peer->highestRoundTripTimeVariance = 0;
 	peer->roundTripTime = SNET_PEER_DEFAULT_ROUND_TRIP_TIME;
 	peer->roundTripTimeVariance = 0;
+	peer->roundTripTimeMicroseconds = SNET_PEER_DEFAULT_ROUND_TRIP_TIME * 1000;
+	peer->roundTripTimeVarianceMicroseconds = 0;
+	peer->minimumRoundTripTime = 0;
+	peer->roundTripTimeSamples = 0;
+	peer->retransmits = 0;
+	memset(peer->drops, 0, sizeof(peer->drops));
+	peer->totalSentData = 0;
+	peer->totalSentUncompressedData = 0;
+	peer->totalReceivedData = 0;
+	peer->totalReceivedUncompressedData = 0;
 	peer->mtu = peer->host->mtu;
 	peer->reliableDataInTransit = 0;
 	peer->outgoingReliableSequenceNumber = 0;
@@ -422,6 +664,14 @@ snet_peer_reset(SNetPeer * peer)
 	memset(peer->unsequencedWindow, 0, sizeof(peer->unsequencedWindow));
 
 	snet_peer_reset_queues(peer);
+
+	peer->incomingFragmentedPackets = 0;
+
+	if (peer->histograms != NULL)
+	{
+		snet_histogram_reset(&peer->histograms[SNET_PEER_HISTOGRAM_ROUND_TRIP_TIME]);
+		snet_histogram_reset(&peer->histograms[SNET_PEER_HISTOGRAM_ACKNOWLEDGE_DELAY]);
+	}
 }
 
 /** Sends a ping request to a peer.
@@ -485,6 +735,19 @@ snet_peer_timeout(SNetPeer * peer, snet_uint32 timeoutLimit, snet_uint32 timeout
 	peer->timeoutMaximum = timeoutMaximum ? timeoutMaximum : SNET_PEER_TIMEOUT_MAXIMUM;
 }
 
+/** Limits the rate at which datagrams are sent to a peer.
+@param peer the peer to limit
+@param rate sustained rate in bytes/second; 0 removes the limit
+@param burst bytes that may be sent back to back after the peer has been idle; defaults to the peer's MTU if 0
+@remarks The limit is enforced per datagram inside snet_host_service(), on top of the
+bandwidth throttle, and applies until the peer is reset.
+*/
+void
+snet_peer_rate_limit(SNetPeer * peer, snet_uint32 rate, snet_uint32 burst)
+{
+	snet_token_bucket_configure(&peer->tokenBucket, rate, burst ? burst : peer->mtu, snet_host_time(peer->host));
+}
+
 /** Force an immediate disconnection from a peer.
 @param peer peer to disconnect
 @param data data describing the disconnection
@@ -582,7 +845,7 @@ snet_peer_disconnect_later(SNetPeer * peer, snet_uint32 data)
 }
 
 SNetAcknowledgement *
-snet_peer_queue_acknowledgement(SNetPeer * peer, const SNetProtocol * command, snet_uint16 sentTime)
+snet_peer_queue_acknowledgement(SNetPeer * peer, const SNetProtocol * command, snet_uint32 sentTime, int preciseSentTime)
 {
 	SNetAcknowledgement * acknowledgement;
 
@@ -603,9 +866,11 @@ snet_peer_queue_acknowledgement(SNetPeer * peer, const SNetProtocol * command, s
 	if (acknowledgement == NULL)
 		return NULL;
 
-	peer->outgoingDataTotal += sizeof(SNetProtocolAcknowledge);
+	peer->outgoingDataTotal += preciseSentTime ? sizeof(SNetProtocolPreciseAcknowledge) : sizeof(SNetProtocolAcknowledge);
 
 	acknowledgement->sentTime = sentTime;
+	acknowledgement->preciseSentTime = preciseSentTime;
+	acknowledgement->receivedTime = peer->host->serviceTime;
 	acknowledgement->command = *command;
 
 	snet_list_insert(snet_list_end(&peer->acknowledgements), acknowledgement);
@@ -618,7 +883,8 @@ snet_peer_setup_outgoing_command(SNetPeer * peer, SNetOutgoingCommand * outgoing
 {
 	SNetChannel * channel = &peer->channels[outgoingCommand->command.header.channelID];
 
-	peer->outgoingDataTotal += snet_protocol_command_size(outgoingCommand->command.header.command) + outgoingCommand->fragmentLength;
+	peer->outgoingDataTotal += snet_protocol_command_size(outgoingCommand->command.header.command) +
+		snet_protocol_stream_header_size(&outgoingCommand->command) + outgoingCommand->fragmentLength;
 
 	if (outgoingCommand->command.header.channelID == 0xFF)
 	{
@@ -673,6 +939,11 @@ snet_peer_setup_outgoing_command(SNetPeer * peer, SNetOutgoingCommand * outgoing
 		break;
 	}
 
+	if (outgoingCommand->packet != NULL)
+		channel->outgoingQueuedData += outgoingCommand->fragmentLength;
+
+	SNET_TRACE(peer->host, SNET_TRACE_QUEUE, queue, peer, outgoingCommand->command.header.command, outgoingCommand->command.header.channelID, outgoingCommand->fragmentLength);
+
 	if (outgoingCommand->command.header.command & SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE)
 		snet_list_insert(snet_list_end(&peer->outgoingReliableCommands), outgoingCommand);
 	else
@@ -778,17 +1049,29 @@ snet_peer_dispatch_incoming_unreliable_commands(SNetPeer * peer, SNetChannel * c
 		droppedCommand = currentCommand;
 	}
 
-	snet_peer_remove_incoming_commands(&channel->incomingUnreliableCommands, snet_list_begin(&channel->incomingUnreliableCommands), droppedCommand);
+	snet_peer_remove_incoming_commands(peer, &channel->incomingUnreliableCommands, snet_list_begin(&channel->incomingUnreliableCommands), droppedCommand);
 }
 
+/** Dispatches the channel's reliable commands that are next in sequence.
+
+A complete command sent without ordering, passed as queuedCommand, is dispatched at once even if
+earlier ones are missing, as is one sent on a stream, which only waits for earlier ones on its
+own stream.  It then stays in the channel's queue without its packet, holding its
+place in the sequence so that copies of it are still dropped, until the sequence reaches it.
+
+@param peer peer the commands came from
+@param channel channel to dispatch from
+@param queuedCommand command just queued or completed, or NULL
+*/
 void
-snet_peer_dispatch_incoming_reliable_commands(SNetPeer * peer, SNetChannel * channel)
+snet_peer_dispatch_incoming_reliable_commands(SNetPeer * peer, SNetChannel * channel, SNetIncomingCommand * queuedCommand)
 {
+	snet_uint16 incomingReliableSequenceNumber = channel->incomingReliableSequenceNumber;
 	SNetListIterator currentCommand;
 
-	for (currentCommand = snet_list_begin(&channel->incomingReliableCommands);
-		currentCommand != snet_list_end(&channel->incomingReliableCommands);
-		currentCommand = snet_list_next(currentCommand))
+	currentCommand = snet_list_begin(&channel->incomingReliableCommands);
+
+	while (currentCommand != snet_list_end(&channel->incomingReliableCommands))
 	{
 		SNetIncomingCommand * incomingCommand = (SNetIncomingCommand *)currentCommand;
 
@@ -800,20 +1083,81 @@ snet_peer_dispatch_incoming_reliable_commands(SNetPeer * peer, SNetChannel * cha
 
 		if (incomingCommand->fragmentCount > 0)
 			channel->incomingReliableSequenceNumber += incomingCommand->fragmentCount - 1;
+
+		if (incomingCommand == queuedCommand)
+			queuedCommand = NULL;
+
+		currentCommand = snet_list_next(currentCommand);
+
+		if (incomingCommand->packet == NULL)
+		{
+			if (incomingCommand->command.header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM)
+				snet_peer_release_stream_command(peer, incomingCommand);
+
+			snet_peer_remove_incoming_commands(peer, &channel->incomingReliableCommands, &incomingCommand->incomingCommandList, currentCommand);
+		}
+		else
+			if (incomingCommand->command.header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM)
+			{
+				snet_list_remove(&incomingCommand->incomingCommandList);
+
+				snet_peer_dispatch_incoming_stream_command(peer, channel, incomingCommand);
+			}
 	}
 
-	if (currentCommand == snet_list_begin(&channel->incomingReliableCommands))
+	if (queuedCommand != NULL &&
+		queuedCommand->packet != NULL &&
+		queuedCommand->fragmentsRemaining <= 0 &&
+		(queuedCommand->command.header.command & (SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED | SNET_PROTOCOL_COMMAND_FLAG_STREAM)))
+	{
+		SNetIncomingCommand * dispatchedCommand = (SNetIncomingCommand *)snet_malloc(sizeof(SNetIncomingCommand));
+
+		if (dispatchedCommand != NULL)
+		{
+			*dispatchedCommand = *queuedCommand;
+			dispatchedCommand->fragments = NULL;
+
+			queuedCommand->packet = NULL;
+
+			if (dispatchedCommand->command.header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM)
+			{
+				/* a stream with no room to hold it leaves it to wait for the channel's sequence */
+				if (snet_peer_dispatch_incoming_stream_command(peer, channel, dispatchedCommand) < 0)
+				{
+					queuedCommand->packet = dispatchedCommand->packet;
+
+					snet_free(dispatchedCommand);
+				}
+			}
+			else
+			{
+				snet_list_insert(snet_list_end(&peer->dispatchedCommands), dispatchedCommand);
+
+				if (!peer->needsDispatch)
+				{
+					snet_list_insert(snet_list_end(&peer->host->dispatchQueue), &peer->dispatchList);
+
+					peer->needsDispatch = 1;
+				}
+			}
+		}
+	}
+
+	if (channel->incomingReliableSequenceNumber == incomingReliableSequenceNumber)
 		return;
 
 	channel->incomingUnreliableSequenceNumber = 0;
 
-	snet_list_move(snet_list_end(&peer->dispatchedCommands), snet_list_begin(&channel->incomingReliableCommands), snet_list_previous(currentCommand));
-
-	if (!peer->needsDispatch)
+	if (currentCommand != snet_list_begin(&channel->incomingReliableCommands))
 	{
-		snet_list_insert(snet_list_end(&peer->host->dispatchQueue), &peer->dispatchList);
+		snet_list_move(snet_list_end(&peer->dispatchedCommands), snet_list_begin(&channel->incomingReliableCommands), snet_list_previous(currentCommand));
+
+		if (!peer->needsDispatch)
+		{
+			snet_list_insert(snet_list_end(&peer->host->dispatchQueue), &peer->dispatchList);
 
-		peer->needsDispatch = 1;
+			peer->needsDispatch = 1;
+		}
 	}
 
 	if (!snet_list_empty(&channel->incomingUnreliableCommands))
@@ -831,9 +1175,14 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 	SNetIncomingCommand * incomingCommand;
 	SNetListIterator currentCommand;
 	SNetPacket * packet = NULL;
+	SNetPeerDropReason dropReason = SNET_PEER_DROP_REASON_COUNT;
 
 	if (peer->state == SNET_PEER_STATE_DISCONNECT_LATER)
+	{
+		dropReason = SNET_PEER_DROP_DISCONNECTING;
+
 		goto discardCommand;
+	}
 
 	if ((command->header.command & SNET_PROTOCOL_COMMAND_MASK) != SNET_PROTOCOL_COMMAND_SEND_UNSEQUENCED)
 	{
@@ -845,7 +1194,18 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 			reliableWindow += SNET_PEER_RELIABLE_WINDOWS;
 
 		if (reliableWindow < currentWindow || reliableWindow >= currentWindow + SNET_PEER_FREE_RELIABLE_WINDOWS - 1)
+		{
+			/* behind the channel, a reliable command is a resend of one already received and an
+			   unreliable one comes after the reliable command it followed was delivered */
+			if (reliableWindow >= currentWindow + SNET_PEER_RELIABLE_WINDOWS / 2)
+				dropReason = (command->header.command & SNET_PROTOCOL_COMMAND_MASK) == SNET_PROTOCOL_COMMAND_SEND_RELIABLE ||
+					(command->header.command & SNET_PROTOCOL_COMMAND_MASK) == SNET_PROTOCOL_COMMAND_SEND_FRAGMENT ?
+						SNET_PEER_DROP_DUPLICATE : SNET_PEER_DROP_LATE;
+			else
+				dropReason = SNET_PEER_DROP_WINDOW;
+
 			goto discardCommand;
+		}
 	}
 
 	switch (command->header.command & SNET_PROTOCOL_COMMAND_MASK)
@@ -853,7 +1213,11 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 	case SNET_PROTOCOL_COMMAND_SEND_FRAGMENT:
 	case SNET_PROTOCOL_COMMAND_SEND_RELIABLE:
 		if (reliableSequenceNumber == channel->incomingReliableSequenceNumber)
+		{
+			dropReason = SNET_PEER_DROP_DUPLICATE;
+
 			goto discardCommand;
+		}
 
 		for (currentCommand = snet_list_previous(snet_list_end(&channel->incomingReliableCommands));
 			currentCommand != snet_list_end(&channel->incomingReliableCommands);
@@ -875,6 +1239,8 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 				if (incomingCommand->reliableSequenceNumber < reliableSequenceNumber)
 					break;
 
+				dropReason = SNET_PEER_DROP_DUPLICATE;
+
 				goto discardCommand;
 			}
 		}
@@ -886,7 +1252,11 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 
 		if (reliableSequenceNumber == channel->incomingReliableSequenceNumber &&
 			unreliableSequenceNumber <= channel->incomingUnreliableSequenceNumber)
+		{
+			dropReason = unreliableSequenceNumber == channel->incomingUnreliableSequenceNumber ? SNET_PEER_DROP_DUPLICATE : SNET_PEER_DROP_LATE;
+
 			goto discardCommand;
+		}
 
 		for (currentCommand = snet_list_previous(snet_list_end(&channel->incomingUnreliableCommands));
 			currentCommand != snet_list_end(&channel->incomingUnreliableCommands);
@@ -917,6 +1287,8 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 				if (incomingCommand->unreliableSequenceNumber < unreliableSequenceNumber)
 					break;
 
+				dropReason = SNET_PEER_DROP_DUPLICATE;
+
 				goto discardCommand;
 			}
 		}
@@ -931,7 +1303,11 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 	}
 
 	if (peer->totalWaitingData >= peer->host->maximumWaitingData)
+	{
+		++peer->drops[SNET_PEER_DROP_WAITING_DATA];
+
 		goto notifyError;
+	}
 
 	packet = snet_packet_create(data, dataLength, flags);
 	if (packet == NULL)
@@ -948,6 +1324,8 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 	incomingCommand->fragmentsRemaining = fragmentCount;
 	incomingCommand->packet = packet;
 	incomingCommand->fragments = NULL;
+	incomingCommand->streamDistance = 0;
+	incomingCommand->streamID = 0;
 
 	if (fragmentCount > 0)
 	{
@@ -960,6 +1338,8 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 			goto notifyError;
 		}
 		memset(incomingCommand->fragments, 0, (fragmentCount + 31) / 32 * sizeof(snet_uint32));
+
+		++peer->incomingFragmentedPackets;
 	}
 
 	if (packet != NULL)
@@ -975,7 +1355,7 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 	{
 	case SNET_PROTOCOL_COMMAND_SEND_FRAGMENT:
 	case SNET_PROTOCOL_COMMAND_SEND_RELIABLE:
-		snet_peer_dispatch_incoming_reliable_commands(peer, channel);
+		snet_peer_dispatch_incoming_reliable_commands(peer, channel, incomingCommand);
 		break;
 
 	default:
@@ -986,6 +1366,10 @@ snet_peer_queue_incoming_command(SNetPeer * peer, const SNetProtocol * command,
 	return incomingCommand;
 
 discardCommand:
+	/* only commands carrying a packet are counted */
+	if (dropReason < SNET_PEER_DROP_REASON_COUNT)
+		++peer->drops[dropReason];
+
 	if (fragmentCount > 0)
 		goto notifyError;
 
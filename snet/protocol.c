@@ -8,6 +8,7 @@
 #include "snet/utility.h"
 #include "snet/time.h"
 #include "snet/snet.h"
+#include "snet/trace.h"
 
 static size_t commandSizes[SNET_PROTOCOL_COMMAND_COUNT] =
 {
@@ -23,15 +24,163 @@ static size_t commandSizes[SNET_PROTOCOL_COMMAND_COUNT] =
 	sizeof(SNetProtocolSendUnsequenced),
 	sizeof(SNetProtocolBandwidthLimit),
 	sizeof(SNetProtocolThrottleConfigure),
-	sizeof(SNetProtocolSendFragment)
+	sizeof(SNetProtocolSendFragment),
+	sizeof(SNetProtocolConnectCookie),
+	sizeof(SNetProtocolSessionTicket)
 };
 
 size_t
 snet_protocol_command_size(snet_uint8 commandNumber)
 {
+	if ((commandNumber & (SNET_PROTOCOL_COMMAND_MASK | SNET_PROTOCOL_COMMAND_FLAG_PRECISE_SENT_TIME)) ==
+		(SNET_PROTOCOL_COMMAND_ACKNOWLEDGE | SNET_PROTOCOL_COMMAND_FLAG_PRECISE_SENT_TIME))
+		return sizeof(SNetProtocolPreciseAcknowledge);
+
 	return commandSizes[commandNumber & SNET_PROTOCOL_COMMAND_MASK];
 }
 
+/** Returns the size of the stream header following a command built by this host, or 0 if it has none. */
+size_t
+snet_protocol_stream_header_size(const SNetProtocol * command)
+{
+	const snet_uint8 * header = (const snet_uint8 *)command + commandSizes[command->header.command & SNET_PROTOCOL_COMMAND_MASK],
+		* current = header;
+
+	if (!(command->header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM))
+		return 0;
+
+	while (*current++ & 0x80)
+		;
+
+	return current - header + sizeof(snet_uint16);
+}
+
+/** Reads the stream header following a command.
+@param command command with SNET_PROTOCOL_COMMAND_FLAG_STREAM set
+@param dataEnd end of the data the header must lie within
+@param streamID set to the stream ID
+@param distance set to how far back in the channel's reliable sequence the packet sent before this one on the stream lies, or 0 if it was acknowledged
+@returns the size of the header, or 0 if it is truncated or its stream ID does not fit in 32 bits
+*/
+size_t
+snet_protocol_read_stream_header(const SNetProtocol * command, const snet_uint8 * dataEnd, snet_uint32 * streamID, snet_uint16 * distance)
+{
+	const snet_uint8 * header = (const snet_uint8 *)command + commandSizes[command->header.command & SNET_PROTOCOL_COMMAND_MASK],
+		* current = header;
+	snet_uint32 value = 0;
+	int shift;
+
+	for (shift = 0;; shift += 7)
+	{
+		if (current >= dataEnd || (shift == 28 && *current > 0x0F))
+			return 0;
+
+		value |= (snet_uint32)(*current & 0x7F) << shift;
+
+		if (!(*current++ & 0x80))
+			break;
+	}
+
+	if (current + sizeof(snet_uint16) > dataEnd)
+		return 0;
+
+	*streamID = value;
+	*distance = (snet_uint16)((current[0] << 8) | current[1]);
+
+	return current + sizeof(snet_uint16) - header;
+}
+
+/** Writes the stream header after a command, which must already have SNET_PROTOCOL_COMMAND_FLAG_STREAM set.
+@returns the size of the header, at most SNET_PROTOCOL_MAXIMUM_STREAM_HEADER_SIZE
+*/
+size_t
+snet_protocol_write_stream_header(SNetProtocol * command, snet_uint32 streamID, snet_uint16 distance)
+{
+	snet_uint8 * header = (snet_uint8 *)command + commandSizes[command->header.command & SNET_PROTOCOL_COMMAND_MASK],
+		* current = header;
+
+	while (streamID >= 0x80)
+	{
+		*current++ = (snet_uint8)(streamID | 0x80);
+		streamID >>= 7;
+	}
+	*current++ = (snet_uint8)streamID;
+
+	*current++ = (snet_uint8)(distance >> 8);
+	*current++ = (snet_uint8)distance;
+
+	return current - header;
+}
+
+/* The header has 12 bits for the peer ID, enough for IDs below SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME.
+   Larger ones are sent as SNET_PROTOCOL_HEADER_EXTENDED_PEER_ID, with the whole ID in 16 bits after the sent time. */
+static snet_uint16
+snet_protocol_header_peer_id(snet_uint16 peerID)
+{
+	if (peerID == SNET_PROTOCOL_MAXIMUM_PEER_ID)
+		return SNET_PROTOCOL_HEADER_NO_PEER_ID;
+
+	return peerID < SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME ? peerID : SNET_PROTOCOL_HEADER_EXTENDED_PEER_ID;
+}
+
+/* Reads the peer ID and sent time of a header whose sent time ends at *headerSize, moving *headerSize
+   past the extensions there are.  Returns 1 if the sent time is in microseconds, 0 if it is the low
+   16 bits of one in milliseconds or missing, and -1 for a header cut short or an extended ID out of range. */
+static int
+snet_protocol_read_header(const snet_uint8 * data, size_t dataLength, size_t * headerSize, snet_uint16 * peerID, snet_uint32 * sentTime)
+{
+	const SNetProtocolHeader * header = (const SNetProtocolHeader *)data;
+	snet_uint16 flags = SNET_NET_TO_HOST_16(header->peerID),
+		headerPeerID = flags & ~(SNET_PROTOCOL_HEADER_FLAG_MASK | SNET_PROTOCOL_HEADER_SESSION_MASK);
+
+	if (dataLength < *headerSize)
+		return -1;
+
+	*sentTime = flags & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME ? SNET_NET_TO_HOST_16(header->sentTime) : 0;
+
+	if (headerPeerID == SNET_PROTOCOL_HEADER_NO_PEER_ID)
+	{
+		*peerID = SNET_PROTOCOL_MAXIMUM_PEER_ID;
+
+		return 0;
+	}
+
+	if (headerPeerID < SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME)
+	{
+		*peerID = headerPeerID;
+
+		return 0;
+	}
+
+	if (dataLength < *headerSize + sizeof(snet_uint16))
+		return -1;
+
+	*peerID = SNET_NET_TO_HOST_16(*(const snet_uint16 *)&data[*headerSize]);
+	*headerSize += sizeof(snet_uint16);
+
+	if (headerPeerID == SNET_PROTOCOL_HEADER_EXTENDED_PEER_ID)
+		return *peerID >= SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME && *peerID < SNET_PROTOCOL_MAXIMUM_PEER_ID ? 0 : -1;
+
+	if (!(flags & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME) || *peerID >= SNET_PROTOCOL_MAXIMUM_PEER_ID ||
+		dataLength < *headerSize + sizeof(snet_uint16))
+		return -1;
+
+	*sentTime |= (snet_uint32)SNET_NET_TO_HOST_16(*(const snet_uint16 *)&data[*headerSize]) << 16;
+	*headerSize += sizeof(snet_uint16);
+
+	return 1;
+}
+
+/* SNET_CHECKSUM_TYPE_NONE selects the host's own callback, so custom checksums keep working. */
+static SNetChecksumCallback
+snet_protocol_checksum(SNetHost * host, snet_uint8 checksumType)
+{
+	if (checksumType == SNET_CHECKSUM_TYPE_NONE)
+		return host->checksum;
+
+	return snet_checksum_callback((SNetChecksumType)checksumType);
+}
+
 static void
 snet_protocol_change_state(SNetHost * host, SNetPeer * peer, SNetPeerState state)
 {
@@ -40,6 +189,8 @@ snet_protocol_change_state(SNetHost * host, SNetPeer * peer, SNetPeerState state
 	else
 		snet_peer_on_disconnect(peer);
 
+	SNET_TRACE(host, SNET_TRACE_STATE, state, peer, peer->state, state, 0);
+
 	peer->state = state;
 }
 
@@ -62,6 +213,7 @@ snet_protocol_dispatch_incoming_commands(SNetHost * host, SNetEvent * event)
 	while (!snet_list_empty(&host->dispatchQueue))
 	{
 		SNetPeer * peer = (SNetPeer *)snet_list_remove(snet_list_begin(&host->dispatchQueue));
+		snet_uint32 streamID;
 
 		peer->needsDispatch = 0;
 
@@ -92,12 +244,15 @@ snet_protocol_dispatch_incoming_commands(SNetHost * host, SNetEvent * event)
 			if (snet_list_empty(&peer->dispatchedCommands))
 				continue;
 
+			streamID = ((SNetIncomingCommand *)snet_list_front(&peer->dispatchedCommands))->streamID;
+
 			event->packet = snet_peer_receive(peer, &event->channelID);
 			if (event->packet == NULL)
 				continue;
 
 			event->type = SNET_EVENT_TYPE_RECEIVE;
 			event->peer = peer;
+			event->data = streamID;
 
 			if (!snet_list_empty(&peer->dispatchedCommands))
 			{
@@ -158,6 +313,16 @@ snet_protocol_notify_disconnect(SNetHost * host, SNetPeer * peer, SNetEvent * ev
 		}
 }
 
+/* the channel whose queued and in-flight data counts an outgoing command's packet data, if any */
+static SNetChannel *
+snet_protocol_command_channel(SNetPeer * peer, const SNetOutgoingCommand * outgoingCommand)
+{
+	if (outgoingCommand->packet == NULL || outgoingCommand->command.header.channelID >= peer->channelCount)
+		return NULL;
+
+	return &peer->channels[outgoingCommand->command.header.channelID];
+}
+
 static void
 snet_protocol_remove_sent_unreliable_commands(SNetPeer * peer)
 {
@@ -191,6 +356,7 @@ snet_protocol_remove_sent_reliable_command(SNetPeer * peer, snet_uint16 reliable
 	SNetOutgoingCommand * outgoingCommand = NULL;
 	SNetListIterator currentCommand;
 	SNetProtocolCommand commandNumber;
+	SNetChannel * dataChannel;
 	int wasSent = 1;
 
 	for (currentCommand = snet_list_begin(&peer->sentReliableCommands);
@@ -244,6 +410,18 @@ snet_protocol_remove_sent_reliable_command(SNetPeer * peer, snet_uint16 reliable
 
 	snet_list_remove(&outgoingCommand->outgoingCommandList);
 
+	if (outgoingCommand->command.header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM)
+		snet_peer_acknowledge_stream_command(peer, &outgoingCommand->command);
+
+	dataChannel = snet_protocol_command_channel(peer, outgoingCommand);
+	if (dataChannel != NULL)
+	{
+		if (wasSent)
+			dataChannel->outgoingInFlightData -= outgoingCommand->fragmentLength;
+		else
+			dataChannel->outgoingQueuedData -= outgoingCommand->fragmentLength;
+	}
+
 	if (outgoingCommand->packet != NULL)
 	{
 		if (wasSent)
@@ -271,51 +449,96 @@ snet_protocol_remove_sent_reliable_command(SNetPeer * peer, snet_uint16 reliable
 	return commandNumber;
 }
 
+/* Answers a connect without a valid cookie, allocating nothing.  The reply is smaller than
+   the connect, so a spoofed flood cannot use the host to amplify traffic. */
+static void
+snet_protocol_send_connect_cookie(SNetHost * host, const SNetProtocol * connect)
+{
+	snet_uint8 headerData[sizeof(SNetProtocolHeader) + sizeof(snet_uint16) + sizeof(snet_uint32)];
+	SNetProtocolHeader * header = (SNetProtocolHeader *)headerData;
+	snet_uint16 peerID = SNET_NET_TO_HOST_16(connect->connect.outgoingPeerID);
+	SNetProtocol command;
+	SNetBuffer buffers[2];
+	int sentLength;
+
+	if (peerID >= SNET_PROTOCOL_MAXIMUM_PEER_ID)
+		return;
+
+	header->peerID = SNET_HOST_TO_NET_16(snet_protocol_header_peer_id(peerID));
+
+	command.header.command = SNET_PROTOCOL_COMMAND_CONNECT_COOKIE;
+	command.header.channelID = 0xFF;
+	command.header.reliableSequenceNumber = 0;
+	command.connectCookie.connectID = connect->connect.connectID;
+	snet_host_connect_cookie(host, &host->receivedAddress, connect->connect.connectID, command.connectCookie.cookie);
+
+	buffers[0].data = headerData;
+	buffers[0].dataLength = (size_t) & ((SNetProtocolHeader *)0)->sentTime;
+	buffers[1].data = &command;
+	buffers[1].dataLength = sizeof(SNetProtocolConnectCookie);
+
+	if (peerID >= SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME)
+	{
+		*(snet_uint16 *)& headerData[buffers[0].dataLength] = SNET_HOST_TO_NET_16(peerID);
+		buffers[0].dataLength += sizeof(snet_uint16);
+	}
+
+	if (host->checksum != NULL)
+	{
+		snet_uint32 * checksum = (snet_uint32 *)& headerData[buffers[0].dataLength];
+		SNetChecksumCallback checksumCallback = snet_protocol_checksum(host, connect->connect.checksumType);
+
+		if (checksumCallback == NULL)
+			return;
+
+		*checksum = connect->connect.connectID;
+		buffers[0].dataLength += sizeof(snet_uint32);
+		*checksum = checksumCallback(buffers, 2);
+	}
+
+	sentLength = snet_host_send(host, &host->receivedAddress, buffers, 2);
+	if (sentLength > 0)
+	{
+		if (host->capture != NULL)
+			snet_host_capture_datagram(host, 1, SNET_PROTOCOL_MAXIMUM_PEER_ID, &host->receivedAddress, buffers, 2, 0);
+
+		SNET_TRACE(host, SNET_TRACE_SEND, send, (SNetPeer *)NULL, sentLength, 1, 0);
+
+		host->totalSentData += sentLength;
+		host->totalSentPackets++;
+	}
+}
+
 static SNetPeer *
 snet_protocol_handle_connect(SNetHost * host, SNetProtocolHeader * header, SNetProtocol * command)
 {
 	snet_uint8 incomingSessionID, outgoingSessionID;
 	snet_uint32 mtu, windowSize;
 	SNetChannel * channel;
-	size_t channelCount, duplicatePeers = 0;
-	SNetPeer * currentPeer, *peer = NULL;
+	size_t channelCount;
+	SNetPeer * peer;
 	SNetProtocol verifyCommand;
 
 	channelCount = SNET_NET_TO_HOST_32(command->connect.channelCount);
 
 	if (channelCount < SNET_PROTOCOL_MINIMUM_CHANNEL_COUNT ||
-		channelCount > SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT)
+		channelCount > SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT ||
+		SNET_NET_TO_HOST_16(command->connect.outgoingPeerID) >= SNET_PROTOCOL_MAXIMUM_PEER_ID)
 		return NULL;
 
-	for (currentPeer = host->peers;
-		currentPeer < &host->peers[host->peerCount];
-		++currentPeer)
-	{
-		if (currentPeer->state == SNET_PEER_STATE_DISCONNECTED)
-		{
-			if (peer == NULL)
-				peer = currentPeer;
-		}
-		else
-			if (currentPeer->state != SNET_PEER_STATE_CONNECTING &&
-				currentPeer->address.host == host->receivedAddress.host)
-			{
-				if (currentPeer->address.port == host->receivedAddress.port &&
-					currentPeer->connectID == command->connect.connectID)
-					return NULL;
-
-				++duplicatePeers;
-			}
-	}
-
-	if (peer == NULL || duplicatePeers >= host->duplicatePeers)
+	if (host->freePeers == 0 ||
+		snet_host_address_lookup(host, &host->receivedAddress, command->connect.connectID) != NULL ||
+		snet_host_address_count(host, host->receivedAddress.host) >= host->duplicatePeers)
 		return NULL;
 
+	peer = host->freePeerList[host->freePeers - 1];
+
 	if (channelCount > host->channelLimit)
 		channelCount = host->channelLimit;
 	peer->channels = (SNetChannel *)snet_malloc(channelCount * sizeof(SNetChannel));
 	if (peer->channels == NULL)
 		return NULL;
+	--host->freePeers;
 	peer->channelCount = channelCount;
 	peer->state = SNET_PEER_STATE_ACKNOWLEDGING_CONNECT;
 	peer->connectID = command->connect.connectID;
@@ -327,6 +550,14 @@ snet_protocol_handle_connect(SNetHost * host, SNetProtocolHeader * header, SNetP
 	peer->packetThrottleAcceleration = SNET_NET_TO_HOST_32(command->connect.packetThrottleAcceleration);
 	peer->packetThrottleDeceleration = SNET_NET_TO_HOST_32(command->connect.packetThrottleDeceleration);
 	peer->eventData = SNET_NET_TO_HOST_32(command->connect.data);
+	peer->checksumType = host->checksum != NULL ? command->connect.checksumType : SNET_CHECKSUM_TYPE_NONE;
+	peer->protocolFlags = command->connect.flags & host->protocolFlags;
+	peer->hasSessionTicket = 0;
+
+	if (snet_host_verify_session_ticket(host, &command->connect.ticket, &host->receivedAddress))
+		snet_peer_resume_session(peer, &command->connect.ticket);
+
+	snet_host_address_insert(host, peer);
 
 	incomingSessionID = command->connect.incomingSessionID == 0xFF ? peer->outgoingSessionID : command->connect.incomingSessionID;
 	incomingSessionID = (incomingSessionID + 1) & (SNET_PROTOCOL_HEADER_SESSION_MASK >> SNET_PROTOCOL_HEADER_SESSION_SHIFT);
@@ -354,6 +585,9 @@ snet_protocol_handle_connect(SNetHost * host, SNetProtocolHeader * header, SNetP
 
 		channel->usedReliableWindows = 0;
 		memset(channel->reliableWindows, 0, sizeof(channel->reliableWindows));
+
+		channel->outgoingQueuedData = 0;
+		channel->outgoingInFlightData = 0;
 	}
 
 	mtu = SNET_NET_TO_HOST_32(command->connect.mtu);
@@ -411,33 +645,71 @@ snet_protocol_handle_connect(SNetHost * host, SNetProtocolHeader * header, SNetP
 	verifyCommand.verifyConnect.channelCount = SNET_HOST_TO_NET_32(channelCount);
 	verifyCommand.verifyConnect.incomingBandwidth = SNET_HOST_TO_NET_32(host->incomingBandwidth);
 	verifyCommand.verifyConnect.outgoingBandwidth = SNET_HOST_TO_NET_32(host->outgoingBandwidth);
+	peer->advertisedIncomingBandwidth = host->incomingBandwidth;
+	peer->advertisedOutgoingBandwidth = host->outgoingBandwidth;
 	verifyCommand.verifyConnect.packetThrottleInterval = SNET_HOST_TO_NET_32(peer->packetThrottleInterval);
 	verifyCommand.verifyConnect.packetThrottleAcceleration = SNET_HOST_TO_NET_32(peer->packetThrottleAcceleration);
 	verifyCommand.verifyConnect.packetThrottleDeceleration = SNET_HOST_TO_NET_32(peer->packetThrottleDeceleration);
 	verifyCommand.verifyConnect.connectID = peer->connectID;
+	verifyCommand.verifyConnect.checksumType = peer->checksumType;
+	verifyCommand.verifyConnect.flags = peer->protocolFlags;
 
 	snet_peer_queue_outgoing_command(peer, &verifyCommand, NULL, 0, 0);
 
 	return peer;
 }
 
+/* Checks the stream header of a reliable send or fragment.  Returns the size of the header,
+   0 if the command has none, or -1 if the header is malformed or streams were not agreed on. */
+static int
+snet_protocol_receive_stream_header(SNetHost * host, SNetPeer * peer, const SNetProtocol * command)
+{
+	snet_uint32 streamID;
+	snet_uint16 distance;
+	size_t headerSize;
+
+	if (!(command->header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM))
+		return 0;
+
+	if (!(peer->protocolFlags & SNET_PROTOCOL_CONNECT_FLAG_STREAMS))
+		return -1;
+
+	headerSize = snet_protocol_read_stream_header(command, &host->receivedData[host->receivedDataLength], &streamID, &distance);
+	if (headerSize == 0)
+		return -1;
+
+	return (int)headerSize;
+}
+
 static int
 snet_protocol_handle_send_reliable(SNetHost * host, SNetPeer * peer, const SNetProtocol * command, snet_uint8 ** currentData)
 {
+	snet_uint32 flags = SNET_PACKET_FLAG_RELIABLE;
 	size_t dataLength;
+	int streamHeaderSize;
 
 	if (command->header.channelID >= peer->channelCount ||
 		(peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER))
 		return -1;
 
+	streamHeaderSize = snet_protocol_receive_stream_header(host, peer, command);
+	if (streamHeaderSize < 0)
+		return -1;
+
+	if (streamHeaderSize > 0)
+		flags |= SNET_PACKET_FLAG_STREAM;
+	else
+		if (command->header.command & SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED)
+			flags |= SNET_PACKET_FLAG_UNSEQUENCED;
+
 	dataLength = SNET_NET_TO_HOST_16(command->sendReliable.dataLength);
-	*currentData += dataLength;
+	*currentData += streamHeaderSize + dataLength;
 	if (dataLength > host->maximumPacketSize ||
 		*currentData < host->receivedData ||
 		*currentData > & host->receivedData[host->receivedDataLength])
 		return -1;
 
-	if (snet_peer_queue_incoming_command(peer, command, (const snet_uint8 *)command + sizeof(SNetProtocolSendReliable), dataLength, SNET_PACKET_FLAG_RELIABLE, 0) == NULL)
+	if (snet_peer_queue_incoming_command(peer, command, (const snet_uint8 *)command + sizeof(SNetProtocolSendReliable) + streamHeaderSize, dataLength, flags, 0) == NULL)
 		return -1;
 
 	return 0;
@@ -479,7 +751,11 @@ snet_protocol_handle_send_unsequenced(SNetHost * host, SNetPeer * peer, const SN
 	}
 	else
 		if (peer->unsequencedWindow[index / 32] & (1 << (index % 32)))
+		{
+			++peer->drops[SNET_PEER_DROP_DUPLICATE];
+
 			return 0;
+		}
 
 	if (snet_peer_queue_incoming_command(peer, command, (const snet_uint8 *)command + sizeof(SNetProtocolSendUnsequenced), dataLength, SNET_PACKET_FLAG_UNSEQUENCED, 0) == NULL)
 		return -1;
@@ -524,13 +800,18 @@ snet_protocol_handle_send_fragment(SNetHost * host, SNetPeer * peer, const SNetP
 	snet_uint16 startWindow, currentWindow;
 	SNetListIterator currentCommand;
 	SNetIncomingCommand * startCommand = NULL;
+	int streamHeaderSize;
 
 	if (command->header.channelID >= peer->channelCount ||
 		(peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER))
 		return -1;
 
+	streamHeaderSize = snet_protocol_receive_stream_header(host, peer, command);
+	if (streamHeaderSize < 0)
+		return -1;
+
 	fragmentLength = SNET_NET_TO_HOST_16(command->sendFragment.dataLength);
-	*currentData += fragmentLength;
+	*currentData += streamHeaderSize + fragmentLength;
 	if (fragmentLength > host->maximumPacketSize ||
 		*currentData < host->receivedData ||
 		*currentData > & host->receivedData[host->receivedDataLength])
@@ -580,7 +861,7 @@ snet_protocol_handle_send_fragment(SNetHost * host, SNetPeer * peer, const SNetP
 				break;
 
 			if ((incomingCommand->command.header.command & SNET_PROTOCOL_COMMAND_MASK) != SNET_PROTOCOL_COMMAND_SEND_FRAGMENT ||
-				totalLength != incomingCommand->packet->dataLength ||
+				(incomingCommand->packet != NULL && totalLength != incomingCommand->packet->dataLength) ||
 				fragmentCount != incomingCommand->fragmentCount)
 				return -1;
 
@@ -592,10 +873,17 @@ snet_protocol_handle_send_fragment(SNetHost * host, SNetPeer * peer, const SNetP
 	if (startCommand == NULL)
 	{
 		SNetProtocol hostCommand = *command;
+		snet_uint32 flags = SNET_PACKET_FLAG_RELIABLE;
+
+		if (streamHeaderSize > 0)
+			flags |= SNET_PACKET_FLAG_STREAM;
+		else
+			if (command->header.command & SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED)
+				flags |= SNET_PACKET_FLAG_UNSEQUENCED;
 
 		hostCommand.header.reliableSequenceNumber = startSequenceNumber;
 
-		startCommand = snet_peer_queue_incoming_command(peer, &hostCommand, NULL, totalLength, SNET_PACKET_FLAG_RELIABLE, fragmentCount);
+		startCommand = snet_peer_queue_incoming_command(peer, &hostCommand, NULL, totalLength, flags, fragmentCount);
 		if (startCommand == NULL)
 			return -1;
 	}
@@ -610,11 +898,15 @@ snet_protocol_handle_send_fragment(SNetHost * host, SNetPeer * peer, const SNetP
 			fragmentLength = startCommand->packet->dataLength - fragmentOffset;
 
 		memcpy(startCommand->packet->data + fragmentOffset,
-			(snet_uint8 *)command + sizeof(SNetProtocolSendFragment),
+			(snet_uint8 *)command + sizeof(SNetProtocolSendFragment) + streamHeaderSize,
 			fragmentLength);
 
 		if (startCommand->fragmentsRemaining <= 0)
-			snet_peer_dispatch_incoming_reliable_commands(peer, channel);
+		{
+			--peer->incomingFragmentedPackets;
+
+			snet_peer_dispatch_incoming_reliable_commands(peer, channel, startCommand);
+		}
 	}
 
 	return 0;
@@ -732,7 +1024,11 @@ snet_protocol_handle_send_unreliable_fragment(SNetHost * host, SNetPeer * peer,
 			fragmentLength);
 
 		if (startCommand->fragmentsRemaining <= 0)
+		{
+			--peer->incomingFragmentedPackets;
+
 			snet_peer_dispatch_incoming_unreliable_commands(peer, channel);
+		}
 	}
 
 	return 0;
@@ -828,58 +1124,84 @@ snet_protocol_handle_acknowledge(SNetHost * host, SNetEvent * event, SNetPeer *
 {
 	snet_uint32 roundTripTime,
 		receivedSentTime,
-		receivedReliableSequenceNumber;
+		receivedReliableSequenceNumber,
+		packetThrottle;
 	SNetProtocolCommand commandNumber;
 
 	if (peer->state == SNET_PEER_STATE_DISCONNECTED || peer->state == SNET_PEER_STATE_ZOMBIE)
 		return 0;
 
-	receivedSentTime = SNET_NET_TO_HOST_16(command->acknowledge.receivedSentTime);
-	receivedSentTime |= host->serviceTime & 0xFFFF0000;
-	if ((receivedSentTime & 0x8000) > (host->serviceTime & 0x8000))
-		receivedSentTime -= 0x10000;
+	if (command->header.command & SNET_PROTOCOL_COMMAND_FLAG_PRECISE_SENT_TIME)
+	{
+		roundTripTime = snet_host_time_microseconds(host) - SNET_NET_TO_HOST_32(command->preciseAcknowledge.receivedSentTime);
+		if (roundTripTime & 0x80000000)
+			return 0;
+	}
+	else
+	{
+		receivedSentTime = SNET_NET_TO_HOST_16(command->acknowledge.receivedSentTime);
+		receivedSentTime |= host->serviceTime & 0xFFFF0000;
+		if ((receivedSentTime & 0x8000) > (host->serviceTime & 0x8000))
+			receivedSentTime -= 0x10000;
+
+		if (SNET_TIME_LESS(host->serviceTime, receivedSentTime))
+			return 0;
 
-	if (SNET_TIME_LESS(host->serviceTime, receivedSentTime))
-		return 0;
+		roundTripTime = SNET_TIME_DIFFERENCE(host->serviceTime, receivedSentTime) * 1000;
+	}
 
 	peer->lastReceiveTime = host->serviceTime;
 	peer->earliestTimeout = 0;
 
-	roundTripTime = SNET_TIME_DIFFERENCE(host->serviceTime, receivedSentTime);
+	if (peer->roundTripTimeSamples++ == 0 || roundTripTime < peer->minimumRoundTripTime)
+		peer->minimumRoundTripTime = roundTripTime;
+
+	if (peer->histograms != NULL)
+		snet_histogram_record(&peer->histograms[SNET_PEER_HISTOGRAM_ROUND_TRIP_TIME], roundTripTime);
+
+	packetThrottle = peer->packetThrottle;
 
 	snet_peer_throttle(peer, roundTripTime);
 
-	peer->roundTripTimeVariance -= peer->roundTripTimeVariance / 4;
+	if (peer->packetThrottle != packetThrottle)
+		SNET_TRACE(host, SNET_TRACE_THROTTLE, throttle, peer, packetThrottle, peer->packetThrottle, roundTripTime);
+
+	peer->roundTripTimeVarianceMicroseconds -= peer->roundTripTimeVarianceMicroseconds / 4;
 
-	if (roundTripTime >= peer->roundTripTime)
+	if (roundTripTime >= peer->roundTripTimeMicroseconds)
 	{
-		peer->roundTripTime += (roundTripTime - peer->roundTripTime) / 8;
-		peer->roundTripTimeVariance += (roundTripTime - peer->roundTripTime) / 4;
+		peer->roundTripTimeMicroseconds += (roundTripTime - peer->roundTripTimeMicroseconds) / 8;
+		peer->roundTripTimeVarianceMicroseconds += (roundTripTime - peer->roundTripTimeMicroseconds) / 4;
 	}
 	else
 	{
-		peer->roundTripTime -= (peer->roundTripTime - roundTripTime) / 8;
-		peer->roundTripTimeVariance += (peer->roundTripTime - roundTripTime) / 4;
+		peer->roundTripTimeMicroseconds -= (peer->roundTripTimeMicroseconds - roundTripTime) / 8;
+		peer->roundTripTimeVarianceMicroseconds += (peer->roundTripTimeMicroseconds - roundTripTime) / 4;
 	}
 
-	if (peer->roundTripTime < peer->lowestRoundTripTime)
-		peer->lowestRoundTripTime = peer->roundTripTime;
+	peer->roundTripTime = (peer->roundTripTimeMicroseconds + 999) / 1000;
+	peer->roundTripTimeVariance = (peer->roundTripTimeVarianceMicroseconds + 999) / 1000;
 
-	if (peer->roundTripTimeVariance > peer->highestRoundTripTimeVariance)
-		peer->highestRoundTripTimeVariance = peer->roundTripTimeVariance;
+	if (peer->roundTripTimeMicroseconds < peer->lowestRoundTripTime)
+		peer->lowestRoundTripTime = peer->roundTripTimeMicroseconds;
+
+	if (peer->roundTripTimeVarianceMicroseconds > peer->highestRoundTripTimeVariance)
+		peer->highestRoundTripTimeVariance = peer->roundTripTimeVarianceMicroseconds;
 
 	if (peer->packetThrottleEpoch == 0 ||
 		SNET_TIME_DIFFERENCE(host->serviceTime, peer->packetThrottleEpoch) >= peer->packetThrottleInterval)
 	{
 		peer->lastRoundTripTime = peer->lowestRoundTripTime;
 		peer->lastRoundTripTimeVariance = peer->highestRoundTripTimeVariance;
-		peer->lowestRoundTripTime = peer->roundTripTime;
-		peer->highestRoundTripTimeVariance = peer->roundTripTimeVariance;
+		peer->lowestRoundTripTime = peer->roundTripTimeMicroseconds;
+		peer->highestRoundTripTimeVariance = peer->roundTripTimeVarianceMicroseconds;
 		peer->packetThrottleEpoch = host->serviceTime;
 	}
 
 	receivedReliableSequenceNumber = SNET_NET_TO_HOST_16(command->acknowledge.receivedReliableSequenceNumber);
 
+	SNET_TRACE(host, SNET_TRACE_ACKNOWLEDGE, acknowledge, peer, receivedReliableSequenceNumber, command->header.channelID, roundTripTime);
+
 	commandNumber = snet_protocol_remove_sent_reliable_command(peer, receivedReliableSequenceNumber, command->header.channelID);
 
 	switch (peer->state)
@@ -912,6 +1234,63 @@ snet_protocol_handle_acknowledge(SNetHost * host, SNetEvent * event, SNetPeer *
 	return 0;
 }
 
+static SNetOutgoingCommand *
+snet_protocol_find_connect(SNetList * commands)
+{
+	SNetListIterator currentCommand;
+
+	for (currentCommand = snet_list_begin(commands);
+		currentCommand != snet_list_end(commands);
+		currentCommand = snet_list_next(currentCommand))
+	{
+		SNetOutgoingCommand * outgoingCommand = (SNetOutgoingCommand *)currentCommand;
+
+		if ((outgoingCommand->command.header.command & SNET_PROTOCOL_COMMAND_MASK) == SNET_PROTOCOL_COMMAND_CONNECT)
+			return outgoingCommand;
+	}
+
+	return NULL;
+}
+
+static int
+snet_protocol_handle_connect_cookie(SNetHost * host, SNetPeer * peer, const SNetProtocol * command)
+{
+	SNetOutgoingCommand * outgoingCommand;
+
+	if (peer->state != SNET_PEER_STATE_CONNECTING ||
+		command->connectCookie.connectID != peer->connectID)
+		return 0;
+
+	outgoingCommand = snet_protocol_find_connect(&peer->sentReliableCommands);
+	if (outgoingCommand != NULL)
+	{
+		/* resend straight away instead of waiting out the retransmission timeout */
+		snet_list_insert(snet_list_begin(&peer->outgoingReliableCommands), snet_list_remove(&outgoingCommand->outgoingCommandList));
+	}
+	else
+	{
+		outgoingCommand = snet_protocol_find_connect(&peer->outgoingReliableCommands);
+		if (outgoingCommand == NULL)
+			return 0;
+	}
+
+	memcpy(outgoingCommand->command.connect.cookie, command->connectCookie.cookie, sizeof(outgoingCommand->command.connect.cookie));
+
+	return 0;
+}
+
+static int
+snet_protocol_handle_session_ticket(SNetHost * host, SNetPeer * peer, const SNetProtocol * command)
+{
+	if (peer->state != SNET_PEER_STATE_CONNECTED && peer->state != SNET_PEER_STATE_DISCONNECT_LATER)
+		return -1;
+
+	peer->sessionTicket = command->sessionTicket.ticket;
+	peer->hasSessionTicket = 1;
+
+	return 0;
+}
+
 static int
 snet_protocol_handle_verify_connect(SNetHost * host, SNetEvent * event, SNetPeer * peer, const SNetProtocol * command)
 {
@@ -927,7 +1306,8 @@ snet_protocol_handle_verify_connect(SNetHost * host, SNetEvent * event, SNetPeer
 		SNET_NET_TO_HOST_32(command->verifyConnect.packetThrottleInterval) != peer->packetThrottleInterval ||
 		SNET_NET_TO_HOST_32(command->verifyConnect.packetThrottleAcceleration) != peer->packetThrottleAcceleration ||
 		SNET_NET_TO_HOST_32(command->verifyConnect.packetThrottleDeceleration) != peer->packetThrottleDeceleration ||
-		command->verifyConnect.connectID != peer->connectID)
+		command->verifyConnect.connectID != peer->connectID ||
+		command->verifyConnect.checksumType != peer->checksumType)
 	{
 		peer->eventData = 0;
 
@@ -938,10 +1318,13 @@ snet_protocol_handle_verify_connect(SNetHost * host, SNetEvent * event, SNetPeer
 
 	snet_protocol_remove_sent_reliable_command(peer, 1, 0xFF);
 
+	snet_host_address_insert(host, peer);
+
 	if (channelCount < peer->channelCount)
 		peer->channelCount = channelCount;
 
 	peer->outgoingPeerID = SNET_NET_TO_HOST_16(command->verifyConnect.outgoingPeerID);
+	peer->protocolFlags = command->verifyConnect.flags & host->protocolFlags;
 	peer->incomingSessionID = command->verifyConnect.incomingSessionID;
 	peer->outgoingSessionID = command->verifyConnect.outgoingSessionID;
 
@@ -981,9 +1364,13 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 	SNetProtocol * command;
 	SNetPeer * peer;
 	snet_uint8 * currentData;
-	size_t headerSize;
+	size_t headerSize, receivedDataLength;
 	snet_uint16 peerID, flags;
 	snet_uint8 sessionID;
+	snet_uint32 sentTime;
+	int preciseSentTime;
+	SNetChecksumUpdateCallback checksumUpdate = NULL;
+	snet_uint32 checksumState = 0, desiredChecksum = 0;
 
 	if (host->receivedDataLength < (size_t) & ((SNetProtocolHeader *)0)->sentTime)
 		return 0;
@@ -993,9 +1380,11 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 	peerID = SNET_NET_TO_HOST_16(header->peerID);
 	sessionID = (peerID & SNET_PROTOCOL_HEADER_SESSION_MASK) >> SNET_PROTOCOL_HEADER_SESSION_SHIFT;
 	flags = peerID & SNET_PROTOCOL_HEADER_FLAG_MASK;
-	peerID &= ~(SNET_PROTOCOL_HEADER_FLAG_MASK | SNET_PROTOCOL_HEADER_SESSION_MASK);
 
 	headerSize = (flags & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME ? sizeof(SNetProtocolHeader) : (size_t) & ((SNetProtocolHeader *)0)->sentTime);
+	preciseSentTime = snet_protocol_read_header(host->receivedData, host->receivedDataLength, &headerSize, &peerID, &sentTime);
+	if (preciseSentTime < 0)
+		return 0;
 	if (host->checksum != NULL)
 		headerSize += sizeof(snet_uint32);
 
@@ -1018,17 +1407,44 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 				return 0;
 		}
 
+	receivedDataLength = host->receivedDataLength;
+
 	if (flags & SNET_PROTOCOL_HEADER_FLAG_COMPRESSED)
 	{
 		size_t originalSize;
+		unsigned long long phaseStart;
 		if (host->compressor.context == NULL || host->compressor.decompress == NULL)
 			return 0;
 
-		originalSize = host->compressor.decompress(host->compressor.context,
-			host->receivedData + headerSize,
-			host->receivedDataLength - headerSize,
-			host->packetData[1] + headerSize,
-			sizeof(host->packetData[1]) - headerSize);
+		phaseStart = snet_host_phase_start(host);
+
+		if (host->checksum != NULL && peer != NULL && host->compressor.decompressChecksum != NULL)
+			checksumUpdate = snet_checksum_update_callback((SNetChecksumType)peer->checksumType);
+
+		if (checksumUpdate != NULL)
+		{
+			snet_uint32 * checksum = (snet_uint32 *)& host->receivedData[headerSize - sizeof(snet_uint32)];
+
+			desiredChecksum = *checksum;
+			*checksum = peer->connectID;
+			checksumState = checksumUpdate(0xFFFFFFFF, host->receivedData, headerSize);
+
+			originalSize = host->compressor.decompressChecksum(host->compressor.context,
+				host->receivedData + headerSize,
+				host->receivedDataLength - headerSize,
+				host->packetData[1] + headerSize,
+				sizeof(host->packetData[1]) - headerSize,
+				checksumUpdate, &checksumState);
+		}
+		else
+			originalSize = host->compressor.decompress(host->compressor.context,
+				host->receivedData + headerSize,
+				host->receivedDataLength - headerSize,
+				host->packetData[1] + headerSize,
+				sizeof(host->packetData[1]) - headerSize);
+
+		snet_host_phase_end(host, SNET_HOST_PHASE_DECOMPRESS, phaseStart);
+
 		if (originalSize <= 0 || originalSize > sizeof(host->packetData[1]) - headerSize)
 			return 0;
 
@@ -1037,28 +1453,56 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 		host->receivedDataLength = headerSize + originalSize;
 	}
 
-	if (host->checksum != NULL)
+	if (checksumUpdate != NULL)
 	{
-		snet_uint32 * checksum = (snet_uint32 *)& host->receivedData[headerSize - sizeof(snet_uint32)],
-			desiredChecksum = *checksum;
-		SNetBuffer buffer;
+		if (SNET_HOST_TO_NET_32(~checksumState) != desiredChecksum)
+			return 0;
+	}
+	else
+		if (host->checksum != NULL)
+		{
+			snet_uint32 * checksum = (snet_uint32 *)& host->receivedData[headerSize - sizeof(snet_uint32)];
+			SNetChecksumCallback checksumCallback;
+			SNetBuffer buffer;
 
-		*checksum = peer != NULL ? peer->connectID : 0;
+			if (peer != NULL)
+				checksumCallback = snet_protocol_checksum(host, peer->checksumType);
+			else
+			{
+				const SNetProtocol * connect = (const SNetProtocol *)& host->receivedData[headerSize];
 
-		buffer.data = host->receivedData;
-		buffer.dataLength = host->receivedDataLength;
+				/* a connect names its own checksum type, which is then verified along with the rest of the packet */
+				if (host->receivedDataLength >= headerSize + sizeof(SNetProtocolConnect) &&
+					(connect->header.command & SNET_PROTOCOL_COMMAND_MASK) == SNET_PROTOCOL_COMMAND_CONNECT)
+					checksumCallback = snet_protocol_checksum(host, connect->connect.checksumType);
+				else
+					checksumCallback = host->checksum;
+			}
 
-		if (host->checksum(&buffer, 1) != desiredChecksum)
-			return 0;
-	}
+			if (checksumCallback == NULL)
+				return 0;
+
+			desiredChecksum = *checksum;
+			*checksum = peer != NULL ? peer->connectID : 0;
+
+			buffer.data = host->receivedData;
+			buffer.dataLength = host->receivedDataLength;
+
+			if (checksumCallback(&buffer, 1) != desiredChecksum)
+				return 0;
+		}
 
 	if (peer != NULL)
 	{
 		peer->address.host = host->receivedAddress.host;
 		peer->address.port = host->receivedAddress.port;
 		peer->incomingDataTotal += host->receivedDataLength;
+		peer->totalReceivedData += receivedDataLength;
+		peer->totalReceivedUncompressedData += host->receivedDataLength;
 	}
 
+	SNET_TRACE(host, SNET_TRACE_RECEIVE, receive, peer, receivedDataLength, host->receivedDataLength, flags);
+
 	currentData = host->receivedData + headerSize;
 
 	while (currentData < &host->receivedData[host->receivedDataLength])
@@ -1075,7 +1519,7 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 		if (commandNumber >= SNET_PROTOCOL_COMMAND_COUNT)
 			break;
 
-		commandSize = commandSizes[commandNumber];
+		commandSize = snet_protocol_command_size(command->header.command);
 		if (commandSize == 0 || currentData + commandSize > & host->receivedData[host->receivedDataLength])
 			break;
 
@@ -1094,8 +1538,15 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 			break;
 
 		case SNET_PROTOCOL_COMMAND_CONNECT:
-			if (peer != NULL)
+			if (peer != NULL ||
+				!snet_host_connect_allowed(host, host->receivedAddress.host))
+				goto commandError;
+			if (host->connectCookies &&
+				!snet_host_verify_connect_cookie(host, &host->receivedAddress, command->connect.connectID, command->connect.cookie))
+			{
+				snet_protocol_send_connect_cookie(host, command);
 				goto commandError;
+			}
 			peer = snet_protocol_handle_connect(host, header, command);
 			if (peer == NULL)
 				goto commandError;
@@ -1151,6 +1602,16 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 				goto commandError;
 			break;
 
+		case SNET_PROTOCOL_COMMAND_CONNECT_COOKIE:
+			if (snet_protocol_handle_connect_cookie(host, peer, command))
+				goto commandError;
+			break;
+
+		case SNET_PROTOCOL_COMMAND_SESSION_TICKET:
+			if (snet_protocol_handle_session_ticket(host, peer, command))
+				goto commandError;
+			break;
+
 		default:
 			goto commandError;
 		}
@@ -1158,13 +1619,9 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 		if (peer != NULL &&
 			(command->header.command & SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE) != 0)
 		{
-			snet_uint16 sentTime;
-
 			if (!(flags & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME))
 				break;
 
-			sentTime = SNET_NET_TO_HOST_16(header->sentTime);
-
 			switch (peer->state)
 			{
 			case SNET_PEER_STATE_DISCONNECTING:
@@ -1175,11 +1632,11 @@ snet_protocol_handle_incoming_commands(SNetHost * host, SNetEvent * event)
 
 			case SNET_PEER_STATE_ACKNOWLEDGING_DISCONNECT:
 				if ((command->header.command & SNET_PROTOCOL_COMMAND_MASK) == SNET_PROTOCOL_COMMAND_DISCONNECT)
-					snet_peer_queue_acknowledgement(peer, command, sentTime);
+					snet_peer_queue_acknowledgement(peer, command, sentTime, preciseSentTime);
 				break;
 
 			default:
-				snet_peer_queue_acknowledgement(peer, command, sentTime);
+				snet_peer_queue_acknowledgement(peer, command, sentTime, preciseSentTime);
 				break;
 			}
 		}
@@ -1202,13 +1659,9 @@ snet_protocol_receive_incoming_commands(SNetHost * host, SNetEvent * event)
 		int receivedLength;
 		SNetBuffer buffer;
 
-		buffer.data = host->packetData[0];
-		buffer.dataLength = sizeof(host->packetData[0]);
-
-		receivedLength = snet_socket_receive(host->socket,
+		receivedLength = snet_host_receive(host,
 			&host->receivedAddress,
-			&buffer,
-			1);
+			&host->receivedData);
 
 		if (receivedLength < 0)
 			return -1;
@@ -1216,12 +1669,32 @@ snet_protocol_receive_incoming_commands(SNetHost * host, SNetEvent * event)
 		if (receivedLength == 0)
 			return 0;
 
-		host->receivedData = host->packetData[0];
 		host->receivedDataLength = receivedLength;
 
 		host->totalReceivedData += receivedLength;
 		host->totalReceivedPackets++;
 
+		if (host->capture != NULL)
+		{
+			snet_uint16 peerID = SNET_PROTOCOL_MAXIMUM_PEER_ID;
+
+			if ((size_t)receivedLength >= sizeof(snet_uint16))
+			{
+				size_t headerSize = SNET_NET_TO_HOST_16(((SNetProtocolHeader *)host->receivedData)->peerID) & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME ?
+					sizeof(SNetProtocolHeader) : (size_t) & ((SNetProtocolHeader *)0)->sentTime;
+
+				snet_uint32 sentTime;
+
+				if (snet_protocol_read_header(host->receivedData, receivedLength, &headerSize, &peerID, &sentTime) < 0)
+					peerID = SNET_PROTOCOL_MAXIMUM_PEER_ID;
+			}
+
+			buffer.data = host->receivedData;
+			buffer.dataLength = receivedLength;
+
+			snet_host_capture_datagram(host, 0, peerID, &host->receivedAddress, &buffer, 1, 0);
+		}
+
 		if (host->intercept != NULL)
 		{
 			switch (host->intercept(host, event))
@@ -1253,7 +1726,8 @@ snet_protocol_receive_incoming_commands(SNetHost * host, SNetEvent * event)
 		}
 	}
 
-	return -1;
+	/* the rest waits for the next service rather than starving sends */
+	return 0;
 }
 
 static void
@@ -1264,36 +1738,47 @@ snet_protocol_send_acknowledgements(SNetHost * host, SNetPeer * peer)
 	SNetAcknowledgement * acknowledgement;
 	SNetListIterator currentAcknowledgement;
 	snet_uint16 reliableSequenceNumber;
+	snet_uint8 commandNumber;
 
 	currentAcknowledgement = snet_list_begin(&peer->acknowledgements);
 
 	while (currentAcknowledgement != snet_list_end(&peer->acknowledgements))
 	{
+		acknowledgement = (SNetAcknowledgement *)currentAcknowledgement;
+
+		/* the sent time goes back as it came, so only the peer that stamped it needs to know its unit */
+		commandNumber = acknowledgement->preciseSentTime ?
+			SNET_PROTOCOL_COMMAND_ACKNOWLEDGE | SNET_PROTOCOL_COMMAND_FLAG_PRECISE_SENT_TIME : SNET_PROTOCOL_COMMAND_ACKNOWLEDGE;
+
 		if (command >= &host->commands[sizeof(host->commands) / sizeof(SNetProtocol)] ||
 			buffer >= &host->buffers[sizeof(host->buffers) / sizeof(SNetBuffer)] ||
-			peer->mtu - host->packetSize < sizeof(SNetProtocolAcknowledge))
+			peer->mtu - host->packetSize < snet_protocol_command_size(commandNumber))
 		{
 			host->continueSending = 1;
 
 			break;
 		}
 
-		acknowledgement = (SNetAcknowledgement *)currentAcknowledgement;
-
 		currentAcknowledgement = snet_list_next(currentAcknowledgement);
 
 		buffer->data = command;
-		buffer->dataLength = sizeof(SNetProtocolAcknowledge);
+		buffer->dataLength = snet_protocol_command_size(commandNumber);
 
 		host->packetSize += buffer->dataLength;
 
 		reliableSequenceNumber = SNET_HOST_TO_NET_16(acknowledgement->command.header.reliableSequenceNumber);
 
-		command->header.command = SNET_PROTOCOL_COMMAND_ACKNOWLEDGE;
+		command->header.command = commandNumber;
 		command->header.channelID = acknowledgement->command.header.channelID;
 		command->header.reliableSequenceNumber = reliableSequenceNumber;
 		command->acknowledge.receivedReliableSequenceNumber = reliableSequenceNumber;
-		command->acknowledge.receivedSentTime = SNET_HOST_TO_NET_16(acknowledgement->sentTime);
+		if (acknowledgement->preciseSentTime)
+			command->preciseAcknowledge.receivedSentTime = SNET_HOST_TO_NET_32(acknowledgement->sentTime);
+		else
+			command->acknowledge.receivedSentTime = SNET_HOST_TO_NET_16(acknowledgement->sentTime);
+
+		if (peer->histograms != NULL)
+			snet_histogram_record(&peer->histograms[SNET_PEER_HISTOGRAM_ACKNOWLEDGE_DELAY], SNET_TIME_DIFFERENCE(host->serviceTime, acknowledgement->receivedTime));
 
 		if ((acknowledgement->command.header.command & SNET_PROTOCOL_COMMAND_MASK) == SNET_PROTOCOL_COMMAND_DISCONNECT)
 			snet_protocol_dispatch_state(host, peer, SNET_PEER_STATE_ZOMBIE);
@@ -1316,6 +1801,7 @@ snet_protocol_send_unreliable_outgoing_commands(SNetHost * host, SNetPeer * peer
 	SNetBuffer * buffer = &host->buffers[host->bufferCount];
 	SNetOutgoingCommand * outgoingCommand;
 	SNetListIterator currentCommand;
+	SNetChannel * channel;
 
 	currentCommand = snet_list_begin(&peer->outgoingUnreliableCommands);
 
@@ -1348,8 +1834,16 @@ snet_protocol_send_unreliable_outgoing_commands(SNetHost * host, SNetPeer * peer
 			{
 				snet_uint16 reliableSequenceNumber = outgoingCommand->reliableSequenceNumber,
 					unreliableSequenceNumber = outgoingCommand->unreliableSequenceNumber;
+				snet_uint8 channelID = outgoingCommand->command.header.channelID;
+				snet_uint32 droppedCommands = 0;
 				for (;;)
 				{
+					++droppedCommands;
+
+					channel = snet_protocol_command_channel(peer, outgoingCommand);
+					if (channel != NULL)
+						channel->outgoingQueuedData -= outgoingCommand->fragmentLength;
+
 					--outgoingCommand->packet->referenceCount;
 
 					if (outgoingCommand->packet->referenceCount == 0)
@@ -1369,6 +1863,10 @@ snet_protocol_send_unreliable_outgoing_commands(SNetHost * host, SNetPeer * peer
 					currentCommand = snet_list_next(currentCommand);
 				}
 
+				++peer->drops[SNET_PEER_DROP_THROTTLE];
+
+				SNET_TRACE(host, SNET_TRACE_THROTTLE_DROP, throttle_drop, peer, unreliableSequenceNumber, channelID, droppedCommands);
+
 				continue;
 			}
 		}
@@ -1391,6 +1889,10 @@ snet_protocol_send_unreliable_outgoing_commands(SNetHost * host, SNetPeer * peer
 
 			host->packetSize += buffer->dataLength;
 
+			channel = snet_protocol_command_channel(peer, outgoingCommand);
+			if (channel != NULL)
+				channel->outgoingQueuedData -= outgoingCommand->fragmentLength;
+
 			snet_list_insert(snet_list_end(&peer->sentUnreliableCommands), outgoingCommand);
 		}
 		else
@@ -1415,6 +1917,7 @@ snet_protocol_check_timeouts(SNetHost * host, SNetPeer * peer, SNetEvent * event
 {
 	SNetOutgoingCommand * outgoingCommand;
 	SNetListIterator currentCommand, insertPosition;
+	SNetChannel * dataChannel;
 
 	currentCommand = snet_list_begin(&peer->sentReliableCommands);
 	insertPosition = snet_list_begin(&peer->outgoingReliableCommands);
@@ -1445,10 +1948,20 @@ snet_protocol_check_timeouts(SNetHost * host, SNetPeer * peer, SNetEvent * event
 		if (outgoingCommand->packet != NULL)
 			peer->reliableDataInTransit -= outgoingCommand->fragmentLength;
 
+		dataChannel = snet_protocol_command_channel(peer, outgoingCommand);
+		if (dataChannel != NULL)
+		{
+			dataChannel->outgoingInFlightData -= outgoingCommand->fragmentLength;
+			dataChannel->outgoingQueuedData += outgoingCommand->fragmentLength;
+		}
+
 		++peer->packetsLost;
+		++peer->retransmits;
 
 		outgoingCommand->roundTripTimeout *= 2;
 
+		SNET_TRACE(host, SNET_TRACE_RETRANSMIT, retransmit, peer, outgoingCommand->reliableSequenceNumber, outgoingCommand->command.header.channelID, outgoingCommand->roundTripTimeout);
+
 		snet_list_insert(insertPosition, snet_list_remove(&outgoingCommand->outgoingCommandList));
 
 		if (currentCommand == snet_list_begin(&peer->sentReliableCommands) &&
@@ -1519,7 +2032,8 @@ snet_protocol_send_reliable_outgoing_commands(SNetHost * host, SNetPeer * peer)
 
 		canPing = 0;
 
-		commandSize = commandSizes[outgoingCommand->command.header.command & SNET_PROTOCOL_COMMAND_MASK];
+		commandSize = commandSizes[outgoingCommand->command.header.command & SNET_PROTOCOL_COMMAND_MASK] +
+			snet_protocol_stream_header_size(&outgoingCommand->command);
 		if (command >= &host->commands[sizeof(host->commands) / sizeof(SNetProtocol)] ||
 			buffer + 1 >= &host->buffers[sizeof(host->buffers) / sizeof(SNetBuffer)] ||
 			peer->mtu - host->packetSize < commandSize ||
@@ -1543,7 +2057,8 @@ snet_protocol_send_reliable_outgoing_commands(SNetHost * host, SNetPeer * peer)
 
 		if (outgoingCommand->roundTripTimeout == 0)
 		{
-			outgoingCommand->roundTripTimeout = peer->roundTripTime + 4 * peer->roundTripTimeVariance;
+			/* the variance gets at least a tick of the millisecond service clock, as in RFC 6298 */
+			outgoingCommand->roundTripTimeout = (peer->roundTripTimeMicroseconds + SNET_MAX(4 * peer->roundTripTimeVarianceMicroseconds, 1000) + 999) / 1000;
 			outgoingCommand->roundTripTimeoutLimit = peer->timeoutLimit * outgoingCommand->roundTripTimeout;
 		}
 
@@ -1573,6 +2088,12 @@ snet_protocol_send_reliable_outgoing_commands(SNetHost * host, SNetPeer * peer)
 			host->packetSize += outgoingCommand->fragmentLength;
 
 			peer->reliableDataInTransit += outgoingCommand->fragmentLength;
+
+			if (channel != NULL)
+			{
+				channel->outgoingQueuedData -= outgoingCommand->fragmentLength;
+				channel->outgoingInFlightData += outgoingCommand->fragmentLength;
+			}
 		}
 
 		++peer->packetsSent;
@@ -1587,58 +2108,145 @@ snet_protocol_send_reliable_outgoing_commands(SNetHost * host, SNetPeer * peer)
 	return canPing;
 }
 
+/* Refills the peer and host buckets and reports whether either is empty.  A held back peer
+   records how long until it may send, so snet_host_service() can wake up in time. */
+static int
+snet_protocol_rate_limited(SNetHost * host, SNetPeer * peer)
+{
+	snet_uint32 delay;
+
+	if (peer->tokenBucket.rate == 0 && host->tokenBucket.rate == 0 && peer->bandwidthClass == NULL)
+		return 0;
+
+	snet_token_bucket_refill(&peer->tokenBucket, host->serviceTime);
+	snet_token_bucket_refill(&host->tokenBucket, host->serviceTime);
+
+	delay = SNET_MAX(snet_token_bucket_delay(&peer->tokenBucket), snet_token_bucket_delay(&host->tokenBucket));
+	if (peer->bandwidthClass != NULL)
+	{
+		snet_uint32 classDelay = snet_bandwidth_class_delay(peer->bandwidthClass, host->serviceTime);
+
+		if (classDelay > 0)
+			peer->bandwidthClass->overlimits++;
+
+		delay = SNET_MAX(delay, classDelay);
+	}
+	if (delay == 0)
+		return 0;
+
+	if (host->tokenBucketDelay == 0 || delay < host->tokenBucketDelay)
+		host->tokenBucketDelay = delay;
+
+	return 1;
+}
+
 static int
 snet_protocol_send_outgoing_commands(SNetHost * host, SNetEvent * event, int checkForTimeouts)
 {
-	snet_uint8 headerData[sizeof(SNetProtocolHeader) + sizeof(snet_uint32)];
+	snet_uint8 headerData[sizeof(SNetProtocolHeader) + 2 * sizeof(snet_uint16) + sizeof(snet_uint32)];
 	SNetProtocolHeader * header = (SNetProtocolHeader *)headerData;
 	SNetPeer * currentPeer;
 	int sentLength;
-	size_t shouldCompress = 0;
+	size_t shouldCompress = 0, startPeer, peersScanned, headerSize;
+	snet_uint16 headerPeerID;
+	int passLimited;
+	SNetChecksumUpdateCallback checksumUpdate;
+	snet_uint32 checksumState = 0;
 
 	host->continueSending = 1;
+	host->tokenBucketDelay = 0;
 
+	/* only the peers in use are visited, which follow the free ones in host->freePeerList and
+	   may be freed as their timeouts are checked */
 	while (host->continueSending)
 		for (host->continueSending = 0,
-			currentPeer = host->peers;
-			currentPeer < &host->peers[host->peerCount];
-			++currentPeer)
+			startPeer = host->nextSendPeer,
+			passLimited = 0,
+			peersScanned = 0;
+			peersScanned < host->peerCount - host->freePeers;
+			++peersScanned)
 		{
+			size_t peerIndex = (startPeer + peersScanned) % (host->peerCount - host->freePeers);
+
+			/* each pass starts at the first peer held back by the previous one, so rate limited peers take turns */
+			currentPeer = host->freePeerList[host->freePeers + peerIndex];
+
 			if (currentPeer->state == SNET_PEER_STATE_DISCONNECTED ||
 				currentPeer->state == SNET_PEER_STATE_ZOMBIE)
 				continue;
 
+			headerPeerID = snet_protocol_header_peer_id(currentPeer->outgoingPeerID);
+			headerSize = sizeof(SNetProtocolHeader);
+			if (currentPeer->protocolFlags & SNET_PROTOCOL_CONNECT_FLAG_PRECISE_TIME)
+				headerSize += 2 * sizeof(snet_uint16);
+			else
+				if (headerPeerID == SNET_PROTOCOL_HEADER_EXTENDED_PEER_ID)
+					headerSize += sizeof(snet_uint16);
+
 			host->headerFlags = 0;
 			host->commandCount = 0;
 			host->bufferCount = 1;
-			host->packetSize = sizeof(SNetProtocolHeader);
+			host->packetSize = headerSize;
 
 			if (!snet_list_empty(&currentPeer->acknowledgements))
 				snet_protocol_send_acknowledgements(host, currentPeer);
 
 			if (checkForTimeouts != 0 &&
 				!snet_list_empty(&currentPeer->sentReliableCommands) &&
-				SNET_TIME_GREATER_EQUAL(host->serviceTime, currentPeer->nextTimeout) &&
-				snet_protocol_check_timeouts(host, currentPeer, event) == 1)
+				SNET_TIME_GREATER_EQUAL(host->serviceTime, currentPeer->nextTimeout))
 			{
-				if (event != NULL && event->type != SNET_EVENT_TYPE_NONE)
-					return 1;
-				else
+				unsigned long long phaseStart = snet_host_phase_start(host);
+				int timedOut = snet_protocol_check_timeouts(host, currentPeer, event);
+
+				snet_host_phase_end(host, SNET_HOST_PHASE_TIMEOUTS, phaseStart);
+
+				if (timedOut == 1)
+				{
+					if (event != NULL && event->type != SNET_EVENT_TYPE_NONE)
+						return 1;
+
+					/* a reset peer trades places with the first peer in use and the rest move down one, so
+					   the pass starts one place further back and the same index is checked again */
+					if (currentPeer->state == SNET_PEER_STATE_DISCONNECTED)
+					{
+						if (startPeer > 0)
+							--startPeer;
+						--peersScanned;
+					}
+
 					continue;
+				}
 			}
 
-			if ((snet_list_empty(&currentPeer->outgoingReliableCommands) ||
-				snet_protocol_send_reliable_outgoing_commands(host, currentPeer)) &&
-				snet_list_empty(&currentPeer->sentReliableCommands) &&
-				SNET_TIME_DIFFERENCE(host->serviceTime, currentPeer->lastReceiveTime) >= currentPeer->pingInterval &&
-				currentPeer->mtu - host->packetSize >= sizeof(SNetProtocolPing))
+			if (host->sessionTickets &&
+				currentPeer->state == SNET_PEER_STATE_CONNECTED &&
+				SNET_TIME_DIFFERENCE(host->serviceTime, currentPeer->sessionTicketTime) >= SNET_HOST_SESSION_TICKET_INTERVAL)
+				snet_peer_issue_session_ticket(currentPeer);
+
+			/* a rate limited peer still gets its acknowledgements, so the remote RTT is not inflated */
+			if (!snet_protocol_rate_limited(host, currentPeer))
 			{
-				snet_peer_ping(currentPeer);
-				snet_protocol_send_reliable_outgoing_commands(host, currentPeer);
-			}
+				if ((snet_list_empty(&currentPeer->outgoingReliableCommands) ||
+					snet_protocol_send_reliable_outgoing_commands(host, currentPeer)) &&
+					snet_list_empty(&currentPeer->sentReliableCommands) &&
+					SNET_TIME_DIFFERENCE(host->serviceTime, currentPeer->lastReceiveTime) >= currentPeer->pingInterval &&
+					currentPeer->mtu - host->packetSize >= sizeof(SNetProtocolPing))
+				{
+					snet_peer_ping(currentPeer);
+					snet_protocol_send_reliable_outgoing_commands(host, currentPeer);
+				}
 
-			if (!snet_list_empty(&currentPeer->outgoingUnreliableCommands))
-				snet_protocol_send_unreliable_outgoing_commands(host, currentPeer);
+				if (!snet_list_empty(&currentPeer->outgoingUnreliableCommands))
+					snet_protocol_send_unreliable_outgoing_commands(host, currentPeer);
+			}
+			else
+			if (!passLimited &&
+				(!snet_list_empty(&currentPeer->outgoingReliableCommands) ||
+				!snet_list_empty(&currentPeer->outgoingUnreliableCommands)))
+			{
+				host->nextSendPeer = peerIndex;
+				passLimited = 1;
+			}
 
 			if (host->commandCount == 0)
 				continue;
@@ -1676,22 +2284,72 @@ snet_protocol_send_outgoing_commands(SNetHost * host, SNetEvent * event, int che
 			host->buffers->data = headerData;
 			if (host->headerFlags & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME)
 			{
-				header->sentTime = SNET_HOST_TO_NET_16(host->serviceTime & 0xFFFF);
+				if (currentPeer->protocolFlags & SNET_PROTOCOL_CONNECT_FLAG_PRECISE_TIME)
+				{
+					snet_uint32 sentTime = snet_host_time_microseconds(host);
+
+					headerPeerID = SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME;
+					header->sentTime = SNET_HOST_TO_NET_16(sentTime & 0xFFFF);
+					*(snet_uint16 *)& headerData[sizeof(SNetProtocolHeader)] = SNET_HOST_TO_NET_16(currentPeer->outgoingPeerID);
+					*(snet_uint16 *)& headerData[sizeof(SNetProtocolHeader) + sizeof(snet_uint16)] = SNET_HOST_TO_NET_16(sentTime >> 16);
 
-				host->buffers->dataLength = sizeof(SNetProtocolHeader);
+					host->buffers->dataLength = sizeof(SNetProtocolHeader) + 2 * sizeof(snet_uint16);
+				}
+				else
+				{
+					header->sentTime = SNET_HOST_TO_NET_16(host->serviceTime & 0xFFFF);
+
+					host->buffers->dataLength = sizeof(SNetProtocolHeader);
+				}
 			}
 			else
 				host->buffers->dataLength = (size_t) & ((SNetProtocolHeader *)0)->sentTime;
 
+			if (headerPeerID == SNET_PROTOCOL_HEADER_EXTENDED_PEER_ID)
+			{
+				*(snet_uint16 *)& headerData[host->buffers->dataLength] = SNET_HOST_TO_NET_16(currentPeer->outgoingPeerID);
+				host->buffers->dataLength += sizeof(snet_uint16);
+			}
+
+			if (currentPeer->outgoingPeerID < SNET_PROTOCOL_MAXIMUM_PEER_ID)
+				host->headerFlags |= currentPeer->outgoingSessionID << SNET_PROTOCOL_HEADER_SESSION_SHIFT;
+
 			shouldCompress = 0;
+			checksumUpdate = NULL;
 			if (host->compressor.context != NULL && host->compressor.compress != NULL)
 			{
-				size_t originalSize = host->packetSize - sizeof(SNetProtocolHeader),
+				size_t originalSize = host->packetSize - headerSize,
+					compressedSize;
+				unsigned long long phaseStart = snet_host_phase_start(host);
+
+				if (host->checksum != NULL && host->compressor.compressChecksum != NULL)
+					checksumUpdate = snet_checksum_update_callback((SNetChecksumType)currentPeer->checksumType);
+
+				if (checksumUpdate != NULL)
+				{
+					snet_uint32 * checksum = (snet_uint32 *)& headerData[host->buffers->dataLength];
+
+					/* the header is only used as checksummed here if compression succeeds, so it can be folded in up front */
+					header->peerID = SNET_HOST_TO_NET_16(headerPeerID | host->headerFlags | SNET_PROTOCOL_HEADER_FLAG_COMPRESSED);
+					*checksum = currentPeer->outgoingPeerID < SNET_PROTOCOL_MAXIMUM_PEER_ID ? currentPeer->connectID : 0;
+					checksumState = checksumUpdate(0xFFFFFFFF, headerData, host->buffers->dataLength + sizeof(snet_uint32));
+
+					compressedSize = host->compressor.compressChecksum(host->compressor.context,
+						&host->buffers[1], host->bufferCount - 1,
+						originalSize,
+						host->packetData[1],
+						originalSize,
+						checksumUpdate, &checksumState);
+				}
+				else
 					compressedSize = host->compressor.compress(host->compressor.context,
 						&host->buffers[1], host->bufferCount - 1,
 						originalSize,
 						host->packetData[1],
 						originalSize);
+
+				snet_host_phase_end(host, SNET_HOST_PHASE_COMPRESS, phaseStart);
+
 				if (compressedSize > 0 && compressedSize < originalSize)
 				{
 					host->headerFlags |= SNET_PROTOCOL_HEADER_FLAG_COMPRESSED;
@@ -1702,15 +2360,16 @@ snet_protocol_send_outgoing_commands(SNetHost * host, SNetEvent * event, int che
 				}
 			}
 
-			if (currentPeer->outgoingPeerID < SNET_PROTOCOL_MAXIMUM_PEER_ID)
-				host->headerFlags |= currentPeer->outgoingSessionID << SNET_PROTOCOL_HEADER_SESSION_SHIFT;
-			header->peerID = SNET_HOST_TO_NET_16(currentPeer->outgoingPeerID | host->headerFlags);
+			header->peerID = SNET_HOST_TO_NET_16(headerPeerID | host->headerFlags);
 			if (host->checksum != NULL)
 			{
 				snet_uint32 * checksum = (snet_uint32 *)& headerData[host->buffers->dataLength];
 				*checksum = currentPeer->outgoingPeerID < SNET_PROTOCOL_MAXIMUM_PEER_ID ? currentPeer->connectID : 0;
 				host->buffers->dataLength += sizeof(snet_uint32);
-				*checksum = host->checksum(host->buffers, host->bufferCount);
+				if (shouldCompress > 0 && checksumUpdate != NULL)
+					*checksum = SNET_HOST_TO_NET_32(~checksumState);
+				else
+					*checksum = snet_protocol_checksum(host, currentPeer->checksumType)(host->buffers, host->bufferCount);
 			}
 
 			if (shouldCompress > 0)
@@ -1722,13 +2381,32 @@ snet_protocol_send_outgoing_commands(SNetHost * host, SNetEvent * event, int che
 
 			currentPeer->lastSendTime = host->serviceTime;
 
-			sentLength = snet_socket_send(host->socket, &currentPeer->address, host->buffers, host->bufferCount);
+			sentLength = snet_host_send(host, &currentPeer->address, host->buffers, host->bufferCount);
+
+			/* recorded before the sent unreliable packets the buffers point into are released */
+			if (host->capture != NULL && sentLength > 0)
+				snet_host_capture_datagram(host, 1, currentPeer->incomingPeerID, &currentPeer->address, host->buffers, host->bufferCount,
+					shouldCompress > 0 ? sentLength - shouldCompress + host->packetSize - headerSize : 0);
 
 			snet_protocol_remove_sent_unreliable_commands(currentPeer);
 
 			if (sentLength < 0)
 				return -1;
 
+			if (currentPeer->tokenBucket.rate != 0)
+				currentPeer->tokenBucket.tokens -= sentLength;
+			if (host->tokenBucket.rate != 0)
+				host->tokenBucket.tokens -= sentLength;
+			if (currentPeer->bandwidthClass != NULL)
+				snet_bandwidth_class_charge(currentPeer->bandwidthClass, sentLength);
+
+			SNET_TRACE(host, SNET_TRACE_SEND, send, currentPeer, sentLength, host->commandCount, shouldCompress > 0);
+
+			currentPeer->totalSentData += sentLength;
+			currentPeer->totalSentUncompressedData += sentLength;
+			if (shouldCompress > 0)
+				currentPeer->totalSentUncompressedData += host->packetSize - headerSize - shouldCompress;
+
 			host->totalSentData += sentLength;
 			host->totalSentPackets++;
 		}
@@ -1745,9 +2423,41 @@ snet_protocol_send_outgoing_commands(SNetHost * host, SNetEvent * event, int che
 void
 snet_host_flush(SNetHost * host)
 {
-	host->serviceTime = snet_time_get();
+	host->serviceTime = snet_host_time(host);
 
 	snet_protocol_send_outgoing_commands(host, NULL, 0);
+	snet_host_send_batch(host);
+}
+
+/* runs one phase of snet_host_service, timing it if the host keeps histograms */
+static int
+snet_protocol_service_phase(SNetHost * host, SNetEvent * event, SNetHostPhase phase)
+{
+	unsigned long long phaseStart = snet_host_phase_start(host);
+	int result;
+
+	switch (phase)
+	{
+	case SNET_HOST_PHASE_DISPATCH:
+		result = snet_protocol_dispatch_incoming_commands(host, event);
+		break;
+
+	case SNET_HOST_PHASE_RECEIVE:
+		result = snet_protocol_receive_incoming_commands(host, event);
+		break;
+
+	default:
+		result = snet_protocol_send_outgoing_commands(host, event, 1);
+		break;
+	}
+
+	/* whatever the phase sent, such as acknowledgements or replies to connects, goes out together */
+	if (snet_host_send_batch(host) < 0)
+		result = -1;
+
+	snet_host_phase_end(host, phase, phaseStart);
+
+	return result;
 }
 
 /** Checks for any queued events on the host and dispatches one if available.
@@ -1787,7 +2497,7 @@ if event == NULL then no events will be delivered
 int
 snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 {
-	snet_uint32 waitCondition;
+	snet_uint32 waitCondition, waitTime;
 
 	if (event != NULL)
 	{
@@ -1795,7 +2505,7 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 		event->peer = NULL;
 		event->packet = NULL;
 
-		switch (snet_protocol_dispatch_incoming_commands(host, event))
+		switch (snet_protocol_service_phase(host, event, SNET_HOST_PHASE_DISPATCH))
 		{
 		case 1:
 			return 1;
@@ -1812,7 +2522,7 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 		}
 	}
 
-	host->serviceTime = snet_time_get();
+	host->serviceTime = snet_host_time(host);
 
 	timeout += host->serviceTime;
 
@@ -1821,7 +2531,7 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 		if (SNET_TIME_DIFFERENCE(host->serviceTime, host->bandwidthThrottleEpoch) >= SNET_HOST_BANDWIDTH_THROTTLE_INTERVAL)
 			snet_host_bandwidth_throttle(host);
 
-		switch (snet_protocol_send_outgoing_commands(host, event, 1))
+		switch (snet_protocol_service_phase(host, event, SNET_HOST_PHASE_SEND))
 		{
 		case 1:
 			return 1;
@@ -1837,7 +2547,7 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 			break;
 		}
 
-		switch (snet_protocol_receive_incoming_commands(host, event))
+		switch (snet_protocol_service_phase(host, event, SNET_HOST_PHASE_RECEIVE))
 		{
 		case 1:
 			return 1;
@@ -1853,7 +2563,7 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 			break;
 		}
 
-		switch (snet_protocol_send_outgoing_commands(host, event, 1))
+		switch (snet_protocol_service_phase(host, event, SNET_HOST_PHASE_SEND))
 		{
 		case 1:
 			return 1;
@@ -1871,7 +2581,7 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 
 		if (event != NULL)
 		{
-			switch (snet_protocol_dispatch_incoming_commands(host, event))
+			switch (snet_protocol_service_phase(host, event, SNET_HOST_PHASE_DISPATCH))
 			{
 			case 1:
 				return 1;
@@ -1893,19 +2603,23 @@ snet_host_service(SNetHost * host, SNetEvent * event, snet_uint32 timeout)
 
 		do
 		{
-			host->serviceTime = snet_time_get();
+			host->serviceTime = snet_host_time(host);
 
 			if (SNET_TIME_GREATER_EQUAL(host->serviceTime, timeout))
 				return 0;
 
 			waitCondition = SNET_SOCKET_WAIT_RECEIVE | SNET_SOCKET_WAIT_INTERRUPT;
 
-			if (snet_socket_wait(host->socket, &waitCondition, SNET_TIME_DIFFERENCE(timeout, host->serviceTime)) != 0)
+			waitTime = SNET_TIME_DIFFERENCE(timeout, host->serviceTime);
+			if (host->tokenBucketDelay != 0 && host->tokenBucketDelay < waitTime)
+				waitTime = host->tokenBucketDelay;
+
+			if (snet_host_wait(host, &waitCondition, waitTime) != 0)
 				return -1;
 		} while (waitCondition & SNET_SOCKET_WAIT_INTERRUPT);
 
-		host->serviceTime = snet_time_get();
-	} while (waitCondition & SNET_SOCKET_WAIT_RECEIVE);
+		host->serviceTime = snet_host_time(host);
+	} while ((waitCondition & SNET_SOCKET_WAIT_RECEIVE) || host->tokenBucketDelay != 0);
 
 	return 0;
 }
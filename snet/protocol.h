@@ -16,8 +16,10 @@ enum
 	SNET_PROTOCOL_MAXIMUM_WINDOW_SIZE = 65536,
 	SNET_PROTOCOL_MINIMUM_CHANNEL_COUNT = 1,
 	SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT = 255,
-	SNET_PROTOCOL_MAXIMUM_PEER_ID = 0xFFF,
-	SNET_PROTOCOL_MAXIMUM_FRAGMENT_COUNT = 1024 * 1024
+	SNET_PROTOCOL_MAXIMUM_PEER_ID = 0xFFFF,
+	SNET_PROTOCOL_MAXIMUM_FRAGMENT_COUNT = 1024 * 1024,
+	SNET_PROTOCOL_CONNECT_COOKIE_SIZE = 8,
+	SNET_PROTOCOL_MAXIMUM_STREAM_HEADER_SIZE = 7
 };
 
 typedef enum _SNetProtocolCommand
@@ -35,7 +37,9 @@ typedef enum _SNetProtocolCommand
 	SNET_PROTOCOL_COMMAND_BANDWIDTH_LIMIT = 10,
 	SNET_PROTOCOL_COMMAND_THROTTLE_CONFIGURE = 11,
 	SNET_PROTOCOL_COMMAND_SEND_UNRELIABLE_FRAGMENT = 12,
-	SNET_PROTOCOL_COMMAND_COUNT = 13,
+	SNET_PROTOCOL_COMMAND_CONNECT_COOKIE = 13,
+	SNET_PROTOCOL_COMMAND_SESSION_TICKET = 14,
+	SNET_PROTOCOL_COMMAND_COUNT = 15,
 
 	SNET_PROTOCOL_COMMAND_MASK = 0x0F
 } SNetProtocolCommand;
@@ -43,16 +47,36 @@ typedef enum _SNetProtocolCommand
 typedef enum _SNetProtocolFlag
 {
 	SNET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE = (1 << 7),
+	/* on a reliable send or fragment, the packet is delivered on arrival rather than in sequence */
 	SNET_PROTOCOL_COMMAND_FLAG_UNSEQUENCED = (1 << 6),
+	/* on an acknowledgement, the sent time is the whole one in microseconds */
+	SNET_PROTOCOL_COMMAND_FLAG_PRECISE_SENT_TIME = (1 << 5),
+	/* on a reliable send or fragment, the command is followed by the stream ID as a varint and
+	   16 bits giving how far back in the channel's reliable sequence the packet sent before it
+	   on the stream lies, or 0 if every packet sent before it on the stream was acknowledged */
+	SNET_PROTOCOL_COMMAND_FLAG_STREAM = (1 << 4),
 
 	SNET_PROTOCOL_HEADER_FLAG_COMPRESSED = (1 << 14),
 	SNET_PROTOCOL_HEADER_FLAG_SENT_TIME = (1 << 15),
 	SNET_PROTOCOL_HEADER_FLAG_MASK = SNET_PROTOCOL_HEADER_FLAG_COMPRESSED | SNET_PROTOCOL_HEADER_FLAG_SENT_TIME,
 
 	SNET_PROTOCOL_HEADER_SESSION_MASK = (3 << 12),
-	SNET_PROTOCOL_HEADER_SESSION_SHIFT = 12
+	SNET_PROTOCOL_HEADER_SESSION_SHIFT = 12,
+
+	/* as an extended peer ID, followed by the upper 16 bits of a sent time in microseconds */
+	SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME = 0xFFD,
+	/* peer IDs from SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME up follow the sent time in 16 bits of their own */
+	SNET_PROTOCOL_HEADER_EXTENDED_PEER_ID = 0xFFE,
+	SNET_PROTOCOL_HEADER_NO_PEER_ID = 0xFFF
 } SNetProtocolFlag;
 
+/** Optional parts of the protocol, offered in a connect and accepted in its verify. */
+typedef enum _SNetProtocolConnectFlag
+{
+	SNET_PROTOCOL_CONNECT_FLAG_PRECISE_TIME = (1 << 0),  /**< sent times in microseconds, as set by snet_host_precise_time() */
+	SNET_PROTOCOL_CONNECT_FLAG_STREAMS = (1 << 1)        /**< ordered streams within channels, sent by snet_peer_send_stream() */
+} SNetProtocolConnectFlag;
+
 #ifdef _MSC_VER
 #pragma pack(push, 1)
 #define SNET_PACKED
@@ -82,6 +106,23 @@ typedef struct _SNetProtocolAcknowledge
 	snet_uint16 receivedSentTime;
 } SNET_PACKED SNetProtocolAcknowledge;
 
+typedef struct _SNetProtocolPreciseAcknowledge
+{
+	SNetProtocolCommandHeader header;
+	snet_uint16 receivedReliableSequenceNumber;
+	snet_uint32 receivedSentTime;
+} SNET_PACKED SNetProtocolPreciseAcknowledge;
+
+/** Connection state a host signs and hands to a peer, which presents it again when reconnecting. */
+typedef struct _SNetSessionTicket
+{
+	snet_uint32 issueTime;             /**< the issuing host's service time, in milliseconds */
+	snet_uint32 roundTripTime;
+	snet_uint32 roundTripTimeVariance;
+	snet_uint32 packetThrottle;
+	snet_uint8  mac[8];
+} SNET_PACKED SNetSessionTicket;
+
 typedef struct _SNetProtocolConnect
 {
 	SNetProtocolCommandHeader header;
@@ -98,8 +139,25 @@ typedef struct _SNetProtocolConnect
 	snet_uint32 packetThrottleDeceleration;
 	snet_uint32 connectID;
 	snet_uint32 data;
+	snet_uint8  checksumType;
+	snet_uint8  flags;
+	snet_uint8  cookie[SNET_PROTOCOL_CONNECT_COOKIE_SIZE];
+	SNetSessionTicket ticket;
 } SNET_PACKED SNetProtocolConnect;
 
+typedef struct _SNetProtocolConnectCookie
+{
+	SNetProtocolCommandHeader header;
+	snet_uint32 connectID;
+	snet_uint8  cookie[SNET_PROTOCOL_CONNECT_COOKIE_SIZE];
+} SNET_PACKED SNetProtocolConnectCookie;
+
+typedef struct _SNetProtocolSessionTicket
+{
+	SNetProtocolCommandHeader header;
+	SNetSessionTicket ticket;
+} SNET_PACKED SNetProtocolSessionTicket;
+
 typedef struct _SNetProtocolVerifyConnect
 {
 	SNetProtocolCommandHeader header;
@@ -115,6 +173,8 @@ typedef struct _SNetProtocolVerifyConnect
 	snet_uint32 packetThrottleAcceleration;
 	snet_uint32 packetThrottleDeceleration;
 	snet_uint32 connectID;
+	snet_uint8  checksumType;
+	snet_uint8  flags;
 } SNET_PACKED SNetProtocolVerifyConnect;
 
 typedef struct _SNetProtocolBandwidthLimit
@@ -178,8 +238,11 @@ typedef union _SNetProtocol
 {
 	SNetProtocolCommandHeader header;
 	SNetProtocolAcknowledge acknowledge;
+	SNetProtocolPreciseAcknowledge preciseAcknowledge;
 	SNetProtocolConnect connect;
 	SNetProtocolVerifyConnect verifyConnect;
+	SNetProtocolConnectCookie connectCookie;
+	SNetProtocolSessionTicket sessionTicket;
 	SNetProtocolDisconnect disconnect;
 	SNetProtocolPing ping;
 	SNetProtocolSendReliable sendReliable;
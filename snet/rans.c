@@ -0,0 +1,373 @@
+/**
+@file rans.c
+@brief An adaptive order-0 rANS coder with flat frequency tables
+*/
+#define SNET_BUILDING_LIB 1
+#include <string.h>
+#include "snet/snet.h"
+
+/* speed-optimized alternative to the PPM range coder in compress.c: a single flat
+   cumulative frequency table per packet, no divisions on either side of the coder */
+enum
+{
+	SNET_RANS_CODER_SCALE_BITS = 12,
+	SNET_RANS_CODER_SCALE = 1 << SNET_RANS_CODER_SCALE_BITS,
+	SNET_RANS_CODER_LOWER_BOUND = 1 << 23,
+
+	/* the model is rebuilt whenever the number of coded symbols reaches a power of two at or above this */
+	SNET_RANS_CODER_REBUILD_MINIMUM = 16,
+	/* frequency every symbol keeps regardless of its count, so short packets are not overfitted */
+	SNET_RANS_CODER_SYMBOL_MINIMUM = 2,
+	/* the decoder maps a slot to its symbol through a coarse bucket table plus a short forward scan */
+	SNET_RANS_CODER_BUCKET_BITS = 4,
+
+	SNET_RANS_CODER_MAXIMUM_SYMBOLS = SNET_PROTOCOL_MAXIMUM_MTU,
+	/* bytes coded between checksum updates, so each block is folded in while it is still in L1 */
+	SNET_RANS_CODER_CHECKSUM_BLOCK = 64
+};
+
+typedef struct _SNetRansModel
+{
+	snet_uint16 counts[256];
+	snet_uint16 frequencies[256];
+	snet_uint16 cumulative[257];
+	snet_uint8  buckets[SNET_RANS_CODER_SCALE >> SNET_RANS_CODER_BUCKET_BITS];
+	size_t      symbolCount;
+	size_t      symbolLimit;
+	snet_uint8  mostFrequent;
+} SNetRansModel;
+
+typedef struct _SNetRansCoder
+{
+	SNetRansModel model;
+	/* every packet starts from the same uniform model */
+	SNetRansModel uniformModel;
+	/* reciprocals of every possible frequency, so encoding x / freq becomes a multiply and shift */
+	snet_uint32   reciprocals[SNET_RANS_CODER_SCALE];
+	snet_uint8    reciprocalShifts[SNET_RANS_CODER_SCALE];
+	/* symbols are modelled front to back but must be encoded back to front */
+	snet_uint16   symbolStarts[SNET_RANS_CODER_MAXIMUM_SYMBOLS];
+	snet_uint16   symbolFrequencies[SNET_RANS_CODER_MAXIMUM_SYMBOLS];
+} SNetRansCoder;
+
+static void
+snet_rans_model_reset(SNetRansModel * model)
+{
+	int symbol;
+
+	memset(model, 0, sizeof(SNetRansModel));
+
+	for (symbol = 0; symbol < 256; ++symbol)
+	{
+		model->frequencies[symbol] = SNET_RANS_CODER_SCALE / 256;
+		model->cumulative[symbol] = symbol * (SNET_RANS_CODER_SCALE / 256);
+		model->buckets[(symbol * (SNET_RANS_CODER_SCALE / 256)) >> SNET_RANS_CODER_BUCKET_BITS] = symbol;
+	}
+	model->cumulative[256] = SNET_RANS_CODER_SCALE;
+}
+
+void *
+snet_rans_coder_create(void)
+{
+	SNetRansCoder * ransCoder = (SNetRansCoder *)snet_malloc(sizeof(SNetRansCoder));
+	snet_uint32 frequency;
+
+	if (ransCoder == NULL)
+		return NULL;
+
+	snet_rans_model_reset(&ransCoder->uniformModel);
+
+	ransCoder->reciprocals[0] = 0;
+	ransCoder->reciprocalShifts[0] = 0;
+
+	for (frequency = 1; frequency < SNET_RANS_CODER_SCALE; ++frequency)
+	{
+		snet_uint32 shift = 0;
+
+		if (frequency < 2)
+		{
+			ransCoder->reciprocals[frequency] = ~0U;
+			ransCoder->reciprocalShifts[frequency] = 0;
+			continue;
+		}
+
+		while (frequency > (1U << shift))
+			++shift;
+
+		ransCoder->reciprocals[frequency] = (snet_uint32)(((1ULL << (shift + 31)) + frequency - 1) / frequency);
+		ransCoder->reciprocalShifts[frequency] = (snet_uint8)(shift - 1);
+	}
+
+	return ransCoder;
+}
+
+void
+snet_rans_coder_destroy(void * context)
+{
+	SNetRansCoder * ransCoder = (SNetRansCoder *)context;
+	if (ransCoder == NULL)
+		return;
+
+	snet_free(ransCoder);
+}
+
+/* Redistributes the scale over the observed counts.  symbolCount is always a power of two
+   here, so the normalization is a shift and both sides of the coder agree bit for bit. */
+static void
+snet_rans_model_rebuild(SNetRansModel * model)
+{
+	snet_uint32 shift = 0, cumulative = 0, remainder;
+	int symbol;
+
+	while (((size_t)1 << shift) < model->symbolCount)
+		++shift;
+
+	for (symbol = 0; symbol < 256; ++symbol)
+	{
+		snet_uint32 frequency = SNET_RANS_CODER_SYMBOL_MINIMUM +
+			((model->counts[symbol] * (snet_uint32)(SNET_RANS_CODER_SCALE - 256 * SNET_RANS_CODER_SYMBOL_MINIMUM)) >> shift);
+
+		model->frequencies[symbol] = (snet_uint16)frequency;
+		model->cumulative[symbol] = (snet_uint16)cumulative;
+		cumulative += frequency;
+	}
+
+	/* rounding leftovers go to the most frequent symbol */
+	remainder = SNET_RANS_CODER_SCALE - cumulative;
+	model->frequencies[model->mostFrequent] += (snet_uint16)remainder;
+	for (symbol = model->mostFrequent + 1; symbol < 256; ++symbol)
+		model->cumulative[symbol] += (snet_uint16)remainder;
+}
+
+/* only the decoder needs to map slots back to symbols */
+static void
+snet_rans_model_rebuild_buckets(SNetRansModel * model)
+{
+	snet_uint32 slot;
+	int symbol = 0;
+
+	for (slot = 0; slot < SNET_RANS_CODER_SCALE; slot += 1 << SNET_RANS_CODER_BUCKET_BITS)
+	{
+		while (model->cumulative[symbol + 1] <= slot)
+			++symbol;
+		model->buckets[slot >> SNET_RANS_CODER_BUCKET_BITS] = (snet_uint8)symbol;
+	}
+}
+
+#define SNET_RANS_MODEL_UPDATE(model, symbol, rebuildBuckets) \
+{ \
+    if (++ (model) -> counts [symbol] > (model) -> counts [(model) -> mostFrequent]) \
+      (model) -> mostFrequent = symbol; \
+    ++ (model) -> symbolCount; \
+    if ((model) -> symbolCount >= SNET_RANS_CODER_REBUILD_MINIMUM && \
+        (model) -> symbolCount < (model) -> symbolLimit && \
+        ! ((model) -> symbolCount & ((model) -> symbolCount - 1))) \
+    { \
+        snet_rans_model_rebuild (model); \
+        rebuildBuckets; \
+    } \
+}
+
+/* The modelling pass is the only one that reads the input, so the checksum is folded in block by block as it goes. */
+size_t
+snet_rans_coder_compress_checksum(void * context, const SNetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, snet_uint8 * outData, size_t outLimit, SNetChecksumUpdateCallback update, snet_uint32 * checksum)
+{
+	SNetRansCoder * ransCoder = (SNetRansCoder *)context;
+	SNetRansModel * model;
+	snet_uint8 * outEnd = &outData[outLimit], *outPosition = outEnd;
+	size_t symbol, symbolCount = 0, headerSize;
+	snet_uint32 state = SNET_RANS_CODER_LOWER_BOUND;
+
+	if (ransCoder == NULL || inBufferCount <= 0 || inLimit <= 0 || inLimit > SNET_RANS_CODER_MAXIMUM_SYMBOLS)
+		return 0;
+
+	for (symbol = 0; symbol < inBufferCount; ++symbol)
+		symbolCount += inBuffers[symbol].dataLength;
+	if (symbolCount > SNET_RANS_CODER_MAXIMUM_SYMBOLS)
+		return 0;
+
+	model = &ransCoder->model;
+	*model = ransCoder->uniformModel;
+	model->symbolLimit = symbolCount;
+	symbolCount = 0;
+
+	while (inBufferCount-- > 0)
+	{
+		const snet_uint8 * inData = (const snet_uint8 *)inBuffers->data,
+			*inEnd = &inData[inBuffers->dataLength];
+
+		while (inData < inEnd)
+		{
+			const snet_uint8 * blockStart = inData,
+				*blockEnd = inEnd - inData > SNET_RANS_CODER_CHECKSUM_BLOCK ? &inData[SNET_RANS_CODER_CHECKSUM_BLOCK] : inEnd;
+
+			while (inData < blockEnd)
+			{
+				snet_uint8 value = *inData++;
+
+				ransCoder->symbolStarts[symbolCount] = model->cumulative[value];
+				ransCoder->symbolFrequencies[symbolCount] = model->frequencies[value];
+				++symbolCount;
+
+				SNET_RANS_MODEL_UPDATE(model, value, );
+			}
+
+			if (update != NULL)
+				*checksum = update(*checksum, blockStart, (size_t)(inData - blockStart));
+		}
+
+		++inBuffers;
+	}
+
+	headerSize = symbolCount < 0x80 ? 1 : 2;
+
+	for (symbol = symbolCount; symbol-- > 0;)
+	{
+		snet_uint32 start = ransCoder->symbolStarts[symbol],
+			frequency = ransCoder->symbolFrequencies[symbol],
+			maximum = ((SNET_RANS_CODER_LOWER_BOUND >> SNET_RANS_CODER_SCALE_BITS) << 8) * frequency,
+			quotient;
+
+		while (state >= maximum)
+		{
+			if (outPosition <= &outData[headerSize])
+				return 0;
+			*--outPosition = (snet_uint8)(state & 0xFF);
+			state >>= 8;
+		}
+
+		/* state / frequency via reciprocal; frequency 1 is folded into the bias */
+		quotient = (snet_uint32)(((unsigned long long)state * ransCoder->reciprocals[frequency]) >> 32) >> ransCoder->reciprocalShifts[frequency];
+		state += (frequency < 2 ? start + SNET_RANS_CODER_SCALE - 1 : start) + quotient * (SNET_RANS_CODER_SCALE - frequency);
+	}
+
+	if (outPosition - &outData[headerSize] < 4)
+		return 0;
+
+	outPosition -= 4;
+	outPosition[0] = (snet_uint8)(state >> 0);
+	outPosition[1] = (snet_uint8)(state >> 8);
+	outPosition[2] = (snet_uint8)(state >> 16);
+	outPosition[3] = (snet_uint8)(state >> 24);
+
+	if (headerSize > 1)
+	{
+		outData[0] = (snet_uint8)(0x80 | (symbolCount >> 8));
+		outData[1] = (snet_uint8)(symbolCount & 0xFF);
+	}
+	else
+		outData[0] = (snet_uint8)symbolCount;
+
+	memmove(&outData[headerSize], outPosition, outEnd - outPosition);
+
+	return headerSize + (size_t)(outEnd - outPosition);
+}
+
+size_t
+snet_rans_coder_compress(void * context, const SNetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, snet_uint8 * outData, size_t outLimit)
+{
+	return snet_rans_coder_compress_checksum(context, inBuffers, inBufferCount, inLimit, outData, outLimit, NULL, NULL);
+}
+
+size_t
+snet_rans_coder_decompress_checksum(void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit, SNetChecksumUpdateCallback update, snet_uint32 * checksum)
+{
+	SNetRansCoder * ransCoder = (SNetRansCoder *)context;
+	SNetRansModel * model;
+	const snet_uint8 * inEnd = &inData[inLimit];
+	snet_uint8 * outStart = outData, *outEnd;
+	size_t symbolCount;
+	snet_uint32 state;
+
+	if (ransCoder == NULL || inLimit <= 0)
+		return 0;
+
+	symbolCount = *inData++;
+	if (symbolCount & 0x80)
+	{
+		if (inData >= inEnd)
+			return 0;
+		symbolCount = ((symbolCount & 0x7F) << 8) | *inData++;
+	}
+
+	if (symbolCount > outLimit || symbolCount > SNET_RANS_CODER_MAXIMUM_SYMBOLS || inEnd - inData < 4)
+		return 0;
+
+	state = (snet_uint32)inData[0] | ((snet_uint32)inData[1] << 8) | ((snet_uint32)inData[2] << 16) | ((snet_uint32)inData[3] << 24);
+	inData += 4;
+
+	model = &ransCoder->model;
+	*model = ransCoder->uniformModel;
+	model->symbolLimit = symbolCount;
+
+	for (outEnd = &outData[symbolCount]; outData < outEnd;)
+	{
+		snet_uint8 * blockStart = outData,
+			*blockEnd = outEnd - outData > SNET_RANS_CODER_CHECKSUM_BLOCK ? &outData[SNET_RANS_CODER_CHECKSUM_BLOCK] : outEnd;
+
+		for (; outData < blockEnd; ++outData)
+		{
+			snet_uint32 slot = state & (SNET_RANS_CODER_SCALE - 1);
+			size_t symbol = model->buckets[slot >> SNET_RANS_CODER_BUCKET_BITS];
+
+			while (model->cumulative[symbol + 1] <= slot)
+				++symbol;
+
+			state = model->frequencies[symbol] * (state >> SNET_RANS_CODER_SCALE_BITS) + slot - model->cumulative[symbol];
+
+			while (state < SNET_RANS_CODER_LOWER_BOUND)
+			{
+				if (inData >= inEnd)
+					return 0;
+				state = (state << 8) | *inData++;
+			}
+
+			*outData = (snet_uint8)symbol;
+
+			SNET_RANS_MODEL_UPDATE(model, symbol, snet_rans_model_rebuild_buckets(model));
+		}
+
+		if (update != NULL)
+			*checksum = update(*checksum, blockStart, (size_t)(outData - blockStart));
+	}
+
+	if (state != SNET_RANS_CODER_LOWER_BOUND || inData != inEnd)
+		return 0;
+
+	return (size_t)(outData - outStart);
+}
+
+size_t
+snet_rans_coder_decompress(void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit)
+{
+	return snet_rans_coder_decompress_checksum(context, inData, inLimit, outData, outLimit, NULL, NULL);
+}
+
+/** @defgroup host SNet host functions
+@{
+*/
+
+/** Sets the packet compressor the host should use to the rANS coder.
+@param host host to enable the rANS coder for
+@returns 0 on success, < 0 on failure
+@remarks The rANS coder trades some compression ratio against the default range coder for
+considerably less CPU time per byte.  Both sides of a connection must use the same compressor.
+*/
+int
+snet_host_compress_with_rans_coder(SNetHost * host)
+{
+	SNetCompressor compressor;
+	memset(&compressor, 0, sizeof(compressor));
+	compressor.context = snet_rans_coder_create();
+	if (compressor.context == NULL)
+		return -1;
+	compressor.compress = snet_rans_coder_compress;
+	compressor.decompress = snet_rans_coder_decompress;
+	compressor.destroy = snet_rans_coder_destroy;
+	compressor.compressChecksum = snet_rans_coder_compress_checksum;
+	compressor.decompressChecksum = snet_rans_coder_decompress_checksum;
+	snet_host_compress(host, &compressor);
+	return 0;
+}
+
+/** @} */
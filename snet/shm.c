@@ -0,0 +1,1168 @@
+/**
+@file  shm.c
+@brief SNet shared-memory transport for peers on the same machine
+*/
+#ifdef __linux__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#endif
+
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+#include "snet/time.h"
+
+/** @defgroup shm SNet shared-memory functions
+@{
+*/
+
+#ifdef __linux__
+
+enum
+{
+	SNET_SHARED_RING_SIZE = 1024 * 1024,
+	SNET_SHARED_MAGIC = 0x534E4D31,
+	SNET_SHARED_WRAP = 0xFFFFFFFF,
+	SNET_SHARED_ACCEPT_INTERVAL = 1,
+	SNET_SHARED_CHECK_INTERVAL = 100,
+	SNET_SHARED_HELLO_TIMEOUT = 100,
+	SNET_SHARED_PENDING_COUNT = 16,
+	SNET_SHARED_REFUSAL_COUNT = 16,
+	SNET_SHARED_REFUSAL_TIMEOUT = 5000
+};
+
+/* A single-producer, single-consumer ring of length-prefixed datagrams. Each index is written
+   by one side only and sits on its own cache line. */
+typedef struct _SNetSharedRing
+{
+	snet_uint32 head;                  /* advanced by the consumer */
+	snet_uint8  headPadding[60];
+	snet_uint32 tail;                  /* advanced by the producer */
+	snet_uint8  tailPadding[60];
+	snet_uint32 sleeping;              /* set while the consumer waits on its eventfd */
+	snet_uint8  sleepingPadding[60];
+	snet_uint8  data[SNET_SHARED_RING_SIZE];
+} SNetSharedRing;
+
+typedef struct _SNetSharedHello
+{
+	snet_uint32 magic;
+	snet_uint32 ringSize;
+	snet_uint32 host;                  /* the client's address as the server would see it over UDP */
+	snet_uint16 port;
+	snet_uint16 reserved;
+} SNetSharedHello;
+
+/* Ring i carries datagrams from side i, the client being side 0, and events[i] wakes its consumer. */
+typedef struct _SNetSharedLink
+{
+	SNetAddress      address;          /* the other side's address, as used over UDP */
+	int              side;
+	int              control;          /* hangs up when the other side goes away */
+	int              events[2];
+	SNetSharedRing * rings;
+} SNetSharedLink;
+
+typedef struct _SNetSharedRefusal
+{
+	SNetAddress address;
+	snet_uint32 time;
+} SNetSharedRefusal;
+
+/* an accepted control socket whose hello has yet to arrive */
+typedef struct _SNetSharedPending
+{
+	int         control;
+	snet_uint32 time;
+} SNetSharedPending;
+
+typedef struct _SNetSharedMemory
+{
+	SNetHost *        host;
+	SNetTransport     transport;       /* the transport carrying datagrams for other machines */
+	SNetSocket        socket;
+	snet_uint16       port;
+	int               listener;
+	SNetSharedLink *  links;
+	size_t            linkCount;
+	size_t            linkCapacity;
+	size_t            nextLink;        /* where the next receive starts, linkCount being the wrapped transport */
+	struct pollfd *   pollSet;
+	SNetSharedPending pending[SNET_SHARED_PENDING_COUNT];
+	size_t            pendingCount;
+	SNetSharedRefusal refusals[SNET_SHARED_REFUSAL_COUNT];
+	size_t            nextRefusal;
+	snet_uint32       acceptTime;
+	snet_uint32       checkTime;
+} SNetSharedMemory;
+
+/* the listener's name for a host bound to host and port, where host may be SNET_HOST_ANY */
+static socklen_t
+snet_shared_name(struct sockaddr_un * name, snet_uint32 host, snet_uint16 port)
+{
+	int nameLength;
+
+	memset(name, 0, sizeof(struct sockaddr_un));
+
+	name->sun_family = AF_UNIX;
+
+	/* abstract names vanish with their socket and are private to the network namespace */
+	nameLength = snprintf(name->sun_path + 1, sizeof(name->sun_path) - 1, "snet-shm-%08x-%u",
+		(unsigned)SNET_NET_TO_HOST_32(host), (unsigned)port);
+
+	return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + nameLength);
+}
+
+static int
+snet_shared_ring_write(SNetSharedRing * ring, const SNetBuffer * buffers, size_t bufferCount)
+{
+	snet_uint32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+		tail = ring->tail,
+		position = tail & (SNET_SHARED_RING_SIZE - 1),
+		needed,
+		recordLength;
+	size_t dataLength = 0, i;
+	snet_uint8 * data;
+
+	for (i = 0; i < bufferCount; ++i)
+		dataLength += buffers[i].dataLength;
+
+	if (dataLength > SNET_PROTOCOL_MAXIMUM_MTU)
+		return -1;
+
+	recordLength = (snet_uint32)((sizeof(snet_uint32) + dataLength + 3) & ~3);
+	needed = recordLength;
+	if (position + recordLength > SNET_SHARED_RING_SIZE)
+		needed += SNET_SHARED_RING_SIZE - position;
+
+	if (SNET_SHARED_RING_SIZE - (tail - head) < needed)
+		return 0;
+
+	if (position + recordLength > SNET_SHARED_RING_SIZE)
+	{
+		*(snet_uint32 *)&ring->data[position] = SNET_SHARED_WRAP;
+
+		tail += SNET_SHARED_RING_SIZE - position;
+		position = 0;
+	}
+
+	*(snet_uint32 *)&ring->data[position] = (snet_uint32)dataLength;
+
+	data = &ring->data[position + sizeof(snet_uint32)];
+	for (i = 0; i < bufferCount; ++i)
+	{
+		memcpy(data, buffers[i].data, buffers[i].dataLength);
+		data += buffers[i].dataLength;
+	}
+
+	/* sequentially consistent, so either the consumer sees the datagram before it sleeps or
+	   the producer sees it sleeping */
+	__atomic_store_n(&ring->tail, tail + recordLength, __ATOMIC_SEQ_CST);
+
+	return (int)dataLength;
+}
+
+static int
+snet_shared_ring_read(SNetSharedRing * ring, SNetBuffer * buffers, size_t bufferCount)
+{
+	snet_uint32 head = ring->head,
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE),
+		position = head & (SNET_SHARED_RING_SIZE - 1),
+		dataLength;
+	size_t bufferLength = 0, copied, i;
+
+	if (head == tail)
+		return 0;
+
+	dataLength = *(snet_uint32 *)&ring->data[position];
+	if (dataLength == SNET_SHARED_WRAP)
+	{
+		head += SNET_SHARED_RING_SIZE - position;
+		position = 0;
+
+		dataLength = *(snet_uint32 *)&ring->data[position];
+	}
+
+	for (i = 0; i < bufferCount; ++i)
+		bufferLength += buffers[i].dataLength;
+
+	/* the other side is trusted as far as the segment goes, but not to stay within it */
+	if (dataLength > SNET_PROTOCOL_MAXIMUM_MTU || dataLength > bufferLength || tail - head > SNET_SHARED_RING_SIZE ||
+		position + sizeof(snet_uint32) + dataLength > SNET_SHARED_RING_SIZE ||
+		sizeof(snet_uint32) + dataLength > tail - head)
+		return -1;
+
+	for (i = 0, copied = 0; copied < dataLength; ++i)
+	{
+		size_t length = buffers[i].dataLength < dataLength - copied ? buffers[i].dataLength : dataLength - copied;
+
+		memcpy(buffers[i].data, &ring->data[position + sizeof(snet_uint32) + copied], length);
+		copied += length;
+	}
+
+	__atomic_store_n(&ring->head, head + ((sizeof(snet_uint32) + dataLength + 3) & ~3), __ATOMIC_RELEASE);
+
+	return (int)dataLength;
+}
+
+static int
+snet_shared_ring_empty(SNetSharedRing * ring)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == ring->head;
+}
+
+static void
+snet_shared_wake(int event)
+{
+	unsigned long long count = 1;
+
+	/* a failed write means the counter is already saturated, which wakes the consumer anyway */
+	if (write(event, &count, sizeof(count)) < 0)
+		return;
+}
+
+static SNetSharedLink *
+snet_shared_find_link(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	size_t i;
+
+	for (i = 0; i < shared->linkCount; ++i)
+	{
+		SNetSharedLink * link = &shared->links[i];
+
+		if (link->address.host == address->host && link->address.port == address->port)
+			return link;
+	}
+
+	return NULL;
+}
+
+static void
+snet_shared_close_link(SNetSharedMemory * shared, SNetSharedLink * link)
+{
+	munmap(link->rings, 2 * sizeof(SNetSharedRing));
+	close(link->control);
+	close(link->events[0]);
+	close(link->events[1]);
+
+	*link = shared->links[--shared->linkCount];
+}
+
+static SNetSharedLink *
+snet_shared_add_link(SNetSharedMemory * shared)
+{
+	if (shared->linkCount >= shared->linkCapacity)
+	{
+		size_t linkCapacity = shared->linkCapacity > 0 ? shared->linkCapacity * 2 : 4;
+		SNetSharedLink * links = (SNetSharedLink *)snet_malloc(linkCapacity * sizeof(SNetSharedLink));
+		struct pollfd * pollSet = (struct pollfd *)snet_malloc((2 + SNET_SHARED_PENDING_COUNT + 2 * linkCapacity) * sizeof(struct pollfd));
+
+		if (links == NULL || pollSet == NULL)
+		{
+			if (links != NULL)
+				snet_free(links);
+			if (pollSet != NULL)
+				snet_free(pollSet);
+
+			return NULL;
+		}
+
+		if (shared->links != NULL)
+		{
+			memcpy(links, shared->links, shared->linkCount * sizeof(SNetSharedLink));
+			snet_free(shared->links);
+		}
+		snet_free(shared->pollSet);
+
+		shared->links = links;
+		shared->pollSet = pollSet;
+		shared->linkCapacity = linkCapacity;
+	}
+
+	return &shared->links[shared->linkCount++];
+}
+
+static int
+snet_shared_refused(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	snet_uint32 now = snet_time_get();
+	size_t i;
+
+	for (i = 0; i < SNET_SHARED_REFUSAL_COUNT; ++i)
+	{
+		SNetSharedRefusal * refusal = &shared->refusals[i];
+
+		if (refusal->address.host == address->host &&
+			refusal->address.port == address->port &&
+			refusal->address.port != 0 &&
+			SNET_TIME_DIFFERENCE(now, refusal->time) < SNET_SHARED_REFUSAL_TIMEOUT)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+snet_shared_refuse(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	SNetSharedRefusal * refusal = &shared->refusals[shared->nextRefusal];
+
+	refusal->address = *address;
+	refusal->time = snet_time_get();
+
+	shared->nextRefusal = (shared->nextRefusal + 1) % SNET_SHARED_REFUSAL_COUNT;
+}
+
+static int
+snet_shared_local(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	if ((SNET_NET_TO_HOST_32(address->host) >> 24) == 127)
+		return 1;
+
+	return shared->host->address.host != SNET_HOST_ANY && address->host == shared->host->address.host;
+}
+
+/* the host's address as the host at address would see it over UDP */
+static snet_uint32
+snet_shared_hello_host(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	if (shared->host->address.host != SNET_HOST_ANY)
+		return shared->host->address.host;
+
+	if ((SNET_NET_TO_HOST_32(address->host) >> 24) != 127)
+		return address->host;
+
+	return SNET_HOST_TO_NET_32(0x7F000001);
+}
+
+/* offers a link to the host listening for address, falling back to UDP if none answers */
+static SNetSharedLink *
+snet_shared_connect(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	struct sockaddr_un name;
+	socklen_t nameLength = snet_shared_name(&name, address->host, address->port);
+	SNetSharedHello hello;
+	SNetSharedLink * link;
+	struct msghdr msgHdr;
+	struct iovec iov;
+	union
+	{
+		struct cmsghdr header;
+		char           data[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct cmsghdr * cmsg;
+	int fds[3] = { -1, -1, -1 }, controlSocket, connected;
+	void * rings = MAP_FAILED;
+
+	if (address->port == shared->port && snet_shared_local(shared, address))
+		return NULL;
+
+	controlSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (controlSocket < 0)
+		return NULL;
+
+	/* a host bound to the very address is the one UDP would reach, and failing that one bound to any */
+	connected = connect(controlSocket, (struct sockaddr *)&name, nameLength) == 0;
+	if (!connected && address->host != SNET_HOST_ANY)
+	{
+		nameLength = snet_shared_name(&name, SNET_HOST_ANY, address->port);
+		connected = connect(controlSocket, (struct sockaddr *)&name, nameLength) == 0;
+	}
+
+	if (!connected)
+	{
+		close(controlSocket);
+		snet_shared_refuse(shared, address);
+
+		return NULL;
+	}
+
+	fds[0] = memfd_create("snet-shm", MFD_CLOEXEC);
+	fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+		ftruncate(fds[0], 2 * sizeof(SNetSharedRing)) < 0)
+		goto failed;
+
+	rings = mmap(NULL, 2 * sizeof(SNetSharedRing), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (rings == MAP_FAILED)
+		goto failed;
+
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = SNET_SHARED_MAGIC;
+	hello.ringSize = SNET_SHARED_RING_SIZE;
+	hello.host = snet_shared_hello_host(shared, address);
+	hello.port = shared->port;
+
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(hello);
+
+	memset(&msgHdr, 0, sizeof(msgHdr));
+	memset(&control, 0, sizeof(control));
+	msgHdr.msg_iov = &iov;
+	msgHdr.msg_iovlen = 1;
+	msgHdr.msg_control = control.data;
+	msgHdr.msg_controllen = sizeof(control.data);
+
+	cmsg = CMSG_FIRSTHDR(&msgHdr);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+	if (sendmsg(controlSocket, &msgHdr, MSG_NOSIGNAL) != sizeof(hello))
+		goto failed;
+
+	link = snet_shared_add_link(shared);
+	if (link == NULL)
+		goto failed;
+
+	close(fds[0]);
+
+	link->address = *address;
+	link->side = 0;
+	link->control = controlSocket;
+	link->events[0] = fds[1];
+	link->events[1] = fds[2];
+	link->rings = (SNetSharedRing *)rings;
+
+	return link;
+
+failed:
+	if (rings != MAP_FAILED)
+		munmap(rings, 2 * sizeof(SNetSharedRing));
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	if (fds[2] >= 0)
+		close(fds[2]);
+	close(controlSocket);
+
+	snet_shared_refuse(shared, address);
+
+	return NULL;
+}
+
+/* takes up the link offered on an accepted control socket
+   @retval 1 if the link was taken up
+   @retval 0 if the hello has not arrived yet, the socket being left open
+   @retval -1 if the offer was rejected, the socket being closed */
+static int
+snet_shared_take_hello(SNetSharedMemory * shared, int controlSocket)
+{
+	SNetSharedHello hello;
+	SNetSharedLink * link;
+	struct msghdr msgHdr;
+	struct iovec iov;
+	union
+	{
+		struct cmsghdr header;
+		char           data[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct cmsghdr * cmsg;
+	struct stat segment;
+	int fds[3] = { -1, -1, -1 };
+	void * rings = MAP_FAILED;
+	SNetAddress address;
+	ssize_t receivedLength;
+
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(hello);
+
+	memset(&msgHdr, 0, sizeof(msgHdr));
+	msgHdr.msg_iov = &iov;
+	msgHdr.msg_iovlen = 1;
+	msgHdr.msg_control = control.data;
+	msgHdr.msg_controllen = sizeof(control.data);
+
+	receivedLength = recvmsg(controlSocket, &msgHdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (receivedLength < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	if (receivedLength != sizeof(hello))
+	{
+		close(controlSocket);
+
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msgHdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgHdr, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_RIGHTS &&
+			cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+			memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+	}
+
+	if (fds[0] < 0 ||
+		hello.magic != SNET_SHARED_MAGIC ||
+		hello.ringSize != SNET_SHARED_RING_SIZE ||
+		fstat(fds[0], &segment) < 0 ||
+		segment.st_size < (off_t)(2 * sizeof(SNetSharedRing)))
+		goto rejected;
+
+	rings = mmap(NULL, 2 * sizeof(SNetSharedRing), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (rings == MAP_FAILED)
+		goto rejected;
+
+	address.host = hello.host;
+	address.port = hello.port;
+
+	/* a client that reconnects replaces the link it had, but where both hosts offered each other a
+	   link at once, both keep the one offered by the lower address, and the other is rejected */
+	link = snet_shared_find_link(shared, &address);
+	if (link != NULL)
+	{
+		if (link->side == 0)
+		{
+			snet_uint32 host = SNET_NET_TO_HOST_32(snet_shared_hello_host(shared, &address)),
+				otherHost = SNET_NET_TO_HOST_32(address.host);
+
+			if (host < otherHost || (host == otherHost && shared->port < address.port))
+				goto rejected;
+		}
+
+		snet_shared_close_link(shared, link);
+	}
+
+	link = snet_shared_add_link(shared);
+	if (link == NULL)
+		goto rejected;
+
+	close(fds[0]);
+
+	link->address = address;
+	link->side = 1;
+	link->control = controlSocket;
+	link->events[0] = fds[1];
+	link->events[1] = fds[2];
+	link->rings = (SNetSharedRing *)rings;
+
+	return 1;
+
+rejected:
+	if (rings != MAP_FAILED)
+		munmap(rings, 2 * sizeof(SNetSharedRing));
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	if (fds[2] >= 0)
+		close(fds[2]);
+	close(controlSocket);
+
+	return -1;
+}
+
+/* takes up the links offered by other processes of the same user, without waiting for any hello
+   that has yet to arrive; those are kept pending and taken up on a later call */
+static int
+snet_shared_accept(SNetSharedMemory * shared)
+{
+	snet_uint32 now = snet_time_get();
+	int accepted = 0;
+	size_t i = 0;
+
+	while (i < shared->pendingCount)
+	{
+		SNetSharedPending * pending = &shared->pending[i];
+		int result = snet_shared_take_hello(shared, pending->control);
+
+		if (result == 0 && SNET_TIME_DIFFERENCE(now, pending->time) < SNET_SHARED_HELLO_TIMEOUT)
+		{
+			++i;
+			continue;
+		}
+
+		if (result == 0)
+			close(pending->control);
+		else
+		if (result > 0)
+			accepted = 1;
+
+		*pending = shared->pending[--shared->pendingCount];
+	}
+
+	for (;;)
+	{
+		struct ucred credentials;
+		socklen_t credentialsLength = sizeof(credentials);
+		int controlSocket, result;
+
+		controlSocket = accept4(shared->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (controlSocket < 0)
+			break;
+
+		if (getsockopt(controlSocket, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) < 0 ||
+			credentials.uid != getuid())
+		{
+			close(controlSocket);
+			continue;
+		}
+
+		result = snet_shared_take_hello(shared, controlSocket);
+		if (result > 0)
+			accepted = 1;
+		else
+		if (result == 0)
+		{
+			if (shared->pendingCount >= SNET_SHARED_PENDING_COUNT)
+			{
+				close(controlSocket);
+				continue;
+			}
+
+			shared->pending[shared->pendingCount].control = controlSocket;
+			shared->pending[shared->pendingCount].time = now;
+			++shared->pendingCount;
+		}
+	}
+
+	return accepted;
+}
+
+/* tears down the links whose other side has gone away */
+static void
+snet_shared_check_links(SNetSharedMemory * shared)
+{
+	size_t i = 0;
+
+	while (i < shared->linkCount)
+	{
+		SNetSharedLink * link = &shared->links[i];
+		char byte;
+		ssize_t result = recv(link->control, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+		if (result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+			snet_shared_close_link(shared, link);
+		else
+			++i;
+	}
+}
+
+/* the link datagrams to address go through, offering one if there is none yet, or NULL where they go over the wrapped transport */
+static SNetSharedLink *
+snet_shared_link(SNetSharedMemory * shared, const SNetAddress * address)
+{
+	SNetSharedLink * link = snet_shared_find_link(shared, address);
+
+	if (link == NULL && snet_shared_local(shared, address) && !snet_shared_refused(shared, address))
+		link = snet_shared_connect(shared, address);
+
+	return link;
+}
+
+static int
+snet_shared_link_send(SNetSharedLink * link, const SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetSharedRing * ring = &link->rings[link->side];
+	int sentLength = snet_shared_ring_write(ring, buffers, bufferCount);
+
+	if (sentLength > 0 && __atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST))
+		snet_shared_wake(link->events[link->side]);
+
+	/* a full ring drops the datagram, as a full socket buffer would */
+	return sentLength;
+}
+
+/* takes up offers of links and tears down those whose other side has gone away, each at its own interval */
+static void
+snet_shared_update(SNetSharedMemory * shared)
+{
+	snet_uint32 now = snet_time_get();
+
+	if (SNET_TIME_DIFFERENCE(now, shared->acceptTime) >= SNET_SHARED_ACCEPT_INTERVAL)
+	{
+		shared->acceptTime = now;
+
+		snet_shared_accept(shared);
+	}
+
+	if (SNET_TIME_DIFFERENCE(now, shared->checkTime) >= SNET_SHARED_CHECK_INTERVAL)
+	{
+		shared->checkTime = now;
+
+		snet_shared_check_links(shared);
+	}
+}
+
+static int SNET_CALLBACK
+snet_shared_send(void * context, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetSharedMemory * shared = (SNetSharedMemory *)context;
+	SNetSharedLink * link = snet_shared_link(shared, address);
+
+	if (link != NULL)
+		return snet_shared_link_send(link, buffers, bufferCount);
+
+	return shared->transport.send(shared->transport.context, address, buffers, bufferCount);
+}
+
+static int SNET_CALLBACK
+snet_shared_send_batch(void * context, const SNetDatagram * datagrams, size_t datagramCount)
+{
+	SNetSharedMemory * shared = (SNetSharedMemory *)context;
+	size_t sentCount = 0;
+
+	while (sentCount < datagramCount)
+	{
+		SNetSharedLink * link = snet_shared_link(shared, &datagrams[sentCount].address);
+		size_t remoteCount = 1;
+		int result;
+
+		if (link != NULL)
+		{
+			snet_shared_link_send(link, datagrams[sentCount].buffers, datagrams[sentCount].bufferCount);
+
+			++sentCount;
+
+			continue;
+		}
+
+		if (shared->transport.sendBatch == NULL)
+		{
+			const SNetDatagram * datagram = &datagrams[sentCount];
+
+			result = shared->transport.send(shared->transport.context, &datagram->address, datagram->buffers, datagram->bufferCount);
+			if (result > 0)
+				result = 1;
+		}
+		else
+		{
+			/* datagrams for other machines go to the wrapped transport together, up to the next one for a link */
+			while (sentCount + remoteCount < datagramCount &&
+				snet_shared_link(shared, &datagrams[sentCount + remoteCount].address) == NULL)
+				++remoteCount;
+
+			result = shared->transport.sendBatch(shared->transport.context, &datagrams[sentCount], remoteCount);
+		}
+
+		if (result < 0)
+			return sentCount > 0 ? (int)sentCount : -1;
+
+		sentCount += (size_t)result;
+
+		if ((size_t)result < remoteCount)
+			break;
+	}
+
+	return (int)sentCount;
+}
+
+static int SNET_CALLBACK
+snet_shared_receive(void * context, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetSharedMemory * shared = (SNetSharedMemory *)context;
+	size_t slotCount, i;
+
+	snet_shared_update(shared);
+
+	/* the links and the wrapped transport take turns, so neither starves the other */
+	slotCount = shared->linkCount + 1;
+	for (i = 0; i < slotCount; ++i)
+	{
+		size_t slot = (shared->nextLink + i) % slotCount;
+		int receivedLength;
+
+		if (slot == shared->linkCount)
+		{
+			receivedLength = shared->transport.receive(shared->transport.context, address, buffers, bufferCount);
+			if (receivedLength == 0)
+				continue;
+		}
+		else
+		{
+			SNetSharedLink * link = &shared->links[slot];
+
+			receivedLength = snet_shared_ring_read(&link->rings[!link->side], buffers, bufferCount);
+			if (receivedLength < 0)
+			{
+				snet_shared_close_link(shared, link);
+
+				return 0;
+			}
+			if (receivedLength == 0)
+				continue;
+
+			*address = link->address;
+		}
+
+		shared->nextLink = slot + 1;
+
+		return receivedLength;
+	}
+
+	return 0;
+}
+
+static int SNET_CALLBACK
+snet_shared_receive_batch(void * context, SNetDatagram * datagrams, size_t datagramCount)
+{
+	SNetSharedMemory * shared = (SNetSharedMemory *)context;
+	size_t receivedCount = 0, slotCount, i;
+
+	snet_shared_update(shared);
+
+	/* a batch is filled from the first of the links and the wrapped transport to have any waiting,
+	   and they take turns, as for a single datagram */
+	slotCount = shared->linkCount + 1;
+	for (i = 0; i < slotCount; ++i)
+	{
+		size_t slot = (shared->nextLink + i) % slotCount;
+
+		if (slot == shared->linkCount)
+		{
+			int result = shared->transport.receive(shared->transport.context, &datagrams->address, datagrams->buffers, datagrams->bufferCount);
+			if (result < 0)
+				return -1;
+
+			if (result > 0)
+			{
+				datagrams->dataLength = (size_t)result;
+				receivedCount = 1;
+
+				/* the wrapped transport is mostly polled while idle, so it is only asked for a batch once a datagram turns up */
+				if (shared->transport.receiveBatch != NULL && datagramCount > 1)
+				{
+					result = shared->transport.receiveBatch(shared->transport.context, &datagrams[1], datagramCount - 1);
+					if (result > 0)
+						receivedCount += (size_t)result;
+				}
+			}
+		}
+		else
+		{
+			SNetSharedLink * link = &shared->links[slot];
+
+			while (receivedCount < datagramCount)
+			{
+				SNetDatagram * datagram = &datagrams[receivedCount];
+				int receivedLength = snet_shared_ring_read(&link->rings[!link->side], datagram->buffers, datagram->bufferCount);
+
+				if (receivedLength < 0)
+				{
+					snet_shared_close_link(shared, link);
+
+					return (int)receivedCount;
+				}
+				if (receivedLength == 0)
+					break;
+
+				datagram->address = link->address;
+				datagram->dataLength = (size_t)receivedLength;
+				++receivedCount;
+			}
+		}
+
+		if (receivedCount > 0)
+		{
+			shared->nextLink = slot + 1;
+
+			break;
+		}
+	}
+
+	return (int)receivedCount;
+}
+
+static int SNET_CALLBACK
+snet_shared_wait(void * context, snet_uint32 * condition, snet_uint32 timeout)
+{
+	SNetSharedMemory * shared = (SNetSharedMemory *)context;
+	struct pollfd * pollSet = shared->pollSet;
+	size_t pollCount = 1, linkCount = 0, pendingCount = 0, i;
+	snet_uint32 waitCondition = *condition;
+	int pollResult, accept = 0, check = 0;
+
+	if (waitCondition & SNET_SOCKET_WAIT_RECEIVE)
+	{
+		int pending = 0;
+
+		linkCount = shared->linkCount;
+		pendingCount = shared->pendingCount;
+
+		for (i = 0; i < linkCount; ++i)
+		{
+			SNetSharedRing * ring = &shared->links[i].rings[!shared->links[i].side];
+
+			__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+			if (!snet_shared_ring_empty(ring))
+				pending = 1;
+		}
+
+		if (pending)
+		{
+			for (i = 0; i < linkCount; ++i)
+				__atomic_store_n(&shared->links[i].rings[!shared->links[i].side].sleeping, 0, __ATOMIC_RELAXED);
+
+			*condition = SNET_SOCKET_WAIT_RECEIVE;
+
+			return 0;
+		}
+	}
+
+	pollSet[0].fd = shared->socket;
+	pollSet[0].events = 0;
+	pollSet[0].revents = 0;
+	if (waitCondition & SNET_SOCKET_WAIT_SEND)
+		pollSet[0].events |= POLLOUT;
+	if (waitCondition & SNET_SOCKET_WAIT_RECEIVE)
+	{
+		pollSet[0].events |= POLLIN;
+
+		pollSet[1].fd = shared->listener;
+		pollSet[1].events = POLLIN;
+		pollSet[1].revents = 0;
+		pollCount = 2;
+
+		for (i = 0; i < pendingCount; ++i)
+		{
+			pollSet[pollCount].fd = shared->pending[i].control;
+			pollSet[pollCount].events = POLLIN;
+			pollSet[pollCount].revents = 0;
+			++pollCount;
+		}
+
+		for (i = 0; i < linkCount; ++i)
+		{
+			SNetSharedLink * link = &shared->links[i];
+
+			pollSet[pollCount].fd = link->events[!link->side];
+			pollSet[pollCount].events = POLLIN;
+			pollSet[pollCount].revents = 0;
+			++pollCount;
+
+			pollSet[pollCount].fd = link->control;
+			pollSet[pollCount].events = POLLIN;
+			pollSet[pollCount].revents = 0;
+			++pollCount;
+		}
+	}
+
+	pollResult = poll(pollSet, pollCount, timeout);
+
+	for (i = 0; i < linkCount; ++i)
+		__atomic_store_n(&shared->links[i].rings[!shared->links[i].side].sleeping, 0, __ATOMIC_RELAXED);
+
+	if (pollResult < 0)
+	{
+		if (errno == EINTR && waitCondition & SNET_SOCKET_WAIT_INTERRUPT)
+		{
+			*condition = SNET_SOCKET_WAIT_INTERRUPT;
+
+			return 0;
+		}
+
+		return -1;
+	}
+
+	*condition = SNET_SOCKET_WAIT_NONE;
+
+	if (pollResult == 0)
+		return 0;
+
+	if (pollSet[0].revents & POLLOUT)
+		*condition |= SNET_SOCKET_WAIT_SEND;
+
+	if (pollSet[0].revents & POLLIN)
+		*condition |= SNET_SOCKET_WAIT_RECEIVE;
+
+	if (pollCount > 1)
+	{
+		struct pollfd * linkPollSet = &pollSet[2 + pendingCount];
+
+		if (pollSet[1].revents & POLLIN)
+			accept = 1;
+
+		for (i = 0; i < pendingCount; ++i)
+		{
+			if (pollSet[2 + i].revents)
+				accept = 1;
+		}
+
+		for (i = 0; i < linkCount; ++i)
+		{
+			if (linkPollSet[2 * i].revents & POLLIN)
+			{
+				unsigned long long count;
+
+				if (read(linkPollSet[2 * i].fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+					check = 1;
+
+				*condition |= SNET_SOCKET_WAIT_RECEIVE;
+			}
+
+			if (linkPollSet[2 * i + 1].revents)
+				check = 1;
+		}
+	}
+
+	if (check)
+		snet_shared_check_links(shared);
+
+	if (accept && snet_shared_accept(shared))
+		*condition |= SNET_SOCKET_WAIT_RECEIVE;
+
+	return 0;
+}
+
+static void SNET_CALLBACK
+snet_shared_destroy(void * context)
+{
+	SNetSharedMemory * shared = (SNetSharedMemory *)context;
+
+	while (shared->linkCount > 0)
+		snet_shared_close_link(shared, &shared->links[0]);
+
+	while (shared->pendingCount > 0)
+		close(shared->pending[--shared->pendingCount].control);
+
+	close(shared->listener);
+
+	if (shared->links != NULL)
+		snet_free(shared->links);
+	snet_free(shared->pollSet);
+
+	if (shared->transport.destroy != NULL)
+		(*shared->transport.destroy) (shared->transport.context);
+
+	snet_free(shared);
+}
+
+/** Lets the host exchange datagrams with hosts in other processes on the same machine through shared memory.
+
+When the host first sends to a loopback address, or to its own, it offers the host listening
+on that port a pair of lock-free rings in a shared memory segment, with an eventfd to wake each
+side.  If that host has shared memory enabled too and runs as the same user, datagrams between
+the two go through the rings from then on; otherwise they keep going over UDP.  Either way
+connections, channels and reliability are those of UDP, so peers need not know which is used.
+Datagrams for other machines go through the wrapped transport, in batches where it takes them.
+
+@param host host to configure, whose transport must have a socket, so shared memory should be
+enabled before snet_host_impair()
+@param enable non-zero to enable shared memory, or 0 to go back to the wrapped transport
+@retval 0 on success
+@retval < 0 on failure, or where shared memory is not supported
+@remarks Linux only.  The host's socket is bound to an ephemeral port first if it has none, and
+snet_host_socket() returns SNET_SOCKET_NULL while shared memory is enabled, as the rings do not
+make any one descriptor readable.
+*/
+int
+snet_host_shared_memory(SNetHost * host, int enable)
+{
+	SNetSharedMemory * shared = host->transport.send == snet_shared_send ? (SNetSharedMemory *)host->transport.context : NULL;
+	SNetTransport transport;
+	SNetAddress address;
+	SNetSocket hostSocket;
+	struct sockaddr_un name;
+	socklen_t nameLength;
+	int listener;
+
+	if (!enable)
+	{
+		if (shared != NULL)
+		{
+			transport = shared->transport;
+			shared->transport.destroy = NULL;
+
+			snet_host_transport(host, &transport);
+		}
+
+		return 0;
+	}
+
+	if (shared != NULL)
+		return 0;
+
+	hostSocket = snet_host_socket(host);
+	if (hostSocket == SNET_SOCKET_NULL || snet_socket_get_address(hostSocket, &address) < 0)
+		return -1;
+
+	if (address.port == 0 &&
+		(snet_socket_bind(hostSocket, NULL) < 0 || snet_socket_get_address(hostSocket, &address) < 0))
+		return -1;
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		return -1;
+
+	nameLength = snet_shared_name(&name, address.host, address.port);
+	if (bind(listener, (struct sockaddr *)&name, nameLength) < 0 || listen(listener, SOMAXCONN) < 0)
+	{
+		close(listener);
+
+		return -1;
+	}
+
+	shared = (SNetSharedMemory *)snet_malloc(sizeof(SNetSharedMemory));
+	if (shared == NULL)
+	{
+		close(listener);
+
+		return -1;
+	}
+
+	memset(shared, 0, sizeof(SNetSharedMemory));
+
+	shared->pollSet = (struct pollfd *)snet_malloc((2 + SNET_SHARED_PENDING_COUNT) * sizeof(struct pollfd));
+	if (shared->pollSet == NULL)
+	{
+		snet_free(shared);
+		close(listener);
+
+		return -1;
+	}
+
+	shared->host = host;
+	shared->transport = host->transport;
+	shared->socket = hostSocket;
+	shared->port = address.port;
+	shared->listener = listener;
+	shared->acceptTime = shared->checkTime = snet_time_get();
+
+	/* the shared memory transport now owns the transport it wraps */
+	host->transport.destroy = NULL;
+
+	memset(&transport, 0, sizeof(SNetTransport));
+	transport.context = shared;
+	transport.send = snet_shared_send;
+	transport.receive = snet_shared_receive;
+	transport.sendBatch = snet_shared_send_batch;
+	transport.receiveBatch = snet_shared_receive_batch;
+	transport.wait = snet_shared_wait;
+	transport.destroy = snet_shared_destroy;
+
+	snet_host_transport(host, &transport);
+
+	return 0;
+}
+
+#else
+
+int
+snet_host_shared_memory(SNetHost * host, int enable)
+{
+	(void)host;
+
+	return enable ? -1 : 0;
+}
+
+#endif
+
+/** @} */
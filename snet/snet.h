@@ -23,9 +23,10 @@ extern "C"
 #include "snet/list.h"
 #include "snet/callbacks.h"
 
+/* the minor version changes with the wire protocol, and hosts of different minor versions cannot connect */
 #define SNET_VERSION_MAJOR 0
-#define SNET_VERSION_MINOR 0
-#define SNET_VERSION_PATCH 1
+#define SNET_VERSION_MINOR 1
+#define SNET_VERSION_PATCH 0
 #define SNET_VERSION_CREATE(major, minor, patch) (((major)<<16) | ((minor)<<8) | (patch))
 #define SNET_VERSION_GET_MAJOR(version) (((version)>>16)&0xFF)
 #define SNET_VERSION_GET_MINOR(version) (((version)>>8)&0xFF)
@@ -106,8 +107,9 @@ extern "C"
 		/** packet must be received by the target peer and resend attempts should be
 		* made until the packet is delivered */
 		SNET_PACKET_FLAG_RELIABLE = (1 << 0),
-		/** packet will not be sequenced with other packets
-		* not supported for reliable packets
+		/** packet will not be sequenced with other packets;
+		* a reliable packet is still resent until delivered, but is delivered as soon as it
+		* arrives rather than after the reliable packets sent before it
 		*/
 		SNET_PACKET_FLAG_UNSEQUENCED = (1 << 1),
 		/** packet will not allocate data, and user must supply it instead */
@@ -115,6 +117,9 @@ extern "C"
 		/** packet will be fragmented using unreliable (instead of reliable) sends
 		* if it exceeds the MTU */
 		SNET_PACKET_FLAG_UNRELIABLE_FRAGMENT = (1 << 3),
+		/** packet was received on a stream, sent by snet_peer_send_stream(), whose ID is the
+		* receive event's data */
+		SNET_PACKET_FLAG_STREAM = (1 << 4),
 
 		/** whether the packet has been sent from all queues it has been entered into */
 		SNET_PACKET_FLAG_SENT = (1 << 8)
@@ -135,7 +140,7 @@ extern "C"
 	*    and resend attempts should be made until the packet is delivered
 	*
 	*    SNET_PACKET_FLAG_UNSEQUENCED - packet will not be sequenced with other packets
-	*    (not supported for reliable packets)
+	*    (a reliable packet is delivered as soon as it arrives, without waiting for earlier ones)
 	*
 	*    SNET_PACKET_FLAG_NO_ALLOCATE - packet will not allocate data, and user must supply it instead
 
@@ -155,6 +160,8 @@ extern "C"
 	{
 		SNetListNode acknowledgementList;
 		snet_uint32  sentTime;
+		snet_uint32  receivedTime;
+		int          preciseSentTime;   /**< whether sentTime is the whole one in microseconds */
 		SNetProtocol command;
 	} SNetAcknowledgement;
 
@@ -178,6 +185,8 @@ extern "C"
 		SNetListNode     incomingCommandList;
 		snet_uint16      reliableSequenceNumber;
 		snet_uint16      unreliableSequenceNumber;
+		snet_uint16      streamDistance;
+		snet_uint32      streamID;
 		SNetProtocol     command;
 		snet_uint32      fragmentCount;
 		snet_uint32      fragmentsRemaining;
@@ -211,6 +220,14 @@ extern "C"
 		SNET_HOST_DEFAULT_MTU = 1400,
 		SNET_HOST_DEFAULT_MAXIMUM_PACKET_SIZE = 32 * 1024 * 1024,
 		SNET_HOST_DEFAULT_MAXIMUM_WAITING_DATA = 32 * 1024 * 1024,
+		SNET_HOST_DEFAULT_MAXIMUM_STREAMS = 16384,
+		SNET_HOST_CONNECT_COOKIE_INTERVAL = 10000,
+		SNET_HOST_CONNECT_COOKIE_SECRET_SIZE = 16,
+		SNET_HOST_SESSION_TICKET_INTERVAL = 5000,
+		SNET_HOST_SESSION_TICKET_LIFETIME = 600,
+		SNET_HOST_CONNECT_LIMIT_WIDTH = 512,
+		SNET_HOST_CAPTURE_DEFAULT_BUFFER_SIZE = 1024 * 1024,
+		SNET_HOST_DATAGRAM_BATCH = 16,
 
 		SNET_PEER_DEFAULT_ROUND_TRIP_TIME = 500,
 		SNET_PEER_DEFAULT_PACKET_THROTTLE = 32,
@@ -231,7 +248,8 @@ extern "C"
 		SNET_PEER_FREE_UNSEQUENCED_WINDOWS = 32,
 		SNET_PEER_RELIABLE_WINDOWS = 16,
 		SNET_PEER_RELIABLE_WINDOW_SIZE = 0x1000,
-		SNET_PEER_FREE_RELIABLE_WINDOWS = 8
+		SNET_PEER_FREE_RELIABLE_WINDOWS = 8,
+		SNET_PEER_STREAM_BUCKETS = 16
 	};
 
 	typedef struct _SNetChannel
@@ -244,8 +262,216 @@ extern "C"
 		snet_uint16  incomingUnreliableSequenceNumber;
 		SNetList     incomingReliableCommands;
 		SNetList     incomingUnreliableCommands;
+		snet_uint32  outgoingQueuedData;     /**< packet data queued for sending */
+		snet_uint32  outgoingInFlightData;   /**< reliable packet data sent and not yet acknowledged */
 	} SNetChannel;
 
+	/**
+	* An ordered stream within a channel, kept only while packets sent on it are unacknowledged
+	* or packets received on it wait for an earlier one.
+	*/
+	typedef struct _SNetStream
+	{
+		SNetListNode streamList;                     /**< chains the stream into its peer's stream hash */
+		snet_uint32  streamID;
+		snet_uint8   channelID;
+		snet_uint16  outgoingReliableSequenceNumber; /**< channel sequence number of the last packet sent on the stream */
+		snet_uint32  outgoingCommandCount;           /**< commands sent on the stream and not yet acknowledged */
+		SNetList     incomingCommands;               /**< complete packets waiting for an earlier one on the stream */
+	} SNetStream;
+
+	/**
+	* Why a peer discarded packet data, as counted in SNetPeerStats.
+	*/
+	typedef enum _SNetPeerDropReason
+	{
+		SNET_PEER_DROP_THROTTLE      = 0,   /**< outgoing unreliable packet skipped by the packet throttle */
+		SNET_PEER_DROP_DUPLICATE     = 1,   /**< incoming command that was already received */
+		SNET_PEER_DROP_WINDOW        = 2,   /**< incoming command too far ahead of the receive window */
+		SNET_PEER_DROP_WAITING_DATA  = 3,   /**< incoming packet refused because maximumWaitingData was reached */
+		SNET_PEER_DROP_DISCONNECTING = 4,   /**< incoming packet arriving after snet_peer_disconnect_later() */
+		SNET_PEER_DROP_LATE          = 5,   /**< incoming unreliable command sent before one already delivered on its channel */
+		SNET_PEER_DROP_REASON_COUNT  = 6
+	} SNetPeerDropReason;
+
+	/**
+	* Statistics for a single channel of a peer.
+	*/
+	typedef struct _SNetChannelStats
+	{
+		snet_uint32 queuedData;              /**< packet data queued for sending */
+		snet_uint32 inFlightData;            /**< reliable packet data sent and not yet acknowledged */
+	} SNetChannelStats;
+
+#define SNET_PEER_STATS_VERSION 3
+
+	/**
+	* A snapshot of a peer's statistics, filled in by snet_peer_get_stats().
+	*
+	* The caller sets version to SNET_PEER_STATS_VERSION before the call.  Later versions
+	* only append fields, so a program built against an older header keeps working.
+	* Totals are 32 bit and wrap, like the host totals.
+	*/
+	typedef struct _SNetPeerStats
+	{
+		snet_uint32      version;
+		SNetPeerState    state;
+		snet_uint32      roundTripTime;               /**< smoothed mean, in milliseconds */
+		snet_uint32      roundTripTimeMinimum;        /**< lowest sample since connecting, in milliseconds, rounded up like roundTripTime */
+		snet_uint32      roundTripTimeVariance;
+		snet_uint32      roundTripTimeSamples;
+		snet_uint32      packetThrottle;              /**< relative to SNET_PEER_PACKET_THROTTLE_SCALE */
+		snet_uint32      packetLoss;                  /**< relative to SNET_PEER_PACKET_LOSS_SCALE */
+		snet_uint32      retransmits;                 /**< reliable commands resent after a timeout */
+		snet_uint32      queuedData;                  /**< sum of queuedData over the channels */
+		snet_uint32      inFlightData;                /**< sum of inFlightData over the channels */
+		snet_uint32      drops[SNET_PEER_DROP_LATE];  /**< indexed by SNetPeerDropReason, for the reasons before SNET_PEER_DROP_LATE */
+		snet_uint32      incomingFragmentedPackets;   /**< packets with fragments still missing */
+		snet_uint32      sentData;                    /**< datagram bytes sent, after compression */
+		snet_uint32      sentUncompressedData;        /**< the same datagrams before compression */
+		snet_uint32      receivedData;                /**< datagram bytes received, before decompression */
+		snet_uint32      receivedUncompressedData;    /**< the same datagrams after decompression */
+		size_t           channelCount;
+		SNetChannelStats channels[SNET_PROTOCOL_MAXIMUM_CHANNEL_COUNT];
+		snet_uint32      roundTripTimeMicroseconds;   /**< since version 2, roundTripTime in microseconds */
+		snet_uint32      roundTripTimeMinimumMicroseconds;
+		snet_uint32      roundTripTimeVarianceMicroseconds;
+		snet_uint32      lateDrops;                   /**< since version 3, drops for SNET_PEER_DROP_LATE, which drops has no room for */
+	} SNetPeerStats;
+
+	enum
+	{
+		SNET_HISTOGRAM_SUB_BUCKET_BITS = 5,
+		SNET_HISTOGRAM_BUCKET_COUNT    = (34 - SNET_HISTOGRAM_SUB_BUCKET_BITS) << (SNET_HISTOGRAM_SUB_BUCKET_BITS - 1)
+	};
+
+	/**
+	* A log-linear histogram of 32 bit values, in the style of HdrHistogram.
+	*
+	* Values below 2^SNET_HISTOGRAM_SUB_BUCKET_BITS are counted exactly.  Larger values share a
+	* bucket with others of the same magnitude that agree in their top SNET_HISTOGRAM_SUB_BUCKET_BITS
+	* bits, so percentiles are accurate to within about 6%.  Recording is a few shifts and an
+	* increment, and a histogram is a fixed block of memory that may be copied to export it.
+	@sa snet_histogram_percentile()
+	*/
+	typedef struct _SNetHistogram
+	{
+		snet_uint32        totalCount;
+		snet_uint32        minimum;
+		snet_uint32        maximum;
+		unsigned long long sum;
+		snet_uint32        counts[SNET_HISTOGRAM_BUCKET_COUNT];
+	} SNetHistogram;
+
+	/**
+	* The parts of snet_host_service() timed by a host's phase histograms, in nanoseconds.
+	@sa snet_host_histograms()
+	*/
+	typedef enum _SNetHostPhase
+	{
+		SNET_HOST_PHASE_DISPATCH   = 0,   /**< one dispatch of queued incoming events */
+		SNET_HOST_PHASE_SEND       = 1,   /**< one pass sending to every peer, including TIMEOUTS and COMPRESS */
+		SNET_HOST_PHASE_RECEIVE    = 2,   /**< one pass reading the socket, including DECOMPRESS */
+		SNET_HOST_PHASE_TIMEOUTS   = 3,   /**< checking one peer's sent reliable commands for timeouts */
+		SNET_HOST_PHASE_COMPRESS   = 4,   /**< compressing one outgoing datagram */
+		SNET_HOST_PHASE_DECOMPRESS = 5,   /**< decompressing one incoming datagram */
+		SNET_HOST_PHASE_COUNT      = 6
+	} SNetHostPhase;
+
+	/**
+	* The per-peer histograms kept while a host's histograms are enabled.
+	@sa snet_peer_histogram()
+	*/
+	typedef enum _SNetPeerHistogram
+	{
+		SNET_PEER_HISTOGRAM_ROUND_TRIP_TIME   = 0,   /**< each round trip time sample, before smoothing, in microseconds */
+		SNET_PEER_HISTOGRAM_ACKNOWLEDGE_DELAY = 1,   /**< time an acknowledgement waited before being sent, in milliseconds */
+		SNET_PEER_HISTOGRAM_COUNT             = 2
+	} SNetPeerHistogram;
+
+	/**
+	* Number of peers using one IP address, an entry in the host's open addressed
+	* address count table.  Entries with a count of 0 are free.
+	*/
+	typedef struct _SNetAddressCount
+	{
+		snet_uint32 host;
+		snet_uint32 count;
+	} SNetAddressCount;
+
+	/**
+	* A token bucket limiting outgoing datagrams to a sustained rate with a bounded burst.
+	*
+	* Tokens are bytes.  A datagram may be sent while the bucket holds any tokens and
+	* its full size is then deducted, so the bucket briefly runs negative after a
+	* datagram larger than what remained.
+	@sa snet_host_rate_limit()
+	@sa snet_peer_rate_limit()
+	*/
+	typedef struct _SNetTokenBucket
+	{
+		snet_uint32 rate;            /**< refill rate in bytes/second, or 0 if unlimited */
+		snet_uint32 burst;           /**< capacity of the bucket in bytes */
+		int         tokens;
+		snet_uint32 lastRefillTime;
+	} SNetTokenBucket;
+
+	/**
+	* One cell of the host's connect rate limiter, a token bucket shared by every
+	* IP address that hashes to it.
+	@sa snet_host_connect_rate_limit()
+	*/
+	typedef struct _SNetConnectLimit
+	{
+		snet_uint32 tokens;          /**< connect attempts available, in thousandths */
+		snet_uint32 lastRefillTime;
+	} SNetConnectLimit;
+
+	/**
+	* A capture of a host's datagrams in progress, started by snet_host_capture().
+	*
+	* head is advanced by the service loop as it records datagrams and tail by the
+	* writer thread as it writes them out; both only grow, and are taken modulo bufferSize.
+	*/
+	typedef struct _SNetCapture
+	{
+		void *             file;
+		void *             thread;
+		snet_uint8 *       buffer;
+		size_t             bufferSize;
+		size_t             head;
+		size_t             tail;
+		size_t             stopping;
+		unsigned long long startTime;            /**< wall clock when the capture started, in microseconds */
+		unsigned long long startNanoseconds;     /**< snet_time_get_nanoseconds() when the capture started */
+		snet_uint32        droppedDatagrams;     /**< datagrams not recorded because the ring buffer was full */
+		snet_uint32        writeErrors;          /**< writes to the file that failed, counted by the writer thread */
+	} SNetCapture;
+
+	/**
+	* A node in a tree of egress limits shared by groups of peers.
+	*
+	* The statistics are charged with every datagram sent to a peer in this class
+	* or any class below it; the user should reset them to 0 as needed to prevent overflow.
+	@sa snet_bandwidth_class_create()
+	@sa snet_peer_bandwidth_class()
+	*/
+	typedef struct _SNetBandwidthClass
+	{
+		SNetListNode       classList;
+		struct _SNetHost * host;
+		struct _SNetBandwidthClass * parent;
+		size_t             childCount;
+		size_t             peerCount;         /**< number of peers assigned directly to this class */
+		SNetTokenBucket    rateBucket;        /**< guaranteed rate */
+		SNetTokenBucket    ceilingBucket;     /**< maximum rate while borrowing from the parent */
+		void *             data;              /**< Application private data, may be freely modified */
+		snet_uint32        totalSentData;     /**< total data sent through the class */
+		snet_uint32        totalSentPackets;  /**< total UDP packets sent through the class */
+		snet_uint32        totalBorrowedData; /**< data sent in excess of the guaranteed rate, borrowed from the parent */
+		snet_uint32        overlimits;        /**< number of times a peer in the class was held back */
+	} SNetBandwidthClass;
+
 	/**
 	* An SNet peer which data packets may be sent or received from.
 	*
@@ -260,15 +486,30 @@ extern "C"
 		snet_uint32   connectID;
 		snet_uint8    outgoingSessionID;
 		snet_uint8    incomingSessionID;
+		snet_uint8    checksumType;       /**< SNetChecksumType agreed on in the handshake */
+		snet_uint8    protocolFlags;      /**< SNetProtocolConnectFlag values agreed on in the handshake */
 		SNetAddress   address;            /**< Internet address of the peer */
 		void *        data;               /**< Application private data, may be freely modified */
 		SNetPeerState state;
 		SNetChannel * channels;
 		size_t        channelCount;       /**< Number of channels allocated for communication with peer */
+		SNetList *    streams;            /**< streams chained by channel and stream ID, streamMask + 1 buckets, or NULL before the first */
+		size_t        streamMask;
+		size_t        streamCount;
 		snet_uint32   incomingBandwidth;  /**< Downstream bandwidth of the client in bytes/second */
 		snet_uint32   outgoingBandwidth;  /**< Upstream bandwidth of the client in bytes/second */
 		snet_uint32   incomingBandwidthThrottleEpoch;
 		snet_uint32   outgoingBandwidthThrottleEpoch;
+		snet_uint32   advertisedIncomingBandwidth; /**< incoming bandwidth limit last sent to the peer */
+		snet_uint32   advertisedOutgoingBandwidth; /**< outgoing bandwidth limit last sent to the peer */
+		size_t        connectedPeerIndex;
+		size_t        freePeerIndex;      /**< position in host->freePeerList */
+		SNetListNode  addressList;        /**< chains the peer into its host's address hash once the handshake is under way */
+		SNetSessionTicket sessionTicket;  /**< last ticket received from the foreign host, valid if hasSessionTicket is set */
+		snet_uint8    hasSessionTicket;
+		snet_uint32   sessionTicketTime;  /**< when the local host last issued a ticket to the peer */
+		SNetTokenBucket tokenBucket;      /**< per-peer rate limit, set by snet_peer_rate_limit() */
+		SNetBandwidthClass * bandwidthClass; /**< bandwidth class the peer is charged to, set by snet_peer_bandwidth_class() */
 		snet_uint32   incomingDataTotal;
 		snet_uint32   outgoingDataTotal;
 		snet_uint32   lastSendTime;
@@ -291,12 +532,24 @@ extern "C"
 		snet_uint32   timeoutLimit;
 		snet_uint32   timeoutMinimum;
 		snet_uint32   timeoutMaximum;
-		snet_uint32   lastRoundTripTime;
+		snet_uint32   lastRoundTripTime;        /**< the packet throttle's reference, in microseconds, as are the three that follow */
 		snet_uint32   lowestRoundTripTime;
 		snet_uint32   lastRoundTripTimeVariance;
 		snet_uint32   highestRoundTripTimeVariance;
 		snet_uint32   roundTripTime;            /**< mean round trip time (RTT), in milliseconds, between sending a reliable packet and receiving its acknowledgement */
 		snet_uint32   roundTripTimeVariance;
+		snet_uint32   roundTripTimeMicroseconds; /**< roundTripTime in microseconds, which it is rounded up from */
+		snet_uint32   roundTripTimeVarianceMicroseconds;
+		snet_uint32   minimumRoundTripTime;     /**< in microseconds */
+		snet_uint32   roundTripTimeSamples;
+		snet_uint32   retransmits;
+		snet_uint32   drops[SNET_PEER_DROP_REASON_COUNT];
+		snet_uint32   incomingFragmentedPackets;
+		snet_uint32   totalSentData;
+		snet_uint32   totalSentUncompressedData;
+		snet_uint32   totalReceivedData;
+		snet_uint32   totalReceivedUncompressedData;
+		SNetHistogram * histograms;     /**< SNET_PEER_HISTOGRAM_COUNT histograms, or NULL if the host's histograms are disabled */
 		snet_uint32   mtu;
 		snet_uint32   windowSize;
 		snet_uint32   reliableDataInTransit;
@@ -315,6 +568,27 @@ extern "C"
 		size_t        totalWaitingData;
 	} SNetPeer;
 
+
+	/** Callback that computes the checksum of the data held in buffers[0:bufferCount-1] */
+	typedef snet_uint32(SNET_CALLBACK * SNetChecksumCallback) (const SNetBuffer * buffers, size_t bufferCount);
+
+	/** Callback that folds data[0:dataLength-1] into a running checksum and returns the new state */
+	typedef snet_uint32(SNET_CALLBACK * SNetChecksumUpdateCallback) (snet_uint32 checksum, const snet_uint8 * data, size_t dataLength);
+
+	/** Built-in checksum algorithms, as selected with snet_host_checksum().
+	*
+	* The type is carried in the connection handshake, so the receiving host
+	* follows whichever built-in algorithm the connecting host uses.
+	* SNET_CHECKSUM_TYPE_NONE with a non-NULL SNetHost::checksum denotes a custom
+	* callback that both sides must agree on out of band.
+	*/
+	typedef enum _SNetChecksumType
+	{
+		SNET_CHECKSUM_TYPE_NONE = 0,
+		SNET_CHECKSUM_TYPE_CRC32 = 1,        /**< CRC32 (IEEE), PCLMULQDQ accelerated where available */
+		SNET_CHECKSUM_TYPE_CRC32C = 2        /**< CRC32C (Castagnoli), SSE4.2 accelerated where available */
+	} SNetChecksumType;
+
 	/** An SNet packet compressor for compressing UDP packets before socket sends or receives.
 	*/
 	typedef struct _SNetCompressor
@@ -327,14 +601,93 @@ extern "C"
 		size_t(SNET_CALLBACK * decompress) (void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit);
 		/** Destroys the context when compression is disabled or the host is destroyed. May be NULL. */
 		void (SNET_CALLBACK * destroy) (void * context);
+		/** As compress, but also folds every input byte into *checksum with update while it is being consumed. May be NULL. */
+		size_t(SNET_CALLBACK * compressChecksum) (void * context, const SNetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, snet_uint8 * outData, size_t outLimit, SNetChecksumUpdateCallback update, snet_uint32 * checksum);
+		/** As decompress, but also folds every output byte into *checksum with update while it is being produced. May be NULL. */
+		size_t(SNET_CALLBACK * decompressChecksum) (void * context, const snet_uint8 * inData, size_t inLimit, snet_uint8 * outData, size_t outLimit, SNetChecksumUpdateCallback update, snet_uint32 * checksum);
 	} SNetCompressor;
 
-	/** Callback that computes the checksum of the data held in buffers[0:bufferCount-1] */
-	typedef snet_uint32(SNET_CALLBACK * SNetChecksumCallback) (const SNetBuffer * buffers, size_t bufferCount);
+	/** A datagram passed to or from a transport in a batch.
+	*/
+	typedef struct _SNetDatagram
+	{
+		SNetAddress  address;        /**< destination when sending, source when receiving */
+		SNetBuffer * buffers;        /**< data gathered when sending; when receiving, buffers[0] is filled */
+		size_t       bufferCount;
+		size_t       dataLength;     /**< bytes received, set by the transport */
+	} SNetDatagram;
+
+	/** Batches of datagrams a transport has received but the host has not yet processed, or is yet to send. */
+	typedef struct _SNetDatagramBatch SNetDatagramBatch;
+
+	/** The interface through which a host sends and receives datagrams.
+	*
+	* Hosts use snet_socket_transport() over their own socket unless given another transport by
+	* snet_host_create_with_transport() or snet_host_transport(), such as to feed them recorded
+	* datagrams or connect them to an in-memory network.  Callbacks marked optional must be NULL
+	* when not provided.
+	*/
+	typedef struct _SNetTransport
+	{
+		/** Context data for the transport. Must be non-NULL. */
+		void * context;
+		/** Sends a datagram gathered from buffers[0:bufferCount-1] to address. Should return the bytes sent, 0 if it would block, or < 0 on failure. */
+		int (SNET_CALLBACK * send) (void * context, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount);
+		/** Receives a datagram into buffers[0:bufferCount-1], storing its source in address. Should return the bytes received, 0 if none is waiting, or < 0 on failure. */
+		int (SNET_CALLBACK * receive) (void * context, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount);
+		/** Waits up to timeout milliseconds for the SNET_SOCKET_WAIT_* conditions in *condition, as snet_socket_wait() does. May be NULL to return at once. */
+		int (SNET_CALLBACK * wait) (void * context, snet_uint32 * condition, snet_uint32 timeout);
+		/** Closes the transport and destroys the context when it is replaced or the host is destroyed. May be NULL. */
+		void (SNET_CALLBACK * destroy) (void * context);
+		/** Sends datagrams[0:datagramCount-1] in order. Should return how many were sent, 0 if none could be without blocking, or < 0 on failure. Optional. */
+		int (SNET_CALLBACK * sendBatch) (void * context, const SNetDatagram * datagrams, size_t datagramCount);
+		/** Receives up to datagramCount datagrams, as receive does for each, setting their address and dataLength. Should return how many were received, 0 if none is waiting, or < 0 on failure. Optional. */
+		int (SNET_CALLBACK * receiveBatch) (void * context, SNetDatagram * datagrams, size_t datagramCount);
+		/** Returns a descriptor that becomes readable when datagrams arrive, for applications waiting on many at once, or SNET_SOCKET_NULL if there is none. Optional. */
+		SNetSocket (SNET_CALLBACK * socket) (void * context);
+	} SNetTransport;
+
+	/** Network conditions emulated in one direction by snet_host_impair(). Chances are in parts per million.
+	*/
+	typedef struct _SNetImpairment
+	{
+		snet_uint32 loss;            /**< chance of dropping a datagram */
+		snet_uint32 duplicate;       /**< chance of delivering a datagram twice */
+		snet_uint32 reorder;         /**< chance of a datagram skipping delay and jitter, overtaking those still delayed */
+		snet_uint32 delay;           /**< delay added to every datagram, in milliseconds */
+		snet_uint32 jitter;          /**< largest random change to the delay, up or down, in milliseconds */
+		snet_uint32 bandwidth;       /**< link rate in bytes per second, or 0 for unlimited */
+		snet_uint32 queueLimit;      /**< bytes that may wait for the link before datagrams are dropped, or 0 for unlimited */
+	} SNetImpairment;
+
+	/** An in-memory network on which hosts exchange datagrams in virtual time, created by snet_fabric_create(). */
+	typedef struct _SNetFabric SNetFabric;
+
+	/** Callback returning the current time in milliseconds, for running a host on a virtual clock instead of snet_time_get(). */
+	typedef snet_uint32 (SNET_CALLBACK * SNetClockCallback) (struct _SNetHost * host);
 
 	/** Callback for intercepting received raw UDP packets. Should return 1 to intercept, 0 to ignore, or -1 to propagate an error. */
 	typedef int (SNET_CALLBACK * SNetInterceptCallback) (struct _SNetHost * host, struct _SNetEvent * event);
 
+	/**
+	* A protocol event reported to a host's trace callback and, in builds with HAS_SYS_SDT_H,
+	* fired as the USDT probe snet:<name> with the peer's incoming ID followed by the three arguments.
+	*/
+	typedef enum _SNetTraceType
+	{
+		SNET_TRACE_SEND          = 0,   /**< send: datagram bytes, commands, 1 if compressed; the peer is NULL for a stateless reply */
+		SNET_TRACE_RECEIVE       = 1,   /**< receive: datagram bytes, bytes after decompression, header flags; the peer is NULL for a connect */
+		SNET_TRACE_QUEUE         = 2,   /**< queue: command byte, channel ID, packet data bytes */
+		SNET_TRACE_RETRANSMIT    = 3,   /**< retransmit: reliable sequence number, channel ID, doubled round trip timeout */
+		SNET_TRACE_ACKNOWLEDGE   = 4,   /**< acknowledge: reliable sequence number, channel ID, round trip time sample in microseconds */
+		SNET_TRACE_THROTTLE      = 5,   /**< throttle: old packet throttle, new packet throttle, round trip time sample in microseconds */
+		SNET_TRACE_THROTTLE_DROP = 6,   /**< throttle_drop: unreliable sequence number, channel ID, commands dropped */
+		SNET_TRACE_STATE         = 7    /**< state: old SNetPeerState, new SNetPeerState, 0 */
+	} SNetTraceType;
+
+	/** Callback for tracing protocol events, called synchronously from within the host's service. */
+	typedef void (SNET_CALLBACK * SNetTraceCallback) (struct _SNetHost * host, SNetTraceType type, struct _SNetPeer * peer, snet_uint32 arg0, snet_uint32 arg1, snet_uint32 arg2);
+
 	/** An SNet host for communicating with peers.
 	*
 	* No fields should be modified unless otherwise stated.
@@ -347,6 +700,7 @@ extern "C"
 	@sa snet_host_broadcast()
 	@sa snet_host_compress()
 	@sa snet_host_compress_with_range_coder()
+	@sa snet_host_compress_with_rans_coder()
 	@sa snet_host_channel_limit()
 	@sa snet_host_bandwidth_limit()
 	@sa snet_host_bandwidth_throttle()
@@ -374,6 +728,8 @@ extern "C"
 		SNetBuffer           buffers[SNET_BUFFER_MAXIMUM];
 		size_t               bufferCount;
 		SNetChecksumCallback checksum;                    /**< callback the user can set to enable packet checksums for this host */
+		SNetChecksumType     checksumType;                /**< built-in checksum offered when connecting, set by snet_host_checksum() */
+		snet_uint8           protocolFlags;               /**< SNetProtocolConnectFlag values offered when connecting and accepted from connecting peers */
 		SNetCompressor       compressor;
 		snet_uint8           packetData[2][SNET_PROTOCOL_MAXIMUM_MTU];
 		SNetAddress          receivedAddress;
@@ -384,11 +740,40 @@ extern "C"
 		snet_uint32          totalReceivedData;           /**< total data received, user should reset to 0 as needed to prevent overflow */
 		snet_uint32          totalReceivedPackets;        /**< total UDP packets received, user should reset to 0 as needed to prevent overflow */
 		SNetInterceptCallback intercept;                  /**< callback the user can set to intercept received raw UDP packets */
+		SNetTraceCallback    trace;                       /**< callback the user can set to trace protocol events, or NULL */
+		SNetCapture *        capture;                     /**< datagram capture in progress, or NULL, set by snet_host_capture() */
+		SNetTransport        transport;                   /**< transport the host sends and receives through, set by snet_host_transport() */
+		SNetDatagramBatch *  receiveBatch;                /**< datagrams received at once by transport.receiveBatch, or NULL */
+		SNetDatagramBatch *  sendBatch;                   /**< datagrams held for transport.sendBatch until the end of a service phase, or NULL */
+		SNetClockCallback    clock;                       /**< callback the user can set to run the host on a virtual clock, or NULL */
+		void *               clockContext;                /**< application data for the clock callback */
 		size_t               connectedPeers;
+		SNetPeer **          connectedPeerList;           /**< the first connectedPeers entries are the connected peers, in no particular order */
+		size_t               freePeers;
+		SNetPeer **          freePeerList;                /**< every peer, the first freePeers entries being the disconnected ones and the rest those in use */
+		SNetList *           addressHash;                 /**< peers chained by address, port and connect ID, addressHashMask + 1 buckets */
+		SNetAddressCount *   addressCounts;               /**< peers per IP address, 2 * (addressHashMask + 1) entries */
+		size_t               addressHashMask;
+		snet_uint32          addressHashSeed;
+		SNetTokenBucket      tokenBucket;                 /**< host-wide rate limit, set by snet_host_rate_limit() */
+		snet_uint32          tokenBucketDelay;            /**< time until a rate limited peer may send again, or 0 if none is waiting */
+		size_t               nextSendPeer;
+		SNetList             bandwidthClasses;
 		size_t               bandwidthLimitedPeers;
 		size_t               duplicatePeers;              /**< optional number of allowed peers from duplicate IPs, defaults to SNET_PROTOCOL_MAXIMUM_PEER_ID */
+		int                  connectCookies;              /**< whether connects must echo a cookie first, set by snet_host_connect_cookies() */
+		snet_uint8           connectCookieSecret[SNET_HOST_CONNECT_COOKIE_SECRET_SIZE];
+		int                  sessionTickets;              /**< whether connected peers are issued session tickets, set by snet_host_session_tickets() */
+		snet_uint8           sessionTicketSecret[SNET_HOST_CONNECT_COOKIE_SECRET_SIZE];
+		SNetConnectLimit *   connectLimits;               /**< 2 rows of SNET_HOST_CONNECT_LIMIT_WIDTH cells, or NULL if connects are not rate limited */
+		snet_uint32          connectLimitRate;
+		snet_uint32          connectLimitBurst;
+		snet_uint32          droppedConnects;             /**< connects dropped by the connect rate limiter, user should reset to 0 as needed to prevent overflow */
+		SNetHistogram *      phaseHistograms;             /**< SNET_HOST_PHASE_COUNT histograms, or NULL if disabled, set by snet_host_histograms() */
+		SNetHistogram *      peerHistograms;
 		size_t               maximumPacketSize;           /**< the maximum allowable packet size that may be sent or received on a peer */
 		size_t               maximumWaitingData;          /**< the maximum aggregate amount of buffer space a peer may use waiting for packets to be delivered */
+		size_t               maximumStreams;              /**< the maximum number of streams a peer may use at once, counting those the foreign host uses */
 	} SNetHost;
 
 	/**
@@ -432,7 +817,7 @@ extern "C"
 		SNetEventType        type;      /**< type of the event */
 		SNetPeer *           peer;      /**< peer that generated a connect, disconnect or receive event */
 		snet_uint8           channelID; /**< channel on the peer that generated the event, if appropriate */
-		snet_uint32          data;      /**< data associated with the event, if appropriate */
+		snet_uint32          data;      /**< data associated with the event, if appropriate; for a received stream packet, its stream ID */
 		SNetPacket *         packet;    /**< packet associated with the event, if appropriate */
 	} SNetEvent;
 
@@ -481,6 +866,11 @@ extern "C"
 	Sets the current wall-time in milliseconds.
 	*/
 	SNET_API void snet_time_set(snet_uint32);
+	/**
+	Returns a monotonic time in nanoseconds, for measuring short intervals.  Its
+	initial value is unspecified and it is not affected by snet_time_set().
+	*/
+	SNET_API unsigned long long snet_time_get_nanoseconds(void);
 
 	/** @defgroup socket SNet socket functions
 	@{
@@ -493,6 +883,9 @@ extern "C"
 	SNET_API int        snet_socket_connect(SNetSocket, const SNetAddress *);
 	SNET_API int        snet_socket_send(SNetSocket, const SNetAddress *, const SNetBuffer *, size_t);
 	SNET_API int        snet_socket_receive(SNetSocket, SNetAddress *, SNetBuffer *, size_t);
+	SNET_API int        snet_socket_send_batch(SNetSocket, const SNetDatagram *, size_t);
+	SNET_API int        snet_socket_receive_batch(SNetSocket, SNetDatagram *, size_t);
+	SNET_API void       snet_socket_transport(SNetSocket *, SNetTransport *);
 	SNET_API int        snet_socket_wait(SNetSocket, snet_uint32 *, snet_uint32);
 	SNET_API int        snet_socket_set_option(SNetSocket, SNetSocketOption, int);
 	SNET_API int        snet_socket_get_option(SNetSocket, SNetSocketOption, int *);
@@ -541,22 +934,75 @@ extern "C"
 	SNET_API void         snet_packet_destroy(SNetPacket *);
 	SNET_API int          snet_packet_resize(SNetPacket *, size_t);
 	SNET_API snet_uint32  snet_crc32(const SNetBuffer *, size_t);
+	SNET_API snet_uint32  snet_crc32c(const SNetBuffer *, size_t);
+	SNET_API SNetChecksumCallback snet_checksum_callback(SNetChecksumType);
+	SNET_API SNetChecksumUpdateCallback snet_checksum_update_callback(SNetChecksumType);
+	extern   void         snet_checksum_initialize(void);
 
 	SNET_API SNetHost * snet_host_create(const SNetAddress *, size_t, size_t, snet_uint32, snet_uint32);
+	SNET_API SNetHost * snet_host_create_with_transport(const SNetAddress *, size_t, size_t, snet_uint32, snet_uint32, const SNetTransport *);
 	SNET_API void       snet_host_destroy(SNetHost *);
 	SNET_API SNetPeer * snet_host_connect(SNetHost *, const SNetAddress *, size_t, snet_uint32);
+	SNET_API SNetPeer * snet_host_resume(SNetHost *, const SNetAddress *, size_t, snet_uint32, const SNetSessionTicket *);
 	SNET_API int        snet_host_check_events(SNetHost *, SNetEvent *);
 	SNET_API int        snet_host_service(SNetHost *, SNetEvent *, snet_uint32);
 	SNET_API void       snet_host_flush(SNetHost *);
 	SNET_API void       snet_host_broadcast(SNetHost *, snet_uint8, SNetPacket *);
 	SNET_API void       snet_host_compress(SNetHost *, const SNetCompressor *);
+	SNET_API void       snet_host_transport(SNetHost *, const SNetTransport *);
+	extern   snet_uint32 snet_host_time(SNetHost *);
+	extern   snet_uint32 snet_host_time_microseconds(SNetHost *);
+	SNET_API SNetSocket snet_host_socket(SNetHost *);
+	extern   int        snet_host_send(SNetHost *, const SNetAddress *, const SNetBuffer *, size_t);
+	extern   int        snet_host_send_batch(SNetHost *);
+	extern   int        snet_host_receive(SNetHost *, SNetAddress *, snet_uint8 **);
+	extern   int        snet_host_wait(SNetHost *, snet_uint32 *, snet_uint32);
+	extern   void       snet_host_free_batches(SNetHost *);
+	SNET_API int        snet_host_impair(SNetHost *, const SNetImpairment *, const SNetImpairment *, snet_uint32);
+	extern   int        snet_host_impairment_due(SNetHost *, snet_uint32 *);
+	SNET_API int        snet_host_shared_memory(SNetHost *, int);
+	SNET_API SNetFabric * snet_fabric_create(snet_uint32);
+	SNET_API void       snet_fabric_destroy(SNetFabric *);
+	SNET_API SNetHost * snet_fabric_host_create(SNetFabric *, const SNetAddress *, size_t, size_t, snet_uint32, snet_uint32);
+	SNET_API snet_uint32 snet_fabric_time(const SNetFabric *);
+	SNET_API int        snet_fabric_service(SNetFabric *, SNetEvent *, snet_uint32);
+	SNET_API int        snet_host_checksum(SNetHost *, SNetChecksumType);
+	SNET_API void       snet_host_precise_time(SNetHost *, int);
 	SNET_API int        snet_host_compress_with_range_coder(SNetHost * host);
+	SNET_API int        snet_host_compress_with_rans_coder(SNetHost * host);
 	SNET_API void       snet_host_channel_limit(SNetHost *, size_t);
 	SNET_API void       snet_host_bandwidth_limit(SNetHost *, snet_uint32, snet_uint32);
+	SNET_API void       snet_host_rate_limit(SNetHost *, snet_uint32, snet_uint32);
+	SNET_API int        snet_host_connect_rate_limit(SNetHost *, snet_uint32, snet_uint32);
+	extern   int        snet_host_connect_allowed(SNetHost *, snet_uint32);
+	SNET_API void       snet_host_connect_cookies(SNetHost *, int, const snet_uint8 *);
+	extern   void       snet_host_connect_cookie(SNetHost *, const SNetAddress *, snet_uint32, snet_uint8 *);
+	extern   int        snet_host_verify_connect_cookie(SNetHost *, const SNetAddress *, snet_uint32, const snet_uint8 *);
+	SNET_API void       snet_host_session_tickets(SNetHost *, int, const snet_uint8 *);
+	extern   int        snet_host_verify_session_ticket(SNetHost *, const SNetSessionTicket *, const SNetAddress *);
 	extern   void       snet_host_bandwidth_throttle(SNetHost *);
+	extern   void       snet_token_bucket_configure(SNetTokenBucket *, snet_uint32, snet_uint32, snet_uint32);
+	extern   void       snet_token_bucket_refill(SNetTokenBucket *, snet_uint32);
+	extern   snet_uint32 snet_token_bucket_delay(const SNetTokenBucket *);
 	extern  snet_uint32 snet_host_random_seed(void);
+	extern   void *     snet_thread_create(void (*)(void *), void *);
+	extern   void       snet_thread_join(void *);
+	extern   void       snet_thread_sleep(snet_uint32);
+	extern   snet_uint32 snet_host_hash(snet_uint32, snet_uint32);
+	extern   void       snet_host_address_insert(SNetHost *, SNetPeer *);
+	extern   void       snet_host_address_remove(SNetHost *, SNetPeer *);
+	extern   SNetPeer * snet_host_address_lookup(SNetHost *, const SNetAddress *, snet_uint32);
+	extern   size_t     snet_host_address_count(SNetHost *, snet_uint32);
+	SNET_API int        snet_host_capture(SNetHost *, const char *, size_t);
+	extern   void       snet_host_capture_datagram(SNetHost *, int, snet_uint16, const SNetAddress *, const SNetBuffer *, size_t, size_t);
+	SNET_API int        snet_host_histograms(SNetHost *, int);
+	SNET_API void       snet_host_reset_histograms(SNetHost *);
+	SNET_API const SNetHistogram * snet_host_phase_histogram(const SNetHost *, SNetHostPhase);
+	extern   unsigned long long snet_host_phase_start(const SNetHost *);
+	extern   void       snet_host_phase_end(SNetHost *, SNetHostPhase, unsigned long long);
 
 	SNET_API int                 snet_peer_send(SNetPeer *, snet_uint8, SNetPacket *);
+	SNET_API int                 snet_peer_send_stream(SNetPeer *, snet_uint8, snet_uint32, SNetPacket *);
 	SNET_API SNetPacket *        snet_peer_receive(SNetPeer *, snet_uint8 * channelID);
 	SNET_API void                snet_peer_ping(SNetPeer *);
 	SNET_API void                snet_peer_ping_interval(SNetPeer *, snet_uint32);
@@ -566,14 +1012,32 @@ extern "C"
 	SNET_API void                snet_peer_disconnect_now(SNetPeer *, snet_uint32);
 	SNET_API void                snet_peer_disconnect_later(SNetPeer *, snet_uint32);
 	SNET_API void                snet_peer_throttle_configure(SNetPeer *, snet_uint32, snet_uint32, snet_uint32);
+	SNET_API void                snet_peer_rate_limit(SNetPeer *, snet_uint32, snet_uint32);
+	SNET_API void                snet_peer_bandwidth_class(SNetPeer *, SNetBandwidthClass *);
+	SNET_API int                 snet_peer_session_ticket(const SNetPeer *, SNetSessionTicket *);
+	SNET_API int                 snet_peer_get_stats(const SNetPeer *, SNetPeerStats *);
+	SNET_API const SNetHistogram * snet_peer_histogram(const SNetPeer *, SNetPeerHistogram);
+	extern void                  snet_peer_issue_session_ticket(SNetPeer *);
+	extern void                  snet_peer_resume_session(SNetPeer *, const SNetSessionTicket *);
+
+	SNET_API SNetBandwidthClass * snet_bandwidth_class_create(SNetHost *, SNetBandwidthClass *, snet_uint32, snet_uint32, snet_uint32);
+	SNET_API int                  snet_bandwidth_class_destroy(SNetBandwidthClass *);
+	extern snet_uint32            snet_bandwidth_class_delay(SNetBandwidthClass *, snet_uint32);
+	extern void                   snet_bandwidth_class_charge(SNetBandwidthClass *, snet_uint32);
 	extern int                   snet_peer_throttle(SNetPeer *, snet_uint32);
 	extern void                  snet_peer_reset_queues(SNetPeer *);
 	extern void                  snet_peer_setup_outgoing_command(SNetPeer *, SNetOutgoingCommand *);
 	extern SNetOutgoingCommand * snet_peer_queue_outgoing_command(SNetPeer *, const SNetProtocol *, SNetPacket *, snet_uint32, snet_uint16);
 	extern SNetIncomingCommand * snet_peer_queue_incoming_command(SNetPeer *, const SNetProtocol *, const void *, size_t, snet_uint32, snet_uint32);
-	extern SNetAcknowledgement * snet_peer_queue_acknowledgement(SNetPeer *, const SNetProtocol *, snet_uint16);
+	extern SNetAcknowledgement * snet_peer_queue_acknowledgement(SNetPeer *, const SNetProtocol *, snet_uint32, int);
 	extern void                  snet_peer_dispatch_incoming_unreliable_commands(SNetPeer *, SNetChannel *);
-	extern void                  snet_peer_dispatch_incoming_reliable_commands(SNetPeer *, SNetChannel *);
+	extern void                  snet_peer_dispatch_incoming_reliable_commands(SNetPeer *, SNetChannel *, SNetIncomingCommand *);
+	extern SNetStream *          snet_peer_stream(SNetPeer *, snet_uint8, snet_uint32);
+	extern void                  snet_peer_trim_stream(SNetPeer *, SNetStream *);
+	extern void                  snet_peer_acknowledge_stream_command(SNetPeer *, const SNetProtocol *);
+	extern int                   snet_peer_dispatch_incoming_stream_command(SNetPeer *, SNetChannel *, SNetIncomingCommand *);
+	extern void                  snet_peer_release_stream_command(SNetPeer *, const SNetIncomingCommand *);
+	extern void                  snet_peer_reset_streams(SNetPeer *);
 	extern void                  snet_peer_on_connect(SNetPeer *);
 	extern void                  snet_peer_on_disconnect(SNetPeer *);
 
@@ -581,8 +1045,25 @@ extern "C"
 	SNET_API void   snet_range_coder_destroy(void *);
 	SNET_API size_t snet_range_coder_compress(void *, const SNetBuffer *, size_t, size_t, snet_uint8 *, size_t);
 	SNET_API size_t snet_range_coder_decompress(void *, const snet_uint8 *, size_t, snet_uint8 *, size_t);
+	SNET_API size_t snet_range_coder_compress_checksum(void *, const SNetBuffer *, size_t, size_t, snet_uint8 *, size_t, SNetChecksumUpdateCallback, snet_uint32 *);
+	SNET_API size_t snet_range_coder_decompress_checksum(void *, const snet_uint8 *, size_t, snet_uint8 *, size_t, SNetChecksumUpdateCallback, snet_uint32 *);
+
+	SNET_API void * snet_rans_coder_create(void);
+	SNET_API void   snet_rans_coder_destroy(void *);
+	SNET_API size_t snet_rans_coder_compress(void *, const SNetBuffer *, size_t, size_t, snet_uint8 *, size_t);
+	SNET_API size_t snet_rans_coder_decompress(void *, const snet_uint8 *, size_t, snet_uint8 *, size_t);
+	SNET_API size_t snet_rans_coder_compress_checksum(void *, const SNetBuffer *, size_t, size_t, snet_uint8 *, size_t, SNetChecksumUpdateCallback, snet_uint32 *);
+	SNET_API size_t snet_rans_coder_decompress_checksum(void *, const snet_uint8 *, size_t, snet_uint8 *, size_t, SNetChecksumUpdateCallback, snet_uint32 *);
+
+	SNET_API void        snet_histogram_reset(SNetHistogram *);
+	SNET_API void        snet_histogram_record(SNetHistogram *, snet_uint32);
+	SNET_API void        snet_histogram_merge(SNetHistogram *, const SNetHistogram *);
+	SNET_API snet_uint32 snet_histogram_percentile(const SNetHistogram *, double);
 
 	extern size_t snet_protocol_command_size(snet_uint8);
+	extern size_t snet_protocol_stream_header_size(const SNetProtocol *);
+	extern size_t snet_protocol_read_stream_header(const SNetProtocol *, const snet_uint8 *, snet_uint32 *, snet_uint16 *);
+	extern size_t snet_protocol_write_stream_header(SNetProtocol *, snet_uint32, snet_uint16);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,433 @@
+/**
+@file  stream.c
+@brief SNet ordered streams within channels
+*/
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+
+/** @defgroup stream SNet stream functions
+@{
+*/
+
+static SNetList *
+snet_peer_stream_bucket(SNetPeer * peer, snet_uint8 channelID, snet_uint32 streamID)
+{
+	snet_uint32 hash = snet_host_hash(peer->host->addressHashSeed, streamID);
+
+	hash = snet_host_hash(hash, channelID);
+
+	return &peer->streams[hash & peer->streamMask];
+}
+
+/* Doubles the peer's stream buckets, or creates the first ones, rechaining the streams it has. */
+static int
+snet_peer_grow_streams(SNetPeer * peer)
+{
+	SNetList * oldStreams = peer->streams;
+	size_t oldBucketCount = peer->streams != NULL ? peer->streamMask + 1 : 0,
+		bucketCount = oldBucketCount > 0 ? 2 * oldBucketCount : SNET_PEER_STREAM_BUCKETS,
+		bucket;
+
+	peer->streams = (SNetList *)snet_malloc(bucketCount * sizeof(SNetList));
+	if (peer->streams == NULL)
+	{
+		peer->streams = oldStreams;
+
+		return -1;
+	}
+
+	for (bucket = 0; bucket < bucketCount; ++bucket)
+		snet_list_clear(&peer->streams[bucket]);
+
+	peer->streamMask = bucketCount - 1;
+
+	for (bucket = 0; bucket < oldBucketCount; ++bucket)
+	{
+		while (!snet_list_empty(&oldStreams[bucket]))
+		{
+			SNetStream * stream = (SNetStream *)snet_list_remove(snet_list_begin(&oldStreams[bucket]));
+
+			snet_list_insert(snet_list_end(snet_peer_stream_bucket(peer, stream->channelID, stream->streamID)), stream);
+		}
+	}
+
+	if (oldStreams != NULL)
+		snet_free(oldStreams);
+
+	return 0;
+}
+
+static SNetStream *
+snet_peer_find_stream(SNetPeer * peer, snet_uint8 channelID, snet_uint32 streamID)
+{
+	SNetList * bucket;
+	SNetListIterator currentStream;
+
+	if (peer->streams == NULL)
+		return NULL;
+
+	bucket = snet_peer_stream_bucket(peer, channelID, streamID);
+
+	for (currentStream = snet_list_begin(bucket);
+		currentStream != snet_list_end(bucket);
+		currentStream = snet_list_next(currentStream))
+	{
+		SNetStream * stream = (SNetStream *)currentStream;
+
+		if (stream->streamID == streamID && stream->channelID == channelID)
+			return stream;
+	}
+
+	return NULL;
+}
+
+/** Finds a stream of the peer, creating it if the peer is not using it at the moment.
+@param peer peer the stream belongs to
+@param channelID channel the stream is within
+@param streamID ID of the stream within the channel
+@returns the stream, or NULL if the peer has the host's maximumStreams in use already or memory ran out
+*/
+SNetStream *
+snet_peer_stream(SNetPeer * peer, snet_uint8 channelID, snet_uint32 streamID)
+{
+	SNetStream * stream = snet_peer_find_stream(peer, channelID, streamID);
+
+	if (stream != NULL)
+		return stream;
+
+	if (peer->streamCount >= peer->host->maximumStreams)
+		return NULL;
+
+	if ((peer->streams == NULL || peer->streamCount > peer->streamMask) &&
+		snet_peer_grow_streams(peer) < 0)
+		return NULL;
+
+	stream = (SNetStream *)snet_malloc(sizeof(SNetStream));
+	if (stream == NULL)
+		return NULL;
+
+	stream->streamID = streamID;
+	stream->channelID = channelID;
+	stream->outgoingReliableSequenceNumber = 0;
+	stream->outgoingCommandCount = 0;
+	snet_list_clear(&stream->incomingCommands);
+
+	snet_list_insert(snet_list_end(snet_peer_stream_bucket(peer, channelID, streamID)), stream);
+
+	++peer->streamCount;
+
+	return stream;
+}
+
+/** Frees a stream once nothing sent on it awaits acknowledgement and nothing received on it waits.
+
+Neither end needs the stream after that: the next packet sent on it names no earlier one to wait
+for, and the channel alone can tell whether an earlier one named by a packet received has been
+delivered.
+*/
+void
+snet_peer_trim_stream(SNetPeer * peer, SNetStream * stream)
+{
+	if (stream->outgoingCommandCount > 0 || !snet_list_empty(&stream->incomingCommands))
+		return;
+
+	snet_list_remove(&stream->streamList);
+
+	snet_free(stream);
+
+	--peer->streamCount;
+}
+
+/** Notes the acknowledgement of a command the host sent on a stream.
+@param peer peer the command was sent to
+@param command the command as sent, with its stream header
+*/
+void
+snet_peer_acknowledge_stream_command(SNetPeer * peer, const SNetProtocol * command)
+{
+	SNetStream * stream;
+	snet_uint32 streamID;
+	snet_uint16 distance;
+
+	if (snet_protocol_read_stream_header(command, (const snet_uint8 *)(command + 1), &streamID, &distance) == 0)
+		return;
+
+	stream = snet_peer_find_stream(peer, command->header.channelID, streamID);
+	if (stream == NULL || stream->outgoingCommandCount == 0)
+		return;
+
+	--stream->outgoingCommandCount;
+
+	snet_peer_trim_stream(peer, stream);
+}
+
+static void
+snet_peer_free_stream_command(SNetIncomingCommand * incomingCommand)
+{
+	--incomingCommand->packet->referenceCount;
+
+	if (incomingCommand->packet->referenceCount == 0)
+		snet_packet_destroy(incomingCommand->packet);
+
+	if (incomingCommand->fragments != NULL)
+		snet_free(incomingCommand->fragments);
+
+	snet_free(incomingCommand);
+}
+
+static void
+snet_peer_dispatch_stream_command(SNetPeer * peer, SNetIncomingCommand * incomingCommand)
+{
+	snet_list_insert(snet_list_end(&peer->dispatchedCommands), incomingCommand);
+
+	if (!peer->needsDispatch)
+	{
+		snet_list_insert(snet_list_end(&peer->host->dispatchQueue), &peer->dispatchList);
+
+		peer->needsDispatch = 1;
+	}
+}
+
+/* Dispatches a command and then every one its stream holds that was waiting, directly or not, on it. */
+static void
+snet_peer_dispatch_stream_commands(SNetPeer * peer, SNetStream * stream, SNetIncomingCommand * incomingCommand)
+{
+	for (;;)
+	{
+		snet_uint16 reliableSequenceNumber = incomingCommand->reliableSequenceNumber;
+		SNetListIterator currentCommand;
+
+		snet_peer_dispatch_stream_command(peer, incomingCommand);
+
+		if (stream == NULL)
+			return;
+
+		for (currentCommand = snet_list_begin(&stream->incomingCommands);
+			currentCommand != snet_list_end(&stream->incomingCommands);
+			currentCommand = snet_list_next(currentCommand))
+		{
+			SNetIncomingCommand * heldCommand = (SNetIncomingCommand *)currentCommand;
+
+			if ((snet_uint16)(heldCommand->reliableSequenceNumber - heldCommand->streamDistance) == reliableSequenceNumber)
+				break;
+		}
+
+		if (currentCommand == snet_list_end(&stream->incomingCommands))
+			return;
+
+		incomingCommand = (SNetIncomingCommand *)snet_list_remove(currentCommand);
+	}
+}
+
+/* Whether a reliable sequence number is beyond the channel's sequence, within the receive window. */
+static int
+snet_peer_stream_ahead(SNetChannel * channel, snet_uint16 reliableSequenceNumber)
+{
+	return (snet_uint16)(reliableSequenceNumber - channel->incomingReliableSequenceNumber - 1) <
+		(SNET_PEER_FREE_RELIABLE_WINDOWS - 1) * SNET_PEER_RELIABLE_WINDOW_SIZE;
+}
+
+/* Whether the command with the reliable sequence number has been delivered, if it was sent on the
+   stream: the channel has reached it or dispatched it early, and the stream does not hold it. */
+static int
+snet_peer_stream_delivered(SNetChannel * channel, SNetStream * stream, snet_uint16 reliableSequenceNumber)
+{
+	SNetListIterator currentCommand;
+
+	if (snet_peer_stream_ahead(channel, reliableSequenceNumber))
+	{
+		for (currentCommand = snet_list_begin(&channel->incomingReliableCommands);
+			currentCommand != snet_list_end(&channel->incomingReliableCommands);
+			currentCommand = snet_list_next(currentCommand))
+		{
+			if (((SNetIncomingCommand *)currentCommand)->reliableSequenceNumber == reliableSequenceNumber)
+				break;
+		}
+
+		if (currentCommand == snet_list_end(&channel->incomingReliableCommands) ||
+			((SNetIncomingCommand *)currentCommand)->packet != NULL)
+			return 0;
+	}
+
+	if (stream == NULL)
+		return 1;
+
+	for (currentCommand = snet_list_begin(&stream->incomingCommands);
+		currentCommand != snet_list_end(&stream->incomingCommands);
+		currentCommand = snet_list_next(currentCommand))
+	{
+		if (((SNetIncomingCommand *)currentCommand)->reliableSequenceNumber == reliableSequenceNumber)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Whether a complete command sent on the stream, ahead of the channel's sequence and before the one
+   with the reliable sequence number, waits in the channel's queue for the sequence to reach it. */
+static int
+snet_peer_stream_queued(SNetChannel * channel, snet_uint32 streamID, snet_uint16 reliableSequenceNumber)
+{
+	SNetListIterator currentCommand;
+
+	for (currentCommand = snet_list_begin(&channel->incomingReliableCommands);
+		currentCommand != snet_list_end(&channel->incomingReliableCommands);
+		currentCommand = snet_list_next(currentCommand))
+	{
+		SNetIncomingCommand * incomingCommand = (SNetIncomingCommand *)currentCommand;
+		snet_uint32 queuedStreamID;
+		snet_uint16 distance;
+
+		if (incomingCommand->reliableSequenceNumber == reliableSequenceNumber)
+			break;
+
+		if (incomingCommand->packet != NULL &&
+			incomingCommand->fragmentsRemaining <= 0 &&
+			(incomingCommand->command.header.command & SNET_PROTOCOL_COMMAND_FLAG_STREAM) &&
+			snet_protocol_read_stream_header(&incomingCommand->command, (const snet_uint8 *)(&incomingCommand->command + 1), &queuedStreamID, &distance) > 0 &&
+			queuedStreamID == streamID)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Whether a command sent on a stream must wait: the one before it on the stream has not been
+   delivered, or an earlier one on the stream waits for the channel's sequence, having had no
+   stream to hold it.  The sender takes such a one as delivered once acknowledged, so the
+   command may name none before it. */
+static int
+snet_peer_stream_waits(SNetChannel * channel, SNetStream * stream, snet_uint32 streamID, snet_uint16 reliableSequenceNumber, snet_uint16 distance)
+{
+	if (!snet_peer_stream_ahead(channel, reliableSequenceNumber))
+		return 0;
+
+	if (distance != 0 && !snet_peer_stream_delivered(channel, stream, (snet_uint16)(reliableSequenceNumber - distance)))
+		return 1;
+
+	return snet_peer_stream_queued(channel, streamID, reliableSequenceNumber);
+}
+
+/** Dispatches a complete reliable command sent on a stream once the one before it on the stream has been.
+
+The channel has already put the command in order with every other on it and dropped copies, and
+hands it over either early, as soon as it is complete, or once the channel's sequence reaches it.
+The command names the packet sent before it on its stream, if that was still unacknowledged
+when it was sent; only while that packet has not been delivered does the command wait, held by
+its stream, and never once the channel's sequence has reached it.
+
+@param peer peer the command came from
+@param channel channel the command came on
+@param incomingCommand command with its packet, in no list, which the stream takes over
+@retval 0 if the command was dispatched or is held by its stream
+@retval < 0 if the command must wait and the peer has no room for another stream, leaving the
+command to wait for the channel's sequence instead; later commands on its stream then wait
+behind it, as a command left there for any reason holds back those after it on its stream
+*/
+int
+snet_peer_dispatch_incoming_stream_command(SNetPeer * peer, SNetChannel * channel, SNetIncomingCommand * incomingCommand)
+{
+	SNetStream * stream;
+	snet_uint32 streamID = 0;
+	snet_uint16 distance = 0;
+
+	snet_protocol_read_stream_header(&incomingCommand->command, (const snet_uint8 *)(&incomingCommand->command + 1), &streamID, &distance);
+
+	incomingCommand->streamID = streamID;
+	incomingCommand->streamDistance = distance;
+
+	stream = snet_peer_find_stream(peer, incomingCommand->command.header.channelID, streamID);
+
+	if (!snet_peer_stream_waits(channel, stream, streamID, incomingCommand->reliableSequenceNumber, distance))
+	{
+		snet_peer_dispatch_stream_commands(peer, stream, incomingCommand);
+
+		if (stream != NULL)
+			snet_peer_trim_stream(peer, stream);
+
+		return 0;
+	}
+
+	if (stream == NULL)
+	{
+		stream = snet_peer_stream(peer, incomingCommand->command.header.channelID, streamID);
+		if (stream == NULL)
+			return -1;
+	}
+
+	snet_list_insert(snet_list_end(&stream->incomingCommands), incomingCommand);
+
+	return 0;
+}
+
+/** Dispatches a command its stream holds once the channel's sequence reaches it.
+
+By then every earlier command on the channel, and so every earlier one on the stream, has been
+dispatched, so the command need not wait for the one it names should that be a packet the
+channel can no longer tell apart from a later one.
+
+@param peer peer the command came from
+@param dispatchedCommand the command as the channel left it on dispatching it early, without its packet
+*/
+void
+snet_peer_release_stream_command(SNetPeer * peer, const SNetIncomingCommand * dispatchedCommand)
+{
+	SNetStream * stream;
+	SNetListIterator currentCommand;
+	snet_uint32 streamID;
+	snet_uint16 distance;
+
+	if (snet_protocol_read_stream_header(&dispatchedCommand->command, (const snet_uint8 *)(&dispatchedCommand->command + 1), &streamID, &distance) == 0)
+		return;
+
+	stream = snet_peer_find_stream(peer, dispatchedCommand->command.header.channelID, streamID);
+	if (stream == NULL)
+		return;
+
+	for (currentCommand = snet_list_begin(&stream->incomingCommands);
+		currentCommand != snet_list_end(&stream->incomingCommands);
+		currentCommand = snet_list_next(currentCommand))
+	{
+		SNetIncomingCommand * heldCommand = (SNetIncomingCommand *)currentCommand;
+
+		if (heldCommand->reliableSequenceNumber == dispatchedCommand->reliableSequenceNumber)
+		{
+			snet_peer_dispatch_stream_commands(peer, stream, (SNetIncomingCommand *)snet_list_remove(currentCommand));
+
+			snet_peer_trim_stream(peer, stream);
+
+			return;
+		}
+	}
+}
+
+/** Frees the peer's streams along with any packets held on them. */
+void
+snet_peer_reset_streams(SNetPeer * peer)
+{
+	size_t bucket;
+
+	if (peer->streams == NULL)
+		return;
+
+	for (bucket = 0; bucket <= peer->streamMask; ++bucket)
+	{
+		while (!snet_list_empty(&peer->streams[bucket]))
+		{
+			SNetStream * stream = (SNetStream *)snet_list_remove(snet_list_begin(&peer->streams[bucket]));
+
+			while (!snet_list_empty(&stream->incomingCommands))
+				snet_peer_free_stream_command((SNetIncomingCommand *)snet_list_remove(snet_list_begin(&stream->incomingCommands)));
+
+			snet_free(stream);
+		}
+	}
+
+	snet_free(peer->streams);
+
+	peer->streams = NULL;
+	peer->streamMask = 0;
+	peer->streamCount = 0;
+}
+
+/** @} */
@@ -0,0 +1,31 @@
+/**
+@file  trace.h
+@brief SNet protocol tracepoints
+*/
+#ifndef __SNET_TRACE_H__
+#define __SNET_TRACE_H__
+
+#ifdef HAS_SYS_SDT_H
+#include <sys/sdt.h>
+
+/* a USDT probe is a nop until a tracer attaches to it */
+#define SNET_TRACE_PROBE(name, peer, arg0, arg1, arg2) \
+	DTRACE_PROBE4(snet, name, (peer) != NULL ? (peer)->incomingPeerID : 0xFFFF, arg0, arg1, arg2)
+#else
+#define SNET_TRACE_PROBE(name, peer, arg0, arg1, arg2) ((void) 0)
+#endif
+
+/* each argument is evaluated once, and the values go to both the probe and the callback */
+#define SNET_TRACE(host, type, name, peer, arg0, arg1, arg2) \
+	do { \
+		SNetHost * snetTraceHost = (host); \
+		SNetPeer * snetTracePeer = (peer); \
+		snet_uint32 snetTraceArg0 = (snet_uint32)(arg0), \
+			snetTraceArg1 = (snet_uint32)(arg1), \
+			snetTraceArg2 = (snet_uint32)(arg2); \
+		SNET_TRACE_PROBE(name, snetTracePeer, snetTraceArg0, snetTraceArg1, snetTraceArg2); \
+		if (snetTraceHost->trace != NULL) \
+			snetTraceHost->trace(snetTraceHost, (type), snetTracePeer, snetTraceArg0, snetTraceArg1, snetTraceArg2); \
+	} while (0)
+
+#endif /* __SNET_TRACE_H__ */
@@ -0,0 +1,347 @@
+/**
+@file  transport.c
+@brief SNet replaceable transports and clocks
+*/
+#include <string.h>
+#define SNET_BUILDING_LIB 1
+#include "snet/snet.h"
+
+/** @defgroup transport SNet transport functions
+@{
+*/
+
+struct _SNetDatagramBatch
+{
+	size_t       datagramCount;
+	size_t       nextDatagram;
+	SNetDatagram datagrams[SNET_HOST_DATAGRAM_BATCH];
+	SNetBuffer   buffers[SNET_HOST_DATAGRAM_BATCH];
+	snet_uint8   data[SNET_HOST_DATAGRAM_BATCH][SNET_PROTOCOL_MAXIMUM_MTU];
+};
+
+static int SNET_CALLBACK
+snet_socket_transport_send(void * context, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	return snet_socket_send(*(SNetSocket *)context, address, buffers, bufferCount);
+}
+
+static int SNET_CALLBACK
+snet_socket_transport_receive(void * context, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount)
+{
+	return snet_socket_receive(*(SNetSocket *)context, address, buffers, bufferCount);
+}
+
+static int SNET_CALLBACK
+snet_socket_transport_wait(void * context, snet_uint32 * condition, snet_uint32 timeout)
+{
+	return snet_socket_wait(*(SNetSocket *)context, condition, timeout);
+}
+
+#ifdef HAS_SENDMMSG
+static int SNET_CALLBACK
+snet_socket_transport_send_batch(void * context, const SNetDatagram * datagrams, size_t datagramCount)
+{
+	return snet_socket_send_batch(*(SNetSocket *)context, datagrams, datagramCount);
+}
+#endif
+
+#ifdef HAS_RECVMMSG
+static int SNET_CALLBACK
+snet_socket_transport_receive_batch(void * context, SNetDatagram * datagrams, size_t datagramCount)
+{
+	return snet_socket_receive_batch(*(SNetSocket *)context, datagrams, datagramCount);
+}
+#endif
+
+static SNetSocket SNET_CALLBACK
+snet_socket_transport_socket(void * context)
+{
+	return *(SNetSocket *)context;
+}
+
+/** Fills in a transport that sends and receives through a BSD socket.
+
+This is the transport every host created by snet_host_create() uses for its own socket.
+Batches go through sendmmsg() and recvmmsg() in builds with HAS_SENDMMSG and HAS_RECVMMSG;
+otherwise the host sends and receives one datagram at a time.
+
+@param socket where the socket is kept; it must outlive the transport, which does not close it
+@param transport transport to fill in
+*/
+void
+snet_socket_transport(SNetSocket * socket, SNetTransport * transport)
+{
+	memset(transport, 0, sizeof(SNetTransport));
+
+	transport->context = socket;
+	transport->send = snet_socket_transport_send;
+	transport->receive = snet_socket_transport_receive;
+	transport->wait = snet_socket_transport_wait;
+	transport->socket = snet_socket_transport_socket;
+#ifdef HAS_SENDMMSG
+	transport->sendBatch = snet_socket_transport_send_batch;
+#endif
+#ifdef HAS_RECVMMSG
+	transport->receiveBatch = snet_socket_transport_receive_batch;
+#endif
+}
+
+/** Sets the transport the host should send and receive datagrams through in place of its socket.
+
+The socket stays open, so the host keeps its address, but is no longer read or written.
+Together with a virtual clock in host->clock, a transport lets a host be driven without a
+network, such as to replay a capture deterministically.
+
+@param host host to configure
+@param transport callbacks for the transport; if NULL, the host goes back to its socket
+@remarks A host on a virtual clock should be serviced with a timeout of 0, unless its transport's
+wait callback advances the clock, since the host otherwise waits for a time that never comes.
+Datagrams held for the old transport's sendBatch are sent before it is destroyed, while those it
+has already received are still processed.
+*/
+void
+snet_host_transport(SNetHost * host, const SNetTransport * transport)
+{
+	snet_host_send_batch(host);
+
+	if (host->transport.context != NULL && host->transport.destroy != NULL)
+		(*host->transport.destroy) (host->transport.context);
+
+	if (transport)
+		host->transport = *transport;
+	else
+		snet_socket_transport(&host->socket, &host->transport);
+}
+
+/** Returns a descriptor that becomes readable when the host has datagrams waiting.
+
+Applications servicing many hosts, or waiting on other descriptors too, can poll these and call
+snet_host_service() with a timeout of 0 for the hosts whose descriptors are ready.
+
+@param host host to query
+@returns the descriptor from the host's transport, or SNET_SOCKET_NULL if it has none
+*/
+SNetSocket
+snet_host_socket(SNetHost * host)
+{
+	if (host->transport.socket == NULL)
+		return SNET_SOCKET_NULL;
+
+	return host->transport.socket(host->transport.context);
+}
+
+/** Returns the host's current time, from its clock if one is set. */
+snet_uint32
+snet_host_time(SNetHost * host)
+{
+	return host->clock != NULL ? host->clock(host) : snet_time_get();
+}
+
+/** Returns the host's current time in microseconds, wrapping every 71 minutes.  A clock set in
+host->clock only counts milliseconds, which this scales up. */
+snet_uint32
+snet_host_time_microseconds(SNetHost * host)
+{
+	return host->clock != NULL ? host->clock(host) * 1000 : (snet_uint32)(snet_time_get_nanoseconds() / 1000);
+}
+
+static SNetDatagramBatch *
+snet_host_batch(SNetDatagramBatch ** batch)
+{
+	if (*batch == NULL)
+	{
+		*batch = (SNetDatagramBatch *)snet_malloc(sizeof(SNetDatagramBatch));
+		if (*batch != NULL)
+		{
+			(*batch)->datagramCount = 0;
+			(*batch)->nextDatagram = 0;
+		}
+	}
+
+	return *batch;
+}
+
+/** Frees the host's batches, dropping any datagrams in them. */
+void
+snet_host_free_batches(SNetHost * host)
+{
+	if (host->receiveBatch != NULL)
+		snet_free(host->receiveBatch);
+	if (host->sendBatch != NULL)
+		snet_free(host->sendBatch);
+
+	host->receiveBatch = NULL;
+	host->sendBatch = NULL;
+}
+
+/** Sends a datagram through the host's transport.
+
+If the transport takes batches, the datagram is copied into the host's send batch and goes out
+with the rest of it at the end of the service phase, by snet_host_send_batch().
+
+@returns the bytes sent or held, 0 if the transport would block, or < 0 on failure
+*/
+int
+snet_host_send(SNetHost * host, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	SNetDatagramBatch * batch;
+	SNetDatagram * datagram;
+	size_t dataLength = 0, i;
+	snet_uint8 * data;
+
+	if (host->transport.sendBatch == NULL)
+		return host->transport.send(host->transport.context, address, buffers, bufferCount);
+
+	for (i = 0; i < bufferCount; ++i)
+		dataLength += buffers[i].dataLength;
+
+	batch = snet_host_batch(&host->sendBatch);
+	if (batch == NULL || dataLength > SNET_PROTOCOL_MAXIMUM_MTU)
+	{
+		if (snet_host_send_batch(host) < 0)
+			return -1;
+
+		return host->transport.send(host->transport.context, address, buffers, bufferCount);
+	}
+
+	if (batch->datagramCount >= SNET_HOST_DATAGRAM_BATCH && snet_host_send_batch(host) < 0)
+		return -1;
+
+	datagram = &batch->datagrams[batch->datagramCount];
+	datagram->address = *address;
+	datagram->buffers = &batch->buffers[batch->datagramCount];
+	datagram->bufferCount = 1;
+	datagram->dataLength = dataLength;
+	datagram->buffers->data = data = batch->data[batch->datagramCount];
+	datagram->buffers->dataLength = dataLength;
+
+	for (i = 0; i < bufferCount; ++i)
+	{
+		memcpy(data, buffers[i].data, buffers[i].dataLength);
+		data += buffers[i].dataLength;
+	}
+
+	++batch->datagramCount;
+
+	return (int)dataLength;
+}
+
+/** Sends the datagrams held in the host's send batch.
+
+Any the transport could not take without blocking are dropped, as a full socket buffer would.
+
+@returns 0 on success, or < 0 on failure
+*/
+int
+snet_host_send_batch(SNetHost * host)
+{
+	SNetDatagramBatch * batch = host->sendBatch;
+	size_t sent = 0;
+	int result = 0;
+
+	if (batch == NULL || batch->datagramCount == 0)
+		return 0;
+
+	while (sent < batch->datagramCount)
+	{
+		int sentCount = host->transport.sendBatch(host->transport.context, &batch->datagrams[sent], batch->datagramCount - sent);
+
+		if (sentCount <= 0)
+		{
+			result = sentCount;
+			break;
+		}
+
+		sent += sentCount;
+	}
+
+	batch->datagramCount = 0;
+
+	return result < 0 ? -1 : 0;
+}
+
+/** Receives the next datagram through the host's transport.
+
+Transports that take batches are asked for up to SNET_HOST_DATAGRAM_BATCH datagrams at once,
+which are then handed out one per call.
+
+@param host host to receive for
+@param address set to the source of the datagram
+@param data set to where the datagram lies, valid until the next call
+@returns the bytes received, 0 if none is waiting, or < 0 on failure
+*/
+int
+snet_host_receive(SNetHost * host, SNetAddress * address, snet_uint8 ** data)
+{
+	SNetDatagramBatch * batch = host->receiveBatch;
+	SNetDatagram * datagram;
+
+	if (batch == NULL || batch->nextDatagram >= batch->datagramCount)
+	{
+		int receivedCount;
+		size_t i;
+
+		if (host->transport.receiveBatch == NULL || snet_host_batch(&host->receiveBatch) == NULL)
+		{
+			SNetBuffer buffer;
+
+			buffer.data = host->packetData[0];
+			buffer.dataLength = sizeof(host->packetData[0]);
+
+			*data = host->packetData[0];
+
+			return host->transport.receive(host->transport.context, address, &buffer, 1);
+		}
+
+		batch = host->receiveBatch;
+		batch->datagramCount = 0;
+		batch->nextDatagram = 0;
+
+		for (i = 0; i < SNET_HOST_DATAGRAM_BATCH; ++i)
+		{
+			batch->buffers[i].data = batch->data[i];
+			batch->buffers[i].dataLength = sizeof(batch->data[i]);
+			batch->datagrams[i].buffers = &batch->buffers[i];
+			batch->datagrams[i].bufferCount = 1;
+			batch->datagrams[i].dataLength = 0;
+		}
+
+		receivedCount = host->transport.receiveBatch(host->transport.context, batch->datagrams, SNET_HOST_DATAGRAM_BATCH);
+		if (receivedCount <= 0)
+			return receivedCount;
+
+		batch->datagramCount = (size_t)receivedCount;
+	}
+
+	datagram = &batch->datagrams[batch->nextDatagram++];
+
+	*address = datagram->address;
+	*data = (snet_uint8 *)datagram->buffers[0].data;
+
+	return (int)datagram->dataLength;
+}
+
+/** Waits on the host's transport, returning at once if a received batch is still being processed. */
+int
+snet_host_wait(SNetHost * host, snet_uint32 * condition, snet_uint32 timeout)
+{
+	if ((*condition & SNET_SOCKET_WAIT_RECEIVE) &&
+		host->receiveBatch != NULL &&
+		host->receiveBatch->nextDatagram < host->receiveBatch->datagramCount)
+	{
+		*condition = SNET_SOCKET_WAIT_RECEIVE;
+
+		return 0;
+	}
+
+	if (host->transport.wait == NULL)
+	{
+		*condition = SNET_SOCKET_WAIT_NONE;
+
+		return 0;
+	}
+
+	return host->transport.wait(host->transport.context, condition, timeout);
+}
+
+/** @} */
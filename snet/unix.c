@@ -4,6 +4,10 @@
 */
 #ifndef _WIN32
 
+#if (defined(HAS_SENDMMSG) || defined(HAS_RECVMMSG)) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -15,8 +19,9 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 
-#define ENET_BUILDING_LIB 1
+#define SNET_BUILDING_LIB 1
 #include "snet/snet.h"
 
 #ifdef __APPLE__
@@ -61,6 +66,8 @@ static snet_uint32 timeBase = 0;
 int
 snet_initialize(void)
 {
+	snet_checksum_initialize();
+
 	return 0;
 }
 
@@ -95,6 +102,80 @@ snet_time_set(snet_uint32 newTimeBase)
 	timeBase = timeVal.tv_sec * 1000 + timeVal.tv_usec / 1000 - newTimeBase;
 }
 
+typedef struct _SNetUnixThread
+{
+	pthread_t thread;
+	void (* function) (void *);
+	void * data;
+} SNetUnixThread;
+
+static void *
+snet_thread_start(void * data)
+{
+	SNetUnixThread * thread = (SNetUnixThread *)data;
+
+	thread->function(thread->data);
+
+	return NULL;
+}
+
+void *
+snet_thread_create(void (* function) (void *), void * data)
+{
+	SNetUnixThread * thread = (SNetUnixThread *)snet_malloc(sizeof(SNetUnixThread));
+	if (thread == NULL)
+		return NULL;
+
+	thread->function = function;
+	thread->data = data;
+
+	if (pthread_create(&thread->thread, NULL, snet_thread_start, thread) != 0)
+	{
+		snet_free(thread);
+
+		return NULL;
+	}
+
+	return thread;
+}
+
+void
+snet_thread_join(void * thread)
+{
+	pthread_join(((SNetUnixThread *)thread)->thread, NULL);
+
+	snet_free(thread);
+}
+
+void
+snet_thread_sleep(snet_uint32 milliseconds)
+{
+	struct timespec timeSpec;
+
+	timeSpec.tv_sec = milliseconds / 1000;
+	timeSpec.tv_nsec = (milliseconds % 1000) * 1000000;
+
+	nanosleep(&timeSpec, NULL);
+}
+
+unsigned long long
+snet_time_get_nanoseconds(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec timeSpec;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &timeSpec) == 0)
+		return (unsigned long long)timeSpec.tv_sec * 1000000000ULL + timeSpec.tv_nsec;
+#endif
+	{
+		struct timeval timeVal;
+
+		gettimeofday(&timeVal, NULL);
+
+		return (unsigned long long)timeVal.tv_sec * 1000000000ULL + timeVal.tv_usec * 1000ULL;
+	}
+}
+
 int
 snet_address_set_host(SNetAddress * address, const char * name)
 {
@@ -197,7 +278,7 @@ snet_socket_bind(SNetSocket socket, const SNetAddress * address)
 
 	if (address != NULL)
 	{
-		sin.sin_port = ENET_HOST_TO_NET_16(address->port);
+		sin.sin_port = SNET_HOST_TO_NET_16(address->port);
 		sin.sin_addr.s_addr = address->host;
 	}
 	else
@@ -221,7 +302,7 @@ snet_socket_get_address(SNetSocket socket, SNetAddress * address)
 		return -1;
 
 	address->host = (snet_uint32)sin.sin_addr.s_addr;
-	address->port = ENET_NET_TO_HOST_16(sin.sin_port);
+	address->port = SNET_NET_TO_HOST_16(sin.sin_port);
 
 	return 0;
 }
@@ -235,7 +316,7 @@ snet_socket_listen(SNetSocket socket, int backlog)
 SNetSocket
 snet_socket_create(SNetSocketType type)
 {
-	return socket(PF_INET, type == ENET_SOCKET_TYPE_DATAGRAM ? SOCK_DGRAM : SOCK_STREAM, 0);
+	return socket(PF_INET, type == SNET_SOCKET_TYPE_DATAGRAM ? SOCK_DGRAM : SOCK_STREAM, 0);
 }
 
 int
@@ -244,7 +325,7 @@ snet_socket_set_option(SNetSocket socket, SNetSocketOption option, int value)
 	int result = -1;
 	switch (option)
 	{
-	case ENET_SOCKOPT_NONBLOCK:
+	case SNET_SOCKOPT_NONBLOCK:
 #ifdef HAS_FCNTL
 		result = fcntl(socket, F_SETFL, (value ? O_NONBLOCK : 0) | (fcntl(socket, F_GETFL) & ~O_NONBLOCK));
 #else
@@ -252,23 +333,23 @@ snet_socket_set_option(SNetSocket socket, SNetSocketOption option, int value)
 #endif
 		break;
 
-	case ENET_SOCKOPT_BROADCAST:
+	case SNET_SOCKOPT_BROADCAST:
 		result = setsockopt(socket, SOL_SOCKET, SO_BROADCAST, (char *)& value, sizeof(int));
 		break;
 
-	case ENET_SOCKOPT_REUSEADDR:
+	case SNET_SOCKOPT_REUSEADDR:
 		result = setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (char *)& value, sizeof(int));
 		break;
 
-	case ENET_SOCKOPT_RCVBUF:
+	case SNET_SOCKOPT_RCVBUF:
 		result = setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (char *)& value, sizeof(int));
 		break;
 
-	case ENET_SOCKOPT_SNDBUF:
+	case SNET_SOCKOPT_SNDBUF:
 		result = setsockopt(socket, SOL_SOCKET, SO_SNDBUF, (char *)& value, sizeof(int));
 		break;
 
-	case ENET_SOCKOPT_RCVTIMEO:
+	case SNET_SOCKOPT_RCVTIMEO:
 	{
 		struct timeval timeVal;
 		timeVal.tv_sec = value / 1000;
@@ -277,7 +358,7 @@ snet_socket_set_option(SNetSocket socket, SNetSocketOption option, int value)
 		break;
 	}
 
-	case ENET_SOCKOPT_SNDTIMEO:
+	case SNET_SOCKOPT_SNDTIMEO:
 	{
 		struct timeval timeVal;
 		timeVal.tv_sec = value / 1000;
@@ -286,7 +367,7 @@ snet_socket_set_option(SNetSocket socket, SNetSocketOption option, int value)
 		break;
 	}
 
-	case ENET_SOCKOPT_NODELAY:
+	case SNET_SOCKOPT_NODELAY:
 		result = setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char *)& value, sizeof(int));
 		break;
 
@@ -303,7 +384,7 @@ snet_socket_get_option(SNetSocket socket, SNetSocketOption option, int * value)
 	socklen_t len;
 	switch (option)
 	{
-	case ENET_SOCKOPT_ERROR:
+	case SNET_SOCKOPT_ERROR:
 		len = sizeof(int);
 		result = getsockopt(socket, SOL_SOCKET, SO_ERROR, value, &len);
 		break;
@@ -323,7 +404,7 @@ snet_socket_connect(SNetSocket socket, const SNetAddress * address)
 	memset(&sin, 0, sizeof(struct sockaddr_in));
 
 	sin.sin_family = AF_INET;
-	sin.sin_port = ENET_HOST_TO_NET_16(address->port);
+	sin.sin_port = SNET_HOST_TO_NET_16(address->port);
 	sin.sin_addr.s_addr = address->host;
 
 	result = connect(socket, (struct sockaddr *) & sin, sizeof(struct sockaddr_in));
@@ -345,12 +426,12 @@ snet_socket_accept(SNetSocket socket, SNetAddress * address)
 		address != NULL ? &sinLength : NULL);
 
 	if (result == -1)
-		return ENET_SOCKET_NULL;
+		return SNET_SOCKET_NULL;
 
 	if (address != NULL)
 	{
 		address->host = (snet_uint32)sin.sin_addr.s_addr;
-		address->port = ENET_NET_TO_HOST_16(sin.sin_port);
+		address->port = SNET_NET_TO_HOST_16(sin.sin_port);
 	}
 
 	return result;
@@ -386,7 +467,7 @@ snet_socket_send(SNetSocket socket,
 		memset(&sin, 0, sizeof(struct sockaddr_in));
 
 		sin.sin_family = AF_INET;
-		sin.sin_port = ENET_HOST_TO_NET_16(address->port);
+		sin.sin_port = SNET_HOST_TO_NET_16(address->port);
 		sin.sin_addr.s_addr = address->host;
 
 		msgHdr.msg_name = &sin;
@@ -448,12 +529,145 @@ snet_socket_receive(SNetSocket socket,
 	if (address != NULL)
 	{
 		address->host = (snet_uint32)sin.sin_addr.s_addr;
-		address->port = ENET_NET_TO_HOST_16(sin.sin_port);
+		address->port = SNET_NET_TO_HOST_16(sin.sin_port);
 	}
 
 	return recvLength;
 }
 
+int
+snet_socket_send_batch(SNetSocket socket, const SNetDatagram * datagrams, size_t datagramCount)
+{
+#ifdef HAS_SENDMMSG
+	struct mmsghdr msgHdrs[SNET_HOST_DATAGRAM_BATCH];
+	struct sockaddr_in sins[SNET_HOST_DATAGRAM_BATCH];
+	int sentCount;
+	size_t i;
+
+	if (datagramCount > SNET_HOST_DATAGRAM_BATCH)
+		datagramCount = SNET_HOST_DATAGRAM_BATCH;
+
+	memset(msgHdrs, 0, datagramCount * sizeof(struct mmsghdr));
+	memset(sins, 0, datagramCount * sizeof(struct sockaddr_in));
+
+	for (i = 0; i < datagramCount; ++i)
+	{
+		sins[i].sin_family = AF_INET;
+		sins[i].sin_port = SNET_HOST_TO_NET_16(datagrams[i].address.port);
+		sins[i].sin_addr.s_addr = datagrams[i].address.host;
+
+		msgHdrs[i].msg_hdr.msg_name = &sins[i];
+		msgHdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgHdrs[i].msg_hdr.msg_iov = (struct iovec *) datagrams[i].buffers;
+		msgHdrs[i].msg_hdr.msg_iovlen = datagrams[i].bufferCount;
+	}
+
+	sentCount = sendmmsg(socket, msgHdrs, (unsigned int)datagramCount, MSG_NOSIGNAL);
+
+	if (sentCount == -1)
+	{
+		if (errno == EWOULDBLOCK)
+			return 0;
+
+		return -1;
+	}
+
+	return sentCount;
+#else
+	size_t i;
+
+	for (i = 0; i < datagramCount; ++i)
+	{
+		int sentLength = snet_socket_send(socket, &datagrams[i].address, datagrams[i].buffers, datagrams[i].bufferCount);
+
+		if (sentLength < 0)
+			return i > 0 ? (int)i : -1;
+
+		if (sentLength == 0)
+			break;
+	}
+
+	return (int)i;
+#endif
+}
+
+int
+snet_socket_receive_batch(SNetSocket socket, SNetDatagram * datagrams, size_t datagramCount)
+{
+#ifdef HAS_RECVMMSG
+	struct mmsghdr msgHdrs[SNET_HOST_DATAGRAM_BATCH];
+	struct sockaddr_in sins[SNET_HOST_DATAGRAM_BATCH];
+	int receivedCount, keptCount, i;
+
+	if (datagramCount > SNET_HOST_DATAGRAM_BATCH)
+		datagramCount = SNET_HOST_DATAGRAM_BATCH;
+
+	do
+	{
+		memset(msgHdrs, 0, datagramCount * sizeof(struct mmsghdr));
+
+		for (i = 0; i < (int)datagramCount; ++i)
+		{
+			msgHdrs[i].msg_hdr.msg_name = &sins[i];
+			msgHdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgHdrs[i].msg_hdr.msg_iov = (struct iovec *) datagrams[i].buffers;
+			msgHdrs[i].msg_hdr.msg_iovlen = datagrams[i].bufferCount;
+		}
+
+		receivedCount = recvmmsg(socket, msgHdrs, (unsigned int)datagramCount, 0, NULL);
+
+		if (receivedCount == -1)
+		{
+			if (errno == EWOULDBLOCK)
+				return 0;
+
+			return -1;
+		}
+
+		/* a truncated datagram is dropped on its own, and the rest move up in its place with their buffers */
+		for (keptCount = 0, i = 0; i < receivedCount; ++i)
+		{
+#ifdef HAS_MSGHDR_FLAGS
+			if (msgHdrs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				continue;
+#endif
+
+			if (keptCount != i)
+			{
+				SNetDatagram datagram = datagrams[keptCount];
+
+				datagrams[keptCount] = datagrams[i];
+				datagrams[i] = datagram;
+			}
+
+			datagrams[keptCount].address.host = (snet_uint32)sins[i].sin_addr.s_addr;
+			datagrams[keptCount].address.port = SNET_NET_TO_HOST_16(sins[i].sin_port);
+			datagrams[keptCount].dataLength = msgHdrs[i].msg_len;
+			++keptCount;
+		}
+	} while (keptCount == 0 && receivedCount > 0);
+
+	return keptCount;
+#else
+	size_t i;
+
+	for (i = 0; i < datagramCount; ++i)
+	{
+		int receivedLength = snet_socket_receive(socket, &datagrams[i].address, datagrams[i].buffers, datagrams[i].bufferCount);
+
+		if (receivedLength < 0)
+			return i > 0 ? (int)i : -1;
+
+		if (receivedLength == 0)
+			break;
+
+		datagrams[i].dataLength = (size_t)receivedLength;
+	}
+
+	return (int)i;
+#endif
+}
+
 int
 snet_socketset_select(SNetSocket maxSocket, SNetSocketSet * readSet, SNetSocketSet * writeSet, snet_uint32 timeout)
 {
@@ -475,19 +689,19 @@ snet_socket_wait(SNetSocket socket, snet_uint32 * condition, snet_uint32 timeout
 	pollSocket.fd = socket;
 	pollSocket.events = 0;
 
-	if (*condition & ENET_SOCKET_WAIT_SEND)
+	if (*condition & SNET_SOCKET_WAIT_SEND)
 		pollSocket.events |= POLLOUT;
 
-	if (*condition & ENET_SOCKET_WAIT_RECEIVE)
+	if (*condition & SNET_SOCKET_WAIT_RECEIVE)
 		pollSocket.events |= POLLIN;
 
 	pollCount = poll(&pollSocket, 1, timeout);
 
 	if (pollCount < 0)
 	{
-		if (errno == EINTR && * condition & ENET_SOCKET_WAIT_INTERRUPT)
+		if (errno == EINTR && * condition & SNET_SOCKET_WAIT_INTERRUPT)
 		{
-			*condition = ENET_SOCKET_WAIT_INTERRUPT;
+			*condition = SNET_SOCKET_WAIT_INTERRUPT;
 
 			return 0;
 		}
@@ -495,16 +709,16 @@ snet_socket_wait(SNetSocket socket, snet_uint32 * condition, snet_uint32 timeout
 		return -1;
 	}
 
-	*condition = ENET_SOCKET_WAIT_NONE;
+	*condition = SNET_SOCKET_WAIT_NONE;
 
 	if (pollCount == 0)
 		return 0;
 
 	if (pollSocket.revents & POLLOUT)
-		* condition |= ENET_SOCKET_WAIT_SEND;
+		* condition |= SNET_SOCKET_WAIT_SEND;
 
 	if (pollSocket.revents & POLLIN)
-		* condition |= ENET_SOCKET_WAIT_RECEIVE;
+		* condition |= SNET_SOCKET_WAIT_RECEIVE;
 
 	return 0;
 #else
@@ -518,19 +732,19 @@ snet_socket_wait(SNetSocket socket, snet_uint32 * condition, snet_uint32 timeout
 	FD_ZERO(&readSet);
 	FD_ZERO(&writeSet);
 
-	if (*condition & ENET_SOCKET_WAIT_SEND)
+	if (*condition & SNET_SOCKET_WAIT_SEND)
 		FD_SET(socket, &writeSet);
 
-	if (*condition & ENET_SOCKET_WAIT_RECEIVE)
+	if (*condition & SNET_SOCKET_WAIT_RECEIVE)
 		FD_SET(socket, &readSet);
 
 	selectCount = select(socket + 1, &readSet, &writeSet, NULL, &timeVal);
 
 	if (selectCount < 0)
 	{
-		if (errno == EINTR && * condition & ENET_SOCKET_WAIT_INTERRUPT)
+		if (errno == EINTR && * condition & SNET_SOCKET_WAIT_INTERRUPT)
 		{
-			*condition = ENET_SOCKET_WAIT_INTERRUPT;
+			*condition = SNET_SOCKET_WAIT_INTERRUPT;
 
 			return 0;
 		}
@@ -538,16 +752,16 @@ snet_socket_wait(SNetSocket socket, snet_uint32 * condition, snet_uint32 timeout
 		return -1;
 	}
 
-	*condition = ENET_SOCKET_WAIT_NONE;
+	*condition = SNET_SOCKET_WAIT_NONE;
 
 	if (selectCount == 0)
 		return 0;
 
 	if (FD_ISSET(socket, &writeSet))
-		* condition |= ENET_SOCKET_WAIT_SEND;
+		* condition |= SNET_SOCKET_WAIT_SEND;
 
 	if (FD_ISSET(socket, &readSet))
-		* condition |= ENET_SOCKET_WAIT_RECEIVE;
+		* condition |= SNET_SOCKET_WAIT_RECEIVE;
 
 	return 0;
 #endif
@@ -0,0 +1,49 @@
+/**
+@file  unix.h
+@brief SNet Unix header
+*/
+#ifndef __SNET_UNIX_H__
+#define __SNET_UNIX_H__
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#ifdef MSG_MAXIOVLEN
+#define SNET_BUFFER_MAXIMUM MSG_MAXIOVLEN
+#endif
+
+typedef int SNetSocket;
+
+#define SNET_SOCKET_NULL -1
+
+#define SNET_HOST_TO_NET_16(value) (htons (value)) /**< macro that converts host to net byte-order of a 16-bit value */
+#define SNET_HOST_TO_NET_32(value) (htonl (value)) /**< macro that converts host to net byte-order of a 32-bit value */
+
+#define SNET_NET_TO_HOST_16(value) (ntohs (value)) /**< macro that converts net to host byte-order of a 16-bit value */
+#define SNET_NET_TO_HOST_32(value) (ntohl (value)) /**< macro that converts net to host byte-order of a 32-bit value */
+
+/* laid out as a struct iovec, so buffers can be handed to sendmsg() and recvmsg() directly */
+typedef struct
+{
+	void * data;
+	size_t dataLength;
+} SNetBuffer;
+
+#define SNET_CALLBACK
+
+#define SNET_API extern
+
+typedef fd_set SNetSocketSet;
+
+#define SNET_SOCKETSET_EMPTY(sockset)          FD_ZERO (& (sockset))
+#define SNET_SOCKETSET_ADD(sockset, socket)    FD_SET (socket, & (sockset))
+#define SNET_SOCKETSET_REMOVE(sockset, socket) FD_CLR (socket, & (sockset))
+#define SNET_SOCKETSET_CHECK(sockset, socket)  FD_ISSET (socket, & (sockset))
+
+#endif /* __SNET_UNIX_H__ */
+
@@ -32,6 +32,8 @@ snet_initialize(void)
 
 	timeBeginPeriod(1);
 
+	snet_checksum_initialize();
+
 	return 0;
 }
 
@@ -61,6 +63,71 @@ snet_time_set(snet_uint32 newTimeBase)
 	timeBase = (snet_uint32)timeGetTime() - newTimeBase;
 }
 
+typedef struct _SNetWin32Thread
+{
+	HANDLE thread;
+	void (* function) (void *);
+	void * data;
+} SNetWin32Thread;
+
+static DWORD WINAPI
+snet_thread_start(LPVOID data)
+{
+	SNetWin32Thread * thread = (SNetWin32Thread *)data;
+
+	thread->function(thread->data);
+
+	return 0;
+}
+
+void *
+snet_thread_create(void (* function) (void *), void * data)
+{
+	SNetWin32Thread * thread = (SNetWin32Thread *)snet_malloc(sizeof(SNetWin32Thread));
+	if (thread == NULL)
+		return NULL;
+
+	thread->function = function;
+	thread->data = data;
+	thread->thread = CreateThread(NULL, 0, snet_thread_start, thread, 0, NULL);
+	if (thread->thread == NULL)
+	{
+		snet_free(thread);
+
+		return NULL;
+	}
+
+	return thread;
+}
+
+void
+snet_thread_join(void * thread)
+{
+	WaitForSingleObject(((SNetWin32Thread *)thread)->thread, INFINITE);
+	CloseHandle(((SNetWin32Thread *)thread)->thread);
+
+	snet_free(thread);
+}
+
+void
+snet_thread_sleep(snet_uint32 milliseconds)
+{
+	Sleep(milliseconds);
+}
+
+unsigned long long
+snet_time_get_nanoseconds(void)
+{
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+
+	/* split so the scaling does not overflow once the counter grows large */
+	return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+		(unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+}
+
 int
 snet_address_set_host(SNetAddress * address, const char * name)
 {
@@ -371,6 +438,46 @@ snet_socket_receive(SNetSocket socket,
 	return (int)recvLength;
 }
 
+int
+snet_socket_send_batch(SNetSocket socket, const SNetDatagram * datagrams, size_t datagramCount)
+{
+	size_t i;
+
+	for (i = 0; i < datagramCount; ++i)
+	{
+		int sentLength = snet_socket_send(socket, &datagrams[i].address, datagrams[i].buffers, datagrams[i].bufferCount);
+
+		if (sentLength < 0)
+			return i > 0 ? (int)i : -1;
+
+		if (sentLength == 0)
+			break;
+	}
+
+	return (int)i;
+}
+
+int
+snet_socket_receive_batch(SNetSocket socket, SNetDatagram * datagrams, size_t datagramCount)
+{
+	size_t i;
+
+	for (i = 0; i < datagramCount; ++i)
+	{
+		int receivedLength = snet_socket_receive(socket, &datagrams[i].address, datagrams[i].buffers, datagrams[i].bufferCount);
+
+		if (receivedLength < 0)
+			return i > 0 ? (int)i : -1;
+
+		if (receivedLength == 0)
+			break;
+
+		datagrams[i].dataLength = (size_t)receivedLength;
+	}
+
+	return (int)i;
+}
+
 int
 snet_socketset_select(SNetSocket maxSocket, SNetSocketSet * readSet, SNetSocketSet * writeSet, snet_uint32 timeout)
 {
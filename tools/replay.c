@@ -0,0 +1,587 @@
+/**
+@file  replay.c
+@brief Replays a datagram capture into an SNet host on a virtual clock
+
+Reads a pcapng capture written by snet_host_capture(), or a pcap or pcapng file from
+tcpdump with Ethernet, raw IP or IPv4 framing, and feeds the datagrams the captured host
+received into a fresh host at their original times.  The host's socket is replaced with a
+transport that delivers those datagrams and swallows everything sent, and its clock is
+virtual, so a run depends only on the capture and the options.
+
+The report gives the CPU time spent replaying, the time spent in each phase of
+snet_host_service(), allocation counts and the events the host produced.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "snet/snet.h"
+#include "snet/time.h"
+
+typedef struct _ReplayDatagram
+{
+	unsigned long long time;          /* microseconds */
+	int                direction;     /* 0 unknown, 1 received by the captured host, 2 sent by it */
+	SNetAddress        source;
+	SNetAddress        destination;
+	const snet_uint8 * data;
+	size_t             dataLength;
+} ReplayDatagram;
+
+typedef struct _Replay
+{
+	ReplayDatagram *  datagrams;
+	size_t            datagramCount;
+	size_t            datagramCapacity;
+	const ReplayDatagram * pending;
+	snet_uint32       virtualTime;
+	unsigned long long sentDatagrams;
+	unsigned long long sentData;
+} Replay;
+
+static Replay replay;
+
+static unsigned long long allocations, frees, allocatedData, outstandingData, peakOutstandingData;
+
+static void * SNET_CALLBACK
+replay_malloc(size_t size)
+{
+	size_t * memory = (size_t *)malloc(size + 2 * sizeof(size_t));
+
+	if (memory == NULL)
+		return NULL;
+
+	memory[0] = size;
+
+	++allocations;
+	allocatedData += size;
+	outstandingData += size;
+	if (outstandingData > peakOutstandingData)
+		peakOutstandingData = outstandingData;
+
+	return memory + 2;
+}
+
+static void SNET_CALLBACK
+replay_free(void * memory)
+{
+	size_t * block;
+
+	if (memory == NULL)
+		return;
+
+	block = (size_t *)memory - 2;
+
+	++frees;
+	outstandingData -= block[0];
+
+	free(block);
+}
+
+static snet_uint32 SNET_CALLBACK
+replay_clock(SNetHost * host)
+{
+	return replay.virtualTime;
+}
+
+static int SNET_CALLBACK
+replay_send(void * context, const SNetAddress * address, const SNetBuffer * buffers, size_t bufferCount)
+{
+	size_t i, length = 0;
+
+	for (i = 0; i < bufferCount; ++i)
+		length += buffers[i].dataLength;
+
+	++replay.sentDatagrams;
+	replay.sentData += length;
+
+	return (int)length;
+}
+
+static int SNET_CALLBACK
+replay_receive(void * context, SNetAddress * address, SNetBuffer * buffers, size_t bufferCount)
+{
+	const ReplayDatagram * datagram = replay.pending;
+
+	if (datagram == NULL)
+		return 0;
+
+	replay.pending = NULL;
+
+	if (datagram->dataLength > buffers[0].dataLength)
+		return 0;
+
+	memcpy(buffers[0].data, datagram->data, datagram->dataLength);
+	*address = datagram->source;
+
+	return (int)datagram->dataLength;
+}
+
+static snet_uint32
+replay_read_32(const snet_uint8 * data, int swap)
+{
+	snet_uint32 value;
+
+	memcpy(&value, data, sizeof(value));
+
+	if (swap)
+		value = (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+
+	return value;
+}
+
+static snet_uint16
+replay_read_16(const snet_uint8 * data, int swap)
+{
+	snet_uint16 value;
+
+	memcpy(&value, data, sizeof(value));
+
+	if (swap)
+		value = (snet_uint16)((value >> 8) | (value << 8));
+
+	return value;
+}
+
+/* strips link, IPv4 and UDP framing and records the datagram, ignoring anything else */
+static void
+replay_add(unsigned long long time, int direction, snet_uint32 linkType, const snet_uint8 * data, size_t dataLength)
+{
+	ReplayDatagram * datagram;
+	size_t headerLength;
+
+	switch (linkType)
+	{
+	case 1:
+		if (dataLength < 14 || data[12] != 0x08 || data[13] != 0x00)
+			return;
+		data += 14;
+		dataLength -= 14;
+		break;
+
+	case 101:
+	case 228:
+		break;
+
+	default:
+		return;
+	}
+
+	if (dataLength < 20 || (data[0] >> 4) != 4 || data[9] != 17)
+		return;
+
+	headerLength = (data[0] & 0x0F) * 4;
+	if (dataLength < headerLength + 8)
+		return;
+
+	if (replay.datagramCount >= replay.datagramCapacity)
+	{
+		replay.datagramCapacity = replay.datagramCapacity ? 2 * replay.datagramCapacity : 1024;
+		replay.datagrams = (ReplayDatagram *)realloc(replay.datagrams, replay.datagramCapacity * sizeof(ReplayDatagram));
+		if (replay.datagrams == NULL)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+
+	datagram = &replay.datagrams[replay.datagramCount++];
+	datagram->time = time;
+	datagram->direction = direction;
+	memcpy(&datagram->source.host, &data[12], 4);
+	memcpy(&datagram->destination.host, &data[16], 4);
+	datagram->source.port = (snet_uint16)((data[headerLength] << 8) | data[headerLength + 1]);
+	datagram->destination.port = (snet_uint16)((data[headerLength + 2] << 8) | data[headerLength + 3]);
+	datagram->data = data + headerLength + 8;
+	datagram->dataLength = dataLength - headerLength - 8;
+}
+
+static int
+replay_parse_pcap(const snet_uint8 * data, size_t dataLength)
+{
+	snet_uint32 magic, linkType;
+	int swap, nanoseconds;
+	size_t offset = 24;
+
+	if (dataLength < 24)
+		return -1;
+
+	magic = replay_read_32(data, 0);
+	swap = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+	nanoseconds = magic == 0xA1B23C4D || magic == 0x4D3CB2A1;
+	linkType = replay_read_32(data + 20, swap);
+
+	while (offset + 16 <= dataLength)
+	{
+		unsigned long long seconds = replay_read_32(data + offset, swap),
+			fraction = replay_read_32(data + offset + 4, swap);
+		size_t capturedLength = replay_read_32(data + offset + 8, swap);
+
+		if (offset + 16 + capturedLength > dataLength)
+			return -1;
+
+		replay_add(seconds * 1000000 + (nanoseconds ? fraction / 1000 : fraction), 0, linkType, data + offset + 16, capturedLength);
+
+		offset += 16 + capturedLength;
+	}
+
+	return 0;
+}
+
+static int
+replay_parse_pcapng(const snet_uint8 * data, size_t dataLength)
+{
+	snet_uint32 linkTypes[16], divisors[16];
+	size_t interfaceCount = 0, offset = 0;
+	int swap = 0;
+
+	while (offset + 12 <= dataLength)
+	{
+		snet_uint32 blockType = replay_read_32(data + offset, 0), blockLength;
+
+		if (blockType == 0x0A0D0D0A)
+		{
+			swap = replay_read_32(data + offset + 8, 0) != 0x1A2B3C4D;
+			interfaceCount = 0;
+		}
+
+		blockType = replay_read_32(data + offset, swap);
+		blockLength = replay_read_32(data + offset + 4, swap);
+		if (blockLength < 12 || offset + blockLength > dataLength)
+			return -1;
+
+		if (blockType == 1 && interfaceCount < 16 && blockLength >= 20)
+		{
+			size_t option = offset + 16;
+
+			linkTypes[interfaceCount] = replay_read_16(data + offset + 8, swap);
+			divisors[interfaceCount] = 1;
+
+			while (option + 4 <= offset + blockLength - 4)
+			{
+				snet_uint16 code = replay_read_16(data + option, swap),
+					length = replay_read_16(data + option + 2, swap);
+
+				if (code == 0)
+					break;
+
+				/* if_tsresol, kept to the decimal resolutions down to nanoseconds */
+				if (code == 9 && length >= 1 && !(data[option + 4] & 0x80))
+				{
+					int exponent = data[option + 4];
+
+					for (divisors[interfaceCount] = 1; exponent > 6 && exponent <= 9; --exponent)
+						divisors[interfaceCount] *= 10;
+				}
+
+				option += 4 + ((length + 3) & ~3);
+			}
+
+			++interfaceCount;
+		}
+		else
+			if (blockType == 6 && blockLength >= 32)
+			{
+				snet_uint32 interfaceID = replay_read_32(data + offset + 8, swap),
+					capturedLength = replay_read_32(data + offset + 20, swap);
+				unsigned long long time = ((unsigned long long)replay_read_32(data + offset + 12, swap) << 32) | replay_read_32(data + offset + 16, swap);
+				size_t option = offset + 28 + ((capturedLength + 3) & ~3);
+				int direction = 0;
+
+				if (interfaceID >= interfaceCount || 28 + capturedLength > blockLength)
+					return -1;
+
+				while (option + 4 <= offset + blockLength - 4)
+				{
+					snet_uint16 code = replay_read_16(data + option, swap),
+						length = replay_read_16(data + option + 2, swap);
+
+					if (code == 0)
+						break;
+
+					if (code == 2 && length == 4)
+						direction = replay_read_32(data + option + 4, swap) & 3;
+
+					option += 4 + ((length + 3) & ~3);
+				}
+
+				replay_add(time / divisors[interfaceID], direction, linkTypes[interfaceID], data + offset + 28, capturedLength);
+			}
+
+		offset += blockLength;
+	}
+
+	return 0;
+}
+
+static const char *
+replay_event_name(SNetEventType type)
+{
+	switch (type)
+	{
+	case SNET_EVENT_TYPE_CONNECT: return "connect";
+	case SNET_EVENT_TYPE_DISCONNECT: return "disconnect";
+	case SNET_EVENT_TYPE_RECEIVE: return "receive";
+	default: return "none";
+	}
+}
+
+static unsigned long long events[4], receivedData;
+
+static int
+replay_service(SNetHost * host, int verbose)
+{
+	SNetEvent event;
+	int result;
+
+	while ((result = snet_host_service(host, &event, 0)) > 0)
+	{
+		++events[event.type];
+
+		if (verbose)
+			printf("event %u %s peer=%u channel=%u data=%u length=%u\n", replay.virtualTime, replay_event_name(event.type),
+				event.peer != NULL ? event.peer->incomingPeerID : 0, event.channelID, event.data,
+				event.packet != NULL ? (unsigned int)event.packet->dataLength : 0);
+
+		if (event.packet != NULL)
+		{
+			receivedData += event.packet->dataLength;
+
+			snet_packet_destroy(event.packet);
+		}
+	}
+
+	return result;
+}
+
+static void
+replay_usage(void)
+{
+	fprintf(stderr,
+		"usage: replay [options] capture\n"
+		"  -p peers     peer slots of the replayed host (default 64)\n"
+		"  -c channels  channel limit (default 0, the protocol maximum)\n"
+		"  -z coder     compression: range or rans (default none)\n"
+		"  -k checksum  checksum: crc32 or crc32c (default none)\n"
+		"  -P port      port of the captured host, if the capture does not mark directions\n"
+		"  -t tick      longest virtual time between services, in milliseconds (default 10)\n"
+		"  -d drain     virtual time to keep servicing after the last datagram, in milliseconds (default 0)\n"
+		"  -v           print every event\n");
+	exit(2);
+}
+
+int
+main(int argc, char ** argv)
+{
+	const char * fileName = NULL, * coder = NULL, * checksum = NULL;
+	size_t peerCount = 64, channelLimit = 0, i, replayed = 0;
+	snet_uint32 tick = 10, drain = 0, port = 0, start = 0x10000, endTime;
+	int verbose = 0, phase;
+	unsigned long long firstTime, baselineOutstandingData;
+	SNetAddress hostAddress;
+	SNetCallbacks callbacks;
+	SNetTransport transport;
+	SNetHost * host;
+	snet_uint8 * data;
+	long dataLength;
+	clock_t cpuTime;
+	FILE * file;
+	static const char * const phaseNames[SNET_HOST_PHASE_COUNT] = { "dispatch", "send", "receive", "timeouts", "compress", "decompress" };
+
+	for (i = 1; i < (size_t)argc; ++i)
+	{
+		if (argv[i][0] != '-' || argv[i][1] == '\0')
+			fileName = argv[i];
+		else
+			if (argv[i][1] == 'v')
+				verbose = 1;
+			else
+			{
+				char option = argv[i][1];
+				const char * value = argv[i][2] != '\0' ? &argv[i][2] : (i + 1 < (size_t)argc ? argv[++i] : NULL);
+
+				if (value == NULL)
+					replay_usage();
+
+				switch (option)
+				{
+				case 'p': peerCount = (size_t)atoi(value); break;
+				case 'c': channelLimit = (size_t)atoi(value); break;
+				case 'z': coder = value; break;
+				case 'k': checksum = value; break;
+				case 'P': port = (snet_uint32)atoi(value); break;
+				case 't': tick = (snet_uint32)atoi(value); break;
+				case 'd': drain = (snet_uint32)atoi(value); break;
+				default: replay_usage();
+				}
+			}
+	}
+
+	if (fileName == NULL || tick == 0)
+		replay_usage();
+
+	file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		perror(fileName);
+		return 1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	dataLength = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data = (snet_uint8 *)malloc(dataLength > 0 ? dataLength : 1);
+	if (data == NULL || fread(data, 1, dataLength, file) != (size_t)dataLength)
+	{
+		fprintf(stderr, "%s: could not read\n", fileName);
+		return 1;
+	}
+	fclose(file);
+
+	if ((dataLength >= 4 && replay_read_32(data, 0) == 0x0A0D0D0A ? replay_parse_pcapng(data, dataLength) : replay_parse_pcap(data, dataLength)) < 0)
+		fprintf(stderr, "%s: truncated, replaying what could be read\n", fileName);
+
+	if (replay.datagramCount == 0)
+	{
+		fprintf(stderr, "%s: no UDP datagrams\n", fileName);
+		return 1;
+	}
+
+	/* without marked directions, the captured host is the one on the given port, or else the first datagram's destination */
+	hostAddress = replay.datagrams[0].destination;
+	for (i = 0; i < replay.datagramCount; ++i)
+		if (replay.datagrams[i].direction == 1)
+		{
+			hostAddress = replay.datagrams[i].destination;
+			break;
+		}
+
+	for (i = 0; i < replay.datagramCount; ++i)
+	{
+		ReplayDatagram * datagram = &replay.datagrams[i];
+
+		if (datagram->direction != 0)
+			continue;
+
+		if (port != 0)
+			datagram->direction = datagram->destination.port == port ? 1 : (datagram->source.port == port ? 2 : 0);
+		else
+			datagram->direction = datagram->destination.host == hostAddress.host && datagram->destination.port == hostAddress.port ? 1 : 2;
+	}
+
+	/* line the virtual clock up with the sent times the captured host stamped, so the acknowledgements it got still match;
+	   microsecond sent times only ever match those of a live clock, so they are left out */
+	firstTime = replay.datagrams[0].time;
+	for (i = 0; i < replay.datagramCount; ++i)
+	{
+		const ReplayDatagram * datagram = &replay.datagrams[i];
+
+		if (datagram->direction == 2 && datagram->dataLength >= 4 &&
+			(((datagram->data[0] << 8) | datagram->data[1]) & SNET_PROTOCOL_HEADER_FLAG_SENT_TIME) &&
+			(((datagram->data[0] << 8) | datagram->data[1]) & ~(SNET_PROTOCOL_HEADER_FLAG_MASK | SNET_PROTOCOL_HEADER_SESSION_MASK)) != SNET_PROTOCOL_HEADER_PRECISE_SENT_TIME)
+		{
+			snet_uint32 sentTime = (datagram->data[2] << 8) | datagram->data[3];
+
+			start = 0x10000 + ((sentTime - (snet_uint32)((datagram->time - firstTime) / 1000)) & 0xFFFF);
+			break;
+		}
+	}
+
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.malloc = replay_malloc;
+	callbacks.free = replay_free;
+	if (snet_initialize_with_callbacks(SNET_VERSION, &callbacks) != 0)
+	{
+		fprintf(stderr, "could not initialize SNet\n");
+		return 1;
+	}
+
+	replay.virtualTime = start;
+
+	host = snet_host_create(NULL, peerCount, channelLimit, 0, 0);
+	if (host == NULL)
+	{
+		fprintf(stderr, "could not create host\n");
+		return 1;
+	}
+
+	host->address = hostAddress;
+	host->randomSeed = 0x5EED5EED;
+	host->clock = replay_clock;
+
+	memset(&transport, 0, sizeof(transport));
+	transport.context = &replay;
+	transport.send = replay_send;
+	transport.receive = replay_receive;
+	snet_host_transport(host, &transport);
+
+	if (coder != NULL && (strcmp(coder, "range") == 0 ? snet_host_compress_with_range_coder(host) : (strcmp(coder, "rans") == 0 ? snet_host_compress_with_rans_coder(host) : -1)) < 0)
+		replay_usage();
+
+	if (checksum != NULL && snet_host_checksum(host, strcmp(checksum, "crc32") == 0 ? SNET_CHECKSUM_TYPE_CRC32 :
+		(strcmp(checksum, "crc32c") == 0 ? SNET_CHECKSUM_TYPE_CRC32C : (SNetChecksumType)-1)) < 0)
+		replay_usage();
+
+	snet_host_histograms(host, 1);
+
+	allocations = frees = allocatedData = 0;
+	baselineOutstandingData = peakOutstandingData = outstandingData;
+
+	cpuTime = clock();
+
+	for (i = 0; i < replay.datagramCount; ++i)
+	{
+		const ReplayDatagram * datagram = &replay.datagrams[i];
+		snet_uint32 target = start + (snet_uint32)((datagram->time - firstTime) / 1000);
+
+		if (datagram->direction != 1)
+			continue;
+
+		while (SNET_TIME_LESS(replay.virtualTime, target))
+		{
+			replay.virtualTime = SNET_TIME_DIFFERENCE(target, replay.virtualTime) > tick ? replay.virtualTime + tick : target;
+
+			if (replay_service(host, verbose) < 0)
+				fprintf(stderr, "service failed at %u\n", replay.virtualTime);
+		}
+
+		replay.pending = datagram;
+		++replayed;
+
+		if (replay_service(host, verbose) < 0)
+			fprintf(stderr, "service failed at %u\n", replay.virtualTime);
+	}
+
+	for (endTime = replay.virtualTime + drain; SNET_TIME_LESS(replay.virtualTime, endTime); )
+	{
+		replay.virtualTime = SNET_TIME_DIFFERENCE(endTime, replay.virtualTime) > tick ? replay.virtualTime + tick : endTime;
+
+		replay_service(host, verbose);
+	}
+
+	cpuTime = clock() - cpuTime;
+
+	printf("datagrams captured=%u replayed=%u sent=%llu sent_bytes=%llu\n", (unsigned int)replay.datagramCount, (unsigned int)replayed, replay.sentDatagrams, replay.sentData);
+	printf("virtual_ms %u\n", replay.virtualTime - start);
+	printf("cpu_us %llu\n", (unsigned long long)cpuTime * 1000000 / CLOCKS_PER_SEC);
+	for (phase = 0; phase < SNET_HOST_PHASE_COUNT; ++phase)
+	{
+		const SNetHistogram * histogram = snet_host_phase_histogram(host, (SNetHostPhase)phase);
+
+		printf("phase %s count=%u total_ns=%llu p50_ns=%u p99_ns=%u p999_ns=%u max_ns=%u\n", phaseNames[phase],
+			histogram->totalCount, histogram->sum,
+			snet_histogram_percentile(histogram, 50.0), snet_histogram_percentile(histogram, 99.0),
+			snet_histogram_percentile(histogram, 99.9), histogram->maximum);
+	}
+	printf("allocations count=%llu frees=%llu bytes=%llu peak_outstanding=%llu\n", allocations, frees, allocatedData, peakOutstandingData - baselineOutstandingData);
+	printf("events connect=%llu disconnect=%llu receive=%llu receive_bytes=%llu\n",
+		events[SNET_EVENT_TYPE_CONNECT], events[SNET_EVENT_TYPE_DISCONNECT], events[SNET_EVENT_TYPE_RECEIVE], receivedData);
+
+	snet_host_destroy(host);
+	snet_deinitialize();
+
+	free(replay.datagrams);
+	free(data);
+
+	return 0;
+}